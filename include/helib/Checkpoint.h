@@ -0,0 +1,118 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_CHECKPOINT_H
+#define HELIB_CHECKPOINT_H
+/**
+ * @file Checkpoint.h
+ * @brief Saving and resuming the state of long homomorphic computations
+ **/
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <helib/Ctxt.h>
+
+namespace helib {
+
+/**
+ * @class Checkpoint
+ * @brief Periodically saves a set of live ciphertexts, together with a
+ * token for the position in the program, so that an interrupted job can
+ * resume from there
+ *
+ * The ciphertexts are registered once by name with track(). save() writes
+ * all of them with Ctxt::write, which keeps their prime set, noise bound
+ * and scaling factors, so they continue exactly where they were. The file
+ * is written next to the old one and then renamed over it, so a crash
+ * while saving leaves the previous checkpoint intact.
+ *
+ * The file records fingerprints of the context and of the public key, and
+ * restore() refuses a checkpoint made with other ones.
+ *
+ * A typical loop:
+ * @code
+ *   Checkpoint cp(pubKey, "job.ckpt", 600);
+ *   cp.track("state", state);
+ *   std::string token;
+ *   long first = cp.restore(token) ? std::stol(token) : 0;
+ *   for (long i = first; i < n; i++) {
+ *     step(state);
+ *     cp.saveIfDue(std::to_string(i + 1));
+ *   }
+ * @endcode
+ **/
+class Checkpoint
+{
+public:
+  /**
+   * @brief Constructor.
+   * @param pubKey The key of the tracked ciphertexts.
+   * @param path The checkpoint file.
+   * @param intervalSeconds The time between two saves by saveIfDue().
+   **/
+  Checkpoint(const PubKey& pubKey,
+             const std::string& path,
+             double intervalSeconds = 600);
+
+  Checkpoint(const Checkpoint&) = delete;
+  Checkpoint& operator=(const Checkpoint&) = delete;
+
+  //! Track a ciphertext, which must outlive this object or be untracked
+  void track(const std::string& name, Ctxt& ctxt);
+
+  //! Track a vector of ciphertexts, whose size may change between saves
+  void track(const std::string& name, std::vector<Ctxt>& ctxts);
+
+  void untrack(const std::string& name);
+
+  //! Whether the checkpoint file exists
+  bool exists() const;
+
+  //! Save the tracked ciphertexts and the token now
+  void save(const std::string& token);
+
+  //! Save if intervalSeconds have passed since the last save (or since
+  //! the construction). Returns true if it saved.
+  bool saveIfDue(const std::string& token);
+
+  /**
+   * @brief Restore the tracked ciphertexts from the checkpoint
+   * @param token Receives the token passed to the save.
+   * @return false if there is no checkpoint file, leaving everything as is.
+   *
+   * Throws if the checkpoint was made with another context or key, or
+   * does not hold all the tracked names.
+   **/
+  bool restore(std::string& token);
+
+private:
+  struct Entry
+  {
+    std::string name;
+    Ctxt* ctxt;               // a single ciphertext, or
+    std::vector<Ctxt>* ctxts; // a vector of them
+  };
+
+  const PubKey& pubKey;
+  std::string path;
+  std::chrono::duration<double> interval;
+  std::chrono::steady_clock::time_point lastSave;
+  std::vector<Entry> entries;
+  uint64_t contextPrint;
+  uint64_t keyPrint;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_CHECKPOINT_H
@@ -51,6 +51,38 @@ long FindM(long k,
 
 class EncryptedArray;
 struct PolyModRing;
+
+/**
+ * @struct NoiseCorrection
+ * @brief Empirical correction factors for the noise estimates
+ *
+ * The noise estimates in Ctxt are derived from HElib's error distribution.
+ * These factors scale the estimates of the individual operations to match
+ * the noise that is actually measured, see NoiseCalibrator in debugging.h.
+ * All the factors default to 1, which leaves the estimates unchanged. They
+ * are serialized with the context.
+ *
+ * The multiply factor only applies to BGV: the noise of a CKKS product is
+ * dominated by the cross terms with the plaintexts, which a single ratio
+ * does not describe.
+ **/
+struct NoiseCorrection
+{
+  double encrypt = 1.0;   //! scales the noise bound of a fresh ciphertext
+  double multiply = 1.0;  //! scales the noise bound of a BGV tensor product
+  double keySwitch = 1.0; //! scales the noise added by key switching
+
+  bool operator==(const NoiseCorrection& other) const
+  {
+    return encrypt == other.encrypt && multiply == other.multiply &&
+           keySwitch == other.keySwitch;
+  }
+  bool operator!=(const NoiseCorrection& other) const
+  {
+    return !(*this == other);
+  }
+};
+
 /**
  * @class Context
  * @brief Maintaining the parameters
@@ -85,6 +117,9 @@ public:
   //! @brief sqrt(variance) of the LWE error (default=3.2)
   NTL::xdouble stdev;
 
+  //! Correction factors for the noise estimates (default=1)
+  NoiseCorrection noiseCorrection;
+
   //======================= high probability bounds ================
   double scale; // default = 10
 
@@ -317,6 +352,9 @@ public:
   // includes both thin and thick
   ThinRecryptData rcData;
 
+  //! Bootstrapping-related data for CKKS
+  CKKSRecryptData ckksRcData;
+
   /******************************************************************/
   // constructor
   Context(unsigned long m,
@@ -335,6 +373,13 @@ public:
 
   bool isBootstrappable() const { return rcData.alMod != nullptr; }
 
+  void makeCKKSBootstrappable(long skWht = 0, long margin = 0)
+  {
+    ckksRcData.init(*this, skWht, margin);
+  }
+
+  bool isCKKSBootstrappable() const { return ckksRcData.isInitialized(); }
+
   IndexSet fullPrimes() const { return ctxtPrimes | specialPrimes; }
 
   IndexSet allPrimes() const
@@ -548,6 +593,11 @@ void buildModChain(Context& context,
 // *other* than calling buildModChain.
 void endBuildModChain(Context& context);
 
+// Partition a set of (roughly equal-size) primes into nDgts digits of
+// consecutive primes, as buildModChain does for context.digits. Returns
+// fewer digits if there are fewer primes than nDgts.
+std::vector<IndexSet> buildDigitPartition(const IndexSet& primes, long nDgts);
+
 ///@}
 // Should point to the "current" context
 extern Context* activeContext;
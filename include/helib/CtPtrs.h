@@ -57,6 +57,15 @@ void packedRecrypt(const CtPtrMat& m, // matrix of Ctxts
                    const EncryptedArray& ea,
                    long belowLvl = LONG_MAX);
 
+// Thin-bootstrap ciphertexts whose valid slots are the sub-hypercube
+// [0,extent[0]) x ... x [0,extent[n-1]), packing as many of them as fit
+// into every call to thinReCrypt. The other slots may hold anything on
+// input, and on output they hold values of the other packed ciphertexts,
+// unless zeroOutside is set (which costs a multiplication by a mask).
+void sparseThinRecrypt(const CtPtrs& cPtrs,
+                       const std::vector<long>& extent,
+                       bool zeroOutside = false);
+
 // Find the lowest level among many ciphertexts
 // FIXME: using bitCapacity isn't really the right thing.
 // this could break some code
@@ -274,6 +274,9 @@ class Ctxt
   friend class PubKey;
   friend class SecKey;
   friend class BasicAutomorphPrecon;
+  friend class ReKeyer;
+  friend class MulAccumulator;
+  friend class NoiseCalibrator;
 
   const Context& context;      // points to the parameters of this FHE instance
   const PubKey& pubKey;        // points to the public encryption key;
@@ -288,6 +291,16 @@ class Ctxt
   NTL::xdouble ratFactor; // rational factor to divide on decryption (for CKKS)
   NTL::xdouble ptxtMag;   // bound on the plaintext size (for CKKS)
 
+  // Multiply by a DoubleCRT or DoubleCRTPrecon constant, the common code of
+  // the multByConstant and multByConstantCKKS overloads for them
+  template <typename DCRT>
+  void multByDCRT(const DCRT& dcrt, double size);
+  template <typename DCRT>
+  void multByDCRTCKKS(const DCRT& dcrt,
+                      NTL::xdouble size,
+                      NTL::xdouble factor,
+                      double roundingErr);
+
   // Create a tensor product of c1,c2. It is assumed that *this,c1,c2
   // are defined relative to the same set of primes and plaintext space,
   // and that *this DOES NOT point to the same object as c1,c2
@@ -344,6 +357,10 @@ class Ctxt
   // result to *this.
   void keySwitchPart(const CtxtPart& p, const KeySwitch& W);
 
+  // Key-switch all the parts to (1,s_i) as reLinearize(i) does, but leave
+  // the result over the special primes, before the final modulus switching
+  void keySwitchToBase(long keyID);
+
   // internal procedure used in key-switching
   void keySwitchDigits(const KeySwitch& W, std::vector<DoubleCRT>& digits);
 
@@ -565,6 +582,9 @@ public:
   //! mod ptxtSpace, while for the other variants, we use
   //! explicitly computed bounds (if not CKKS).
   void multByConstant(const DoubleCRT& dcrt, double size = -1.0);
+  //! Multiply by a constant prepared for repeated use, which is cheaper
+  //! than by the DoubleCRT it was made of
+  void multByConstant(const DoubleCRTPrecon& dcrt, double size = -1.0);
   void multByConstant(const NTL::ZZX& poly, double size = -1.0);
   void multByConstant(const zzX& poly, double size = -1.0);
   void multByConstant(const NTL::ZZ& c);
@@ -596,6 +616,11 @@ public:
                           NTL::xdouble factor = NTL::xdouble(-1.0),
                           double roundingErr = -1.0);
 
+  void multByConstantCKKS(const DoubleCRTPrecon& dcrt,
+                          NTL::xdouble size = NTL::xdouble(-1.0),
+                          NTL::xdouble factor = NTL::xdouble(-1.0),
+                          double roundingErr = -1.0);
+
   void multByConstantCKKS(const NTL::ZZX& poly,
                           NTL::xdouble size = NTL::xdouble(-1.0),
                           NTL::xdouble factor = NTL::xdouble(-1.0),
@@ -782,6 +807,9 @@ public:
   //! @brief Is this an empty ciphertext without any parts
   bool isEmpty() const { return (parts.size() == 0); }
 
+  //! @brief The number of parts of this ciphertext
+  long numParts() const { return parts.size(); }
+
   //! @brief A canonical ciphertext has (at most) handles pointing to (1,s)
   bool inCanonicalForm(long keyID = 0) const
   {
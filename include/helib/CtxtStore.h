@@ -0,0 +1,135 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_CTXTSTORE_H
+#define HELIB_CTXTSTORE_H
+/**
+ * @file CtxtStore.h
+ * @brief A vector of ciphertexts that spills to disk under a memory budget
+ **/
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <helib/Ctxt.h>
+
+namespace helib {
+
+/**
+ * @class CtxtStore
+ * @brief A vector of ciphertexts that are kept on disk when they do not fit
+ * in memory
+ *
+ * At most memoryBudget bytes of ciphertexts are held in memory. When adding
+ * or loading a ciphertext exceeds the budget, the least-recently-used ones
+ * are written to a spill file (in the binary format of Ctxt::write) and
+ * dropped from memory. A ciphertext that was spilled and not modified since
+ * is dropped without writing it again.
+ *
+ * The spill file holds only the ciphertexts, one after the other. Its table
+ * of contents (the offset and length of every spilled ciphertext) is kept in
+ * memory, and the file is removed when the store is destroyed. A ciphertext
+ * that is spilled again is written in place if it still fits, or appended,
+ * so the spill file has no fixed layout and is not itself a TOC file.
+ *
+ * writeTOC() and appendFromTOC() move a store to and from the TOC format of
+ * utils/common (TOC.h, Reader.h, Writer.h): a header with the number of
+ * rows and columns and the offset of every ciphertext, row by row, then the
+ * ciphertexts. A store written this way can be read back with
+ * Reader<Ctxt>, e.g. by readDbFromFile of the PSI tools, and a database
+ * written by Writer<Ctxt> can be streamed into a store, within its budget.
+ * Matrix<Ctxt> and Database hand out references to their elements and keep
+ * them in memory.
+ *
+ * With HELIB_THREADS, prefetch() loads ciphertexts in the background in the
+ * order given, so that a traversal in that order finds them in memory.
+ * forEach() does this for a whole traversal. The store may be used from
+ * several threads.
+ **/
+class CtxtStore
+{
+public:
+  /**
+   * @brief Constructor.
+   * @param pubKey The public key of all the ciphertexts in the store.
+   * @param spillPath The file used for spilling, created (or truncated) here.
+   * @param memoryBudget The number of bytes of ciphertexts held in memory.
+   **/
+  CtxtStore(const PubKey& pubKey,
+            const std::string& spillPath,
+            long memoryBudget);
+  ~CtxtStore();
+
+  CtxtStore(const CtxtStore&) = delete;
+  CtxtStore& operator=(const CtxtStore&) = delete;
+
+  //! Number of ciphertexts in the store
+  long size() const;
+
+  //! Append a ciphertext
+  void push_back(const Ctxt& ctxt);
+
+  //! A copy of the i'th ciphertext, loaded from disk if needed. As copies
+  //! share the data of the ciphertext, this does not copy it.
+  Ctxt get(long i);
+
+  //! Replace the i'th ciphertext
+  void set(long i, const Ctxt& ctxt);
+
+  //! Load the given ciphertexts in the background, in this order, as long as
+  //! they fit in the budget. Replaces any previous request. Without
+  //! HELIB_THREADS this does nothing.
+  void prefetch(const std::vector<long>& order);
+
+  //! Call f(i, ctxt) for every index i in order, prefetching ahead
+  void forEach(const std::vector<long>& order,
+               const std::function<void(long, const Ctxt&)>& f);
+
+  //! Write all the modified ciphertexts to the spill file (they stay in
+  //! memory)
+  void flush();
+
+  //! Write the ciphertexts to a TOC file of size() / cols rows and cols
+  //! columns, ciphertext i at row i / cols and column i % cols
+  void writeTOC(const std::string& path, long cols = 1);
+
+  //! Append the ciphertexts of a TOC file, row by row
+  void appendFromTOC(const std::string& path);
+
+  //! The memory budget, in bytes
+  long memoryBudget() const;
+
+  //! Change the memory budget, spilling ciphertexts if needed
+  void setMemoryBudget(long bytes);
+
+  //! The number of bytes of ciphertexts currently held in memory
+  long residentBytes() const;
+
+  //! Is the i'th ciphertext held in memory
+  bool isResident(long i) const;
+
+  //! Number of ciphertexts that were written to / read from the spill file
+  long spillCount() const;
+  long loadCount() const;
+
+  //! The number of bytes that a ciphertext occupies in memory
+  static long ctxtBytes(const Ctxt& ctxt);
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_CTXTSTORE_H
@@ -23,6 +23,7 @@
 namespace helib {
 
 class Context;
+class DoubleCRTPrecon;
 
 /**
  * @class DoubleCRTHelper
@@ -47,6 +48,9 @@ public:
     return new DoubleCRTHelper(*this);
   }
 
+  /** @brief the rows are charged to the current MemoryScope */
+  virtual long elementBytes() const { return val * sizeof(long); }
+
 private:
   DoubleCRTHelper(); // disable default constructor
 };
@@ -77,7 +81,8 @@ class DoubleCRT
   const Context& context; // the context
 
   // the data itself: if the i'th prime is in use then map[i] is the std::vector
-  // of evaluations wrt this prime
+  // of evaluations wrt this prime. Copies of a DoubleCRT share the rows until
+  // they are written, so methods that only read should use a const reference
   IndexMap<NTL::vec_long> map;
 
   //! a "sanity check" method, verifies consistency of the map with
@@ -112,6 +117,10 @@ class DoubleCRT
   DoubleCRT& Op(const DoubleCRT& other, Fun fun, bool matchIndexSets = true);
 
   DoubleCRT& do_mul(const DoubleCRT& other, bool matchIndexSets = true);
+  DoubleCRT& do_mul(const DoubleCRTPrecon& other, bool matchIndexSets = true);
+
+  friend class DoubleCRTPrecon;
+  friend class DoubleCRTAccumulator;
 
   template <typename Fun>
   DoubleCRT& Op(const NTL::ZZ& num, Fun fun);
@@ -127,8 +136,10 @@ public:
   // the context. If the coefficients of poly are larger than the product of
   // the used primes, they are effectively reduced modulo that product
 
-  // Default copy-constructor:
-  DoubleCRT(const DoubleCRT& other) = default;
+  // Copy-constructor, shares the rows of other until one of them is written
+  DoubleCRT(const DoubleCRT& other) :
+      context(other.context), map(IndexMap<NTL::vec_long>::sharing(other.map))
+  {}
 
   //! @brief Initializing DoubleCRT from a ZZX polynomial
   //! @param poly The ring element itself, zero if not specified
@@ -242,6 +253,11 @@ public:
   //! Returns the sum of the canonical embedding of the digits
   NTL::xdouble breakIntoDigits(std::vector<DoubleCRT>& dgts) const;
 
+  //! @brief Same as above, according to the given partition of the ctxt
+  //! primes (e.g., the one of a specific key-switching matrix)
+  NTL::xdouble breakIntoDigits(std::vector<DoubleCRT>& dgts,
+                               const std::vector<IndexSet>& partition) const;
+
   //! @brief Expand the index set by s1.
   //! It is assumed that s1 is disjoint from the current index set.
   //! If poly_p != 0, then *poly_p will first be set to the result of applying
@@ -305,6 +321,9 @@ public:
     return do_mul(other);
   }
 
+  // Multiplication by a constant prepared for repeated use
+  DoubleCRT& operator*=(const DoubleCRTPrecon& other) { return do_mul(other); }
+
   DoubleCRT& operator*=(const NTL::ZZX& poly) { return Op(poly, MulFun()); }
 
   DoubleCRT& operator*=(const NTL::ZZ& num) { return Op(num, MulFun()); }
@@ -334,6 +353,11 @@ public:
     do_mul(other, matchIndexSets);
   }
 
+  void Mul(const DoubleCRTPrecon& other, bool matchIndexSets = true)
+  {
+    do_mul(other, matchIndexSets);
+  }
+
   // Division by constant
   DoubleCRT& operator/=(const NTL::ZZ& num);
   DoubleCRT& operator/=(long num) { return (*this /= NTL::to_ZZ(num)); }
@@ -359,6 +383,11 @@ public:
   const IndexMap<NTL::vec_long>& getMap() const { return map; }
   const IndexSet& getIndexSet() const { return map.getIndexSet(); }
 
+  //! @brief Move the rows to freshly allocated memory, allocated by the
+  //! calling thread. Under a first-touch policy the new pages are on the
+  //! NUMA node of that thread.
+  void relocate();
+
   // Choose random DoubleCRT's, either at random or with small/Gaussian
   // coefficients.
 
@@ -406,6 +435,77 @@ public:
   friend std::istream& operator>>(std::istream& s, DoubleCRT& d);
 };
 
+/**
+ * @class DoubleCRTPrecon
+ * @brief A DoubleCRT constant prepared for repeated multiplications
+ *
+ * Next to each residue b mod p_i it keeps the Shoup quotient of b, in NTL's
+ * mulmod_precon_t form, so that multiplying by the constant takes one
+ * MulModPrecon per coefficient rather than a full MulMod. Preparing costs
+ * about one MulMod per residue and doubles the memory of the constant, so
+ * it pays off for constants that multiply many ciphertext parts, such as
+ * the diagonals of a matrix or the masks of a rotation.
+ **/
+class DoubleCRTPrecon
+{
+public:
+  explicit DoubleCRTPrecon(const DoubleCRT& dcrt);
+
+  const DoubleCRT& getDCRT() const { return dcrt; }
+  const Context& getContext() const { return dcrt.getContext(); }
+  const IndexSet& getIndexSet() const { return dcrt.getIndexSet(); }
+
+private:
+  DoubleCRT dcrt;
+  // precon[i][j] is the Shoup quotient of the j'th residue mod the i'th
+  // prime, for the primes i in the index set of dcrt
+  std::vector<NTL::Vec<NTL::mulmod_precon_t>> precon;
+  MemoryCharge preconCharge; // the rows of dcrt are charged as any others
+
+  friend class DoubleCRT;
+};
+
+/**
+ * @class DoubleCRTAccumulator
+ * @brief A sum of products of DoubleCRTs with deferred modular reduction
+ *
+ * The products of residues are added up unreduced in 128-bit words, and
+ * only reduced when the sum is read (or, rarely, when another product could
+ * overflow the words). With primes of up to 60 bits, 256 products fit
+ * before that, so a sum of n products costs n plain multiplications and
+ * one reduction per coefficient instead of n modular multiplications and n
+ * modular additions.
+ **/
+class DoubleCRTAccumulator
+{
+public:
+  //! An empty sum over the primes s
+  DoubleCRTAccumulator(const Context& context, const IndexSet& s);
+
+  const IndexSet& getIndexSet() const { return primes; }
+
+  //! Add a*b, where the primes of a and b contain those of the sum
+  void mulAdd(const DoubleCRT& a, const DoubleCRT& b);
+
+  //! Set out to the sum, over the primes of the sum
+  void reduce(DoubleCRT& out) const;
+
+  //! Reset the sum to zero
+  void clear();
+
+private:
+  __extension__ typedef unsigned __int128 wide_t;
+
+  const Context& context;
+  IndexSet primes;
+  std::vector<std::vector<wide_t>> acc; // acc[k] for the k'th prime in primes
+  long count;    // a bound on the terms in each word, in units of p^2
+  long maxCount; // the most terms that cannot overflow a word
+
+  // Reduce the words mod their primes in place
+  void fold();
+};
+
 inline void conv(DoubleCRT& d, const NTL::ZZX& p) { d = p; }
 
 // FIXME-IndexSet
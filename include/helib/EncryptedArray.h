@@ -18,6 +18,10 @@
 #include <exception>
 #include <cmath>
 #include <complex>
+#include <functional>
+#include <map>
+#include <memory>
+#include <tuple>
 #include <NTL/Lazy.h>
 #include <NTL/pair.h>
 #include <NTL/SmartPtr.h>
@@ -26,6 +30,8 @@
 #include <helib/Context.h>
 #include <helib/Ctxt.h>
 #include <helib/keys.h>
+#include <helib/memoryAccounting.h>
+#include <helib/multicore.h>
 
 namespace helib {
 
@@ -306,6 +312,98 @@ public:
   }
 };
 
+/**
+ * @class RotationPlans
+ * @brief A cache of the masks that EncryptedArrayDerived multiplies by when
+ * rotating or shifting along bad dimensions or along several generators
+ *
+ * A plan holds the masks for one rotation (or shift) amount as DoubleCRTs
+ * over all the primes of the context, together with their sizes, so that
+ * the same plan serves ciphertexts at every level. Once a plan is cached,
+ * the rotation only costs its key switches and mult-by-constants. The cache
+ * is shared by the copies of an EncryptedArrayDerived and may be used from
+ * several threads. At most capacity() plans are kept, the least recently
+ * used one being dropped to make room for a new one. The plans are also
+ * charged to MemCategory::CACHE, and all of them are dropped when the
+ * memory budget is exceeded.
+ **/
+class RotationPlans
+{
+public:
+  //! The kind of operation a plan is for
+  enum Kind
+  {
+    ROTATE1D, //!< a non-native rotate1D: the mask of maskTable[dim][amt]
+    SHIFT1D,  //!< shift1D: the mask that zeroes the slots shifted out
+    GENERAL   //!< rotate or shift: the combined mask used at each dimension
+  };
+
+  struct Mask
+  {
+    DoubleCRTPrecon poly; // over context.allPrimes()
+    double size;    // embeddingLargestCoeff of the mask
+  };
+  typedef std::vector<Mask> Plan;
+
+  //! The default capacity
+  static constexpr long DEFAULT_CAPACITY = 64;
+
+  explicit RotationPlans(const Context& context) :
+      context(context),
+      shrinker(MemCategory::CACHE, "RotationPlans", [this] { clear(); })
+  {}
+
+  RotationPlans(const RotationPlans&) = delete;
+  RotationPlans& operator=(const RotationPlans&) = delete;
+
+  /**
+   * @brief Look up a plan, building it if it is not cached yet.
+   * @param kind The kind of operation.
+   * @param dim The dimension of a 1D operation (ignored for GENERAL).
+   * @param amt The amount of the rotation or shift.
+   * @param build Called to compute the masks of the plan as polynomials.
+   * It must set up the NTL context that it needs itself.
+   **/
+  std::shared_ptr<const Plan> get(
+      Kind kind,
+      long dim,
+      long amt,
+      const std::function<void(std::vector<zzX>&)>& build) const;
+
+  //! The number of cached plans
+  long size() const;
+
+  //! The maximum number of cached plans
+  long capacity() const;
+
+  //! Set the maximum number of cached plans (at least 1), dropping the least
+  //! recently used plans that no longer fit
+  void setCapacity(long maxPlans) const;
+
+  //! Drop all the cached plans, e.g. to free their memory
+  void clear() const;
+
+private:
+  const Context& context;
+  mutable HELIB_MUTEX_TYPE mutex;
+
+  struct Entry
+  {
+    std::shared_ptr<const Plan> plan;
+    unsigned long lastUse;
+  };
+  mutable std::map<std::tuple<int, long, long>, Entry> plans;
+  mutable unsigned long useCount = 0;
+  mutable long maxPlans = DEFAULT_CAPACITY;
+
+  // Drop the least recently used plans until at most n are left, with the
+  // mutex held
+  void evictTo(long n) const;
+  // Drops the plans under memory pressure. Destroyed first, so that a
+  // running shrink finishes while the plans are still alive.
+  MemoryShrinker shrinker;
+};
+
 /**
  * @class EncryptedArrayDerived
  * @brief Derived concrete implementation of EncryptedArrayBase
@@ -333,6 +431,13 @@ private:
   NTL::Lazy<NTL::Pair<NTL::Mat<R>, NTL::Mat<R>>> normalBasisMatrices;
   // a is the matrix, b is its inverse
 
+  // The masks of rotate, shift and the non-native 1D operations, which do
+  // not depend on G, so copies share them
+  std::shared_ptr<RotationPlans> rotationPlans;
+
+  // The plan for rotating or shifting by amt in [1, nslots-1]
+  std::shared_ptr<const RotationPlans::Plan> generalPlan(long amt) const;
+
 public:
   explicit EncryptedArrayDerived(const Context& _context,
                                  const RX& _G,
@@ -340,7 +445,9 @@ public:
 
   EncryptedArrayDerived(const EncryptedArrayDerived& other) // copy constructor
       :
-      context(other.context), tab(other.tab)
+      context(other.context),
+      tab(other.tab),
+      rotationPlans(other.rotationPlans)
   {
     RBak bak;
     bak.save();
@@ -371,6 +478,7 @@ public:
     mappingData = other.mappingData;
     linPolyMatrix = other.linPolyMatrix;
     normalBasisMatrices = other.normalBasisMatrices;
+    rotationPlans = other.rotationPlans;
     return *this;
   }
 
@@ -440,6 +548,20 @@ public:
   }
   virtual void shift1D(Ctxt& ctxt, long i, long k) const override;
 
+  //! The number of rotation plans cached by rotate, shift, shift1D and the
+  //! non-native rotate1D
+  long numRotationPlans() const { return rotationPlans->size(); }
+
+  //! Drop the cached rotation plans, e.g. to free their memory
+  void clearRotationPlans() const { rotationPlans->clear(); }
+
+  //! Set the maximum number of cached rotation plans, shared by the copies
+  //! of this array (RotationPlans::DEFAULT_CAPACITY by default)
+  void setMaxRotationPlans(long maxPlans) const
+  {
+    rotationPlans->setCapacity(maxPlans);
+  }
+
   /* Begin CKKS functions. They will simply throw here. */
   /**
    * @brief Unimplemented decrypt function for CKKS. It will always
@@ -1577,10 +1699,77 @@ void applyLinPolyMany(const EncryptedArray& ea,
 //! @brief a low-level variant:
 //! @param encodedCoeffs has all the linPoly coeffs encoded  in slots;
 //!        different transformations can be encoded in different slots
-template <typename P> // P can be ZZX or DoubleCRT
+template <typename P> // P can be zzX, ZZX, DoubleCRT or DoubleCRTPrecon
 void applyLinPolyLL(Ctxt& ctxt, const std::vector<P>& encodedC, long d);
 ///@}
 
+/**
+ * @class LinPolyEvaluator
+ * @brief A family of linearized polynomials with precomputed constants
+ *
+ * The coefficients of all the maps are built and encoded once, and are
+ * kept as DoubleCRT objects over all the primes in the chain, so they can
+ * be reused for ciphertexts at any level. All the maps in the family are
+ * applied to the same Frobenius images of the input, so applying n maps
+ * costs d-1 automorphisms rather than n*(d-1).
+ *
+ * Example usage: compute both the even and odd parts of the slots
+ * \code
+ *     long d = ea.getDegree();
+ *     std::vector<std::vector<ZZX>> L(2, std::vector<ZZX>(d));
+ *     for (long j = 0; j < d; j++)
+ *       L[j % 2][j] = ZZX(j, 1);
+ *
+ *     LinPolyEvaluator evaluator(ea, L); // build once, use many times
+ *     std::vector<Ctxt> parts;
+ *     evaluator.applyAll(parts, ctxt);
+ * \endcode
+ **/
+class LinPolyEvaluator
+{
+  const EncryptedArray& ea;
+  long d;
+
+  // coeffs[i][j] is the j'th coefficient of the i'th map, encoded in all
+  // the slots, or null if it is zero; sizes[i][j] is its embedding size
+  std::vector<std::vector<std::shared_ptr<DoubleCRTPrecon>>> coeffs;
+  std::vector<std::vector<double>> sizes;
+
+public:
+  //! @brief Build the evaluator, maps[i] describes the i'th linear map as
+  //! the input L of ea.buildLinPolyCoeffs, and is applied to all the slots
+  LinPolyEvaluator(const EncryptedArray& ea,
+                   const std::vector<std::vector<NTL::ZZX>>& maps);
+
+  //! @brief Number of maps in the family
+  long size() const { return coeffs.size(); }
+
+  const EncryptedArray& getEA() const { return ea; }
+
+  //! @brief Compute the Frobenius images frob[j] = ctxt^{p^j}, j=0..d-1
+  void frobeniusImages(std::vector<Ctxt>& frob, const Ctxt& ctxt) const;
+
+  //! @brief Set out to the i'th map applied to the ciphertext whose
+  //! Frobenius images (as computed by frobeniusImages) are in frob
+  void apply(Ctxt& out, const std::vector<Ctxt>& frob, long i) const;
+
+  //! @brief Apply the i'th map to ctxt
+  void apply(Ctxt& ctxt, long i) const;
+
+  //! @brief Apply all the maps to ctxt, setting out[i] to the i'th image
+  void applyAll(std::vector<Ctxt>& out, const Ctxt& ctxt) const;
+};
+
+//! @brief Build the masks used by incrementalZeroTest, for n prefixes
+LinPolyEvaluator buildIncrementalZeroTestMasks(const EncryptedArray& ea,
+                                               long n);
+
+//! @brief A variant of incrementalZeroTest that reuses precomputed masks,
+//! as returned by buildIncrementalZeroTestMasks(ea, n) for n=masks.size()
+void incrementalZeroTest(Ctxt* res[],
+                         const LinPolyEvaluator& masks,
+                         const Ctxt& ctxt);
+
 } // namespace helib
 
 #endif // ifndef HELIB_ENCRYPTEDARRAY_H
@@ -103,6 +103,62 @@ public:
   void apply(Ctxt& ctxt) const;
 };
 
+//! @class CKKSEvalMap
+//! @brief The linear transforms used in CKKS bootstrapping
+//!
+//! With n = phi(m)/2 slots, the slots of a polynomial with real
+//! coefficients c_0..c_{2n-1} are its evaluations at one root of unity of
+//! every conjugate pair. Writing w_j = c_j + i*c_{j+n}, the map from w to
+//! the slots is a special FFT: log2(n) layers of butterflies, each with the
+//! three diagonals 0 and +-2^l, applied to w in bit-reversed order.
+//!
+//! slotToCoeff applies these layers and coeffToSlot their inverses, so like
+//! EvalMap the transform is a sequence of sparse matrices, each costing a
+//! level and two rotations rather than a dense matrix. The coefficients
+//! between them are in bit-reversed order, which does not matter as the
+//! modular reduction works slot by slot.
+class CKKSEvalMap
+{
+public:
+  explicit CKKSEvalMap(const EncryptedArray& _ea);
+
+  //! re and im receive c_j and c_{j+n}, for the coefficients c of the
+  //! polynomial encrypted in ctxt (in bit-reversed order of j)
+  void coeffToSlot(Ctxt& re, Ctxt& im, const Ctxt& ctxt) const;
+
+  //! The inverse of coeffToSlot
+  void slotToCoeff(Ctxt& ctxt, const Ctxt& re, const Ctxt& im) const;
+
+  //! The number of layers of each transform, log2(n)
+  long numLayers() const { return forward.size(); }
+
+private:
+  // A matrix over the slots with a few nonzero diagonals: slot k of the
+  // product is the sum over the offsets d of diag[d][k] times slot k+d
+  struct SparseMatrix
+  {
+    std::vector<long> offsets;
+    std::vector<std::shared_ptr<const DoubleCRTPrecon>> diags;
+    std::vector<double> sizes, factors;
+  };
+
+  // A layer maps x to a*x + b*y, y being either conj(x) or a second input
+  struct Layer
+  {
+    SparseMatrix a, b;
+  };
+
+  const EncryptedArray& ea;
+  std::vector<Layer> forward; // slotToCoeff, in the order applied
+  std::vector<Layer> inverse; // coeffToSlot, in the order applied
+  Layer imPart;               // the last inverse layer for im
+
+  SparseMatrix encode(
+      const std::vector<std::vector<std::complex<double>>>& diags) const;
+  static Ctxt apply(const SparseMatrix& mat, const Ctxt& ctxt);
+  static Ctxt apply(const Layer& layer, const Ctxt& x, const Ctxt& y);
+};
+
 } // namespace helib
 
 #endif // ifndef HELIB_EVALMAP_H
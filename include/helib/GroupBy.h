@@ -0,0 +1,100 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_GROUPBY_H
+#define HELIB_GROUPBY_H
+/**
+ * @file GroupBy.h
+ * @brief Encrypted GROUP BY: counts and sums per key over packed records
+ **/
+
+#include <vector>
+
+#include <helib/CtPtrs.h>
+
+namespace helib {
+
+/**
+ * @class GroupBy
+ * @brief Computes, for every value of an encrypted key, the number of
+ * records with that key and the sums of encrypted value columns over them
+ *
+ * The records are in the slots: slot s of every ciphertext belongs to
+ * record s, the key is given by its bits as in binaryArith.h. The
+ * indicators of all the 2^keyBits groups come from one call to
+ * computeAllProducts, which shares the partial products between groups.
+ *
+ * Each aggregate then has to be summed over the slots. Instead of a
+ * totalSums per aggregate (log(n) rotations each, for n = ea.size()),
+ * up to n aggregates are reduced into one ciphertext, aggregate a in slot a:
+ * each is summed over windows of b slots, the windows are masked into
+ * n/b ciphertexts, and these are combined with n/b - 1 rotations that are
+ * shared by all the aggregates. The window sums take all their rotations at
+ * once (hoisted) when that is cheaper than doubling the window, and the
+ * unit selectors of the masks are encoded once per reduce(). The window b
+ * is the divisor of n with the lowest estimated cost, counting the masks.
+ *
+ * The sums are modulo the plaintext space, which must be large enough for
+ * the counts. Every slot is a record: padding slots should hold a key of
+ * an unused group.
+ **/
+class GroupBy
+{
+public:
+  /**
+   * @brief Constructor.
+   * @param ea The slots of the records.
+   * @param keyBits The number of bits of the keys, at most 16.
+   **/
+  GroupBy(const EncryptedArray& ea, long keyBits);
+
+  long numGroups() const { return 1L << keyBits; }
+
+  //! The index of the aggregate of group g in the output of aggregate():
+  //! column 0 for the counts, column v + 1 for the sums of values[v]
+  long aggregateIndex(long g, long column) const
+  {
+    return column * numGroups() + g;
+  }
+
+  //! The number of rotations that reduce() uses for count inputs
+  long numRotations(long count) const;
+
+  //! Compute out[g], with 1 in the slots whose key is g and 0 elsewhere
+  void indicators(std::vector<Ctxt>& out, const CtPtrs& key) const;
+
+  /**
+   * @brief Count the records and sum the values of every group
+   * @param out Receives the aggregates, aggregate a = aggregateIndex(g,
+   * column) in slot a % ea.size() of out[a / ea.size()].
+   * @param key The bits of the key of every record, least significant
+   * first.
+   * @param values The value columns.
+   **/
+  void aggregate(std::vector<Ctxt>& out,
+                 const CtPtrs& key,
+                 const std::vector<Ctxt>& values) const;
+
+  //! Put the sum over the slots of in[a] into slot a % ea.size() of
+  //! out[a / ea.size()]
+  void reduce(std::vector<Ctxt>& out, const std::vector<Ctxt>& in) const;
+
+private:
+  const EncryptedArray& ea;
+  long keyBits;
+
+  // The window of the reduction of count inputs
+  long chooseWindow(long count) const;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_GROUPBY_H
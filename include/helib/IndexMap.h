@@ -16,9 +16,12 @@
  * @brief Implementation of a map indexed by a dynamic set of integers.
  **/
 
+#include <atomic>
+#include <memory>
 #include <unordered_map>
 #include <helib/IndexSet.h>
 #include <helib/clonedPtr.h>
+#include <helib/memoryAccounting.h>
 
 namespace helib {
 
@@ -32,6 +35,10 @@ public:
 
   //! @brief Cloning a pointer, override with code to create a fresh copy
   virtual IndexMapInit<T>* clone() const = 0;
+
+  //! @brief The bytes that an element occupies, charged to the current
+  //! MemoryScope for as long as it lives. Override for large elements.
+  virtual long elementBytes() const { return 0; }
   virtual ~IndexMapInit() {} // ensure that derived destructor is called
 };
 
@@ -39,15 +46,74 @@ public:
 //!
 //! Additionally, it allows new elements of the map to be initialized in a
 //! flexible manner.
+//!
+//! The elements are copy-on-write: copying a map shares the elements with the
+//! original, and an element is duplicated only when it is first accessed
+//! through the non-const operator[] while it is shared. An element that was
+//! accessed through the non-const operator[] may still be written through the
+//! returned reference, so a copy of the map gets its own copy of it rather
+//! than sharing it. Owners that use these references only within their own
+//! methods can share all the elements with sharing().
 template <typename T>
 class IndexMap
 {
+  struct Entry
+  {
+    std::shared_ptr<T> elem;
+    bool exposed; // a mutable reference to *elem was handed out
+  };
 
-  std::unordered_map<long, T> map;
+  std::unordered_map<long, Entry> map;
 
   IndexSet indexSet;
   cloned_ptr<IndexMapInit<T>> init;
 
+  const std::shared_ptr<T>& find(long j) const
+  {
+    assertTrue(indexSet.contains(j), "Key not found");
+    return map.find(j)->second.elem;
+  }
+
+  struct ChargedDelete
+  {
+    MemoryCharge charge;
+    void operator()(T* elem) const { delete elem; }
+  };
+
+  // A new element initialized as by insert, or a copy of *from assigned to
+  // one (so that e.g. fixed-length vectors stay fixed), charged to the
+  // current MemoryScope if the init object gives its size
+  std::shared_ptr<T> make(const T* from = nullptr)
+  {
+    const long bytes = init.null() ? 0 : init->elementBytes();
+    std::shared_ptr<T> elem;
+    if (bytes == 0)
+      elem = std::make_shared<T>();
+    else {
+      MemoryCharge charge(bytes);
+      elem = std::shared_ptr<T>(new T(), ChargedDelete{std::move(charge)});
+    }
+    if (!init.null())
+      init->init(*elem);
+    if (from != nullptr)
+      *elem = *from;
+    return elem;
+  }
+
+  // Share the elements of other, or copy the exposed ones unless shareAll
+  void copyFrom(const IndexMap& other, bool shareAll)
+  {
+    init = other.init;
+    std::unordered_map<long, Entry> copy;
+    for (const auto& entry : other.map)
+      copy[entry.first] = Entry{(entry.second.exposed && !shareAll)
+                                    ? make(entry.second.elem.get())
+                                    : entry.second.elem,
+                                false};
+    map.swap(copy);
+    indexSet = other.indexSet;
+  }
+
 public:
   //! @brief The empty map
   IndexMap();
@@ -62,24 +128,60 @@ public:
   //! operator new, and the pointer is "exclusively owned" by the map object.
   explicit IndexMap(IndexMapInit<T>* _init) : init(_init) {}
 
+  IndexMap(const IndexMap& other) { copyFrom(other, false); }
+  IndexMap(IndexMap&& other) = default;
+
+  IndexMap& operator=(const IndexMap& other)
+  {
+    if (this != &other)
+      copyFrom(other, false);
+    return *this;
+  }
+  IndexMap& operator=(IndexMap&& other) = default;
+
+  //! @brief A copy that shares also the elements that other handed out
+  //! through the non-const operator[]. Only valid if no such reference will
+  //! be written through anymore.
+  static IndexMap sharing(const IndexMap& other)
+  {
+    IndexMap copy(nullptr);
+    copy.copyFrom(other, true);
+    return copy;
+  }
+
   //! @brief Get the underlying index set
   const IndexSet& getIndexSet() const { return indexSet; }
 
   //! @brief Access functions: will raise an error
-  //! if j does not belong to the current index set
+  //! if j does not belong to the current index set.
+  //! The non-const version makes a private copy of a shared element.
   T& operator[](long j)
   {
     assertTrue(indexSet.contains(j), "Key not found");
-    return map[j];
+    Entry& entry = map.find(j)->second;
+    if (entry.elem.use_count() > 1)
+      entry.elem = make(entry.elem.get());
+    else // see the other copies' release of the element
+      std::atomic_thread_fence(std::memory_order_acquire);
+    entry.exposed = true;
+    return *entry.elem;
   }
-  const T& operator[](long j) const
+  const T& operator[](long j) const { return *find(j); }
+
+  //! @brief Is the element j shared with another map?
+  bool isShared(long j) const { return find(j).use_count() > 1; }
+
+  //! @brief Replace the element j by a new element, initialized as by
+  //! insert, that fill(newElem, oldElem) computes from the old one. Unlike
+  //! the non-const operator[], this does not copy a shared element first.
+  template <typename Fill>
+  void rebuild(long j, Fill fill)
   {
     assertTrue(indexSet.contains(j), "Key not found");
-    // unordered_map does not support a const [] operator,
-    // so we have to artificially strip away the const-ness here
-    std::unordered_map<long, T>& map1 =
-        const_cast<std::unordered_map<long, T>&>(map);
-    return map1[j];
+    Entry& entry = map.find(j)->second;
+    std::shared_ptr<T> fresh = make();
+    fill(*fresh, static_cast<const T&>(*entry.elem));
+    entry = Entry{std::move(fresh), false};
   }
 
   //! @brief Insert indexes to the IndexSet.
@@ -88,9 +190,9 @@ public:
   void insert(long j)
   {
     if (!indexSet.contains(j)) {
+      std::shared_ptr<T> elem = make();
+      map[j] = Entry{std::move(elem), false};
       indexSet.insert(j);
-      if (!init.null())
-        init->init(map[j]);
     }
   }
   void insert(const IndexSet& s)
@@ -127,7 +229,7 @@ bool operator==(const IndexMap<T>& map1, const IndexMap<T>& map2)
     return false;
   const IndexSet& s = map1.getIndexSet();
   for (long i = s.first(); i <= s.last(); i = s.next(i)) {
-    if (map1[i] == map2[i])
+    if (&map1[i] == &map2[i] || map1[i] == map2[i])
       continue;
     return false;
   }
@@ -0,0 +1,228 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_LINEARMODEL_H
+#define HELIB_LINEARMODEL_H
+/**
+ * @file LinearModel.h
+ * @brief Inference of linear models and small MLPs on CKKS ciphertexts
+ *
+ * The weights are plaintext, the samples are encrypted. Two packings of the
+ * samples are supported:
+ *  - BLOCKS: feature c of sample s is in slot s*b+c, for a power of two b.
+ *    A layer multiplies by its weights with DIAGONAL encoding (the in+out-1
+ *    nonzero generalized diagonals of the block matrix, in+out-2 rotations)
+ *    or HYBRID encoding (out diagonals of a matrix with the rows repeated,
+ *    then log2 of in/out rotate-and-add steps), whichever needs fewer
+ *    rotations. The rotations of a ciphertext are hoisted.
+ *  - REPLICATED: sample s is in slot s of nslots, and there is one
+ *    ciphertext per feature. The weights are scalars replicated across the
+ *    slots, so a layer needs no rotations and consumes no level.
+ *
+ * CKKS slots form a single (native) dimension of the hypercube, so choosing
+ * the layout along it amounts to choosing the block size.
+ **/
+
+#include <memory>
+#include <vector>
+
+#include <helib/Ctxt.h>
+#include <helib/EncryptedArray.h>
+
+namespace helib {
+
+class ChebyshevApprox;
+
+//! How the samples are laid out in the slots
+enum class SamplePacking
+{
+  BLOCKS,
+  REPLICATED
+};
+
+//! How a layer with BLOCKS packing multiplies by its weights
+enum class BlockEncoding
+{
+  AUTO,
+  DIAGONAL,
+  HYBRID
+};
+
+/**
+ * @class LinearLayer
+ * @brief y = W*x + bias for every sample of a batch
+ *
+ * With BLOCKS packing, the slots of a block past the inputs are ignored, and
+ * those past the outputs hold sums of products of weights and features (or
+ * zeros, for DIAGONAL in a block of blockSize()). A layer works with any
+ * block size that is a multiple of blockSize().
+ **/
+class LinearLayer
+{
+public:
+  /**
+   * @brief Encode the weights for the given packing
+   * @param ea The CKKS EncryptedArray.
+   * @param weights weights[j][c] is the weight of input c for output j.
+   * @param bias The bias of every output, empty for none.
+   * @param packing The layout of the samples.
+   * @param encoding The encoding for BLOCKS packing, AUTO for the one with
+   * the fewest rotations.
+   **/
+  LinearLayer(const EncryptedArray& ea,
+              const std::vector<std::vector<double>>& weights,
+              const std::vector<double>& bias = {},
+              SamplePacking packing = SamplePacking::BLOCKS,
+              BlockEncoding encoding = BlockEncoding::AUTO);
+
+  long numInputs() const { return nIn; }
+  long numOutputs() const { return nOut; }
+  SamplePacking getPacking() const { return packing; }
+  //! The encoding used, DIAGONAL or HYBRID (meaningless for REPLICATED)
+  BlockEncoding getEncoding() const { return encoding; }
+
+  //! The smallest block size this layer works with (1 for REPLICATED)
+  long blockSize() const { return block; }
+  //! The number of rotations per ciphertext
+  long numRotations() const;
+  //! The number of levels consumed
+  long depth() const { return packing == SamplePacking::BLOCKS ? 1 : 0; }
+
+  /**
+   * @brief Apply the layer to a batch
+   *
+   * With BLOCKS packing, every ciphertext holds samples and is replaced in
+   * place. With REPLICATED packing, the numInputs() ciphertexts of the
+   * features are replaced by the numOutputs() ciphertexts of the outputs.
+   **/
+  void apply(std::vector<Ctxt>& ctxts) const;
+
+  //! The rotations of a layer with in inputs and out outputs, and the
+  //! smallest block size it works with
+  static long diagonalRotations(long in, long out);
+  static long hybridRotations(long in, long out);
+  static long diagonalBlockSize(long in, long out);
+  static long hybridBlockSize(long in, long out);
+
+private:
+  // The encoded slots are kept in one form only: a polynomial for the
+  // bias, or prepared for multiplications over all the primes for the
+  // diagonals
+  struct EncodedConst
+  {
+    long amount = 0;   // rotation of the ciphertext it multiplies
+    double size = 0;   // the largest magnitude of the slots
+    double factor = 0; // the scaling factor of the encoding
+    NTL::ZZX poly;     // bias
+    std::shared_ptr<const DoubleCRTPrecon> prepared; // diagonals
+  };
+
+  const EncryptedArray& ea;
+  long nIn, nOut;
+  SamplePacking packing;
+  BlockEncoding encoding;
+  long block;
+  long span; // HYBRID: the number of slots that are summed in steps of nOut
+
+  std::vector<std::vector<double>> weights; // REPLICATED
+  std::vector<double> bias;                 // REPLICATED
+  std::vector<EncodedConst> diagonals;      // BLOCKS
+  EncodedConst encodedBias;                 // BLOCKS
+
+  void encodeSlots(EncodedConst& out,
+                   const std::vector<std::complex<double>>& slots,
+                   bool prepare) const;
+  void applyBlocks(Ctxt& ctxt) const;
+  void applyReplicated(std::vector<Ctxt>& ctxts) const;
+};
+
+/**
+ * @class LinearModel
+ * @brief A sequence of linear layers and activations, evaluated on batches
+ * of encrypted samples
+ *
+ * A batch is a vector of ciphertexts: a single ciphertext with
+ * samplesPerBatch() samples for BLOCKS packing, or numInputs() ciphertexts
+ * with one feature of samplesPerBatch() samples each for REPLICATED packing.
+ * Logistic regression is a layer with one output followed by a Chebyshev
+ * approximation of the sigmoid.
+ **/
+class LinearModel
+{
+public:
+  LinearModel(const EncryptedArray& ea,
+              SamplePacking packing = SamplePacking::BLOCKS);
+
+  //! Append a layer, whose inputs are the outputs of the previous one
+  LinearModel& addLayer(const std::vector<std::vector<double>>& weights,
+                        const std::vector<double>& bias = {},
+                        BlockEncoding encoding = BlockEncoding::AUTO);
+  //! Append an activation function, applied to every output of the
+  //! previous layer (for BLOCKS packing, its interval must also cover the
+  //! values in the unused slots)
+  LinearModel& addActivation(const ChebyshevApprox& f);
+
+  long numInputs() const;
+  long numOutputs() const;
+  SamplePacking getPacking() const { return packing; }
+  const std::vector<LinearLayer>& getLayers() const { return layers; }
+
+  //! The block size of BLOCKS packing, the largest of the layers (1 for
+  //! REPLICATED)
+  long blockSize() const;
+  //! The number of samples in a batch
+  long samplesPerBatch() const { return ea.size() / blockSize(); }
+  //! The number of ciphertexts in a batch of inputs
+  long ctxtsPerBatch() const;
+  //! The number of levels consumed by evaluate()
+  long depth() const;
+  //! The number of rotations that evaluate() performs per batch
+  long numRotations() const;
+
+  //! Evaluate the model on a batch, replacing the inputs by the outputs
+  void evaluate(std::vector<Ctxt>& batch) const;
+
+  //! The slots of the ciphertexts of a batch of at most samplesPerBatch()
+  //! samples, samples[s][c] being feature c of sample s
+  std::vector<std::vector<double>> encodeBatch(
+      const std::vector<std::vector<double>>& samples) const;
+  //! The outputs of the first nSamples samples, from the decrypted slots of
+  //! the ciphertexts of a batch
+  std::vector<std::vector<double>> decodeBatch(
+      const std::vector<std::vector<double>>& slots,
+      long nSamples) const;
+
+  /**
+   * @brief Choose the packing with the best estimated throughput
+   * @param ea The CKKS EncryptedArray.
+   * @param nSamples The number of samples to score.
+   * @param widths The number of inputs followed by the number of outputs of
+   * every layer.
+   *
+   * A rotation, and the encryption of an input ciphertext, are counted as
+   * KEY_SWITCH_COST multiply-and-adds of a ciphertext by a constant.
+   **/
+  static SamplePacking choosePacking(const EncryptedArray& ea,
+                                     long nSamples,
+                                     const std::vector<long>& widths);
+  static constexpr long KEY_SWITCH_COST = 20;
+
+private:
+  const EncryptedArray& ea;
+  SamplePacking packing;
+  std::vector<LinearLayer> layers;
+  // activations[i] is applied after layers[i], null for none
+  std::vector<std::shared_ptr<const ChebyshevApprox>> activations;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_LINEARMODEL_H
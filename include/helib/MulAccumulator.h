@@ -0,0 +1,79 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_MULACCUMULATOR_H
+#define HELIB_MULACCUMULATOR_H
+/**
+ * @file MulAccumulator.h
+ * @brief Sums of ciphertext-times-constant products with deferred reduction
+ **/
+
+#include <vector>
+
+#include <helib/Ctxt.h>
+#include <helib/DoubleCRT.h>
+
+namespace helib {
+
+/**
+ * @class MulAccumulator
+ * @brief Accumulates products c_k * ctxt_k of ciphertexts by DoubleCRT
+ * constants, and reduces the sum once when it is read
+ *
+ * The products of BGV ciphertexts that agree on their primes, plaintext
+ * space, integer factor and key handles (as the rotations of one
+ * ciphertext do) are kept in the 128-bit words of a DoubleCRTAccumulator
+ * per part. Other products, and all CKKS products (whose rational factors
+ * usually differ), are computed and added as usual, so the result is always
+ * the same as adding up the products one by one.
+ **/
+class MulAccumulator
+{
+public:
+  explicit MulAccumulator(const PubKey& pubKey);
+
+  //! Add c * ctxt, where the primes of c contain those of ctxt and size is
+  //! as in Ctxt::multByConstant
+  void mulAdd(const DoubleCRT& c, const Ctxt& ctxt, double size = -1.0);
+  void mulAdd(const DoubleCRTPrecon& c, const Ctxt& ctxt, double size = -1.0);
+
+  //! Same as mulAdd, but a product that is not deferred is computed in
+  //! place in ctxt rather than in a copy, so ctxt may be modified
+  void destMulAdd(const DoubleCRT& c, Ctxt& ctxt, double size = -1.0);
+  void destMulAdd(const DoubleCRTPrecon& c, Ctxt& ctxt, double size = -1.0);
+
+  //! Add a ciphertext that is already a product
+  void add(const Ctxt& ctxt);
+
+  bool isEmpty() const { return acc.empty() && rest.isEmpty(); }
+
+  //! Add the sum to out and reset the accumulator
+  void addTo(Ctxt& out);
+
+private:
+  const PubKey& pubKey;
+  Ctxt sum;  // the metadata (and part handles) of the deferred products
+  Ctxt rest; // the sum of the products that could not be deferred
+  std::vector<DoubleCRTAccumulator> acc; // one per part of sum
+
+  bool canDefer(const Ctxt& ctxt) const;
+
+  template <typename DCRT>
+  void mulAddImpl(const DCRT& c,
+                  const DoubleCRT& dcrt,
+                  const Ctxt& ctxt,
+                  double size,
+                  Ctxt* scratch);
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_MULACCUMULATOR_H
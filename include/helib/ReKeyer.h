@@ -0,0 +1,87 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_REKEYER_H
+#define HELIB_REKEYER_H
+/**
+ * @file ReKeyer.h
+ * @brief Moving ciphertexts from an old secret key to a new one
+ **/
+
+#include <string>
+#include <vector>
+
+#include <helib/Ctxt.h>
+
+namespace helib {
+
+/**
+ * @class ReKeyer
+ * @brief Re-encrypts ciphertexts under a new key by key switching, without
+ * decrypting them
+ *
+ * The owner of both keys calls newKey.GenReKeyMatrix(oldKey) once. The
+ * resulting public key (and the index it returns) is all that the ReKeyer
+ * needs, so the re-keying can run where the ciphertexts are stored. A
+ * ciphertext of the old key is re-tagged as relative to the imported key
+ * and then re-linearized, which key-switches it to key 0 of the new key.
+ **/
+class ReKeyer
+{
+public:
+  /**
+   * @brief Constructor.
+   * @param newKey The public key to re-key to, holding the matrix made by
+   * GenReKeyMatrix.
+   * @param importedKeyID The index returned by GenReKeyMatrix.
+   * @param oldKeyID The index of the key of the ciphertexts in the old key.
+   **/
+  ReKeyer(const PubKey& newKey, long importedKeyID, long oldKeyID = 0);
+
+  const PubKey& getNewKey() const { return newKey; }
+
+  //! Re-key in, a ciphertext of the old key, into out, a ciphertext of the
+  //! new key
+  void reKey(Ctxt& out, const Ctxt& in) const;
+
+  //! Re-key a batch of ciphertexts of the old key in parallel, replacing out
+  //! by ciphertexts of the new key
+  void reKey(std::vector<Ctxt>& out, const std::vector<Ctxt>& in) const;
+
+  /**
+   * @brief Re-key a file of ciphertexts in place
+   * @param path The file, holding ciphertexts of the old key one after the
+   * other in the binary format of Ctxt::write.
+   * @param batchSize The number of ciphertexts that are read, re-keyed in
+   * parallel and written at a time.
+   * @return The number of ciphertexts re-keyed.
+   *
+   * The ciphertexts are written to path + ".rekey", which then replaces
+   * the file, so an interrupted run leaves the original intact. As the old
+   * key's re-linearization matrices are not available, every ciphertext in
+   * the file must be in canonical form: otherwise InvalidArgument is thrown
+   * and the file is left unchanged.
+   **/
+  long reKeyFile(const std::string& path, long batchSize = 64) const;
+
+private:
+  const PubKey& newKey;
+  long importedKeyID;
+  long oldKeyID;
+
+  // Switch ctxt, read or copied as a ciphertext of the new key, from the
+  // old key to key 0
+  void switchKey(Ctxt& ctxt) const;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_REKEYER_H
@@ -0,0 +1,186 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_SEGMENTEDDATABASE_H
+#define HELIB_SEGMENTEDDATABASE_H
+/**
+ * @file SegmentedDatabase.h
+ * @brief An encrypted database that grows and shrinks without rebuilding
+ **/
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <helib/partialMatch.h>
+#include <helib/multicore.h>
+#include <helib/scheduler.h>
+
+namespace helib {
+
+/**
+ * @struct SegmentedResult
+ * @brief The merged result of a query over a SegmentedDatabase
+ **/
+struct SegmentedResult
+{
+  //! One ciphertext per row block of the database
+  std::vector<Ctxt> values;
+
+  //! ids[i][k] is the record in slot k of values[i], or -1 if the slot is
+  //! empty or deleted (and then holds 0)
+  std::vector<std::vector<long>> ids;
+};
+
+/**
+ * @class SegmentedDatabase
+ * @brief An encrypted database made of immutable segments, with deletions
+ * kept as tombstones and a compactor that repacks sparse segments
+ *
+ * As in Database<Ctxt>, the records are packed into the slots of row
+ * blocks, with one ciphertext per column. Every append() adds new segments
+ * and every remove() tombstones one slot, so neither touches existing
+ * ciphertexts. Queries run over all the segments in parallel and merge
+ * their results, zeroing the slots that hold no live record.
+ *
+ * The tombstones are slot masks known to the server, which is what lets
+ * compact() reclaim their slots: it packs the live records of sparse
+ * segments into fewer row blocks with a SlotCompactor. Record ids do not
+ * change, and results carry the id of every slot.
+ *
+ * All the methods may be called concurrently, in particular compact() from
+ * a background thread. Queries and compactions work on a snapshot of the
+ * segments, and a compaction is dropped if any segment that it repacks was
+ * changed meanwhile.
+ **/
+class SegmentedDatabase
+{
+public:
+  /**
+   * @brief Constructor.
+   * @param pubKey The key of the records. Rotations for which it has
+   * key-switching matrices make compaction cheaper.
+   * @param columns The number of columns of every record.
+   * @param rowsPerSegment The maximal number of row blocks of a segment.
+   **/
+  SegmentedDatabase(const PubKey& pubKey, long columns, long rowsPerSegment);
+
+  SegmentedDatabase(const SegmentedDatabase&) = delete;
+  SegmentedDatabase& operator=(const SegmentedDatabase&) = delete;
+
+  long columns() const { return nColumns; }
+  long numSegments() const;
+
+  //! The number of row blocks, which is the cost of a query
+  long numRows() const;
+
+  //! The number of live records
+  long numRecords() const;
+
+  /**
+   * @brief Append records
+   * @param rows rows(i, j) holds column j of record i * ea.size() + k in
+   * slot k.
+   * @param nRecords The number of records in rows, the slots past them are
+   * empty. The default is all the slots.
+   * @return The id of the first record, the others follow consecutively.
+   **/
+  long append(const Matrix<Ctxt>& rows, long nRecords = -1);
+
+  //! Delete a record. Returns false if there is no live record with this id.
+  bool remove(long id);
+
+  /**
+   * @brief Repack the sparse segments
+   * @param maxFill The segments with at most this fraction of live slots
+   * are repacked.
+   * @return The number of row blocks freed, 0 if nothing could be gained or
+   * the segments were changed during the compaction.
+   **/
+  long compact(double maxFill = 0.5);
+
+  //! As Database::contains, over all the live records
+  template <typename TXT2>
+  SegmentedResult contains(const Query_t& lookup_query,
+                           const Matrix<TXT2>& query_data) const
+  {
+    return query(lookup_query, query_data, lookup_query.containsOR);
+  }
+
+  //! As Database::getScore, over all the live records
+  template <typename TXT2>
+  SegmentedResult getScore(const Query_t& weighted_query,
+                           const Matrix<TXT2>& query_data) const
+  {
+    return query(weighted_query, query_data, /*fermat=*/false);
+  }
+
+private:
+  struct Segment
+  {
+    std::shared_ptr<const Matrix<Ctxt>> data;
+    std::vector<std::vector<long>> ids; // -1 for empty and deleted slots
+    long live = 0;
+  };
+
+  struct Location
+  {
+    long segment, row, slot;
+  };
+
+  const PubKey& pubKey;
+  const EncryptedArray& ea;
+  long nColumns;
+  long rowsPerSegment;
+
+  mutable HELIB_MUTEX_TYPE mutex; // guards the members below
+  std::map<long, std::shared_ptr<const Segment>> segments; // by number
+  std::map<long, Location> locations; // of the live records
+  long nextSegment = 0;
+  long nextId = 0;
+
+  std::vector<std::shared_ptr<const Segment>> snapshot() const;
+
+  // Cut rows of data and ids into segments and add them, with the lock held
+  void addSegmentsLocked(const Matrix<Ctxt>& data,
+                         const std::vector<std::vector<long>>& ids);
+
+  // Zero the empty and deleted slots of the scores and concatenate them
+  SegmentedResult merge(
+      const std::vector<std::shared_ptr<const Segment>>& segs,
+      std::vector<std::vector<Ctxt>>& scores) const;
+
+  template <typename TXT2>
+  SegmentedResult query(const Query_t& q,
+                        const Matrix<TXT2>& query_data,
+                        bool fermat) const
+  {
+    std::vector<std::shared_ptr<const Segment>> segs = snapshot();
+    std::vector<std::vector<Ctxt>> scores(segs.size());
+    const long ppowr = pubKey.getContext().alMod.getPPowR();
+    HELIB_EXEC_RANGE(lsize(segs), first, last)
+    for (long s = first; s < last; s++) {
+      Matrix<Ctxt> mask = calculateMasks(ea, query_data, *segs[s]->data);
+      Matrix<Ctxt> score = calculateScores(q.Fs, q.mus, q.taus, mask);
+      for (std::size_t i = 0; i < score.dims(0); i++) {
+        scores[s].push_back(score(i, 0));
+        if (fermat)
+          scores[s].back().power(ppowr - 1);
+      }
+    }
+    HELIB_EXEC_RANGE_END
+    return merge(segs, scores);
+  }
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_SEGMENTEDDATABASE_H
@@ -0,0 +1,103 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_SLOTCOMPACTOR_H
+#define HELIB_SLOTCOMPACTOR_H
+/**
+ * @file SlotCompactor.h
+ * @brief Packing many sparsely filled ciphertexts into a few dense ones
+ **/
+
+#include <vector>
+
+#include <helib/CtPtrs.h>
+
+namespace helib {
+
+/**
+ * @class SlotCompactor
+ * @brief A plan for packing ciphertexts with few valid slots into as few
+ * ciphertexts as possible, and for unpacking them again
+ *
+ * Every input ciphertext is masked to its valid slots and moved by at most
+ * one rotation along one dimension of the hypercube, into one of the packed
+ * ciphertexts, where its slots do not collide with those of the others. The
+ * plan is made once for given masks (first-fit, the largest inputs first),
+ * choosing among the fitting moves those with the fewest key switches in
+ * pack and unpack together. Unpacking rotates back by the opposite amount,
+ * which may use another key-switching matrix than packing. So no move at
+ * all comes first, then rotations with matrices in both directions, then
+ * the others (twice as many key switches in bad dimensions).
+ **/
+class SlotCompactor
+{
+public:
+  /**
+   * @brief Plan the packing
+   * @param pubKey The public key, whose key-switching matrices determine the
+   * cost of rotations.
+   * @param masks masks[i][k] is nonzero if slot k of the i'th ciphertext is
+   * valid.
+   **/
+  SlotCompactor(const PubKey& pubKey,
+                const std::vector<std::vector<long>>& masks);
+
+  //! Number of ciphertexts that are packed
+  long numInputs() const { return lsize(moves); }
+
+  //! Number of ciphertexts that they are packed into
+  long numPacked() const { return nPacked; }
+
+  //! Number of key switches that pack() performs
+  long numPackKeySwitches() const { return packKeySwitches; }
+
+  //! Number of key switches that unpack() performs
+  long numUnpackKeySwitches() const { return unpackKeySwitches; }
+
+  //! Number of key switches of pack() and unpack() together
+  long numKeySwitches() const { return packKeySwitches + unpackKeySwitches; }
+
+  //! The packed ciphertext that input i goes to, -1 if it has no valid slots
+  long targetOf(long i) const { return moves.at(i).target; }
+
+  //! The slot of targetOf(i) that slot k of input i goes to
+  long destinationSlot(long i, long k) const;
+
+  //! Pack the inputs into numPacked() ciphertexts
+  void pack(std::vector<Ctxt>& packed, const CtPtrs& inputs) const;
+
+  //! Recover the inputs from the packed ciphertexts. The invalid slots of
+  //! the outputs hold values of other inputs, unless zeroOutside is set
+  //! (which costs a multiplication by a mask).
+  void unpack(const CtPtrs& outputs,
+              const std::vector<Ctxt>& packed,
+              bool zeroOutside = false) const;
+
+private:
+  struct Move
+  {
+    long target = -1; // index of the packed ciphertext, -1 if no valid slots
+    long dim = -1;    // dimension of the rotation, -1 for none
+    long amount = 0;
+    bool full = false; // all slots valid, no need to mask
+    zzX mask;
+  };
+
+  const EncryptedArray& ea;
+  std::vector<Move> moves;
+  long nPacked;
+  long packKeySwitches;
+  long unpackKeySwitches;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_SLOTCOMPACTOR_H
@@ -0,0 +1,183 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_TRANSCIPHER_H
+#define HELIB_TRANSCIPHER_H
+/**
+ * @file Transcipher.h
+ * @brief Turning symmetric ciphertexts into homomorphic ones
+ *
+ * A client encrypts its data with a cheap symmetric cipher and uploads the
+ * homomorphic encryption of the symmetric key only once. The server then
+ * evaluates the keystream homomorphically and removes it, which leaves
+ * homomorphic ciphertexts of the data. The cipher is a LowMC-style SPN
+ * (Albrecht et al., "Ciphers for MPC and FHE") in counter mode: every round
+ * has a single layer of AND gates, so the multiplicative depth equals the
+ * number of rounds, against 40 or more for AES.
+ **/
+
+#include <string>
+#include <vector>
+
+#include <NTL/mat_GF2.h>
+#include <NTL/vec_GF2.h>
+
+#include <helib/Ctxt.h>
+
+namespace helib {
+
+/**
+ * @class LowMC
+ * @brief A LowMC-style block cipher, used in counter mode as a stream cipher
+ *
+ * Each round applies 3-bit S-boxes to the first 3*nSboxes bits of the
+ * state, then a fixed invertible linear layer, a round constant and a round
+ * key, which is a fixed linear function of the key. The matrices and
+ * constants are derived from a seed string, so the client and the server
+ * get the same instance from the same parameters.
+ *
+ * The block input for a (nonce, counter) pair holds the counter in its low
+ * half and the nonce in its high half, each truncated to 64 bits and to
+ * half the block.
+ **/
+class LowMC
+{
+public:
+  struct Params
+  {
+    long blockSize = 256;
+    long keySize = 128;
+    long nSboxes = 63;
+    long rounds = 14;
+  };
+
+  /**
+   * @brief Constructor.
+   * @param params The sizes of the instance. The number of rounds should
+   * follow the LowMC round formula for the amount of data encrypted under
+   * one key.
+   * @param seed The seed of the matrices and constants.
+   **/
+  explicit LowMC(const Params& params = Params(),
+                 const std::string& seed = "HElib LowMC");
+
+  const Params& getParams() const { return params; }
+  long blockSize() const { return params.blockSize; }
+  long keySize() const { return params.keySize; }
+
+  //! The multiplicative depth of one evaluation
+  long depth() const { return params.rounds; }
+
+  //! The block input for the given nonce and counter
+  NTL::vec_GF2 counterBlock(unsigned long nonce, unsigned long counter) const;
+
+  //! Encrypt one block
+  void encryptBlock(NTL::vec_GF2& out,
+                    const NTL::vec_GF2& in,
+                    const NTL::vec_GF2& key) const;
+
+  /**
+   * @brief Encrypt or decrypt blocks in counter mode
+   * @param blocks The blocks, each of blockSize() bits. Block i is XORed
+   * with the encryption of counterBlock(nonce, firstCounter + i).
+   **/
+  void applyKeystream(std::vector<NTL::vec_GF2>& blocks,
+                      const NTL::vec_GF2& key,
+                      unsigned long nonce,
+                      unsigned long firstCounter = 0) const;
+
+private:
+  friend class Transcipher;
+
+  Params params;
+  std::vector<NTL::mat_GF2> linear;   // rounds invertible n x n matrices
+  std::vector<NTL::vec_GF2> constant; // rounds constants of n bits
+  std::vector<NTL::mat_GF2> keyMat;   // rounds+1 n x k matrices
+
+  void sboxLayer(NTL::vec_GF2& state) const;
+};
+
+/**
+ * @class Transcipher
+ * @brief Evaluates the keystream of a LowMC instance homomorphically
+ *
+ * The evaluation is bit-sliced, with one block per slot: ciphertext j holds
+ * bit j of ea.size() consecutive blocks. This is the layout that the
+ * functions of binaryArith.h work on, so any bits of the decrypted blocks
+ * can be passed to them as the bits of one integer per slot.
+ *
+ * Only BGV with p = 2 is supported. The key ciphertexts need at least
+ * cipher.depth() levels above what is left for the later computation.
+ *
+ * The round keys only depend on the key, so they are computed once by the
+ * constructor and kept at the level of the key: (rounds + 1) * blockSize
+ * ciphertexts in all. Each call of keystream only mods them down to the
+ * level of the state.
+ **/
+class Transcipher
+{
+public:
+  /**
+   * @brief Encrypt a symmetric key for upload, on the client
+   * @param encKey Receives keySize() ciphertexts, bit i of the key in all
+   * the slots of encKey[i].
+   **/
+  static void encryptKey(std::vector<Ctxt>& encKey,
+                         const LowMC& cipher,
+                         const PubKey& publicKey,
+                         const NTL::vec_GF2& key);
+
+  /**
+   * @brief Constructor, on the server.
+   * @param cipher The instance the client encrypts with. It must outlive
+   * the Transcipher.
+   * @param encKey The key uploaded by the client, made by encryptKey.
+   * The round keys are computed from it here.
+   **/
+  Transcipher(const LowMC& cipher, const std::vector<Ctxt>& encKey);
+
+  //! The number of blocks handled by one call
+  long blocksPerBatch() const;
+
+  /**
+   * @brief Evaluate the keystream of a batch of blocks
+   * @param out Receives blockSize() ciphertexts, slot s of out[j] holding
+   * bit j of the keystream of block firstCounter + s.
+   **/
+  void keystream(std::vector<Ctxt>& out,
+                 unsigned long nonce,
+                 unsigned long firstCounter = 0) const;
+
+  /**
+   * @brief Turn symmetric ciphertexts into homomorphic ones
+   * @param out Receives blockSize() ciphertexts, slot s of out[j] holding
+   * bit j of the data of blocks[s]. Slots past blocks.size() are
+   * unspecified.
+   * @param blocks At most blocksPerBatch() blocks, encrypted by
+   * LowMC::applyKeystream from the same nonce and first counter.
+   **/
+  void decrypt(std::vector<Ctxt>& out,
+               const std::vector<NTL::vec_GF2>& blocks,
+               unsigned long nonce,
+               unsigned long firstCounter = 0) const;
+
+private:
+  const LowMC& cipher;
+  // roundKeys[r] = cipher.keyMat[r] * encKey, for r in [0, rounds]
+  std::vector<std::vector<Ctxt>> roundKeys;
+
+  // Add to ctxt the constant holding bits[s] in slot s
+  void addBits(Ctxt& ctxt, const std::vector<long>& bits) const;
+};
+
+} // namespace helib
+
+#endif // ifndef HELIB_TRANSCIPHER_H
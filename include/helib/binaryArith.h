@@ -13,7 +13,8 @@
 #define HELIB_BINARYARITH_H
 /**
  * @file binaryArith.h
- * @brief Implementing integer addition, multiplication in binary representation
+ * @brief Implementing integer addition, multiplication and division in binary
+ * representation
  **/
 #include <helib/EncryptedArray.h>
 #include <helib/CtPtrs.h> //  defines CtPtrs, CtPtrMat
@@ -242,6 +243,117 @@ void multTwoNumbers(CtPtrs& product,
                     long sizeLimit = 0,
                     std::vector<zzX>* unpackSlotEncoding = nullptr);
 
+//! The circuit used by divideBinary
+enum class DivisionAlgorithm
+{
+  //! Subtract the divisor, then keep or restore the remainder depending on
+  //! the sign of the difference
+  RESTORING,
+  //! Add or subtract the divisor depending on the sign of the remainder, and
+  //! correct the remainder once at the end
+  NON_RESTORING
+};
+
+/**
+ * @brief Divide two unsigned integers in binary representation.
+ * @param quotient result of the division, resized to the size of
+ * `dividend`.
+ * @param remainder `dividend` modulo `divisor`, resized to the size of
+ * `divisor`.
+ * @param dividend the number to divide.
+ * @param divisor the number to divide by.
+ * @param algorithm the division circuit to use.
+ * @param unpackSlotEncoding vector of constants for unpacking, as used in
+ * bootstrapping.
+ *
+ * Each bit of the quotient costs one addition of `divisor.size()+1` bits and
+ * one multiplication, in sequence. Before every step the working values are
+ * bootstrapped if they do not have the levels for it left, provided that
+ * `unpackSlotEncoding` is given and the key is bootstrappable.
+ * @note In slots where the divisor is zero the quotient is all ones and the
+ * remainder is the dividend truncated to `divisor.size()` bits. This is
+ * forced at the end with a zero test of the divisor, which costs
+ * `log(divisor.size())` levels up front and one multiplication per output
+ * bit.
+ **/
+void divideBinary(
+    CtPtrs& quotient,
+    CtPtrs& remainder,
+    const CtPtrs& dividend,
+    const CtPtrs& divisor,
+    DivisionAlgorithm algorithm = DivisionAlgorithm::NON_RESTORING,
+    std::vector<zzX>* unpackSlotEncoding = nullptr);
+
+/**
+ * @brief Multiply two unsigned fixed-point numbers in binary representation.
+ * @param product result of the multiplication, with `fracBits` fractional
+ * bits.
+ * @param lhs left hand side of the multiplication.
+ * @param rhs right hand side of the multiplication.
+ * @param fracBits number of fractional bits of `lhs`, `rhs` and `product`.
+ * @param sizeLimit number of bits of `product`, by default
+ * `lhs.size()+rhs.size()-fracBits`.
+ * @param unpackSlotEncoding vector of constants for unpacking, as used in
+ * bootstrapping.
+ *
+ * The full product is rescaled by dropping its `fracBits` least significant
+ * bits, i.e. it is rounded down.
+ **/
+void multFixedPoint(CtPtrs& product,
+                    const CtPtrs& lhs,
+                    const CtPtrs& rhs,
+                    long fracBits,
+                    long sizeLimit = 0,
+                    std::vector<zzX>* unpackSlotEncoding = nullptr);
+
+/**
+ * @brief Divide an unsigned number in binary representation by `2^shift`.
+ * @param output `input / 2^shift`, rounded down or to the nearest integer.
+ * @param input the number to rescale.
+ * @param shift the power of two to divide by, negative to multiply.
+ * @param round when set to `true` round to the nearest integer, with halves
+ * rounded up, rather than down.
+ * @param unpackSlotEncoding vector of constants for unpacking, as used in
+ * bootstrapping.
+ *
+ * Rounding down and multiplying are free. The output has
+ * `input.size()-shift` bits, and one more when rounding so that it cannot
+ * overflow.
+ **/
+void rescaleFixedPoint(CtPtrs& output,
+                       const CtPtrs& input,
+                       long shift,
+                       bool round = false,
+                       std::vector<zzX>* unpackSlotEncoding = nullptr);
+
+/**
+ * @brief Compute the reciprocal of an unsigned fixed-point number in
+ * `[1/2, 1)` by Newton-Raphson iteration.
+ * @param reciprocal `1/divisor` with `fracBits` fractional bits, resized to
+ * `fracBits+2` bits.
+ * @param divisor the number to invert, with `fracBits` fractional bits. Its
+ * bit `fracBits-1` must be set and any higher bits must be zero.
+ * @param fracBits number of fractional bits of `divisor` and `reciprocal`.
+ * @param iterations number of Newton-Raphson iterations, by default as many
+ * as needed for full precision.
+ * @param unpackSlotEncoding vector of constants for unpacking, as used in
+ * bootstrapping.
+ *
+ * Starts from `3-2*divisor`, within a relative error of `1/8` of the
+ * reciprocal, and iterates `x = x*(2-divisor*x)`, which squares the
+ * relative error. Each iteration costs two
+ * fixed-point multiplications and one negation, and the working values are
+ * bootstrapped as needed. With the default number of iterations the result
+ * is within 2 units in the last place of the reciprocal. A divisor
+ * outside of `[1/2, 1)` must first be scaled by a power of two, e.g. with
+ * rescaleFixedPoint.
+ **/
+void reciprocalFixedPoint(CtPtrs& reciprocal,
+                          const CtPtrs& divisor,
+                          long fracBits,
+                          long iterations = 0,
+                          std::vector<zzX>* unpackSlotEncoding = nullptr);
+
 /**
  * @brief Decrypt the binary numbers that are encrypted in eNums.
  * @param pNums vector to decrypt the binary numbers into.
@@ -12,6 +12,7 @@
 #ifndef HELIB_BINIO_H
 #define HELIB_BINIO_H
 #include <iostream>
+#include <string>
 #include <vector>
 #include <type_traits>
 #include <NTL/xdouble.h>
@@ -28,6 +29,7 @@
 #define BINIO_EYE_CONTEXTBASE_END   "]BS|"
 #define BINIO_EYE_CONTEXT_BEGIN     "|CN["
 #define BINIO_EYE_CONTEXT_END       "]CN|"
+#define BINIO_EYE_CONTEXT_EXT       "|CE["
 #define BINIO_EYE_CTXT_BEGIN        "|CX["
 #define BINIO_EYE_CTXT_END          "]CX|"
 #define BINIO_EYE_PK_BEGIN          "|PK["
@@ -36,6 +38,9 @@
 #define BINIO_EYE_SK_END            "]SK|"
 #define BINIO_EYE_SKM_BEGIN         "|KM["
 #define BINIO_EYE_SKM_END           "]KM|"
+#define BINIO_EYE_SKM_DIGITS        "|KD["
+#define BINIO_EYE_CHECKPOINT_BEGIN  "|CP["
+#define BINIO_EYE_CHECKPOINT_END    "]CP|"
 // clang-format on
 
 namespace helib {
@@ -72,6 +77,9 @@ NTL::xdouble read_raw_xdouble(std::istream& str);
 void write_raw_ZZ(std::ostream& str, const NTL::ZZ& zz);
 void read_raw_ZZ(std::istream& str, NTL::ZZ& zz);
 
+void write_raw_string(std::ostream& str, const std::string& s);
+std::string read_raw_string(std::istream& str);
+
 template <typename T>
 void write_raw_vector(std::ostream& str, const std::vector<T>& v)
 {
@@ -0,0 +1,115 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_CHEBYSHEV_H
+#define HELIB_CHEBYSHEV_H
+/**
+ * @file chebyshev.h
+ * @brief Chebyshev approximation of real functions on CKKS ciphertexts
+ *
+ * polyEval handles integer polynomials modulo p^r for BGV. For CKKS, a
+ * function f is approximated on an interval [a,b] by a truncated Chebyshev
+ * series sum_j c_j T_j(t), where t = (2x-a-b)/(b-a) maps [a,b] to [-1,1].
+ * The series is evaluated with baby steps T_1..T_k and giant steps
+ * T_k, T_2k, T_4k, ..., splitting the series recursively by the giant steps
+ * (T_n * T_j = (T_{n+j} + T_{|n-j|})/2). As multiplying by a constant only
+ * changes the ratFactor, this consumes the depth ceil(log2(degree)) of T_n
+ * plus at most one, with O(sqrt(degree)) ciphertext multiplications.
+ **/
+
+#include <functional>
+#include <vector>
+
+#include <helib/Ctxt.h>
+
+namespace helib {
+
+/**
+ * @class ChebyshevApprox
+ * @brief A Chebyshev series that approximates a function on an interval
+ **/
+class ChebyshevApprox
+{
+public:
+  /**
+   * @brief Interpolate f at the degree+1 Chebyshev nodes of [a,b]
+   * @param f The function to approximate.
+   * @param a The lower end of the interval.
+   * @param b The upper end of the interval, b > a.
+   * @param degree The degree of the approximation, >= 1.
+   **/
+  ChebyshevApprox(const std::function<double(double)>& f,
+                  double a,
+                  double b,
+                  long degree);
+
+  //! Use the given Chebyshev coefficients on [a,b]
+  ChebyshevApprox(const std::vector<double>& coeffs, double a, double b);
+
+  double lower() const { return a; }
+  double upper() const { return b; }
+  long degree() const { return coeffs.size() - 1; }
+  const std::vector<double>& getCoeffs() const { return coeffs; }
+
+  //! Evaluate the approximation at a point of [a,b], in the clear
+  double operator()(double x) const;
+
+  //! The largest difference from f over `samples` equally spaced points
+  double maxError(const std::function<double(double)>& f,
+                  long samples = 1000) const;
+
+  //! The number of baby steps k (a power of two) used by evaluate()
+  long babySteps() const { return k; }
+  //! Set the number of baby steps, rounded up to a power of two (0 for the
+  //! default, about sqrt(degree))
+  void setBabySteps(long steps);
+
+  //! The multiplicative depth that evaluate() consumes (at most, vanishing
+  //! coefficients may save some)
+  long depth() const;
+  //! The number of ciphertext multiplications that evaluate() performs (at
+  //! most)
+  long numMults() const;
+
+  /**
+   * @brief Replace the CKKS ciphertext ctxt, which encrypts real values in
+   * [a,b], by an encryption of the approximation at these values
+   **/
+  void evaluate(Ctxt& ctxt) const;
+
+private:
+  std::vector<double> coeffs;
+  double a, b;
+  long k; // number of baby steps
+
+  // Add sum_j c[j]*T_j(t) to sum, and return the constant to be added too.
+  // Coefficients with |c[j]| <= tol are skipped.
+  double addSeries(Ctxt& sum,
+                   const std::vector<double>& c,
+                   const std::vector<Ctxt>& baby,
+                   const std::vector<Ctxt>& giant,
+                   double tol) const;
+  long seriesDepth(long deg, long& mults) const;
+};
+
+//! @name Approximations of common functions on an interval [a,b]
+///@{
+ChebyshevApprox chebyshevSigmoid(double a, double b, long degree);
+ChebyshevApprox chebyshevExp(double a, double b, long degree);
+//! 1/x, requires 0 < a
+ChebyshevApprox chebyshevInverse(double a, double b, long degree);
+//! sqrt(x), requires 0 <= a
+ChebyshevApprox chebyshevSqrt(double a, double b, long degree);
+///@}
+
+} // namespace helib
+
+#endif // ifndef HELIB_CHEBYSHEV_H
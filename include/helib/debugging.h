@@ -15,6 +15,7 @@
 //! @brief debugging utilities
 #include <iostream>
 #include <string>
+#include <vector>
 #include <NTL/ZZX.h>
 #include <helib/NumbTh.h>
 
@@ -32,6 +33,8 @@ class SecKey;
 class EncryptedArray;
 class PlaintextArray;
 class DoubleCRT;
+class Context;
+struct NoiseCorrection;
 
 extern SecKey* dbgKey;
 extern std::shared_ptr<const EncryptedArray> dbgEa;
@@ -83,6 +86,71 @@ void checkNoise(const Ctxt& ctxt,
                 const std::string& msg,
                 double thresh = 10.0);
 
+/**
+ * @class NoiseCalibrator
+ * @brief Fits the correction factors of the noise estimates to measurements
+ *
+ * The calibrator runs randomized workloads of BGV ciphertexts and records,
+ * for every type of operation, how the noise that is measured by decryption
+ * compares with the estimate. The samples are taken relative to the
+ * uncorrected estimates, so that calibrating a context that already has
+ * correction factors refines them:
+ *  - ENCRYPT: measured/estimated noise of a fresh public-key encryption;
+ *  - MULTIPLY: the ratio of a tensor product, divided by the ratios of its
+ *    two inputs;
+ *  - KEY_SWITCH: the increase of the measured noise over the increase of the
+ *    estimate, across a key-switching operation, both over the special
+ *    primes before the modulus switching that ends it.
+ *
+ * fit() turns the largest ratio of each type, times a safety margin, into a
+ * NoiseCorrection that the context then applies.
+ **/
+class NoiseCalibrator
+{
+public:
+  enum Op
+  {
+    ENCRYPT,
+    MULTIPLY,
+    KEY_SWITCH,
+    NUM_OPS
+  };
+
+  explicit NoiseCalibrator(const SecKey& sk);
+
+  //! Run the given number of rounds, each encrypting two random plaintexts,
+  //! multiplying and re-linearizing them, and applying one of the
+  //! automorphisms for which a key-switching matrix exists
+  void runWorkload(long rounds);
+
+  //! Record a sample for the given operation
+  void record(Op op, double ratio);
+
+  //! The samples of the given operation
+  const std::vector<double>& samples(Op op) const { return ratios.at(op); }
+
+  //! The largest sample of the given operation (0 if none)
+  double worstRatio(Op op) const;
+
+  //! The correction factors that bound all the samples with the given
+  //! margin. Operations without samples keep the context's current factor.
+  NoiseCorrection fit(double safety = 2.0) const;
+
+  //! Set the fitted factors in the given context, which must be the
+  //! context of the secret key
+  void apply(Context& context, double safety = 2.0) const;
+
+  //! Forget all the samples
+  void clear();
+
+private:
+  const SecKey& sk;
+  std::vector<std::vector<double>> ratios; // indexed by Op
+
+  void encryptRandom(Ctxt& ctxt);
+  void sampleKeySwitch(Ctxt& ctxt, long k);
+};
+
 bool decryptAndCompare(const Ctxt& ctxt,
                        const SecKey& sk,
                        const EncryptedArray& ea,
@@ -101,6 +101,10 @@ public:
   NTL::xdouble noiseBound; // high probability bound on noise magnitude
   // in each column
 
+  // The partition of the ctxt primes into digits that this matrix was built
+  // for, one column per digit. Empty if it is the default context.digits.
+  std::vector<IndexSet> digits;
+
   explicit KeySwitch(long sPow = 0,
                      long xPow = 0,
                      long fromID = 0,
@@ -117,6 +121,12 @@ public:
 
   unsigned long NumCols() const;
 
+  //! The digit partition to use with this matrix
+  const std::vector<IndexSet>& getDigits(const Context& context) const
+  {
+    return digits.empty() ? context.digits : digits;
+  }
+
   //! @brief returns a dummy static matrix with toKeyId == -1
   static const KeySwitch& dummy();
   bool isDummy() const;
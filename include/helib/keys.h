@@ -142,6 +142,12 @@ public:
   //! dim == -1 is Frobenius
   void setKSStrategy(long dim, int val);
 
+  //! @brief Re-allocate the key-switching matrices (both rows) in parallel,
+  //! spreading their pages over the NUMA nodes of the scheduler threads.
+  //! Call after the matrices are generated or read, with NUMA pinning on
+  //! (see TaskScheduler::setNumaPinning). Harmless on a single node.
+  void interleaveKeySWmatrices();
+
   /**
    * Encrypts plaintext, result returned in the ciphertext argument. When
    * called with highNoise=true, returns a ciphertext with noise level
@@ -200,8 +206,10 @@ public:
   void reCrypt(Ctxt& ctxt) const;     // bootstrap a ciphertext to reduce noise
   void thinReCrypt(Ctxt& ctxt) const; // bootstrap a "thin" ciphertext, where
   // slots are assumed to contain constants
+  void ckksReCrypt(Ctxt& ctxt) const; // bootstrap a CKKS ciphertext
 
   friend class SecKey;
+  friend class Checkpoint;
   friend std::ostream& operator<<(std::ostream& str, const PubKey& pk);
   friend std::istream& operator>>(std::istream& str, PubKey& pk);
   friend void ::helib::writePubKeyBinary(std::ostream& str, const PubKey& pk);
@@ -270,6 +278,27 @@ public:
                       long toKeyIdx = 0,
                       long ptxtSpace = 0);
 
+  //! Same as above, but with the given partition of the ctxt primes into
+  //! digits rather than context.digits (see buildDigitPartition). More
+  //! digits mean a larger matrix and slower key-switching, but less noise.
+  //! The special primes are shared by all matrices, so they must be large
+  //! enough for the largest digit of the partition. Nothing is done if a
+  //! matrix for these keys already exists.
+  void GenKeySWmatrix(long fromSPower,
+                      long fromXPower,
+                      const std::vector<IndexSet>& digits,
+                      long fromKeyIdx = 0,
+                      long toKeyIdx = 0,
+                      long ptxtSpace = 0);
+
+  //! Generate the key-switching matrix for re-keying ciphertexts from key
+  //! oldKeyID of oldKey, a SecKey with the same context, to key 0 of this
+  //! one (see ReKeyer). The old key gets a new key index, for the matrix and
+  //! its bound, but the old secret itself is not kept: this SecKey cannot
+  //! decrypt the old ciphertexts. Every call takes a new index, which is
+  //! returned.
+  long GenReKeyMatrix(const SecKey& oldKey, long oldKeyID = 0);
+
   // Decryption
   void Decrypt(NTL::ZZX& plaintxt, const Ctxt& ciphertxt) const;
 
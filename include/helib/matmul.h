@@ -395,6 +395,17 @@ void traceMap(Ctxt& ctxt);
 
 //====================================
 
+// Rotate ctxt along the native dimension dim by each of the amounts, v[i]
+// being ctxt rotated by amts[i] (cleaned up). The digits of ctxt are computed once and
+// shared by all the rotations (hoisting), unless the key-switching strategy
+// for dim is unknown.
+void hoistedRotate1D(std::vector<std::shared_ptr<Ctxt>>& v,
+                     const Ctxt& ctxt,
+                     long dim,
+                     const std::vector<long>& amts);
+
+//====================================
+
 // These routines apply linear transformation to plaintext arrays.
 // Mainly for testing purposes.
 void mul(PlaintextArray& pa, const MatMul1D& mat);
@@ -0,0 +1,192 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_MEMORYACCOUNTING_H
+#define HELIB_MEMORYACCOUNTING_H
+/**
+ * @file memoryAccounting.h
+ * @brief Accounting of the memory held by ciphertexts, keys and
+ * precomputations, and a process-wide memory budget
+ *
+ * Every row of a DoubleCRT is charged, when it is allocated, to the account
+ * of the innermost MemoryScope of the allocating thread, and released from
+ * it when the last copy sharing the row is destroyed. Rows allocated outside
+ * of any scope are charged to the ciphertexts. The library opens scopes
+ * around the generation and reading of key-switching matrices, the
+ * precomputation of matrix constants and of the bootstrapping maps, and the
+ * rotation plans of an EncryptedArray. Other memory can be charged
+ * explicitly with a MemoryCharge.
+ *
+ * With a budget set by setMemoryBudget, an allocation that brings the total
+ * over the budget first runs the registered MemoryShrinker objects, which
+ * drop caches, and with a hard budget throws a RuntimeError if that did not
+ * free enough.
+ *
+ * @code
+ *   setMemoryBudget(8L << 30);
+ *   {
+ *     MemoryScope scope(MemCategory::MATMUL, "model layer 1");
+ *     exec.upgrade();
+ *   }
+ *   printMemoryUsage(std::cerr);
+ * @endcode
+ **/
+
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace helib {
+
+//! What accounted memory is used for
+enum class MemCategory
+{
+  CTXT,       //!< ciphertexts and all DoubleCRTs outside of a scope
+  KEY_SWITCH, //!< key-switching matrices
+  MATMUL,     //!< DoubleCRT constants of matrix multiplications
+  EVAL_MAP,   //!< the linear maps of bootstrapping
+  RECRYPTION, //!< the other recryption data
+  CACHE       //!< caches that are rebuilt on demand, e.g. rotation plans
+};
+
+const char* memCategoryName(MemCategory category);
+
+//! The bytes charged to one owner in one category. The accounts live as
+//! long as the process, so owners should be a few descriptive names rather
+//! than one per object.
+class MemoryAccount;
+
+/**
+ * @class MemoryScope
+ * @brief Charges the memory that this thread allocates while the scope is
+ * alive to the given owner and category
+ *
+ * Scopes nest, and the innermost one is charged. A scope opened with
+ * override = false keeps an enclosing scope, so that e.g. the matrices of an
+ * EvalMap are charged to the EvalMap rather than to MATMUL. Loops run with
+ * HELIB_EXEC_RANGE charge the scope of the thread that started them.
+ **/
+class MemoryScope
+{
+public:
+  MemoryScope(MemCategory category,
+              const std::string& owner,
+              bool override = true);
+
+  //! Charge the given account, e.g. the current() one of another thread
+  explicit MemoryScope(MemoryAccount* account);
+
+  ~MemoryScope();
+
+  MemoryScope(const MemoryScope&) = delete;
+  MemoryScope& operator=(const MemoryScope&) = delete;
+
+  //! The account that this thread charges now
+  static MemoryAccount* current();
+
+private:
+  MemoryAccount* saved;
+};
+
+/**
+ * @class MemoryCharge
+ * @brief A number of bytes charged to the current account for as long as
+ * this object lives
+ *
+ * A copy charges the same account again. Constructing a charge may run the
+ * shrinkers, or throw under a hard budget.
+ **/
+class MemoryCharge
+{
+public:
+  MemoryCharge() = default;
+  explicit MemoryCharge(long bytes);
+  MemoryCharge(const MemoryCharge& other);
+  MemoryCharge(MemoryCharge&& other) noexcept;
+  MemoryCharge& operator=(MemoryCharge other) noexcept;
+  ~MemoryCharge();
+
+  long bytes() const { return nBytes; }
+
+private:
+  MemoryAccount* account = nullptr;
+  long nBytes = 0;
+};
+
+/**
+ * @class MemoryShrinker
+ * @brief Registers a function that frees memory when the budget is exceeded
+ *
+ * The function runs in the thread whose allocation exceeded the budget, so
+ * it must not take a lock that is held while allocating. Shrinkers of
+ * CACHE run first, then the others, each in the order they were registered.
+ * A shrinker that is already running in another thread is skipped, and the
+ * destructor waits for a running one to finish.
+ **/
+class MemoryShrinker
+{
+public:
+  MemoryShrinker(MemCategory category,
+                 const std::string& owner,
+                 const std::function<void()>& shrink);
+  ~MemoryShrinker();
+
+  MemoryShrinker(const MemoryShrinker&) = delete;
+  MemoryShrinker& operator=(const MemoryShrinker&) = delete;
+
+  struct Entry;
+
+private:
+  std::shared_ptr<Entry> entry;
+};
+
+//! The memory charged to one account
+struct MemoryUsage
+{
+  MemCategory category;
+  std::string owner;
+  long bytes; // now
+  long peak;  // the most at any time
+};
+
+/**
+ * @brief Set the process-wide memory budget, in bytes.
+ * @param bytes The budget, or 0 for none.
+ * @param hard Whether an allocation that the shrinkers cannot make fit
+ * throws a RuntimeError, rather than going over the budget.
+ **/
+void setMemoryBudget(long bytes, bool hard = false);
+
+//! The memory budget, 0 if there is none
+long memoryBudget();
+
+//! The bytes charged now, in total or in one category
+long memoryInUse();
+long memoryInUse(MemCategory category);
+
+//! The most bytes that were charged at any time
+long peakMemoryInUse();
+
+//! Run the shrinkers until at most target bytes are charged, or all of them
+//! ran. Returns the number of bytes freed.
+long reclaimMemory(long target = 0);
+
+//! The accounts that were ever charged, by category and owner
+std::vector<MemoryUsage> memoryUsage();
+
+//! Print the memory charged to each account, and the totals
+void printMemoryUsage(std::ostream& s);
+
+} // namespace helib
+
+#endif // ifndef HELIB_MEMORYACCOUNTING_H
@@ -17,7 +17,9 @@
 #include <stack>
 
 #include <helib/Matrix.h>
+#include <helib/NumbTh.h>
 #include <helib/PolyMod.h>
+#include <helib/polyEval.h>
 
 // This code is in flux and should be considered bery alpha.
 // Not recommended for public use.
@@ -160,6 +162,91 @@ inline Matrix<TXT> calculateScores(
   return result;
 }
 
+/**
+ * @brief Given a mask, counts the number of matching columns of each record.
+ * @tparam TXT type of the mask matrix. Must be a `Ptxt` or `Ctxt`.
+ * @param index_set The indices of the columns of the mask to count.
+ * @param mask The mask from which to count the matches.
+ * @return A column vector holding in each slot the number of the columns in
+ * `index_set` that match.
+ **/
+template <typename TXT>
+inline Matrix<TXT> calculateMatchCounts(const std::vector<long>& index_set,
+                                        const Matrix<TXT>& mask)
+{
+  assertTrue<InvalidArgument>(!index_set.empty(),
+                              "index_set must not be empty");
+  Matrix<long> ones(index_set.size(), 1l);
+  for (std::size_t i = 0; i < index_set.size(); ++i)
+    ones(i, 0) = 1;
+  // The columns are separate ciphertexts, so the sum needs no rotations
+  return mask.columns(index_set) * ones;
+}
+
+/**
+ * @brief Computes the polynomial that maps each integer in [lo, hi] to 1 if
+ * it is at least `threshold` and to 0 otherwise, modulo p^r.
+ * @param lo The smallest input.
+ * @param hi The largest input.
+ * @param threshold The smallest input that maps to 1.
+ * @param p The plaintext prime.
+ * @param r The plaintext exponent.
+ * @return The polynomial, of degree at most hi - lo.
+ * @note The inputs must be distinct modulo p, i.e. hi - lo < p.
+ **/
+inline NTL::ZZX thresholdPolynomial(long lo,
+                                    long hi,
+                                    long threshold,
+                                    long p,
+                                    long r)
+{
+  assertInRange<InvalidArgument>(hi - lo,
+                                 0l,
+                                 p,
+                                 "The range of inputs must be non-empty and "
+                                 "have fewer than p elements");
+  // The ciphertext holds v mod p^r, so that is where the polynomial is fitted
+  const long p2r = NTL::power_long(p, r);
+  NTL::vec_long x, y;
+  x.SetLength(hi - lo + 1);
+  y.SetLength(hi - lo + 1);
+  for (long v = lo; v <= hi; ++v) {
+    x[v - lo] = ((v % p2r) + p2r) % p2r;
+    y[v - lo] = v >= threshold;
+  }
+  NTL::ZZX poly;
+  interpolateMod(poly, x, y, p, r);
+  return poly;
+}
+
+/**
+ * @brief Evaluates a polynomial on every slot of a `Ctxt`, using the
+ * Paterson-Stockmeyer method to keep the depth logarithmic in the degree.
+ * @param ctxt The `Ctxt` to replace by poly(ctxt).
+ * @param poly The polynomial to evaluate.
+ **/
+inline void applyPolynomial(Ctxt& ctxt, const NTL::ZZX& poly)
+{
+  const Ctxt x(ctxt);
+  polyEval(ctxt, poly, x);
+}
+
+/**
+ * @brief Evaluates a polynomial on every slot of a `Ptxt`.
+ * @param ptxt The `Ptxt` to replace by poly(ptxt).
+ * @param poly The polynomial to evaluate.
+ **/
+template <typename TXT>
+inline void applyPolynomial(TXT& ptxt, const NTL::ZZX& poly)
+{
+  const TXT x(ptxt);
+  ptxt.clear();
+  for (long i = NTL::deg(poly); i >= 0; --i) {
+    ptxt.multiplyBy(x);
+    ptxt.addConstant(NTL::ZZX(NTL::conv<long>(NTL::coeff(poly, i))));
+  }
+}
+
 /**
  * @brief Given a value, encode the value across the coefficients of a
  * polynomial.
@@ -586,6 +673,58 @@ public:
   Matrix<TXT2> getScore(const Query_t& weighted_query,
                         const Matrix<TXT2>& query_data) const;
 
+  /**
+   * @brief Function for computing the Hamming distance between the query
+   * data and every record, over a subset of the columns.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param index_set The columns to compare.
+   * @param query_data The query data to compare with the database.
+   * @return A `Matrix<TXT2>` containing the number of the columns in
+   * `index_set` on which each record differs from the query.
+   **/
+  template <typename TXT2>
+  Matrix<TXT2> getHammingDistance(const std::vector<long>& index_set,
+                                  const Matrix<TXT2>& query_data) const;
+
+  /**
+   * @brief Function for performing a fuzzy lookup, matching the records that
+   * are equal to the query data on at least `threshold` of the columns in
+   * `index_set`.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param index_set The columns to compare.
+   * @param threshold The number of columns that must match.
+   * @param query_data The query data to compare with the database.
+   * @return A `Matrix<TXT2>` containing 1s and 0s in slots where there was a
+   * match or no match respectively.
+   * @note The number of columns in `index_set` must be less than p. The
+   * threshold test is a polynomial of that degree.
+   **/
+  template <typename TXT2>
+  Matrix<TXT2> fuzzyContains(const std::vector<long>& index_set,
+                             long threshold,
+                             const Matrix<TXT2>& query_data) const;
+
+  /**
+   * @brief Function for performing a fuzzy lookup with a threshold that is
+   * part of the query data, e.g. encrypted.
+   * @tparam TXT2 The type of the query data, can be either a `Ctxt` or
+   * `Ptxt<BGV>`.
+   * @param index_set The columns to compare.
+   * @param threshold Holds in each slot the number of columns that must match
+   * for the record in that slot, between 0 and the size of `index_set`.
+   * @param query_data The query data to compare with the database.
+   * @return A `Matrix<TXT2>` containing 1s and 0s in slots where there was a
+   * match or no match respectively.
+   * @note Twice the number of columns in `index_set` must be less than p. The
+   * threshold test is a polynomial of that degree.
+   **/
+  template <typename TXT2>
+  Matrix<TXT2> fuzzyContains(const std::vector<long>& index_set,
+                             const TXT2& threshold,
+                             const Matrix<TXT2>& query_data) const;
+
   // TODO - correct name?
   /**
    * @brief Returns number of columns in the database.
@@ -633,6 +772,62 @@ inline Matrix<TXT2> Database<TXT>::getScore(
   return result;
 }
 
+template <typename TXT>
+template <typename TXT2>
+inline Matrix<TXT2> Database<TXT>::getHammingDistance(
+    const std::vector<long>& index_set,
+    const Matrix<TXT2>& query_data) const
+{
+  auto mask = calculateMasks(*(context->ea), query_data, this->data);
+  Matrix<TXT2> result = calculateMatchCounts(index_set, mask);
+  const long n = index_set.size();
+  result.apply([&](auto& txt) {
+    txt.negate();
+    txt.addConstant(NTL::ZZX(n));
+  });
+  return result;
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline Matrix<TXT2> Database<TXT>::fuzzyContains(
+    const std::vector<long>& index_set,
+    long threshold,
+    const Matrix<TXT2>& query_data) const
+{
+  // The counts are in [0, n], so the test has degree n
+  const NTL::ZZX step = thresholdPolynomial(0,
+                                            index_set.size(),
+                                            threshold,
+                                            context->zMStar.getP(),
+                                            context->alMod.getR());
+  auto mask = calculateMasks(*(context->ea), query_data, this->data);
+  Matrix<TXT2> result = calculateMatchCounts(index_set, mask);
+  result.apply([&](auto& txt) { applyPolynomial(txt, step); });
+  return result;
+}
+
+template <typename TXT>
+template <typename TXT2>
+inline Matrix<TXT2> Database<TXT>::fuzzyContains(
+    const std::vector<long>& index_set,
+    const TXT2& threshold,
+    const Matrix<TXT2>& query_data) const
+{
+  // The differences count - threshold are in [-n, n], so the test has
+  // degree 2n
+  const long n = index_set.size();
+  const NTL::ZZX step = thresholdPolynomial(
+      -n, n, 0, context->zMStar.getP(), context->alMod.getR());
+  auto mask = calculateMasks(*(context->ea), query_data, this->data);
+  Matrix<TXT2> result = calculateMatchCounts(index_set, mask);
+  result.apply([&](auto& txt) {
+    txt -= threshold;
+    applyPolynomial(txt, step);
+  });
+  return result;
+}
+
 } // namespace helib
 
 #endif
@@ -455,6 +455,60 @@ public:
 };
 typedef FullBinaryTree<SubDimension> OneGeneratorTree; // tree for one generator
 
+class PubKey;
+class EncryptedArray;
+
+/**
+ * @class PermCostModel
+ * @brief The relative costs used when optimizing permutation networks
+ *
+ * A layer of a permutation network that uses s distinct non-zero shifts
+ * along some generator costs s key-switching automorphisms along that
+ * generator and s+1 multiplications by a mask. The cost of a network is
+ * the sum of the cost of its layers, plus depthCost for every level of
+ * depth, which lets the optimizer trade depth for width.
+ *
+ * The default model counts just the number of shifts, which is what
+ * the optimizer has always minimized. A model can instead be calibrated
+ * from the actual timing of automorphisms and multiplications by masks,
+ * so that expensive generators (e.g., ones whose key-switching matrix is
+ * not available and must be reached in several steps) are used sparingly.
+ **/
+class PermCostModel
+{
+  NTL::Vec<long> shiftCosts; // shiftCosts[genIdx], or 0 if not set
+
+public:
+  long defaultShiftCost; // cost of a shift along a generator not in shiftCosts
+  long maskCost;         // cost of multiplying by a mask
+  long depthCost;        // cost of every level of depth in the network
+
+  explicit PermCostModel(long shift = 1, long mask = 0, long depth = 0) :
+      defaultShiftCost(shift), maskCost(mask), depthCost(depth)
+  {}
+
+  //! The cost of a single shift along the generator with index genIdx
+  long shiftCost(long genIdx) const
+  {
+    if (genIdx >= 0 && genIdx < shiftCosts.length() && shiftCosts[genIdx] > 0)
+      return shiftCosts[genIdx];
+    return defaultShiftCost;
+  }
+
+  void setShiftCost(long genIdx, long cost);
+
+  //! Set the costs from the actual timing of automorphisms along each of
+  //! the generators of ea (with the key-switching matrices of pubKey) and of
+  //! multiplications by masks. Costs are scaled so the cheapest shift costs
+  //! 100. The depthCost is left as is, it is a target rather than a measure.
+  void calibrate(const EncryptedArray& ea, const PubKey& pubKey, long trials = 3);
+
+  //! A compact description of the model, used to key the cache of plans
+  void serialize(std::vector<long>& out) const;
+
+  friend std::ostream& operator<<(std::ostream& s, const PermCostModel& model);
+};
+
 //! A std::vector of generator trees, one per generator in Zm*/(p)
 class GeneratorTrees
 {
@@ -506,7 +560,19 @@ public:
   //! a permutation into dimensions, subject to some constraints. Returns
   //! the cost (# of 1D shifts) of this solution.
   //! Returns NTL_MAX_LONG if no solution
-  long buildOptimalTrees(const NTL::Vec<GenDescriptor>& vec, long depthBound);
+  long buildOptimalTrees(const NTL::Vec<GenDescriptor>& vec, long depthBound)
+  {
+    return buildOptimalTrees(vec, depthBound, PermCostModel());
+  }
+
+  //! Same as above, but minimizing the cost under the given model, over
+  //! all the networks of depth at most depthBound. Returns the cost of the
+  //! network itself, not including the model's depthCost term.
+  //! Plans are cached, so repeated calls with the same generators, bound
+  //! and model do not redo the optimization.
+  long buildOptimalTrees(const NTL::Vec<GenDescriptor>& vec,
+                         long depthBound,
+                         const PermCostModel& model);
 
   /**
    * @brief Computes permutations mapping between linear array and the cube.
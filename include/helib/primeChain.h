@@ -16,6 +16,7 @@
  * @brief handling the chain of moduli
  */
 #include <vector>
+#include <memory>
 #include <helib/IndexSet.h>
 
 namespace helib {
@@ -30,15 +31,31 @@ public:
   typedef std::pair<double, IndexSet> Entry;
   // each table entry is a pair<double,IndexSet>=(size, set-of-primes)
 
-  //! initialize helper table for a given chain
+  //! initialize helper table for a given chain. The cost model is set
+  //! to the static heuristic (iFFT_cost 0 for power-of-two m, 20
+  //! otherwise), so the choices of getSet4Size only depend on the chain.
   void init(const Context& context);
 
+  //! Re-estimate iFFT_cost by timing a few FFTs and iFFTs modulo one
+  //! of the ctxtPrimes. Falls back on the static heuristic if the timer
+  //! resolution is too low. This is never done implicitly: afterwards,
+  //! the prime sets chosen by modulus switching depend on the machine
+  //! and its load, so they may differ from run to run.
+  void calibrate(const Context& context, long trials = 3);
+
+  //! Override the estimated cost of an iFFT, measured as the percentage
+  //! by which it exceeds the cost of an FFT. Clears the memoized choices.
+  void setIFFTCost(long cost);
+  long getIFFTCost() const { return iFFT_cost; }
+
   //! Find a suitable IndexSet of primes whose total size is in the
   //! target interval [low,high], trying to minimize the number of
   //! primes dropped from fromSet.
   //! If no IndexSet exists that fits in the target interval, returns
   //! the IndexSet that gives the largest value smaller than low
   //! (or the smallest value greater than low if reverse flag is set).
+  //! The choice only depends on fromSet and on the window of table
+  //! entries covered by [low,high], so it is memoized per such pair.
   IndexSet getSet4Size(double low,
                        double high,
                        const IndexSet& fromSet,
@@ -66,6 +83,22 @@ public:
 private:
   std::vector<Entry> sizes;
   long iFFT_cost = -1;
+
+  // Memoized results of getSet4Size, keyed by the from-set(s) and the
+  // window of entries in sizes. Shared between copies of this object,
+  // a fresh one is allocated whenever sizes or iFFT_cost change.
+  struct SelectionCache;
+  std::shared_ptr<SelectionCache> cache;
+
+  // Locate the window [lo, hi) of entries whose size is in [low, high]
+  void findWindow(long& lo, long& hi, double low, double high) const;
+
+  // Return the index of the cheapest entry for the given window, or -1
+  long selectEntry(long lo,
+                   long hi,
+                   const IndexSet& from1,
+                   const IndexSet* from2,
+                   bool reverse) const;
 };
 
 std::ostream& operator<<(std::ostream& s, const ModuliSizes::Entry& e);
@@ -30,6 +30,8 @@ class ThinEvalMap;
 class PowerfulDCRT;
 class Context;
 class PubKey;
+class ChebyshevApprox;
+class CKKSEvalMap;
 
 //! @class RecryptData
 //! @brief A structure to hold recryption-related data inside the Context
@@ -134,6 +136,66 @@ public:
             bool minimal = false);
 };
 
+//! @class CKKSRecryptData
+//! @brief Bootstrapping data for CKKS, where the slots hold complex numbers
+//!
+//! A CKKS ciphertext that decrypts to P modulo q0 also decrypts to P + q0*I
+//! modulo the full chain, with I a polynomial with small coefficients when
+//! the secret key is sparse (ModRaise). coeffToSlot moves the coefficients
+//! of P/q0 + I into the slots (the first half as real parts, the second half
+//! as imaginary parts, in two ciphertexts), evalMod removes I by computing
+//! sin(2*pi*x)/(2*pi) ~ x-round(x), and slotToCoeff moves the result back.
+//! Both linear maps are the log2(n) sparse layers of a CKKSEvalMap.
+//! The sine is cos(2*pi*(x-1/4)/2^doublings), approximated by a Chebyshev
+//! series, followed by the given number of double-angle steps.
+class CKKSRecryptData
+{
+public:
+  //! Hamming weight of the sparse bootstrapping key
+  long skHwt;
+
+  //! High-probability bound on the coefficients of I
+  double modBound;
+
+  //! The plaintext is scaled to about 2^{-margin} of q0 before ModRaise,
+  //! trading the accuracy of the sine approximation for that of the linear
+  //! maps
+  long margin;
+
+  //! The default margin balances the relative error (2*pi*x)^2/6 of the sine
+  //! at x = 2^{-margin} against the precision 2^{-r} of the linear maps and
+  //! of evalMod, which the scaling multiplies by 2^{margin}
+  static long defMargin(long r);
+
+  //! Number of double-angle steps after the Chebyshev approximation
+  long doublings;
+
+  std::shared_ptr<const ChebyshevApprox> evalMod;
+
+  //! coeffToSlot and slotToCoeff
+  std::shared_ptr<const CKKSEvalMap> coeffMap;
+
+  CKKSRecryptData() : skHwt(0), modBound(0), margin(0), doublings(0) {}
+
+  //! Initialize the recryption data in a CKKS context
+  void init(const Context& context,
+            long t = 0 /*Hwt for sk*/,
+            long margin_ = 0 /*0 for defMargin*/);
+
+  bool isInitialized() const { return evalMod != nullptr; }
+
+  //! Only the parameters are compared (and serialized with the context),
+  //! the rest is derived from them
+  bool operator==(const CKKSRecryptData& other) const
+  {
+    return skHwt == other.skHwt && margin == other.margin;
+  }
+  bool operator!=(const CKKSRecryptData& other) const
+  {
+    return !(operator==(other));
+  }
+};
+
 #define HELIB_MIN_CAP_FRAC (2.0 / 3.0)
 // Used in calculation of "min capacity".
 // This could be set to 1.0, but just to be on the safe side,
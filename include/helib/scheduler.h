@@ -0,0 +1,179 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#ifndef HELIB_SCHEDULER_H
+#define HELIB_SCHEDULER_H
+/**
+ * @file scheduler.h
+ * @brief A work-stealing scheduler for nested parallel loops
+ *
+ * NTL's thread pool is flat: a parallel loop that is started while another
+ * one is running is executed serially. Hence an outer loop over ciphertexts
+ * forces the inner loops over primes to run on a single thread each. The
+ * TaskScheduler below lets parallel loops nest, with all the threads taking
+ * work from any level of the nesting as they become idle.
+ *
+ * The HELIB_EXEC_RANGE / HELIB_EXEC_RANGE_END macros have the same syntax
+ * as NTL_EXEC_RANGE / NTL_EXEC_RANGE_END, so a call site is migrated by
+ * renaming the macros. Without HELIB_THREADS, the loops run serially.
+ **/
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <helib/assertions.h>
+#include <helib/exceptions.h>
+
+namespace helib {
+
+/**
+ * @class TaskScheduler
+ * @brief A fork/join scheduler with per-thread work-stealing deques
+ *
+ * Each worker thread has a deque of tasks. A parallel loop splits its range
+ * into chunks, pushes them onto the deque of the calling thread, and then
+ * runs chunks of that same loop until all of them are done. Idle workers
+ * steal chunks from the other end of the deques, so chunks of an inner loop
+ * started by one worker are picked up by the others.
+ *
+ * A thread that waits for its loop to finish only runs chunks of that loop,
+ * never unrelated tasks. This keeps the semantics of NTL_EXEC_RANGE, where
+ * the calling thread runs part of the loop, and makes it safe to call a
+ * parallel loop while holding a lock or a thread-local buffer. Once no chunk
+ * is left to take, it sleeps until the last one completes, and idle workers
+ * sleep until tasks are pushed.
+ *
+ * The workers and NTL's pool are the same size and do not run at the same
+ * time: while the calling thread takes part in a loop, NTL's pool is
+ * detached from it, so NTL_EXEC_RANGE in a loop body runs serially.
+ **/
+class TaskScheduler
+{
+public:
+  //! The scheduler used by the library
+  static TaskScheduler& instance();
+
+  //! Number of threads that execute parallel loops, including the caller.
+  //! It starts as the size of NTL's pool, NTL::AvailableThreads(), of the
+  //! thread that first uses the scheduler. NTL's pool size is thread-local,
+  //! so NTL::SetNumThreads alone does not change it: use setNumThreads.
+  long numThreads() const { return nThreads; }
+
+  //! Set the number of threads (>= 1), and the size of NTL's pool of the
+  //! calling thread with it. Waits for the loops that other threads are
+  //! running, and throws LogicError if called from a parallel loop.
+  void setNumThreads(long n);
+
+  //! Index of the calling thread, in [0, numThreads()). Threads that are not
+  //! workers of the scheduler (e.g., the main thread) get the index 0.
+  static long currentWorker();
+
+  //! Number of NUMA nodes of the machine (1 if unknown)
+  long numaNodes() const;
+
+  //! Pin the worker threads to NUMA nodes, worker i to node i % numaNodes().
+  //! Memory that a worker allocates and touches first is then local to its
+  //! node. Must not be called while a parallel loop is running.
+  void setNumaPinning(bool pin);
+  bool numaPinning() const { return pinned; }
+
+  //! The NUMA node of the calling thread, or -1 if it is not pinned
+  static long currentNode();
+
+  /**
+   * @brief Run body(first, last) over a partition of [0, n)
+   * @param n The size of the range.
+   * @param body The function to apply to each sub-range.
+   * @param grain The minimal size of a sub-range.
+   *
+   * May be called from within another parallel loop. Exceptions thrown by
+   * body are re-thrown in the calling thread (the first one, if several).
+   **/
+  void parallelFor(long n,
+                   const std::function<void(long, long)>& body,
+                   long grain = 1);
+
+  //! Run f1 and f2 in parallel and wait for both of them
+  void invoke(const std::function<void()>& f1,
+              const std::function<void()>& f2);
+
+  ~TaskScheduler();
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+  long nThreads;
+  bool pinned;
+
+  TaskScheduler();
+};
+
+/**
+ * @class PerThread
+ * @brief Scratch space with a separate copy for every scheduler thread
+ *
+ * The copy for the calling thread is local(). It is created (as a copy of
+ * the initial value) by the first call to local() on that thread, so with a
+ * first-touch policy it sits on the NUMA node of the thread that uses it.
+ *
+ * The number of copies is fixed when the object is constructed, so the
+ * object must not outlive a change of the number of threads
+ * (TaskScheduler::setNumThreads). As all
+ * the non-worker threads share the index 0, only one such thread may use a
+ * given object at a time.
+ **/
+template <typename T>
+class PerThread
+{
+  T init;
+  std::vector<std::unique_ptr<T>> slots;
+
+public:
+  explicit PerThread(const T& _init = T()) :
+      init(_init), slots(TaskScheduler::instance().numThreads())
+  {}
+
+  T& local()
+  {
+    long i = TaskScheduler::currentWorker();
+    assertInRange<LogicError>(i,
+                              0l,
+                              (long)slots.size(),
+                              "PerThread object is older than the scheduler");
+    if (!slots[i])
+      slots[i].reset(new T(init));
+    return *slots[i];
+  }
+
+  //! Apply f to all the copies that were used, e.g. to combine them after
+  //! a parallel loop. Must not be called while the copies are in use.
+  template <typename F>
+  void forEach(F f)
+  {
+    for (auto& slot : slots)
+      if (slot)
+        f(*slot);
+  }
+};
+
+} // namespace helib
+
+// Drop-in replacements for NTL_EXEC_RANGE / NTL_EXEC_RANGE_END
+#define HELIB_EXEC_RANGE(n, first, last)                                       \
+  helib::TaskScheduler::instance().parallelFor((n), [&](long first, long last) {
+
+#define HELIB_EXEC_RANGE_END                                                   \
+  });
+
+#endif // ifndef HELIB_SCHEDULER_H
@@ -0,0 +1,171 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include <helib/Checkpoint.h>
+#include <helib/binio.h>
+#include <helib/keys.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+namespace {
+
+// 64-bit FNV-1a of the bytes of s
+uint64_t fingerprint(const std::string& s)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : s) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+} // namespace
+
+Checkpoint::Checkpoint(const PubKey& pubKey,
+                       const std::string& path,
+                       double intervalSeconds) :
+    pubKey(pubKey),
+    path(path),
+    interval(intervalSeconds),
+    lastSave(std::chrono::steady_clock::now())
+{
+  std::ostringstream context, key;
+  writeContextBinary(context, pubKey.getContext());
+  contextPrint = fingerprint(context.str());
+  // The encryption key identifies the secret key, the key-switching
+  // matrices may be added to later
+  pubKey.pubEncrKey.write(key);
+  keyPrint = fingerprint(key.str());
+}
+
+void Checkpoint::track(const std::string& name, Ctxt& ctxt)
+{
+  assertEq(&ctxt.getPubKey(), &pubKey, "Ciphertext of another key");
+  untrack(name);
+  entries.push_back({name, &ctxt, nullptr});
+}
+
+void Checkpoint::track(const std::string& name, std::vector<Ctxt>& ctxts)
+{
+  untrack(name);
+  entries.push_back({name, nullptr, &ctxts});
+}
+
+void Checkpoint::untrack(const std::string& name)
+{
+  entries.erase(std::remove_if(entries.begin(),
+                               entries.end(),
+                               [&](const Entry& e) { return e.name == name; }),
+                entries.end());
+}
+
+bool Checkpoint::exists() const { return std::ifstream(path).good(); }
+
+void Checkpoint::save(const std::string& token)
+{
+  HELIB_TIMER_START;
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw IOError("Could not open " + tmpPath);
+
+  writeEyeCatcher(out, BINIO_EYE_CHECKPOINT_BEGIN);
+  write_raw_int(out, contextPrint);
+  write_raw_int(out, keyPrint);
+  write_raw_string(out, token);
+  write_raw_int(out, entries.size());
+  for (const Entry& entry : entries) {
+    write_raw_string(out, entry.name);
+    if (entry.ctxt != nullptr) {
+      write_raw_int(out, 1);
+      entry.ctxt->write(out);
+    } else {
+      write_raw_int(out, entry.ctxts->size());
+      for (const Ctxt& ctxt : *entry.ctxts)
+        ctxt.write(out);
+    }
+  }
+  writeEyeCatcher(out, BINIO_EYE_CHECKPOINT_END);
+
+  out.close();
+  if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    throw IOError("Could not write " + path);
+  lastSave = std::chrono::steady_clock::now();
+}
+
+bool Checkpoint::saveIfDue(const std::string& token)
+{
+  if (std::chrono::steady_clock::now() - lastSave < interval)
+    return false;
+  save(token);
+  return true;
+}
+
+bool Checkpoint::restore(std::string& token)
+{
+  HELIB_TIMER_START;
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+
+  if (readEyeCatcher(in, BINIO_EYE_CHECKPOINT_BEGIN) != 0)
+    throw IOError(path + " is not a checkpoint");
+  assertTrue<InvalidArgument>(uint64_t(read_raw_int(in)) == contextPrint,
+                              "Checkpoint was made with another context");
+  assertTrue<InvalidArgument>(uint64_t(read_raw_int(in)) == keyPrint,
+                              "Checkpoint was made with another key");
+  std::string savedToken = read_raw_string(in);
+
+  // Read everything before changing any tracked ciphertext
+  std::map<std::string, std::vector<Ctxt>> saved;
+  long nEntries = read_raw_int(in);
+  for (long i = 0; i < nEntries; i++) {
+    std::string name = read_raw_string(in);
+    long count = read_raw_int(in);
+    if (!in || count < 0)
+      throw IOError("Could not read " + path);
+    std::vector<Ctxt>& ctxts = saved[name];
+    ctxts.assign(count, Ctxt(pubKey));
+    for (Ctxt& ctxt : ctxts)
+      ctxt.read(in);
+  }
+  if (!in || readEyeCatcher(in, BINIO_EYE_CHECKPOINT_END) != 0)
+    throw IOError("Could not read " + path);
+
+  for (const Entry& entry : entries) {
+    auto it = saved.find(entry.name);
+    assertTrue<InvalidArgument>(it != saved.end(),
+                                "Checkpoint does not hold " + entry.name);
+    assertTrue<InvalidArgument>(entry.ctxt == nullptr ||
+                                    it->second.size() == 1,
+                                "Checkpoint holds a vector for " + entry.name);
+  }
+  for (const Entry& entry : entries) {
+    std::vector<Ctxt>& ctxts = saved.at(entry.name);
+    if (entry.ctxt != nullptr)
+      *entry.ctxt = ctxts[0];
+    else
+      entry.ctxts->swap(ctxts);
+  }
+  token = savedToken;
+  lastSave = std::chrono::steady_clock::now();
+  return true;
+}
+
+} // namespace helib
@@ -219,6 +219,11 @@ bool Context::operator==(const Context& other) const
 
   if (rcData != other.rcData)
     return false;
+  if (ckksRcData != other.ckksRcData)
+    return false;
+
+  if (noiseCorrection != other.noiseCorrection)
+    return false;
   return true;
 }
 
@@ -281,6 +286,15 @@ std::unique_ptr<Context> buildContextFromBinary(std::istream& str)
   return std::unique_ptr<Context>(new Context(m, p, r, gens, ords));
 }
 
+// The CKKS bootstrapping parameters and the noise correction factors are
+// only written if they differ from their defaults, so that such contexts are
+// written as before these fields existed, and older files still read back
+static bool hasExtendedFields(const Context& context)
+{
+  return context.isCKKSBootstrappable() ||
+         context.noiseCorrection != NoiseCorrection();
+}
+
 void writeContextBinary(std::ostream& str, const Context& context)
 {
 
@@ -326,6 +340,19 @@ void writeContextBinary(std::ostream& str, const Context& context)
 
   write_raw_int(str, context.rcData.skHwt);
 
+  if (hasExtendedFields(context)) {
+    writeEyeCatcher(str, BINIO_EYE_CONTEXT_EXT);
+
+    // CKKS bootstrapping parameters, a zero weight if not bootstrappable
+    write_raw_int(str, context.ckksRcData.skHwt);
+    write_raw_int(str, context.ckksRcData.margin);
+
+    // the correction factors for the noise estimates
+    write_raw_double(str, context.noiseCorrection.encrypt);
+    write_raw_double(str, context.noiseCorrection.multiply);
+    write_raw_double(str, context.noiseCorrection.keySwitch);
+  }
+
   writeEyeCatcher(str, BINIO_EYE_CONTEXT_END);
 }
 
@@ -398,7 +425,24 @@ void readContextBinary(std::istream& str, Context& context)
     context.makeBootstrappable(mv, t);
   }
 
-  eyeCatcherFound = readEyeCatcher(str, BINIO_EYE_CONTEXT_END);
+  // The optional fields, absent if they have their defaults
+  context.noiseCorrection = NoiseCorrection();
+  char eye[BINIO_EYE_SIZE];
+  str.read(eye, BINIO_EYE_SIZE);
+  if (memcmp(eye, BINIO_EYE_CONTEXT_EXT, BINIO_EYE_SIZE) == 0) {
+    long ckksHwt = read_raw_int(str);
+    long ckksMargin = read_raw_int(str);
+    if (ckksHwt > 0)
+      context.makeCKKSBootstrappable(ckksHwt, ckksMargin);
+
+    context.noiseCorrection.encrypt = read_raw_double(str);
+    context.noiseCorrection.multiply = read_raw_double(str);
+    context.noiseCorrection.keySwitch = read_raw_double(str);
+
+    str.read(eye, BINIO_EYE_SIZE);
+  }
+
+  eyeCatcherFound = memcmp(eye, BINIO_EYE_CONTEXT_END, BINIO_EYE_SIZE);
   assertEq(eyeCatcherFound, 0, "Could not find post-context eye catcher");
 }
 
@@ -455,6 +499,17 @@ std::ostream& operator<<(std::ostream& str, const Context& context)
   str << context.rcData.mvec;
   str << " " << context.rcData.skHwt;
   str << " " << context.rcData.build_cache;
+  if (hasExtendedFields(context)) {
+    str << " " << context.ckksRcData.skHwt;
+    str << " " << context.ckksRcData.margin;
+
+    // the correction factors, at full precision so that they read back equal
+    std::streamsize precision = str.precision(17);
+    str << " " << context.noiseCorrection.encrypt;
+    str << " " << context.noiseCorrection.multiply;
+    str << " " << context.noiseCorrection.keySwitch;
+    str.precision(precision);
+  }
 
   str << "]\n";
 
@@ -541,6 +596,19 @@ std::istream& operator>>(std::istream& str, Context& context)
   if (mv.length() > 0) {
     context.makeBootstrappable(mv, t, build_cache);
   }
+  // The optional fields, absent if they have their defaults
+  context.noiseCorrection = NoiseCorrection();
+  str >> std::ws;
+  if (str.peek() != ']') {
+    long ckksHwt, ckksMargin;
+    str >> ckksHwt;
+    str >> ckksMargin;
+    if (ckksHwt > 0)
+      context.makeCKKSBootstrappable(ckksHwt, ckksMargin);
+    str >> context.noiseCorrection.encrypt;
+    str >> context.noiseCorrection.multiply;
+    str >> context.noiseCorrection.keySwitch;
+  }
   seekPastChar(str, ']');
   return str;
 }
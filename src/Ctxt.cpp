@@ -601,6 +601,14 @@ void Ctxt::reLinearize(long keyID)
   std::cerr << "*** reLinearlize: " << primeSet;
 #endif
   //std::cout<<"part[2]:" << parts[2] <<std::endl;
+  keySwitchToBase(keyID);
+  std::cout<< "Noise after Reli : "<< noiseBound <<std::endl;
+  dropSmallAndSpecialPrimes();
+   //std::cerr << "====== " << ratFactor << "\n";
+}
+
+void Ctxt::keySwitchToBase(long keyID)
+{
   dropSmallAndSpecialPrimes();
 
 #if 0
@@ -653,9 +661,6 @@ void Ctxt::reLinearize(long keyID)
     tmp.keySwitchPart(part, W); // switch this part & update noiseBound
   }
   *this = tmp;
-  std::cout<< "Noise after Reli : "<< noiseBound <<std::endl;
-  dropSmallAndSpecialPrimes();
-   //std::cerr << "====== " << ratFactor << "\n";
 }
 
 Ctxt& Ctxt::cleanUp()
@@ -697,9 +702,10 @@ void Ctxt::keySwitchPart(const CtxtPart& p, const KeySwitch& W)
   assertEq(W.fromKey, p.skHandle, "Secret key handles do not match");
 
   std::vector<DoubleCRT> polyDigits;
-  NTL::xdouble addedNoise = p.breakIntoDigits(polyDigits);
+  NTL::xdouble addedNoise =
+      p.breakIntoDigits(polyDigits, W.getDigits(context));
   std::cout<<"Noise of AddNoise:" << addedNoise<<std::endl;
-  addedNoise *= W.noiseBound;
+  addedNoise *= W.noiseBound * context.noiseCorrection.keySwitch;
   std::cout<<"Noise of W.noiseBound:" << W.noiseBound<<std::endl;
 
   // Finally we multiply the vector of digits by the key-switching matrix
@@ -1550,7 +1556,8 @@ void Ctxt::tensorProduct(const Ctxt& c1, const Ctxt& c2)
     ratFactor = c1.ratFactor * c2.ratFactor;
     ptxtMag = c1.ptxtMag * c2.ptxtMag;
   } else // BGV
-    noiseBound = c1.noiseBound * c2.noiseBound;
+    noiseBound = c1.noiseBound * c2.noiseBound *
+                 context.noiseCorrection.multiply;
 }
 
 void computeIntervalForMul(double& lo,
@@ -1846,9 +1853,9 @@ void Ctxt::multByConstant(const NTL::ZZ& c)
 
 // Multiply-by-constant, it is assumed that the size of this
 // constant fits in a double float
-void Ctxt::multByConstant(const DoubleCRT& dcrt, double size)
+template <typename DCRT>
+void Ctxt::multByDCRT(const DCRT& dcrt, double size)
 {
-  HELIB_TIMER_START;
   // Special case: if *this is empty then do nothing
   if (this->isEmpty())
     return;
@@ -1872,6 +1879,18 @@ void Ctxt::multByConstant(const DoubleCRT& dcrt, double size)
   noiseBound *= size;
 }
 
+void Ctxt::multByConstant(const DoubleCRT& dcrt, double size)
+{
+  HELIB_TIMER_START;
+  multByDCRT(dcrt, size);
+}
+
+void Ctxt::multByConstant(const DoubleCRTPrecon& dcrt, double size)
+{
+  HELIB_TIMER_START;
+  multByDCRT(dcrt, size);
+}
+
 void Ctxt::multByConstant(const NTL::ZZX& poly, double size)
 {
   HELIB_TIMER_START;
@@ -1914,10 +1933,11 @@ void Ctxt::multByConstantCKKS(const std::vector<std::complex<double>>& other)
   multByConstantCKKS(poly, NTL::xdouble{size}, NTL::xdouble{factor});
 }
 
-void Ctxt::multByConstantCKKS(const DoubleCRT& dcrt,
-                              NTL::xdouble size,
-                              NTL::xdouble factor,
-                              double roundingErr)
+template <typename DCRT>
+void Ctxt::multByDCRTCKKS(const DCRT& dcrt,
+                          NTL::xdouble size,
+                          NTL::xdouble factor,
+                          double roundingErr)
 {
   // VJS-FIXME: looks reasonable, but still needs review
 
@@ -1946,6 +1966,22 @@ void Ctxt::multByConstantCKKS(const DoubleCRT& dcrt,
     part.Mul(dcrt, /*matchIndexSets=*/false);
 }
 
+void Ctxt::multByConstantCKKS(const DoubleCRT& dcrt,
+                              NTL::xdouble size,
+                              NTL::xdouble factor,
+                              double roundingErr)
+{
+  multByDCRTCKKS(dcrt, size, factor, roundingErr);
+}
+
+void Ctxt::multByConstantCKKS(const DoubleCRTPrecon& dcrt,
+                              NTL::xdouble size,
+                              NTL::xdouble factor,
+                              double roundingErr)
+{
+  multByDCRTCKKS(dcrt, size, factor, roundingErr);
+}
+
 void Ctxt::multByConstantCKKS(const Ptxt<CKKS>& ptxt)
 {
   multByConstantCKKS(ptxt.getSlotRepr());
@@ -0,0 +1,460 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+
+#ifdef HELIB_THREADS
+#include <thread>
+#endif
+
+#include <helib/CtxtStore.h>
+#include <helib/Context.h>
+
+namespace helib {
+
+long CtxtStore::ctxtBytes(const Ctxt& ctxt)
+{
+  const Context& context = ctxt.getContext();
+  return ctxt.numParts() * ctxt.getPrimeSet().card() *
+         context.zMStar.getPhiM() * long(sizeof(long));
+}
+
+namespace {
+
+struct Entry
+{
+  std::shared_ptr<const Ctxt> ctxt; // null if not in memory
+  long bytes = 0;      // size in memory (kept after spilling, as an estimate)
+  bool dirty = false;  // modified since it was last written
+  bool loading = false;
+  bool prefetched = false; // loaded ahead, and not used since
+  long version = 0;        // incremented by every set()
+  long offset = -1;        // position in the spill file, -1 if never written
+  long length = 0;         // bytes reserved in the spill file
+  std::list<long>::iterator lruPos;
+};
+
+} // namespace
+
+// All the members are guarded by mtx, except that the file is guarded by
+// ioMtx. A thread that needs both takes mtx first. Loading a ciphertext
+// releases mtx while reading, so other ciphertexts can be used meanwhile.
+struct CtxtStore::Impl
+{
+  const PubKey& pubKey;
+  std::string path;
+  long budget;
+
+  std::mutex mtx;
+  std::condition_variable loaded; // a load finished
+  std::deque<Entry> entries;
+  std::list<long> lru; // the entries in memory, most recently used first
+  long resident = 0;
+  long spills = 0;
+  long loads = 0;
+
+  std::mutex ioMtx;
+  std::fstream file;
+  long fileEnd = 0;
+
+  // The prefetching thread works through order[next..]
+  std::vector<long> order;
+  std::size_t next = 0;
+  bool stop = false;
+  std::condition_variable work;
+#ifdef HELIB_THREADS
+  std::thread prefetcher;
+#endif
+
+  Impl(const PubKey& pk, const std::string& p, long b) :
+      pubKey(pk), path(p), budget(b)
+  {
+    file.open(path,
+              std::ios::in | std::ios::out | std::ios::binary |
+                  std::ios::trunc);
+    if (!file.is_open())
+      throw IOError("Could not open spill file " + path);
+  }
+
+  void touch(long i)
+  {
+    lru.splice(lru.begin(), lru, entries[i].lruPos);
+  }
+
+  void install(long i, const std::shared_ptr<const Ctxt>& ctxt, bool dirty)
+  {
+    Entry& e = entries[i];
+    if (e.ctxt) {
+      resident -= e.bytes;
+      lru.erase(e.lruPos);
+    }
+    e.ctxt = ctxt;
+    e.bytes = ctxtBytes(*ctxt);
+    e.dirty = dirty;
+    resident += e.bytes;
+    lru.push_front(i);
+    e.lruPos = lru.begin();
+  }
+
+  void write(long i)
+  {
+    Entry& e = entries[i];
+    std::ostringstream ss;
+    e.ctxt->write(ss);
+    const std::string data = ss.str();
+
+    std::lock_guard<std::mutex> io(ioMtx);
+    if (e.offset < 0 || long(data.size()) > e.length) { // append
+      e.offset = fileEnd;
+      e.length = data.size();
+      fileEnd += e.length;
+    }
+    file.seekp(e.offset);
+    file.write(data.data(), data.size());
+    file.flush();
+    if (!file)
+      throw IOError("Could not write to spill file " + path);
+    e.dirty = false;
+    spills++;
+  }
+
+  // Drop least-recently-used entries (other than keep, and than prefetched
+  // ones if spareAhead) until the given number of bytes fits in the budget
+  bool makeRoom(long bytes, long keep, bool spareAhead)
+  {
+    auto it = lru.end();
+    while (resident + bytes > budget && it != lru.begin()) {
+      --it;
+      long v = *it;
+      Entry& e = entries[v];
+      if (v == keep || (spareAhead && e.prefetched))
+        continue;
+      if (e.dirty)
+        write(v);
+      e.ctxt.reset();
+      e.prefetched = false;
+      resident -= e.bytes;
+      it = lru.erase(it);
+    }
+    return resident + bytes <= budget;
+  }
+
+  // Read the i'th entry from the spill file, called with the lock held and
+  // the entry not in memory. Does nothing if it was set() meanwhile.
+  void load(std::unique_lock<std::mutex>& lock, long i, bool ahead)
+  {
+    Entry& e = entries[i];
+    e.loading = true;
+    long offset = e.offset, length = e.length, version = e.version;
+    lock.unlock();
+
+    std::shared_ptr<Ctxt> ctxt;
+    std::exception_ptr error;
+    try {
+      std::string data(length, '\0');
+      {
+        std::lock_guard<std::mutex> io(ioMtx);
+        file.seekg(offset);
+        file.read(&data[0], length);
+        if (!file) {
+          file.clear();
+          throw IOError("Could not read from spill file " + path);
+        }
+      }
+      std::istringstream ss(data);
+      ctxt = std::make_shared<Ctxt>(pubKey);
+      ctxt->read(ss);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    lock.lock();
+    Entry& f = entries[i];
+    f.loading = false;
+    loaded.notify_all();
+    if (error)
+      std::rethrow_exception(error);
+    if (f.version != version || f.ctxt)
+      return;
+    install(i, ctxt, /*dirty=*/false);
+    f.prefetched = ahead;
+    loads++;
+    makeRoom(0, i, /*spareAhead=*/ahead);
+  }
+
+  std::shared_ptr<const Ctxt> fetch(std::unique_lock<std::mutex>& lock,
+                                    long i)
+  {
+    assertInRange<OutOfRangeError>(i,
+                                   0l,
+                                   long(entries.size()),
+                                   "CtxtStore index out of range");
+    for (;;) {
+      Entry& e = entries[i];
+      if (e.ctxt) {
+        touch(i);
+        e.prefetched = false; // used, the prefetcher may evict it now
+        work.notify_all();
+        return e.ctxt;
+      }
+      if (e.loading)
+        loaded.wait(lock);
+      else
+        load(lock, i, /*ahead=*/false); // and return it in the next round
+    }
+  }
+
+  void prefetchLoop()
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!stop) {
+      if (next >= order.size()) {
+        work.wait(lock);
+        continue;
+      }
+      long i = order[next];
+      if (i < 0 || i >= long(entries.size()) || entries[i].ctxt ||
+          entries[i].loading) {
+        next++;
+        continue;
+      }
+      // Wait for room that is not taken by entries loaded ahead
+      if (!makeRoom(entries[i].bytes, -1, /*spareAhead=*/true)) {
+        work.wait(lock);
+        continue;
+      }
+      next++;
+      try {
+        load(lock, i, /*ahead=*/true);
+      } catch (...) {
+        // leave it to get() to report the error
+      }
+    }
+  }
+};
+
+CtxtStore::CtxtStore(const PubKey& pubKey,
+                     const std::string& spillPath,
+                     long memoryBudget) :
+    impl(new Impl(pubKey, spillPath, memoryBudget))
+{
+  assertTrue<InvalidArgument>(memoryBudget >= 0,
+                              "Memory budget must be non-negative");
+#ifdef HELIB_THREADS
+  impl->prefetcher = std::thread([this] { impl->prefetchLoop(); });
+#endif
+}
+
+CtxtStore::~CtxtStore()
+{
+  {
+    std::lock_guard<std::mutex> lock(impl->mtx);
+    impl->stop = true;
+  }
+  impl->work.notify_all();
+#ifdef HELIB_THREADS
+  impl->prefetcher.join();
+#endif
+  impl->file.close();
+  std::remove(impl->path.c_str());
+}
+
+long CtxtStore::size() const
+{
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  return impl->entries.size();
+}
+
+void CtxtStore::push_back(const Ctxt& ctxt)
+{
+  assertEq(&ctxt.getPubKey(), &impl->pubKey, "Public key mismatch");
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  long i = impl->entries.size();
+  impl->entries.emplace_back();
+  impl->install(i, std::make_shared<const Ctxt>(ctxt), /*dirty=*/true);
+  impl->makeRoom(0, i, /*spareAhead=*/false);
+}
+
+Ctxt CtxtStore::get(long i)
+{
+  std::shared_ptr<const Ctxt> ctxt;
+  {
+    std::unique_lock<std::mutex> lock(impl->mtx);
+    ctxt = impl->fetch(lock, i);
+  }
+  return *ctxt;
+}
+
+void CtxtStore::set(long i, const Ctxt& ctxt)
+{
+  assertEq(&ctxt.getPubKey(), &impl->pubKey, "Public key mismatch");
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  assertInRange<OutOfRangeError>(i,
+                                 0l,
+                                 long(impl->entries.size()),
+                                 "CtxtStore index out of range");
+  impl->entries[i].version++;
+  impl->entries[i].prefetched = false;
+  impl->install(i, std::make_shared<const Ctxt>(ctxt), /*dirty=*/true);
+  impl->makeRoom(0, i, /*spareAhead=*/false);
+}
+
+void CtxtStore::prefetch(const std::vector<long>& order)
+{
+#ifdef HELIB_THREADS
+  {
+    std::lock_guard<std::mutex> lock(impl->mtx);
+    impl->order = order;
+    impl->next = 0;
+  }
+  impl->work.notify_all();
+#else
+  (void)order;
+#endif
+}
+
+void CtxtStore::forEach(const std::vector<long>& order,
+                        const std::function<void(long, const Ctxt&)>& f)
+{
+  prefetch(order);
+  try {
+    for (long i : order)
+      f(i, get(i));
+  } catch (...) {
+    prefetch({});
+    throw;
+  }
+  prefetch({});
+}
+
+void CtxtStore::flush()
+{
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  for (long i : impl->lru)
+    if (impl->entries[i].dirty)
+      impl->write(i);
+}
+
+void CtxtStore::writeTOC(const std::string& path, long cols)
+{
+  const long n = size();
+  assertTrue<InvalidArgument>(cols > 0 && n % cols == 0,
+                              "The ciphertexts do not fill the columns");
+  std::fstream out(path,
+                   std::ios::in | std::ios::out | std::ios::binary |
+                       std::ios::trunc);
+  if (!out.is_open())
+    throw IOError("Could not open TOC file " + path);
+
+  // The header of TOC::write, filled in once the offsets are known
+  std::vector<uint64_t> header(2 + n);
+  header[0] = n / cols;
+  header[1] = cols;
+  out.write(reinterpret_cast<const char*>(header.data()),
+            sizeof(uint64_t) * header.size());
+  std::vector<long> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  forEach(order, [&](long i, const Ctxt& ctxt) {
+    header[2 + i] = out.tellp();
+    ctxt.write(out);
+  });
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(header.data()),
+            sizeof(uint64_t) * header.size());
+  out.flush();
+  if (!out)
+    throw IOError("Could not write to TOC file " + path);
+}
+
+void CtxtStore::appendFromTOC(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in.is_open())
+    throw IOError("Could not open TOC file " + path);
+  const uint64_t fileSize = in.tellg();
+  in.seekg(0);
+
+  // The header of TOC::read
+  uint64_t dims[2] = {0, 0};
+  in.read(reinterpret_cast<char*>(dims), sizeof(dims));
+  if (!in ||
+      (dims[1] != 0 && dims[0] > fileSize / sizeof(uint64_t) / dims[1]))
+    throw IOError("Invalid table of contents in " + path);
+  std::vector<uint64_t> idx(dims[0] * dims[1]);
+  in.read(reinterpret_cast<char*>(idx.data()), sizeof(uint64_t) * idx.size());
+  if (!in)
+    throw IOError("Invalid table of contents in " + path);
+
+  for (uint64_t offset : idx) {
+    in.seekg(offset);
+    Ctxt ctxt(impl->pubKey);
+    ctxt.read(in);
+    if (!in)
+      throw IOError("Could not read a ciphertext from " + path);
+    push_back(ctxt);
+  }
+}
+
+long CtxtStore::memoryBudget() const
+{
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  return impl->budget;
+}
+
+void CtxtStore::setMemoryBudget(long bytes)
+{
+  assertTrue<InvalidArgument>(bytes >= 0, "Memory budget must be non-negative");
+  {
+    std::lock_guard<std::mutex> lock(impl->mtx);
+    impl->budget = bytes;
+    impl->makeRoom(0, -1, /*spareAhead=*/false);
+  }
+  impl->work.notify_all();
+}
+
+long CtxtStore::residentBytes() const
+{
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  return impl->resident;
+}
+
+bool CtxtStore::isResident(long i) const
+{
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  assertInRange<OutOfRangeError>(i,
+                                 0l,
+                                 long(impl->entries.size()),
+                                 "CtxtStore index out of range");
+  return bool(impl->entries[i].ctxt);
+}
+
+long CtxtStore::spillCount() const
+{
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  return impl->spills;
+}
+
+long CtxtStore::loadCount() const
+{
+  std::lock_guard<std::mutex> lock(impl->mtx);
+  return impl->loads;
+}
+
+} // namespace helib
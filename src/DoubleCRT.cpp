@@ -18,6 +18,8 @@
  * in use. The list of primes is defined by the data member modChain, which is
  * a vector of Cmodulus objects.
  */
+#include <algorithm>
+
 #include <NTL/ZZVec.h>
 #include <NTL/BasicThreadPool.h>
 
@@ -28,6 +30,7 @@
 #include <helib/Context.h>
 #include <helib/norms.h>
 #include <helib/fhe_stats.h>
+#include <helib/scheduler.h>
 #include <helib/log.h>
 
 namespace helib {
@@ -59,12 +62,12 @@ void DoubleCRT::FFT(const NTL::ZZX& poly, const IndexSet& s)
   NTL::Vec<long>& ivec = tls_ivec;
 
   long icard = MakeIndexVector(s, ivec);
-  NTL_EXEC_RANGE(icard, first, last)
+  HELIB_EXEC_RANGE(icard, first, last)
   for (long j = first; j < last; j++) {
     long i = ivec[j];
     context.ithModulus(i).FFT(map[i], poly);
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 }
 
 // FIXME: "code bloat": this just replicates the above with NTL::ZZX -> zzX
@@ -79,12 +82,12 @@ void DoubleCRT::FFT(const zzX& poly, const IndexSet& s)
   NTL::Vec<long>& ivec = tls_ivec;
 
   long icard = MakeIndexVector(s, ivec);
-  NTL_EXEC_RANGE(icard, first, last)
+  HELIB_EXEC_RANGE(icard, first, last)
   for (long j = first; j < last; j++) {
     long i = ivec[j];
     context.ithModulus(i).FFT(map[i], poly);
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 }
 
 // a "sanity check" function, verifies consistency of matrix with current
@@ -101,8 +104,9 @@ void DoubleCRT::verify()
   long phim = context.zMStar.getPhiM();
 
   // check that the content of i'th row is in [0,pi) for all i
+  const IndexMap<NTL::vec_long>& rows = map; // reading must not copy
   for (long i : s) {
-    NTL::vec_long& row = map[i];
+    const NTL::vec_long& row = rows[i];
 
     if (row.length() != phim)
       throw RuntimeError("DoubleCRT object has bad row length");
@@ -233,6 +237,42 @@ DoubleCRT& DoubleCRT::do_mul(const DoubleCRT& other, bool matchIndexSets)
   return *this;
 }
 
+DoubleCRT& DoubleCRT::do_mul(const DoubleCRTPrecon& other,
+                             bool matchIndexSets)
+{
+  HELIB_TIMER_START;
+
+  if (isDryRun())
+    return *this;
+
+  if (&context != &other.getContext())
+    throw RuntimeError("DoubleCRT::mul: incompatible objects");
+
+  // As with a plain DoubleCRT, the index sets are never matched by adding
+  // primes, and the primes of other must contain those of *this
+  if (matchIndexSets && !(map.getIndexSet() >= other.getIndexSet()))
+    throw RuntimeError("DoubleCRT::mul: matchIndexSets not honored");
+
+  if (!(map.getIndexSet() <= other.getIndexSet()))
+    throw RuntimeError(
+        "DoubleCRT::mul: !(map.getIndexSet() <= other.getIndexSet())");
+
+  const IndexSet& s = map.getIndexSet();
+  long phim = context.zMStar.getPhiM();
+
+  // multiply the data, element by element, using the precomputed quotients
+  for (long i : s) {
+    long pi = context.ithPrime(i);
+    NTL::vec_long& row = map[i];
+    const NTL::vec_long& other_row = other.dcrt.map[i];
+    const NTL::Vec<NTL::mulmod_precon_t>& precon_row = other.precon[i];
+
+    for (long j : range(phim))
+      row[j] = NTL::MulModPrecon(row[j], other_row[j], pi, precon_row[j]);
+  }
+  return *this;
+}
+
 #if 0
 template
 DoubleCRT& DoubleCRT::Op<DoubleCRT::MulFun>(const DoubleCRT &other, MulFun fun,
@@ -319,9 +359,16 @@ template DoubleCRT& DoubleCRT::Op<DoubleCRT::AddFun>(const NTL::ZZX& poly,
 template DoubleCRT& DoubleCRT::Op<DoubleCRT::SubFun>(const NTL::ZZX& poly,
                                                      SubFun fun);
 
-// break *this into n digits,according to the primeSets in context.digits
-// returns the sum of the canonical embedding norms of the digits
 NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
+{
+  return breakIntoDigits(digits, context.digits);
+}
+
+// break *this into n digits,according to the given partition of the primes
+// returns the sum of the canonical embedding norms of the digits
+NTL::xdouble DoubleCRT::breakIntoDigits(
+    std::vector<DoubleCRT>& digits,
+    const std::vector<IndexSet>& partition) const
 {
   HELIB_TIMER_START;
 
@@ -332,10 +379,10 @@ NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
   long n = 0;
 
   for (; !empty(remainingPrimes); n++) {
-    IndexSet digitPrimes = context.digits.at(n);
+    IndexSet digitPrimes = partition.at(n);
     digitPrimes.retain(remainingPrimes);
 
-    remainingPrimes.remove(context.digits.at(n));
+    remainingPrimes.remove(partition.at(n));
   }
   std::cout << "n: " << n << std::endl;
   IndexSet allPrimes = getIndexSet() | context.specialPrimes;
@@ -345,8 +392,8 @@ NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
   // the calling routine should ensure that the index set
   // contains only ctxt primes
 
-  assertTrue(n <= (long)context.digits.size(),
-             "n cannot be larger than the size of context.digits");
+  assertTrue(n <= (long)partition.size(),
+             "n cannot be larger than the size of the partition");
 
   digits.resize(n, DoubleCRT(context, IndexSet::emptySet()));
   if (isDryRun())
@@ -354,7 +401,7 @@ NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
 
   for (long i : range(n)) {
     digits[i] = *this;
-    IndexSet notInDigit = digits[i].getIndexSet() / context.digits[i];
+    IndexSet notInDigit = digits[i].getIndexSet() / partition[i];
     digits[i].removePrimes(notInDigit); // reduce modulo the digit primes
   }
 
@@ -395,7 +442,7 @@ NTL::xdouble DoubleCRT::breakIntoDigits(std::vector<DoubleCRT>& digits) const
 
 #endif
 
-    NTL::ZZ pi = context.productOfPrimes(context.digits[i]);
+    NTL::ZZ pi = context.productOfPrimes(partition[i]);
     for (long j : range(i + 1, digits.size())) {
       digits[j].Sub(digits[i], /*matchIndexSets=*/false);
       digits[j] /= pi;
@@ -659,7 +706,7 @@ DoubleCRT::DoubleCRT(const Context &_context)
 #endif
 
 DoubleCRT& DoubleCRT::operator=(const DoubleCRT& other)
-// optimized for the case of matching index sets
+// shares the rows of other, they are copied on the first write
 {
   if (this == &other)
     return *this;
@@ -667,18 +714,8 @@ DoubleCRT& DoubleCRT::operator=(const DoubleCRT& other)
   if (&context != &other.context)
     throw RuntimeError("DoubleCRT assignment: incompatible contexts");
 
-  if (map.getIndexSet() != other.map.getIndexSet()) {
-    map = other.map; // copy the data
-  } else {
-    const IndexSet& s = map.getIndexSet();
-    long phim = context.zMStar.getPhiM();
-    for (long i : s) {
-      NTL::vec_long& row = map[i];
-      const NTL::vec_long& other_row = other.map[i];
-      for (long j : range(phim))
-        row[j] = other_row[j];
-    }
-  }
+  // the rows are shared until one of them is modified
+  map = IndexMap<NTL::vec_long>::sharing(other.map);
   return *this;
 }
 
@@ -1021,6 +1058,16 @@ void DoubleCRT::automorph(long k)
 
   // go over the rows, permute them one at a time
   for (long i : s) {
+    if (map.isShared(i)) { // permute into a new row, no need to copy first
+      map.rebuild(i, [&](NTL::vec_long& fresh, const NTL::vec_long& row) {
+        for (long j : range(phim)) {
+          long rep =
+              NTL::MulModPrecon(zMStar.repInZmstar_unchecked(j), k, m, precon);
+          fresh[j] = row[zMStar.indexInZmstar_unchecked(rep)];
+        }
+      });
+      continue;
+    }
     NTL::vec_long& row = map[i];
 
     // Compute new[j] = old[j*k mod m]
@@ -1095,6 +1142,13 @@ void DoubleCRT::complexConj()
 
   // go over the rows, permute them one at a time
   for (long i : s) {
+    if (map.isShared(i)) { // reverse into a new row, no need to copy first
+      map.rebuild(i, [&](NTL::vec_long& fresh, const NTL::vec_long& row) {
+        for (long j : range(phim))
+          fresh[j] = row[phim - j - 1];
+      });
+      continue;
+    }
     NTL::vec_long& row = map[i];
     for (long j : range(phim / 2)) { // swap i <-> phi(m)-i-1
       std::swap(row[j], row[phim - j - 1]);
@@ -1102,6 +1156,18 @@ void DoubleCRT::complexConj()
   }
 }
 
+// moves each row to memory allocated by the calling thread
+void DoubleCRT::relocate()
+{
+  const IndexSet& s = map.getIndexSet();
+  long phim = context.zMStar.getPhiM();
+  for (long i : s) // the new rows are allocated (and touched) by this thread
+    map.rebuild(i, [phim](NTL::vec_long& fresh, const NTL::vec_long& row) {
+      for (long j : range(phim))
+        fresh[j] = row[j];
+    }); // the old row is released unless shared
+}
+
 // fills each row i with random integers mod pi
 void DoubleCRT::randomize(const NTL::ZZ* seed)
 {
@@ -1431,4 +1497,123 @@ void DoubleCRT::read(std::istream& str)
   }
 }
 
+DoubleCRTPrecon::DoubleCRTPrecon(const DoubleCRT& dcrt) : dcrt(dcrt)
+{
+  HELIB_TIMER_START;
+  if (isDryRun())
+    return;
+
+  const Context& context = dcrt.getContext();
+  const IndexSet& s = dcrt.getIndexSet();
+  if (s.card() == 0)
+    return;
+  long phim = context.zMStar.getPhiM();
+
+  preconCharge = MemoryCharge(s.card() * phim * sizeof(NTL::mulmod_precon_t));
+  precon.resize(s.last() + 1);
+  for (long i : s) {
+    long pi = context.ithPrime(i);
+    NTL::mulmod_t pi_inv = context.ithModulus(i).getQInv();
+    const NTL::vec_long& row = dcrt.map[i];
+    NTL::Vec<NTL::mulmod_precon_t>& precon_row = precon[i];
+    precon_row.SetLength(phim);
+    for (long j : range(phim))
+      precon_row[j] = NTL::PrepMulModPrecon(row[j], pi, pi_inv);
+  }
+}
+
+DoubleCRTAccumulator::DoubleCRTAccumulator(const Context& context,
+                                           const IndexSet& s) :
+    context(context), primes(s), count(0)
+{
+  long nbits = 0;
+  for (long i : primes)
+    nbits = std::max(nbits, NTL::NumBits(context.ithPrime(i)));
+  // Each product is below 2^(2*nbits), so 2^(128 - 2*nbits) of them fit
+  long room = 128 - 2 * nbits;
+  maxCount = (room >= NTL_BITS_PER_LONG - 2) ? NTL_MAX_LONG : (1L << room);
+  if (!isDryRun())
+    acc.assign(primes.card(),
+               std::vector<wide_t>(context.zMStar.getPhiM(), wide_t(0)));
+}
+
+void DoubleCRTAccumulator::mulAdd(const DoubleCRT& a, const DoubleCRT& b)
+{
+  HELIB_TIMER_START;
+  if (isDryRun())
+    return;
+
+  if (&context != &a.context || &context != &b.context)
+    throw RuntimeError("DoubleCRTAccumulator::mulAdd: incompatible objects");
+  if (!(primes <= a.getIndexSet()) || !(primes <= b.getIndexSet()))
+    throw RuntimeError("DoubleCRTAccumulator::mulAdd: missing primes");
+
+  if (count >= maxCount)
+    fold();
+
+  long phim = context.zMStar.getPhiM();
+  long k = 0;
+  for (long i : primes) {
+    const NTL::vec_long& a_row = a.map[i];
+    const NTL::vec_long& b_row = b.map[i];
+    std::vector<wide_t>& acc_row = acc[k++];
+    for (long j : range(phim))
+      acc_row[j] += wide_t(a_row[j]) * wide_t(b_row[j]);
+  }
+  count++;
+}
+
+void DoubleCRTAccumulator::fold()
+{
+  long phim = context.zMStar.getPhiM();
+  long k = 0;
+  for (long i : primes) {
+    long pi = context.ithPrime(i);
+    NTL::sp_ll_reduce_struct red = NTL::make_sp_ll_reduce_struct(pi);
+    std::vector<wide_t>& acc_row = acc[k++];
+    for (long j : range(phim))
+      acc_row[j] = NTL::sp_ll_red_31(0,
+                                     (unsigned long)(acc_row[j] >> 64),
+                                     (unsigned long)(acc_row[j]),
+                                     pi,
+                                     red);
+  }
+  count = 1; // the folded words are below p
+}
+
+void DoubleCRTAccumulator::reduce(DoubleCRT& out) const
+{
+  HELIB_TIMER_START;
+  if (isDryRun())
+    return;
+
+  assertEq(&context, &out.context, "Context mismatch");
+  assertTrue(primes == out.getIndexSet(),
+             "Output must be over the primes of the sum");
+
+  long phim = context.zMStar.getPhiM();
+  long k = 0;
+  for (long i : primes) {
+    long pi = context.ithPrime(i);
+    NTL::sp_ll_reduce_struct red = NTL::make_sp_ll_reduce_struct(pi);
+    const std::vector<wide_t>& acc_row = acc[k++];
+    // a new row, rather than a write into a shared one
+    out.map.rebuild(i, [&](NTL::vec_long& row, const NTL::vec_long&) {
+      for (long j : range(phim))
+        row[j] = NTL::sp_ll_red_31(0,
+                                   (unsigned long)(acc_row[j] >> 64),
+                                   (unsigned long)(acc_row[j]),
+                                   pi,
+                                   red);
+    });
+  }
+}
+
+void DoubleCRTAccumulator::clear()
+{
+  for (std::vector<wide_t>& acc_row : acc)
+    std::fill(acc_row.begin(), acc_row.end(), wide_t(0));
+  count = 0;
+}
+
 } // namespace helib
@@ -17,6 +17,7 @@
 #include <helib/timing.h>
 #include <helib/clonedPtr.h>
 #include <helib/norms.h>
+#include <helib/scheduler.h>
 
 namespace helib {
 
@@ -50,11 +51,107 @@ EncryptedArrayBase* buildEncryptedArray(const Context& context,
   }
 }
 
+std::shared_ptr<const RotationPlans::Plan> RotationPlans::get(
+    Kind kind,
+    long dim,
+    long amt,
+    const std::function<void(std::vector<zzX>&)>& build) const
+{
+  const std::tuple<int, long, long> key(kind, dim, amt);
+  {
+    HELIB_MUTEX_GUARD(mutex);
+    auto it = plans.find(key);
+    if (it != plans.end()) {
+      it->second.lastUse = ++useCount;
+      return it->second.plan;
+    }
+  }
+
+  // Build the plan without holding the lock, so that rotations by other
+  // amounts are not held up. If two threads race, the first one wins.
+  HELIB_NTIMER_START(buildRotationPlan);
+  MemoryScope scope(MemCategory::CACHE, "RotationPlans");
+  std::vector<zzX> masks;
+  build(masks);
+  const IndexSet primes = context.allPrimes();
+  auto plan = std::make_shared<Plan>();
+  plan->reserve(masks.size());
+  for (const zzX& mask : masks)
+    plan->push_back(Mask{DoubleCRTPrecon(DoubleCRT(mask, context, primes)),
+                         embeddingLargestCoeff(mask, context.zMStar)});
+  HELIB_NTIMER_STOP(buildRotationPlan);
+
+  HELIB_MUTEX_GUARD(mutex);
+  auto it = plans.find(key);
+  if (it == plans.end()) {
+    evictTo(maxPlans - 1);
+    it = plans.emplace(key, Entry{std::move(plan), 0}).first;
+  }
+  it->second.lastUse = ++useCount;
+  return it->second.plan;
+}
+
+void RotationPlans::evictTo(long n) const
+{
+  while (long(plans.size()) > n) {
+    auto oldest = plans.begin();
+    for (auto it = plans.begin(); it != plans.end(); ++it)
+      if (it->second.lastUse < oldest->second.lastUse)
+        oldest = it;
+    // A rotation that is still using the plan keeps it alive
+    plans.erase(oldest);
+  }
+}
+
+long RotationPlans::size() const
+{
+  HELIB_MUTEX_GUARD(mutex);
+  return plans.size();
+}
+
+long RotationPlans::capacity() const
+{
+  HELIB_MUTEX_GUARD(mutex);
+  return maxPlans;
+}
+
+void RotationPlans::setCapacity(long maxPlans) const
+{
+  assertTrue<InvalidArgument>(maxPlans >= 1,
+                              "RotationPlans must be able to hold a plan");
+  HELIB_MUTEX_GUARD(mutex);
+  this->maxPlans = maxPlans;
+  evictTo(maxPlans);
+}
+
+void RotationPlans::clear() const
+{
+  HELIB_MUTEX_GUARD(mutex);
+  plans.clear();
+}
+
+// Run two independent operations, on ctxt and tmp in rotate and shift, in
+// parallel
+template <typename F1, typename F2>
+static void execPair(const F1& f1, const F2& f2)
+{
+  HELIB_EXEC_RANGE(2, first, last)
+  for (long j = first; j < last; j++) {
+    if (j == 0)
+      f1();
+    else
+      f2();
+  }
+  HELIB_EXEC_RANGE_END
+}
+
 template <typename type>
 EncryptedArrayDerived<type>::EncryptedArrayDerived(const Context& _context,
                                                    const RX& _G,
                                                    const PAlgebraMod& alMod) :
-    context(_context), tab(alMod.getDerived(type()))
+    context(_context),
+    tab(alMod.getDerived(type())),
+    rotationPlans(std::make_shared<RotationPlans>(_context))
 {
   tab.mapToSlots(mappingData, _G); // Compute the base-G representation maps
 }
@@ -73,10 +170,6 @@ void EncryptedArrayDerived<type>::rotate1D(Ctxt& ctxt,
                        dimension(),
                        "i must be between 0 and dimension()");
 
-  RBak bak;
-  bak.save();
-  tab.restoreContext();
-
   const std::vector<std::vector<RX>>& maskTable = tab.getMaskTable();
   const PAlgebra& zMStar = getPAlgebra();
   long ord = sizeOfDimension(i);
@@ -98,6 +191,19 @@ void EncryptedArrayDerived<type>::rotate1D(Ctxt& ctxt,
   helib::assertTrue(maskTable[i].size() > 0,
                     "Found non-positive sized mask table entry");
 
+  std::shared_ptr<const RotationPlans::Plan> plan = rotationPlans->get(
+      RotationPlans::ROTATE1D,
+      i,
+      amt,
+      [&](std::vector<zzX>& masks) {
+        RBak bak;
+        bak.save();
+        tab.restoreContext();
+        masks.push_back(balanced_zzX(maskTable[i][amt]));
+      });
+  const RotationPlans::Mask& m1 = plan->front();
+  // m1 will be used to multiply both ctxt and T
+
   ctxt.smartAutomorph(zMStar.genToPow(i, amt));
   // ctxt = \rho_i^{amt}(originalCtxt)
 
@@ -108,16 +214,10 @@ void EncryptedArrayDerived<type>::rotate1D(Ctxt& ctxt,
   // assumption that we have the key switch matrix
   // for \rho_i^{-ord}
 
-  const RX& mask = maskTable[i][amt];
-  zzX mask_poly = balanced_zzX(mask);
-  double sz = embeddingLargestCoeff(mask_poly, zMStar);
-  DoubleCRT m1(mask_poly, context, ctxt.getPrimeSet() | T.getPrimeSet());
-  // m1 will be used to multiply both ctxt and T
-
   // Compute ctxt = ctxt*m1 + T - T*m1
-  ctxt.multByConstant(m1, sz);
+  ctxt.multByConstant(m1.poly, m1.size);
   ctxt += T;
-  T.multByConstant(m1, sz);
+  T.multByConstant(m1.poly, m1.size);
   ctxt -= T;
 }
 
@@ -131,10 +231,6 @@ void EncryptedArrayDerived<type>::shift1D(Ctxt& ctxt, long i, long k) const
 
   const std::vector<std::vector<RX>>& maskTable = tab.getMaskTable();
 
-  RBak bak;
-  bak.save();
-  tab.restoreContext();
-
   assertEq(&context, &ctxt.getContext(), "Context mismatch");
   assertInRange(i,
                 0l,
@@ -156,20 +252,64 @@ void EncryptedArrayDerived<type>::shift1D(Ctxt& ctxt, long i, long k) const
   if (amt < 0)
     amt += ord;
 
-  RX mask = maskTable[i][ord - amt];
-
-  long val;
-  if (k < 0)
-    val = al.genToPow(i, amt - ord);
-  else {
-    mask = 1 - mask;
-    val = al.genToPow(i, amt);
-  }
-  ctxt.multByConstant(balanced_zzX(mask)); // zero out slots where mask=0
-  ctxt.smartAutomorph(val);                // shift left by val
+  // The plan is keyed by k, as the mask depends on its sign
+  std::shared_ptr<const RotationPlans::Plan> plan = rotationPlans->get(
+      RotationPlans::SHIFT1D,
+      i,
+      k,
+      [&](std::vector<zzX>& masks) {
+        RBak bak;
+        bak.save();
+        tab.restoreContext();
+        RX mask = maskTable[i][ord - amt];
+        if (k > 0)
+          mask = 1 - mask;
+        masks.push_back(balanced_zzX(mask));
+      });
+  const RotationPlans::Mask& mask = plan->front();
+
+  long val = (k < 0) ? al.genToPow(i, amt - ord) : al.genToPow(i, amt);
+  ctxt.multByConstant(mask.poly, mask.size); // zero out slots where mask=0
+  ctxt.smartAutomorph(val);                  // shift left by val
   HELIB_TIMER_STOP;
 }
 
+// The masks of rotate and shift: (*plan)[i] is the mask that selects the
+// slots that move by v_i rather than v_i+1 along dimension i, where v_i is
+// the i'th coordinate of amt. It combines the masks of all the dimensions
+// after i.
+template <typename type>
+std::shared_ptr<const RotationPlans::Plan> EncryptedArrayDerived<
+    type>::generalPlan(long amt) const
+{
+  return rotationPlans->get(
+      RotationPlans::GENERAL,
+      -1,
+      amt,
+      [&](std::vector<zzX>& masks) {
+        RBak bak;
+        bak.save();
+        tab.restoreContext();
+
+        const PAlgebra& al = getPAlgebra();
+        const std::vector<std::vector<RX>>& maskTable = tab.getMaskTable();
+        const RXModulus& PhimXmod = tab.getPhimXMod();
+
+        long i = al.numOfGens() - 1;
+        RX mask = maskTable[i][al.coordinate(i, amt)];
+        masks.resize(i);
+        for (i--; i >= 0; i--) {
+          masks[i] = balanced_zzX(mask);
+          if (i > 0) {
+            long v = al.coordinate(i, amt);
+            mask =
+                ((mask * (maskTable[i][v] - maskTable[i][v + 1])) % PhimXmod) +
+                maskTable[i][v + 1]; // update the mask for next dimension
+          }
+        }
+      });
+}
+
 // NOTE: masking depth: if there are N dimensions, and if for i = 1..N
 // we define c_i = 1 if dimension i is bad and 0 o/w, then the masking
 // depth is N - 1 + \sum_{i=1} c_i.
@@ -181,12 +321,6 @@ void EncryptedArrayDerived<type>::rotate(Ctxt& ctxt, long amt) const
 
   const PAlgebra& al = getPAlgebra();
 
-  const std::vector<std::vector<RX>>& maskTable = tab.getMaskTable();
-
-  RBak bak;
-  bak.save();
-  tab.restoreContext();
-
   assertEq(&context, &ctxt.getContext(), "Context mismatch");
 
   // Simple case: just one generator
@@ -203,12 +337,12 @@ void EncryptedArrayDerived<type>::rotate(Ctxt& ctxt, long amt) const
   if (amt < 0)
     amt += al.getNSlots();
 
+  std::shared_ptr<const RotationPlans::Plan> plan = generalPlan(amt);
+
   // rotate the ciphertext, one dimension at a time
   long i = al.numOfGens() - 1;
   long v = al.coordinate(i, amt);
-  RX mask = maskTable[i][v];
   Ctxt tmp(ctxt.getPubKey());
-  const RXModulus& PhimXmod = tab.getPhimXMod();
 
   // optimize for the common case where the last generator has order in
   // Zm*/(p) different than its order in Zm*. In this case we can combine
@@ -232,52 +366,39 @@ void EncryptedArrayDerived<type>::rotate(Ctxt& ctxt, long amt) const
     // assumption that we have the key switch matrix
     // for \rho_i^{-ord}
 
-    zzX mask_poly = balanced_zzX(mask);
-    double sz = embeddingLargestCoeff(mask_poly, al);
-
-    DoubleCRT m1(mask_poly, context, ctxt.getPrimeSet() | tmp.getPrimeSet());
+    const RotationPlans::Mask& m1 = (*plan)[i - 1];
     // m1 will be used to multiply both ctxt and tmp
 
     // Compute ctxt = ctxt*m1, tmp = tmp*(1-m1)
-    ctxt.multByConstant(m1, sz);
+    ctxt.multByConstant(m1.poly, m1.size);
 
     Ctxt tmp1(tmp);
-    tmp1.multByConstant(m1, sz);
+    tmp1.multByConstant(m1.poly, m1.size);
     tmp -= tmp1;
 
     // apply rotation relative to next generator before combining the parts
     --i;
     v = al.coordinate(i, amt);
-    rotate1D(ctxt, i, v);
-    rotate1D(tmp, i, v + 1);
+    execPair([&] { rotate1D(ctxt, i, v); }, [&] { rotate1D(tmp, i, v + 1); });
     ctxt += tmp; // combine the two parts
 
     if (i <= 0) {
       return;
     } // no more generators
-
-    // update the mask for next iteration
-    mask = ((mask * (maskTable[i][v] - maskTable[i][v + 1])) % PhimXmod) +
-           maskTable[i][v + 1];
   }
 
   // Handle rotation relative to all the other generators (if any)
   for (i--; i >= 0; i--) {
     v = al.coordinate(i, amt);
 
-    zzX mask_poly = balanced_zzX(mask);
+    const RotationPlans::Mask& mask = (*plan)[i];
 
     tmp = ctxt;
-    tmp.multByConstant(mask_poly); // only the slots in which mask=1
-    ctxt -= tmp;                   // only the slots in which mask=0
+    tmp.multByConstant(mask.poly, mask.size); // only the slots in which mask=1
+    ctxt -= tmp;                              // only the slots in which mask=0
 
-    rotate1D(tmp, i, v);
-    rotate1D(ctxt, i, v + 1);
+    execPair([&] { rotate1D(tmp, i, v); }, [&] { rotate1D(ctxt, i, v + 1); });
     ctxt += tmp;
-    if (i > 0) {
-      mask = ((mask * (maskTable[i][v] - maskTable[i][v + 1])) % PhimXmod) +
-             maskTable[i][v + 1]; // update the mask for next iteration
-    }
   }
   HELIB_TIMER_STOP;
 }
@@ -289,12 +410,6 @@ void EncryptedArrayDerived<type>::shift(Ctxt& ctxt, long k) const
 
   const PAlgebra& al = getPAlgebra();
 
-  const std::vector<std::vector<RX>>& maskTable = tab.getMaskTable();
-
-  RBak bak;
-  bak.save();
-  tab.restoreContext();
-
   assertEq(&context, &ctxt.getContext(), "Context mismatch");
 
   // Simple case: just one generator
@@ -318,34 +433,31 @@ void EncryptedArrayDerived<type>::shift(Ctxt& ctxt, long k) const
   if (amt < 0)
     amt += nSlots;
 
+  // shift uses the same masks as rotate by amt
+  std::shared_ptr<const RotationPlans::Plan> plan = generalPlan(amt);
+
   // rotate the ciphertext, one dimension at a time
   long i = al.numOfGens() - 1;
   long v = al.coordinate(i, amt);
-  RX mask = maskTable[i][v];
   Ctxt tmp(ctxt.getPubKey());
-  const RXModulus& PhimXmod = tab.getPhimXMod();
 
   rotate1D(ctxt, i, v);
   for (i--; i >= 0; i--) {
     v = al.coordinate(i, amt);
 
-    zzX mask_poly = balanced_zzX(mask);
+    const RotationPlans::Mask& mask = (*plan)[i];
 
     tmp = ctxt;
-    tmp.multByConstant(mask_poly); // only the slots in which mask=1
-    ctxt -= tmp;                   // only the slots in which mask=0
+    tmp.multByConstant(mask.poly, mask.size); // only the slots in which mask=1
+    ctxt -= tmp;                              // only the slots in which mask=0
     if (i > 0) {
-      rotate1D(ctxt, i, v + 1);
-      rotate1D(tmp, i, v);
+      execPair([&] { rotate1D(ctxt, i, v + 1); },
+               [&] { rotate1D(tmp, i, v); });
       ctxt += tmp; // combine the two parts
-
-      mask = ((mask * (maskTable[i][v] - maskTable[i][v + 1])) % PhimXmod) +
-             maskTable[i][v + 1]; // update the mask before next iteration
-    } else {                      // i == 0
+    } else {       // i == 0
       if (k < 0)
         v -= al.OrderOf(0);
-      shift1D(tmp, 0, v);
-      shift1D(ctxt, 0, v + 1);
+      execPair([&] { shift1D(tmp, 0, v); }, [&] { shift1D(ctxt, 0, v + 1); });
       ctxt += tmp;
     }
   }
@@ -730,6 +842,101 @@ template void applyLinPolyLL(Ctxt& ctxt,
 template void applyLinPolyLL(Ctxt& ctxt,
                              const std::vector<DoubleCRT>& encodedC,
                              long d);
+template void applyLinPolyLL(Ctxt& ctxt,
+                             const std::vector<DoubleCRTPrecon>& encodedC,
+                             long d);
+
+LinPolyEvaluator::LinPolyEvaluator(
+    const EncryptedArray& _ea,
+    const std::vector<std::vector<NTL::ZZX>>& maps) :
+    ea(_ea), d(_ea.getDegree())
+{
+  HELIB_TIMER_START;
+  const Context& context = ea.getContext();
+  long nslots = ea.size();
+  long n = maps.size();
+
+  // Build the coefficients of all the maps
+  std::vector<std::vector<NTL::ZZX>> C(n);
+  for (long i = 0; i < n; i++) {
+    assertEq(d, lsize(maps[i]), "ea's degree does not match the map size");
+    ea.buildLinPolyCoeffs(C[i], maps[i]);
+  }
+
+  // Encode them and convert to DoubleCRT over all the primes, so they
+  // can be used with ciphertexts at any level
+  coeffs.assign(n, std::vector<std::shared_ptr<DoubleCRTPrecon>>(d));
+  sizes.assign(n, std::vector<double>(d, 0.0));
+  IndexSet allPrimes = context.allPrimes();
+
+  NTL_EXEC_RANGE(n * d, first, last)
+  for (long k = first; k < last; k++) {
+    long i = k / d, j = k % d;
+    if (NTL::IsZero(C[i][j]))
+      continue;
+    std::vector<NTL::ZZX> v(nslots, C[i][j]); // all the slots equal C[i][j]
+    zzX poly;
+    ea.encode(poly, v);
+    sizes[i][j] = embeddingLargestCoeff(poly, context.zMStar);
+    coeffs[i][j] = std::make_shared<DoubleCRTPrecon>(
+        DoubleCRT(poly, context, allPrimes));
+  }
+  NTL_EXEC_RANGE_END
+}
+
+void LinPolyEvaluator::frobeniusImages(std::vector<Ctxt>& frob,
+                                       const Ctxt& ctxt) const
+{
+  assertEq(&ea.getContext(), &ctxt.getContext(), "Context mismatch");
+
+  Ctxt tmp(ctxt);
+  tmp.cleanUp(); // not sure, but this may be a good idea
+
+  frob.assign(d, tmp);
+  NTL_EXEC_RANGE(d - 1, first, last)
+  for (long j = first + 1; j < last + 1; j++)
+    frob[j].frobeniusAutomorph(j);
+  NTL_EXEC_RANGE_END
+}
+
+void LinPolyEvaluator::apply(Ctxt& out,
+                             const std::vector<Ctxt>& frob,
+                             long i) const
+{
+  assertInRange(i, 0l, size(), "Map index out of range");
+  assertEq(d, lsize(frob), "Wrong number of Frobenius images");
+
+  out = Ctxt(ZeroCtxtLike, frob[0]);
+  Ctxt tmp(ZeroCtxtLike, frob[0]);
+  for (long j = 0; j < d; j++) {
+    if (!coeffs[i][j])
+      continue;
+    tmp = frob[j];
+    tmp.multByConstant(*coeffs[i][j], sizes[i][j]);
+    out += tmp;
+  }
+}
+
+void LinPolyEvaluator::apply(Ctxt& ctxt, long i) const
+{
+  std::vector<Ctxt> frob;
+  frobeniusImages(frob, ctxt);
+  apply(ctxt, frob, i);
+}
+
+void LinPolyEvaluator::applyAll(std::vector<Ctxt>& out, const Ctxt& ctxt) const
+{
+  HELIB_TIMER_START;
+  std::vector<Ctxt> frob;
+  frobeniusImages(frob, ctxt);
+
+  long n = size();
+  out.assign(n, Ctxt(ZeroCtxtLike, ctxt));
+  NTL_EXEC_RANGE(n, first, last)
+  for (long i = first; i < last; i++)
+    apply(out[i], frob, i);
+  NTL_EXEC_RANGE_END
+}
 
 /****************** End linear transformation code ******************/
 /********************************************************************/
@@ -9,8 +9,13 @@
  * See the License for the specific language governing permissions and
  * limitations under the License. See accompanying LICENSE file.
  */
+#include <cmath>
+#include <functional>
+#include <tuple>
+
 #include <helib/EvalMap.h>
 #include <helib/apiAttributes.h>
+#include <helib/memoryAccounting.h>
 
 // needed to get NTL's TraceMap functions...needed for ThinEvalMap
 #include <NTL/lzz_pXFactoring.h>
@@ -162,6 +167,7 @@ EvalMap::EvalMap(const EncryptedArray& _ea,
 
 void EvalMap::upgrade()
 {
+  MemoryScope scope(MemCategory::EVAL_MAP, "EvalMap");
   mat1->upgrade();
   for (long i = 0; i < matvec.length(); i++)
     matvec[i]->upgrade();
@@ -640,6 +646,7 @@ ThinEvalMap::ThinEvalMap(const EncryptedArray& _ea,
 
 void ThinEvalMap::upgrade()
 {
+  MemoryScope scope(MemCategory::EVAL_MAP, "ThinEvalMap");
   for (long i = 0; i < matvec.length(); i++)
     if (matvec[i])
       matvec[i]->upgrade();
@@ -915,4 +922,231 @@ static MatMul1D* buildThinStep1Matrix(const EncryptedArray& ea,
 }
 //! \endcond
 
+CKKSEvalMap::CKKSEvalMap(const EncryptedArray& _ea) : ea(_ea)
+{
+  HELIB_TIMER_START;
+  assertEq(ea.getTag(), PA_cx_tag, "CKKSEvalMap requires a CKKS context");
+  const PAlgebra& zMStar = ea.getPAlgebra();
+  const long m = zMStar.getM();
+  const long n = ea.size();
+  assertEq(2 * n, zMStar.getPhiM(), "CKKSEvalMap requires phi(m)/2 slots");
+  assertTrue(n >= 4, "CKKSEvalMap requires at least 4 slots");
+  const double twoPi = 2 * PI;
+  typedef std::complex<double> cx;
+
+  // Slot k holds the evaluation at zeta^e[k], zeta = exp(2*pi*i/m), which
+  // we read off the slots of X
+  zzX mono;
+  mono.SetLength(2, 0);
+  mono[1] = 1;
+  std::vector<cx> x;
+  ea.getCx().decode(x, mono, /*scaling=*/1.0);
+  std::vector<long> e(n);
+  for (long k : range(n))
+    e[k] = mcMod(std::lround(std::arg(x[k]) * m / twoPi), m);
+
+  // Rotating by one moves slot k-1 to slot k, i.e. zeta^(e[k]*g) is
+  // zeta^e[k-1]
+  const long g = zMStar.ZmStarGen(0);
+  for (long k : range(n))
+    assertEq(NTL::MulMod(e[k], g, m),
+             e[mcMod(k - 1, n)],
+             "CKKS slots are not ordered by the generator");
+
+  // The FFT evaluates w at zeta^(h^t) for t < n, h = +-g = 1 (mod 4), as
+  // zeta^(h^(t+n/2)) = -zeta^(h^t). Slot k holds the evaluation at zeta^f,
+  // f = +-e[k] = 1 (mod 4), conjugated if f = -e[k], and slotOf[t] is the
+  // slot with f = h^t.
+  const long h = (g % 4 == 1) ? g : m - g;
+  std::vector<long> hPow(n, 1);
+  for (long t : range(1, n))
+    hPow[t] = NTL::MulMod(hPow[t - 1], h, m);
+  std::vector<long> tOf(m, -1);
+  for (long t : range(n))
+    tOf[hPow[t]] = t;
+  std::vector<long> slotOf(n, -1);
+  std::vector<bool> flip(n);
+  for (long k : range(n)) {
+    flip[k] = (e[k] % 4 != 1);
+    long t = tOf[flip[k] ? m - e[k] : e[k]];
+    assertTrue(t >= 0 && slotOf[t] < 0, "CKKS slots are not the FFT roots");
+    slotOf[t] = k;
+  }
+
+  // The butterflies of size s at FFT positions b+t and b+t+s/2, for blocks
+  // b of size s and t < s/2: Y[b+t] = E[t] + r*O[t] and
+  // Y[b+t+s/2] = E[t] - r*O[t], with r = zeta^((n/s)*h^t). Each entry is
+  // (output position, input position, value).
+  typedef std::vector<std::tuple<long, long, cx>> Entries;
+  auto butterflies = [&](long s, bool invert) {
+    Entries entries;
+    for (long b = 0; b < n; b += s)
+      for (long t = 0; t < s / 2; t++) {
+        cx r = std::polar(1.0, twoPi * NTL::MulMod(n / s, hPow[t], m) / m);
+        long lo = b + t, hi = b + t + s / 2;
+        if (!invert) {
+          entries.emplace_back(lo, lo, 1.0);
+          entries.emplace_back(lo, hi, r);
+          entries.emplace_back(hi, lo, 1.0);
+          entries.emplace_back(hi, hi, -r);
+        } else {
+          entries.emplace_back(lo, lo, 0.5);
+          entries.emplace_back(lo, hi, 0.5);
+          entries.emplace_back(hi, lo, 0.5 / r);
+          entries.emplace_back(hi, hi, -0.5 / r);
+        }
+      }
+    return entries;
+  };
+
+  // The diagonals over the slots of the entries, each value passed through
+  // scale(output slot, input slot, value)
+  auto toMatrix = [&](const Entries& entries,
+                      const std::function<cx(long, long, cx)>& scale) {
+    std::vector<std::vector<cx>> diags(n);
+    for (const auto& entry : entries) {
+      long out = slotOf[std::get<0>(entry)];
+      long in = slotOf[std::get<1>(entry)];
+      std::vector<cx>& diag = diags[mcMod(in - out, n)];
+      if (diag.empty())
+        diag.resize(n);
+      diag[out] += scale(out, in, std::get<2>(entry));
+    }
+    return encode(diags);
+  };
+  auto keep = [](long, long, cx v) { return v; };
+  // Slots that are (not) conjugated, as the input or output of a map
+  auto plainIn = [&](long, long in, cx v) { return flip[in] ? 0.0 : v; };
+  auto conjIn = [&](long, long in, cx v) { return flip[in] ? v : 0.0; };
+  auto plainOut = [&](long out, long, cx v) { return flip[out] ? 0.0 : v; };
+  auto conjOut = [&](long out, long, cx v) {
+    return flip[out] ? std::conj(v) : 0.0;
+  };
+
+  // slotToCoeff: w = re + i*im in the first layer, then the sizes 4..n/2,
+  // then size n, mapped to the conjugated slots from conj(w)
+  long L = NTL::NumBits(n) - 1;
+  forward.resize(L);
+  for (long l : range(L)) {
+    Entries entries = butterflies(2L << l, /*invert=*/false);
+    if (l == 0) {
+      forward[l].a = toMatrix(entries, keep);
+      forward[l].b = toMatrix(entries, [](long, long, cx v) {
+        return cx(0, 1) * v;
+      });
+    } else if (l == L - 1) {
+      forward[l].a = toMatrix(entries, plainOut);
+      forward[l].b = toMatrix(entries, conjOut);
+    } else
+      forward[l].a = toMatrix(entries, keep);
+  }
+
+  // coeffToSlot: the inverse layers in the opposite order, the first one
+  // taking the conjugated slots from conj(ctxt), the last one split into
+  // the real and imaginary parts of w, (w + conj(w))/2 and (w - conj(w))/2i
+  inverse.resize(L);
+  for (long l : range(L)) {
+    Entries entries = butterflies(n >> l, /*invert=*/true);
+    if (l == 0) {
+      inverse[l].a = toMatrix(entries, plainIn);
+      inverse[l].b = toMatrix(entries, conjIn);
+    } else if (l == L - 1) {
+      inverse[l].a = toMatrix(entries, [](long, long, cx v) {
+        return v / 2.0;
+      });
+      inverse[l].b = toMatrix(entries, [](long, long, cx v) {
+        return std::conj(v) / 2.0;
+      });
+      imPart.a = toMatrix(entries, [](long, long, cx v) {
+        return v / cx(0, 2);
+      });
+      imPart.b = toMatrix(entries, [](long, long, cx v) {
+        return -std::conj(v) / cx(0, 2);
+      });
+    } else
+      inverse[l].a = toMatrix(entries, keep);
+  }
+}
+
+CKKSEvalMap::SparseMatrix CKKSEvalMap::encode(
+    const std::vector<std::vector<std::complex<double>>>& diags) const
+{
+  const Context& context = ea.getContext();
+  SparseMatrix mat;
+  for (long d : range(lsize(diags))) {
+    double size = diags[d].empty() ? 0.0 : max_abs(diags[d]);
+    if (size == 0.0)
+      continue;
+    zzX poly;
+    double factor = ea.getCx().encode(poly, diags[d]);
+    mat.offsets.push_back(d);
+    mat.diags.push_back(std::make_shared<DoubleCRTPrecon>(
+        DoubleCRT(poly, context, context.allPrimes())));
+    mat.sizes.push_back(size);
+    mat.factors.push_back(factor);
+  }
+  return mat;
+}
+
+Ctxt CKKSEvalMap::apply(const SparseMatrix& mat, const Ctxt& ctxt)
+{
+  // All the rotations of ctxt at once, sharing its digits
+  std::vector<long> amts;
+  for (long d : mat.offsets)
+    if (d != 0)
+      amts.push_back(-d);
+  std::vector<std::shared_ptr<Ctxt>> rotated;
+  hoistedRotate1D(rotated, ctxt, 0, amts);
+
+  Ctxt sum(ZeroCtxtLike, ctxt);
+  long next = 0;
+  for (long i : range(lsize(mat.offsets))) {
+    Ctxt term = (mat.offsets[i] == 0) ? ctxt : *rotated[next++];
+    term.multByConstantCKKS(*mat.diags[i],
+                            NTL::xdouble(mat.sizes[i]),
+                            NTL::xdouble(mat.factors[i]));
+    sum += term;
+  }
+  return sum;
+}
+
+Ctxt CKKSEvalMap::apply(const Layer& layer, const Ctxt& x, const Ctxt& y)
+{
+  Ctxt result = apply(layer.a, x);
+  if (!layer.b.offsets.empty())
+    result += apply(layer.b, y);
+  return result;
+}
+
+void CKKSEvalMap::coeffToSlot(Ctxt& re, Ctxt& im, const Ctxt& ctxt) const
+{
+  HELIB_TIMER_START;
+  Ctxt conj(ZeroCtxtLike, ctxt);
+  if (!inverse[0].b.offsets.empty()) {
+    conj = ctxt;
+    conj.complexConj();
+  }
+  Ctxt w = apply(inverse[0], ctxt, conj);
+  for (long l : range(1, lsize(inverse) - 1))
+    w = apply(inverse[l].a, w);
+  conj = w;
+  conj.complexConj();
+  re = apply(inverse.back(), w, conj);
+  im = apply(imPart, w, conj);
+}
+
+void CKKSEvalMap::slotToCoeff(Ctxt& ctxt, const Ctxt& re, const Ctxt& im) const
+{
+  HELIB_TIMER_START;
+  Ctxt w = apply(forward[0], re, im);
+  for (long l : range(1, lsize(forward) - 1))
+    w = apply(forward[l].a, w);
+  Ctxt conj(ZeroCtxtLike, w);
+  if (!forward.back().b.offsets.empty()) {
+    conj = w;
+    conj.complexConj();
+  }
+  ctxt = apply(forward.back(), w, conj);
+}
+
 } // namespace helib
@@ -0,0 +1,224 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <memory>
+
+#include <helib/GroupBy.h>
+#include <helib/EncryptedArray.h>
+#include <helib/matmul.h>
+#include <helib/norms.h>
+#include <helib/scheduler.h>
+#include <helib/tableLookup.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+namespace {
+
+// Rough costs in units of a rotation: a hoisted rotation shares the digits
+// of its ciphertext with the others, a mask is a pointwise product
+const double HOISTED_ROTATION_COST = 0.5;
+const double MASK_COST = 0.05;
+
+// Rotations of windowSum(x, b) by doubling the window
+long windowRotations(long b)
+{
+  return NTL::NumBits(b) - 1 + NTL::weight(b) - 1;
+}
+
+// Whether windowSum(x, b) takes the b - 1 rotations of x at once, hoisted,
+// rather than the windowRotations(b) rotations of the doubling in sequence
+bool hoistWindow(const EncryptedArray& ea, long b)
+{
+  return ea.dimension() == 1 && ea.nativeDimension(0) &&
+         (b - 1) * HOISTED_ROTATION_COST < windowRotations(b);
+}
+
+double windowCost(const EncryptedArray& ea, long b)
+{
+  return hoistWindow(ea, b) ? (b - 1) * HOISTED_ROTATION_COST
+                            : windowRotations(b);
+}
+
+// x[i] <- x[i] + x[i+1] + ... + x[i+b-1], either from all the rotations of
+// x at once or by doubling the window and adding one slot for every set bit
+// of b
+void windowSum(const EncryptedArray& ea, Ctxt& x, long b)
+{
+  if (b == 1)
+    return;
+  if (hoistWindow(ea, b)) {
+    std::vector<long> amts;
+    for (long j = 1; j < b; j++)
+      amts.push_back(-j);
+    std::vector<std::shared_ptr<Ctxt>> rotated;
+    hoistedRotate1D(rotated, x, 0, amts);
+    for (const auto& tmp : rotated)
+      x += *tmp;
+    return;
+  }
+  const Ctxt orig = x;
+  long len = 1;
+  for (long i = NTL::NumBits(b) - 2; i >= 0; i--) {
+    Ctxt tmp = x;
+    ea.rotate(tmp, -len);
+    x += tmp;
+    len *= 2;
+    if (NTL::bit(b, i)) {
+      ea.rotate(x, -1);
+      x += orig;
+      len++;
+    }
+  }
+}
+
+} // namespace
+
+GroupBy::GroupBy(const EncryptedArray& ea, long keyBits) :
+    ea(ea), keyBits(keyBits)
+{
+  assertInRange<InvalidArgument>(keyBits,
+                                 1l,
+                                 16l,
+                                 "Keys must have 1 to 16 bits",
+                                 /*right_inclusive=*/true);
+}
+
+long GroupBy::chooseWindow(long count) const
+{
+  // count window sums, n/b - 1 rotations to combine them and count * n/b
+  // masks
+  const long n = ea.size();
+  auto cost = [&](long b) {
+    return count * windowCost(ea, b) + (n / b - 1) +
+           MASK_COST * count * (n / b);
+  };
+  long best = n;
+  for (long b = 1; b <= n; b++)
+    if (n % b == 0 && cost(b) < cost(best))
+      best = b;
+  return best;
+}
+
+long GroupBy::numRotations(long count) const
+{
+  const long n = ea.size();
+  long total = 0;
+  for (long first = 0; first < count; first += n) {
+    const long chunk = std::min(n, count - first);
+    const long b = chooseWindow(chunk);
+    const long window = hoistWindow(ea, b) ? b - 1 : windowRotations(b);
+    total += chunk * window + n / b - 1;
+  }
+  return total;
+}
+
+void GroupBy::indicators(std::vector<Ctxt>& out, const CtPtrs& key) const
+{
+  HELIB_TIMER_START;
+  assertEq<InvalidArgument>(key.size(), keyBits, "Wrong number of key bits");
+  out.assign(numGroups(), Ctxt(ZeroCtxtLike, *key.ptr2nonNull()));
+  CtPtrs_vectorCt products(out);
+  computeAllProducts(products, key);
+}
+
+void GroupBy::aggregate(std::vector<Ctxt>& out,
+                        const CtPtrs& key,
+                        const std::vector<Ctxt>& values) const
+{
+  HELIB_TIMER_START;
+  const long nGroups = numGroups();
+  std::vector<Ctxt> ind;
+  indicators(ind, key);
+
+  std::vector<Ctxt> aggregates = ind;
+  aggregates.resize(nGroups * (1 + lsize(values)), ind[0]);
+  HELIB_EXEC_RANGE(nGroups * lsize(values), first, last)
+  for (long a = first; a < last; a++) {
+    Ctxt& sum = aggregates[nGroups + a];
+    sum = ind[a % nGroups];
+    sum.multiplyBy(values[a / nGroups]);
+  }
+  HELIB_EXEC_RANGE_END
+  reduce(out, aggregates);
+}
+
+void GroupBy::reduce(std::vector<Ctxt>& out, const std::vector<Ctxt>& in) const
+{
+  HELIB_TIMER_START;
+  const long n = ea.size();
+  out.clear();
+  if (in.empty())
+    return;
+
+  // The unit selectors of the slots that the chunks mask, encoded once for
+  // all of them over the primes of all the inputs
+  std::vector<long> widths(lsize(in));
+  std::vector<bool> used(n);
+  IndexSet primes;
+  for (long first = 0; first < lsize(in); first += n) {
+    const long count = std::min(n, lsize(in) - first);
+    const long b = chooseWindow(count);
+    for (long a = 0; a < count; a++) {
+      widths[first + a] = b;
+      for (long i = 0; i < n / b; i++)
+        used[(a + b * i) % n] = true;
+      primes.insert(in[first + a].getPrimeSet());
+    }
+  }
+  std::vector<std::unique_ptr<DoubleCRT>> units(n);
+  std::vector<double> unitSizes(n);
+  HELIB_EXEC_RANGE(n, lo, hi)
+  zzX unit;
+  for (long j = lo; j < hi; j++) {
+    if (!used[j])
+      continue;
+    ea.encodeUnitSelector(unit, j);
+    units[j].reset(new DoubleCRT(unit, ea.getContext(), primes));
+    unitSizes[j] = embeddingLargestCoeff(unit, ea.getPAlgebra());
+  }
+  HELIB_EXEC_RANGE_END
+
+  for (long first = 0; first < lsize(in); first += n) {
+    const long count = std::min(n, lsize(in) - first);
+    const long b = widths[first], steps = n / b;
+
+    std::vector<Ctxt> sums(in.begin() + first, in.begin() + first + count);
+    HELIB_EXEC_RANGE(count, lo, hi)
+    for (long a = lo; a < hi; a++)
+      windowSum(ea, sums[a], b);
+    HELIB_EXEC_RANGE_END
+
+    // z[i] holds the window of aggregate a at slot a + b*i, so that rotating
+    // it left by b*i brings the window there to slot a
+    std::vector<Ctxt> z(steps, Ctxt(ZeroCtxtLike, sums[0]));
+    HELIB_EXEC_RANGE(steps, lo, hi)
+    for (long i = lo; i < hi; i++)
+      for (long a = 0; a < count; a++) {
+        const long j = (a + b * i) % n;
+        Ctxt tmp = sums[a];
+        tmp.multByConstant(*units[j], unitSizes[j]);
+        z[i] += tmp;
+      }
+    HELIB_EXEC_RANGE_END
+
+    // sum_i rotate(z[i], -b*i), by Horner's rule
+    Ctxt acc = z[steps - 1];
+    for (long i = steps - 2; i >= 0; i--) {
+      ea.rotate(acc, -b);
+      acc += z[i];
+    }
+    out.push_back(acc);
+  }
+}
+
+} // namespace helib
@@ -0,0 +1,422 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include <helib/LinearModel.h>
+#include <helib/chebyshev.h>
+#include <helib/matmul.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+// The smallest power of two >= x
+static long powerOfTwoAtLeast(long x) { return 1L << NTL::NextPowerOfTwo(x); }
+
+// HYBRID sums z[j + i*out] for i < span/out; span is the smallest out*2^L
+// covering the diagonals, which reach from slot 0 up to slot in+out-2
+static long hybridSpan(long in, long out)
+{
+  long span = out;
+  while (span < in + out - 1)
+    span *= 2;
+  return span;
+}
+
+// An encryption of zero like ctxt, for outputs whose weights all vanish.
+// Ctxt(ZeroCtxtLike, ctxt) alone is empty, and an empty ciphertext cannot
+// take the bias or an activation, so zeros are encrypted into it.
+static Ctxt zeroLike(const EncryptedArray& ea, const Ctxt& ctxt)
+{
+  Ctxt zero(ZeroCtxtLike, ctxt);
+  ea.getCx().encrypt(zero,
+                     ctxt.getPubKey(),
+                     std::vector<double>(ea.size()),
+                     /*useThisSize=*/1.0);
+  return zero;
+}
+
+long LinearLayer::diagonalRotations(long in, long out) { return in + out - 2; }
+
+long LinearLayer::hybridRotations(long in, long out)
+{
+  long rotations = out - 1;
+  for (long e = out; e < hybridSpan(in, out); e *= 2)
+    rotations++;
+  return rotations;
+}
+
+long LinearLayer::diagonalBlockSize(long in, long out)
+{
+  return powerOfTwoAtLeast(std::max(in, out));
+}
+
+long LinearLayer::hybridBlockSize(long in, long out)
+{
+  return powerOfTwoAtLeast(hybridSpan(in, out));
+}
+
+LinearLayer::LinearLayer(const EncryptedArray& ea,
+                         const std::vector<std::vector<double>>& weights,
+                         const std::vector<double>& bias,
+                         SamplePacking packing,
+                         BlockEncoding encoding) :
+    ea(ea),
+    nIn(0),
+    nOut(lsize(weights)),
+    packing(packing),
+    encoding(encoding),
+    block(1),
+    span(0)
+{
+  assertEq(ea.getTag(), PA_cx_tag, "LinearLayer requires a CKKS context");
+  assertTrue<InvalidArgument>(nOut > 0, "LinearLayer without outputs");
+  nIn = lsize(weights[0]);
+  assertTrue<InvalidArgument>(nIn > 0, "LinearLayer without inputs");
+  for (const auto& row : weights)
+    assertEq<InvalidArgument>(lsize(row),
+                              nIn,
+                              "Rows of the weights differ in length");
+  assertTrue<InvalidArgument>(bias.empty() || lsize(bias) == nOut,
+                              "Bias size must be the number of outputs");
+
+  if (packing == SamplePacking::REPLICATED) {
+    this->weights = weights;
+    this->bias = bias;
+    this->encoding = BlockEncoding::AUTO;
+    return;
+  }
+
+  // Fewer rotations first, then zeros in the unused slots, within ea.size()
+  const long nslots = ea.size();
+  if (encoding == BlockEncoding::AUTO) {
+    bool hybrid =
+        hybridRotations(nIn, nOut) < diagonalRotations(nIn, nOut) &&
+        hybridBlockSize(nIn, nOut) <= nslots;
+    bool diagonalFits = diagonalBlockSize(nIn, nOut) <= nslots;
+    this->encoding = (hybrid || !diagonalFits) ? BlockEncoding::HYBRID
+                                               : BlockEncoding::DIAGONAL;
+  }
+  if (this->encoding == BlockEncoding::DIAGONAL) {
+    block = diagonalBlockSize(nIn, nOut);
+    span = nOut;
+  } else {
+    block = hybridBlockSize(nIn, nOut);
+    span = hybridSpan(nIn, nOut);
+  }
+  assertTrue<InvalidArgument>(block <= nslots,
+                              "LinearLayer does not fit in the slots");
+
+  // Input slot k+t is multiplied into output slot k by the diagonal of
+  // offset t, after rotating the ciphertext by -t. DIAGONAL has the
+  // offsets 1-out..in-1 for k < out. HYBRID has the offsets 1-out..0 for
+  // k < span, with the rows repeated every nOut slots, so that each weight
+  // lands in exactly one slot congruent to its row.
+  long tMax = (this->encoding == BlockEncoding::DIAGONAL) ? nIn - 1 : 0;
+  for (long t = 1 - nOut; t <= tMax; t++) {
+    std::vector<std::complex<double>> slots(nslots);
+    bool zero = true;
+    for (long k = 0; k < span; k++) {
+      long c = k + t;
+      if (c < 0 || c >= nIn)
+        continue;
+      double w = weights[k % nOut][c];
+      if (w == 0.0)
+        continue;
+      zero = false;
+      for (long s = 0; s < nslots; s += block)
+        slots[s + k] = w;
+    }
+    if (zero)
+      continue;
+    diagonals.emplace_back();
+    EncodedConst& diag = diagonals.back();
+    diag.amount = -t;
+    // The diagonals multiply every batch, so prepare them for that once
+    encodeSlots(diag, slots, /*prepare=*/true);
+  }
+
+  std::vector<std::complex<double>> slots(nslots);
+  for (long j = 0; j < lsize(bias); j++)
+    for (long s = 0; s < nslots; s += block)
+      slots[s + j] = bias[j];
+  encodeSlots(encodedBias, slots, /*prepare=*/false);
+}
+
+void LinearLayer::encodeSlots(EncodedConst& out,
+                              const std::vector<std::complex<double>>& slots,
+                              bool prepare) const
+{
+  out.size = max_abs(slots);
+  if (out.size == 0.0)
+    return;
+  if (!prepare) {
+    out.factor = ea.getCx().encode(out.poly, slots);
+    return;
+  }
+  NTL::ZZX poly;
+  out.factor = ea.getCx().encode(poly, slots);
+  const Context& context = ea.getContext();
+  out.prepared = std::make_shared<DoubleCRTPrecon>(
+      DoubleCRT(poly, context, context.allPrimes()));
+}
+
+long LinearLayer::numRotations() const
+{
+  if (packing == SamplePacking::REPLICATED)
+    return 0;
+  long rotations = 0;
+  for (const EncodedConst& diag : diagonals)
+    if (diag.amount != 0)
+      rotations++;
+  for (long e = nOut; e < span; e *= 2)
+    rotations++;
+  return rotations;
+}
+
+void LinearLayer::apply(std::vector<Ctxt>& ctxts) const
+{
+  if (packing == SamplePacking::REPLICATED) {
+    applyReplicated(ctxts);
+    return;
+  }
+  for (Ctxt& ctxt : ctxts)
+    applyBlocks(ctxt);
+}
+
+void LinearLayer::applyBlocks(Ctxt& ctxt) const
+{
+  HELIB_TIMER_START;
+  assertTrue(ctxt.isCKKS(), "LinearLayer requires a CKKS ciphertext");
+  assertEq(ea.size() % block, 0l, "Block size must divide ea.size()");
+
+  // All the rotations of the input at once, sharing its digits
+  std::vector<long> amts;
+  for (const EncodedConst& diag : diagonals)
+    if (diag.amount != 0)
+      amts.push_back(diag.amount);
+  std::vector<std::shared_ptr<Ctxt>> rotated;
+  hoistedRotate1D(rotated, ctxt, 0, amts);
+
+  Ctxt sum(ZeroCtxtLike, ctxt);
+  long next = 0;
+  for (const EncodedConst& diag : diagonals) {
+    Ctxt term = (diag.amount == 0) ? ctxt : *rotated[next++];
+    term.multByConstantCKKS(*diag.prepared,
+                            NTL::xdouble(diag.size),
+                            NTL::xdouble(diag.factor));
+    sum += term;
+  }
+  if (sum.isEmpty())
+    sum = zeroLike(ea, ctxt);
+
+  // HYBRID: output j is the sum of the slots j + i*nOut
+  for (long e = nOut; e < span; e *= 2) {
+    Ctxt tmp = sum;
+    ea.rotate1D(tmp, 0, -e);
+    sum += tmp;
+  }
+
+  if (encodedBias.size != 0.0)
+    sum.addConstantCKKS(encodedBias.poly,
+                        NTL::xdouble(encodedBias.size),
+                        NTL::xdouble(encodedBias.factor));
+  ctxt = sum;
+}
+
+void LinearLayer::applyReplicated(std::vector<Ctxt>& ctxts) const
+{
+  HELIB_TIMER_START;
+  assertEq(lsize(ctxts), nIn, "Expected one ciphertext per input");
+
+  std::vector<Ctxt> outputs(nOut, Ctxt(ZeroCtxtLike, ctxts[0]));
+  for (long j = 0; j < nOut; j++) {
+    for (long c = 0; c < nIn; c++) {
+      double w = weights[j][c];
+      if (w == 0.0)
+        continue;
+      // The ratFactor must stay positive, so negate rather than scale by w
+      Ctxt term = ctxts[c];
+      if (w < 0)
+        term.negate();
+      term.multByConstantCKKS(std::abs(w));
+      outputs[j] += term;
+    }
+    if (outputs[j].isEmpty())
+      outputs[j] = zeroLike(ea, ctxts[0]);
+    if (!bias.empty() && bias[j] != 0.0)
+      outputs[j].addConstantCKKS(bias[j]);
+  }
+  ctxts.swap(outputs);
+}
+
+LinearModel::LinearModel(const EncryptedArray& ea, SamplePacking packing) :
+    ea(ea), packing(packing)
+{}
+
+LinearModel& LinearModel::addLayer(
+    const std::vector<std::vector<double>>& weights,
+    const std::vector<double>& bias,
+    BlockEncoding encoding)
+{
+  layers.emplace_back(ea, weights, bias, packing, encoding);
+  if (layers.size() > 1)
+    assertEq<InvalidArgument>(layers.back().numInputs(),
+                              layers[layers.size() - 2].numOutputs(),
+                              "Layer inputs do not match the previous outputs");
+  activations.emplace_back(nullptr);
+  return *this;
+}
+
+LinearModel& LinearModel::addActivation(const ChebyshevApprox& f)
+{
+  assertFalse<LogicError>(layers.empty(), "Activation before any layer");
+  activations.back() = std::make_shared<const ChebyshevApprox>(f);
+  return *this;
+}
+
+long LinearModel::numInputs() const
+{
+  assertFalse<LogicError>(layers.empty(), "LinearModel without layers");
+  return layers.front().numInputs();
+}
+
+long LinearModel::numOutputs() const
+{
+  assertFalse<LogicError>(layers.empty(), "LinearModel without layers");
+  return layers.back().numOutputs();
+}
+
+long LinearModel::blockSize() const
+{
+  long block = 1; // powers of two, so the largest is a multiple of all
+  for (const LinearLayer& layer : layers)
+    block = std::max(block, layer.blockSize());
+  return block;
+}
+
+long LinearModel::ctxtsPerBatch() const
+{
+  return (packing == SamplePacking::REPLICATED) ? numInputs() : 1;
+}
+
+long LinearModel::depth() const
+{
+  long d = 0;
+  for (long i = 0; i < lsize(layers); i++) {
+    d += layers[i].depth();
+    if (activations[i])
+      d += activations[i]->depth();
+  }
+  return d;
+}
+
+long LinearModel::numRotations() const
+{
+  long rotations = 0;
+  for (const LinearLayer& layer : layers)
+    rotations += layer.numRotations();
+  return rotations;
+}
+
+void LinearModel::evaluate(std::vector<Ctxt>& batch) const
+{
+  HELIB_TIMER_START;
+  assertEq(lsize(batch), ctxtsPerBatch(), "Wrong number of ciphertexts");
+  for (long i = 0; i < lsize(layers); i++) {
+    layers[i].apply(batch);
+    if (activations[i])
+      for (Ctxt& ctxt : batch)
+        activations[i]->evaluate(ctxt);
+  }
+}
+
+std::vector<std::vector<double>> LinearModel::encodeBatch(
+    const std::vector<std::vector<double>>& samples) const
+{
+  assertTrue<InvalidArgument>(lsize(samples) <= samplesPerBatch(),
+                              "Too many samples for one batch");
+  const long nslots = ea.size();
+  const long block = blockSize();
+  std::vector<std::vector<double>> slots(ctxtsPerBatch(),
+                                         std::vector<double>(nslots));
+  for (long s = 0; s < lsize(samples); s++) {
+    assertEq<InvalidArgument>(lsize(samples[s]),
+                              numInputs(),
+                              "Wrong number of features");
+    for (long c = 0; c < numInputs(); c++) {
+      if (packing == SamplePacking::REPLICATED)
+        slots[c][s] = samples[s][c];
+      else
+        slots[0][s * block + c] = samples[s][c];
+    }
+  }
+  return slots;
+}
+
+std::vector<std::vector<double>> LinearModel::decodeBatch(
+    const std::vector<std::vector<double>>& slots,
+    long nSamples) const
+{
+  assertInRange(nSamples,
+                0l,
+                samplesPerBatch(),
+                "Number of samples out of range",
+                true);
+  const long nOut = numOutputs();
+  const long block = blockSize();
+  assertEq<InvalidArgument>(lsize(slots),
+                            packing == SamplePacking::REPLICATED ? nOut : 1l,
+                            "Wrong number of slot vectors");
+  std::vector<std::vector<double>> outputs(nSamples,
+                                           std::vector<double>(nOut));
+  for (long s = 0; s < nSamples; s++)
+    for (long j = 0; j < nOut; j++)
+      outputs[s][j] = (packing == SamplePacking::REPLICATED)
+                          ? slots[j][s]
+                          : slots[0][s * block + j];
+  return outputs;
+}
+
+SamplePacking LinearModel::choosePacking(const EncryptedArray& ea,
+                                         long nSamples,
+                                         const std::vector<long>& widths)
+{
+  assertTrue<InvalidArgument>(widths.size() >= 2, "A model needs a layer");
+  const long nslots = ea.size();
+
+  // Multiply-and-adds by constants per batch, the encryption included
+  long replicated = widths[0] * KEY_SWITCH_COST;
+  long blocks = KEY_SWITCH_COST;
+  long block = 1;
+  for (long l = 0; l + 1 < lsize(widths); l++) {
+    long in = widths[l], out = widths[l + 1];
+    replicated += in * out;
+    long diagonal = LinearLayer::diagonalRotations(in, out);
+    long hybrid = LinearLayer::hybridRotations(in, out);
+    if (hybrid < diagonal) {
+      blocks += hybrid * KEY_SWITCH_COST + out;
+      block = std::max(block, LinearLayer::hybridBlockSize(in, out));
+    } else {
+      blocks += diagonal * KEY_SWITCH_COST + in + out - 1;
+      block = std::max(block, LinearLayer::diagonalBlockSize(in, out));
+    }
+  }
+  if (block > nslots)
+    return SamplePacking::REPLICATED;
+  replicated *= divc(nSamples, nslots);
+  blocks *= divc(nSamples, nslots / block);
+  return (blocks <= replicated) ? SamplePacking::BLOCKS
+                                : SamplePacking::REPLICATED;
+}
+
+} // namespace helib
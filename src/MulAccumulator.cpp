@@ -0,0 +1,126 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <helib/MulAccumulator.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+MulAccumulator::MulAccumulator(const PubKey& pubKey) :
+    pubKey(pubKey), sum(pubKey), rest(pubKey)
+{}
+
+bool MulAccumulator::canDefer(const Ctxt& ctxt) const
+{
+  if (ctxt.isCKKS())
+    return false;
+  if (acc.empty())
+    return true;
+  if (ctxt.primeSet != sum.primeSet || ctxt.ptxtSpace != sum.ptxtSpace ||
+      ctxt.intFactor != sum.intFactor || ctxt.parts.size() != sum.parts.size())
+    return false;
+  for (std::size_t k = 0; k < ctxt.parts.size(); k++)
+    if (!(ctxt.parts[k].skHandle == sum.parts[k].skHandle))
+      return false;
+  return true;
+}
+
+template <typename DCRT>
+void MulAccumulator::mulAddImpl(const DCRT& c,
+                                const DoubleCRT& dcrt,
+                                const Ctxt& ctxt,
+                                double size,
+                                Ctxt* scratch)
+// scratch is either null or the (modifiable) ctxt itself
+{
+  assertEq(&pubKey, &ctxt.getPubKey(), "Public key mismatch");
+  if (ctxt.isEmpty())
+    return;
+
+  if (!canDefer(ctxt)) {
+    if (scratch) {
+      scratch->multByConstant(c, size);
+      rest += *scratch;
+    } else {
+      Ctxt tmp(ctxt);
+      tmp.multByConstant(c, size);
+      rest += tmp;
+    }
+    return;
+  }
+
+  // The default size, as in Ctxt::multByConstant
+  const Context& context = ctxt.getContext();
+  if (size < 0.0)
+    size = context.noiseBoundForMod(ctxt.ptxtSpace, context.zMStar.getPhiM());
+
+  if (acc.empty()) {
+    sum = ctxt; // shares the rows of ctxt, which are replaced by addTo
+    sum.noiseBound = 0;
+    for (std::size_t k = 0; k < ctxt.parts.size(); k++)
+      acc.emplace_back(context, ctxt.primeSet);
+  }
+  for (std::size_t k = 0; k < ctxt.parts.size(); k++)
+    acc[k].mulAdd(ctxt.parts[k], dcrt);
+  sum.noiseBound += ctxt.noiseBound * size;
+}
+
+void MulAccumulator::mulAdd(const DoubleCRT& c, const Ctxt& ctxt, double size)
+{
+  HELIB_TIMER_START;
+  mulAddImpl(c, c, ctxt, size, nullptr);
+}
+
+void MulAccumulator::mulAdd(const DoubleCRTPrecon& c,
+                            const Ctxt& ctxt,
+                            double size)
+{
+  HELIB_TIMER_START;
+  mulAddImpl(c, c.getDCRT(), ctxt, size, nullptr);
+}
+
+void MulAccumulator::destMulAdd(const DoubleCRT& c, Ctxt& ctxt, double size)
+{
+  HELIB_TIMER_START;
+  mulAddImpl(c, c, ctxt, size, &ctxt);
+}
+
+void MulAccumulator::destMulAdd(const DoubleCRTPrecon& c,
+                                Ctxt& ctxt,
+                                double size)
+{
+  HELIB_TIMER_START;
+  mulAddImpl(c, c.getDCRT(), ctxt, size, &ctxt);
+}
+
+void MulAccumulator::add(const Ctxt& ctxt)
+{
+  assertEq(&pubKey, &ctxt.getPubKey(), "Public key mismatch");
+  rest += ctxt;
+}
+
+void MulAccumulator::addTo(Ctxt& out)
+{
+  HELIB_TIMER_START;
+  if (!acc.empty()) {
+    for (std::size_t k = 0; k < acc.size(); k++)
+      acc[k].reduce(sum.parts[k]);
+    out += sum;
+  }
+  if (!rest.isEmpty())
+    out += rest;
+
+  acc.clear();
+  sum.clear();
+  rest.clear();
+}
+
+} // namespace helib
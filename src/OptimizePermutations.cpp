@@ -15,6 +15,7 @@
 
 #include <cstdlib>
 #include <list>
+#include <map>
 #include <sstream>
 #include <memory>
 
@@ -22,6 +23,7 @@
 #include <helib/NumbTh.h>
 #include <helib/EncryptedArray.h>
 #include <helib/permutations.h>
+#include <helib/multicore.h>
 #include <helib/apiAttributes.h>
 
 namespace helib {
@@ -33,6 +35,16 @@ class ClassHash
 public:
   size_t operator()(const T& t) const { return t.hash(); }
 };
+
+// Combine a few small integers into a hash value. This is called for every
+// lookup in the memo tables, so it should not go through a string.
+static inline size_t hashLongs(std::initializer_list<long> vals)
+{
+  size_t h = 0;
+  for (long v : vals)
+    h = h * 1000003 ^ std::hash<long>()(v);
+  return h;
+}
 //! \endcond
 
 // routines for finding optimal level-collapsing strategies for Benes networks
@@ -239,12 +251,7 @@ public:
     budget = _budget;
   }
 
-  size_t hash() const
-  {
-    std::stringstream s;
-    s << i << " " << budget;
-    return std::hash<std::string>()(s.str());
-  }
+  size_t hash() const { return hashLongs({i, budget}); }
 
   bool operator==(const BenesMemoKey& other) const
   {
@@ -350,7 +357,8 @@ BenesMemoEntry optimalBenesAux(long i,
 //   budget = an upper bound on the number of levels in the collapsed network
 //   good = flag indicating whether this is with respect to a "good" generator,
 //     for which shifts by i and i-n correspond to the same rotation
-//   cost = total number of shifts needed by the collapsed network
+//   cost = total cost of the collapsed network, where a level with s shifts
+//     costs s*shiftCost + (s+1)*maskCost (by default, the number of shifts)
 //   solution = list indicating how levels in a standard benes network
 //      are collapsed: if solution = [s_1 s_2 ... s_k], then k <= budget,
 //      and the first s_1 levels are collapsed, the next s_2 levels
@@ -359,7 +367,9 @@ void optimalBenes(long n,
                   long budget,
                   bool good,
                   long& cost,
-                  LongNodePtr& solution)
+                  LongNodePtr& solution,
+                  long shiftCost = 1,
+                  long maskCost = 0)
 {
   long k = GeneralBenesNetwork::depth(n); // k = ceiling(log_2 n)
   long nlev = 2 * k - 1; // before collapsing, we have 2k-1 levels
@@ -370,6 +380,12 @@ void optimalBenes(long n,
   buildBenesCostTable(n, k, good, costTab);
   // Compute the cost for all (n choose 2) possible ways to collapse levels.
 
+  if (shiftCost != 1 || maskCost != 0) { // weigh the shifts by their cost
+    for (long i = 0; i < costTab.length(); i++)
+      for (long j = 0; j < costTab[i].length(); j++)
+        costTab[i][j] = costTab[i][j] * shiftCost + (costTab[i][j] + 1) * maskCost;
+  }
+
   BenesMemoTable memoTab;
   BenesMemoEntry t = optimalBenesAux(0, budget, nlev, costTab, memoTab);
   // Compute the optimal collapsing of layers in a width-n Benes network
@@ -471,30 +487,31 @@ std::ostream& operator<<(std::ostream& s, SplitNodePtr p)
 class LowerMemoKey
 {
 public:
-  long order;  // size of hypercube corresponding to this sub-tree
-  bool good;   // is this a good subtree
-  long budget; // max-depth of network(s) associated to this node
-  long mid;    // whether or not this is the middle layer of the network
+  long order;     // size of hypercube corresponding to this sub-tree
+  bool good;      // is this a good subtree
+  long budget;    // max-depth of network(s) associated to this node
+  long mid;       // whether or not this is the middle layer of the network
+  long shiftCost; // the cost of a shift along this generator
 
-  LowerMemoKey(long _order, bool _good, long _budget, long _mid)
+  LowerMemoKey(long _order, bool _good, long _budget, long _mid, long _shift)
   {
     order = _order;
     good = _good;
     budget = _budget;
     mid = _mid;
+    shiftCost = _shift;
   }
 
   size_t hash() const
   {
-    std::stringstream s;
-    s << order << " " << good << " " << budget << " " << mid;
-    return std::hash<std::string>()(s.str());
+    return hashLongs({order, good, budget, mid, shiftCost});
   }
 
   bool operator==(const LowerMemoKey& other) const
   {
     return order == other.order && good == other.good &&
-           budget == other.budget && mid == other.mid;
+           budget == other.budget && mid == other.mid &&
+           shiftCost == other.shiftCost;
   }
 };
 
@@ -586,12 +603,7 @@ public:
     mid = _mid;
   }
 
-  size_t hash() const
-  {
-    std::stringstream s;
-    s << i << " " << budget << " " << mid;
-    return std::hash<std::string>()(s.str());
-  }
+  size_t hash() const { return hashLongs({i, budget, mid}); }
 
   bool operator==(const UpperMemoKey& other) const
   {
@@ -622,11 +634,15 @@ typedef std::
 // Optimize a single tree: try all possible ways of splitting the order into
 // order1*order2 (and also the solution of not splitting at all). For every
 // possible split, try all budget allocations and allocations of good and mid.
+// The shiftCost is the cost of a shift along this generator, maskCost is the
+// cost of multiplying by a mask (the defaults count the number of shifts).
 LowerMemoEntry optimalLower(long order,
                             bool good,
                             long budget,
                             long mid,
-                            LowerMemoTable& lowerMemoTable)
+                            LowerMemoTable& lowerMemoTable,
+                            long shiftCost = 1,
+                            long maskCost = 0)
 {
   assertTrue<InvalidArgument>(order > 1, "Order must be greater than 1");
   assertTrue<InvalidArgument>(mid == 0 || mid == 1, "mid value is not 1 or 2");
@@ -634,7 +650,7 @@ LowerMemoEntry optimalLower(long order,
 
   // Did we already solve this problem? If so just return the solution.
   LowerMemoTable::iterator find =
-      lowerMemoTable.find(LowerMemoKey(order, good, budget, mid));
+      lowerMemoTable.find(LowerMemoKey(order, good, budget, mid, shiftCost));
 
   if (find != lowerMemoTable.end()) {
     return find->second;
@@ -655,19 +671,37 @@ LowerMemoEntry optimalLower(long order,
     if (mid == 1) {
       // this is the middle node, so just one Benes network
 
-      optimalBenes(order, budget, good, cost, benesSolution1);
+      optimalBenes(order,
+                   budget,
+                   good,
+                   cost,
+                   benesSolution1,
+                   shiftCost,
+                   maskCost);
       benesSolution2 = LongNodePtr();
     } else {
       // not the middle node, so we need two Benes networks.
       // if budget is odd, we split it unevenly
 
       long cost1, cost2;
-      optimalBenes(order, budget / 2, good, cost1, benesSolution1);
+      optimalBenes(order,
+                   budget / 2,
+                   good,
+                   cost1,
+                   benesSolution1,
+                   shiftCost,
+                   maskCost);
       if (budget % 2 == 0) { // both networks have the same budget
         cost2 = cost1;
         benesSolution2 = benesSolution1;
       } else { // one network has budget larger by one than the other
-        optimalBenes(order, budget - budget / 2, good, cost2, benesSolution2);
+        optimalBenes(order,
+                     budget - budget / 2,
+                     good,
+                     cost2,
+                     benesSolution2,
+                     shiftCost,
+                     maskCost);
       }
 
       cost = cost1 + cost2;
@@ -709,15 +743,22 @@ LowerMemoEntry optimalLower(long order,
         // A slick way of giving the middle token to one of the
         // nodes if we have it, and to none of the nodes if we don't
         for (long mid1 = 0; mid1 <= mid; mid1++) {
-          LowerMemoEntry s1 =
-              optimalLower(order1, good1, budget1, mid1, lowerMemoTable);
-          // FIXME: If s1.cost==NTL_MAX_LONG we do not need to compute
-          //        the cost of s2
+          LowerMemoEntry s1 = optimalLower(order1,
+                                           good1,
+                                           budget1,
+                                           mid1,
+                                           lowerMemoTable,
+                                           shiftCost,
+                                           maskCost);
+          if (s1.cost == NTL_MAX_LONG)
+            continue; // no need to compute the cost of s2
           LowerMemoEntry s2 = optimalLower(order / order1,
                                            good2,
                                            budget - budget1,
                                            mid - mid1,
-                                           lowerMemoTable);
+                                           lowerMemoTable,
+                                           shiftCost,
+                                           maskCost);
           if (s1.cost != NTL_MAX_LONG && s2.cost != NTL_MAX_LONG &&
               s1.cost + s2.cost < cost) {
             cost = s1.cost + s2.cost;
@@ -731,7 +772,7 @@ LowerMemoEntry optimalLower(long order,
   }
 
   // Record the best solution in the lowerMemoTable and return it
-  return lowerMemoTable[LowerMemoKey(order, good, budget, mid)] =
+  return lowerMemoTable[LowerMemoKey(order, good, budget, mid, shiftCost)] =
              LowerMemoEntry(cost, solution);
 }
 
@@ -743,7 +784,8 @@ UpperMemoEntry optimalUpperAux(const NTL::Vec<GenDescriptor>& vec,
                                long budget,
                                long mid,
                                UpperMemoTable& upperMemoTable,
-                               LowerMemoTable& lowerMemoTable)
+                               LowerMemoTable& lowerMemoTable,
+                               const PermCostModel& model)
 {
   assertInRange<InvalidArgument>(i,
                                  0l,
@@ -788,9 +830,11 @@ UpperMemoEntry optimalUpperAux(const NTL::Vec<GenDescriptor>& vec,
                                         vec[i].good,
                                         budget1,
                                         mid1,
-                                        lowerMemoTable);
-        // FIXME: If s.cost==NTL_MAX_LONG we do not need to compute
-        //        the cost of t
+                                        lowerMemoTable,
+                                        model.shiftCost(vec[i].genIdx),
+                                        model.maskCost);
+        if (s.cost == NTL_MAX_LONG)
+          continue; // no need to compute the cost of t
 
         // Optimize the rest of the list with the remaining budget and mid
         UpperMemoEntry t = optimalUpperAux(vec,
@@ -798,7 +842,8 @@ UpperMemoEntry optimalUpperAux(const NTL::Vec<GenDescriptor>& vec,
                                            budget - budget1,
                                            mid - mid1,
                                            upperMemoTable,
-                                           lowerMemoTable);
+                                           lowerMemoTable,
+                                           model);
         if (s.cost != NTL_MAX_LONG && t.cost != NTL_MAX_LONG &&
             s.cost + t.cost < bestCost) {
           bestCost = s.cost + t.cost;
@@ -938,10 +983,67 @@ static long copyToGenTree(OneGeneratorTree& gTree, SplitNodePtr& solution)
   return len;
 }
 
+// A cache of optimized plans, keyed by the generators, the depth bound and
+// the cost model. Building the trees for a large hypercube takes much longer
+// than copying them, and the same permutation shape is typically requested
+// many times (e.g., once per PermNetwork).
+namespace {
+class PlanCache
+{
+  static constexpr std::size_t MAX_ENTRIES = 256;
+
+  HELIB_MUTEX_TYPE mtx;
+  std::map<std::vector<long>, std::pair<long, GeneratorTrees>> plans;
+
+public:
+  static PlanCache& instance()
+  {
+    static PlanCache cache;
+    return cache;
+  }
+
+  static std::vector<long> makeKey(const NTL::Vec<GenDescriptor>& gens,
+                                   long depthBound,
+                                   const PermCostModel& model)
+  {
+    std::vector<long> key{depthBound};
+    model.serialize(key);
+    for (long i = 0; i < gens.length(); i++) {
+      key.push_back(gens[i].genIdx);
+      key.push_back(gens[i].order);
+      key.push_back(gens[i].good);
+    }
+    return key;
+  }
+
+  bool lookup(const std::vector<long>& key, long& cost, GeneratorTrees& trees)
+  {
+    HELIB_MUTEX_GUARD(mtx);
+    auto it = plans.find(key);
+    if (it == plans.end())
+      return false;
+    cost = it->second.first;
+    trees = it->second.second;
+    return true;
+  }
+
+  void insert(const std::vector<long>& key,
+              long cost,
+              const GeneratorTrees& trees)
+  {
+    HELIB_MUTEX_GUARD(mtx);
+    if (plans.size() >= MAX_ENTRIES)
+      plans.clear(); // crude, but plans are cheap to recompute
+    plans[key] = std::make_pair(cost, trees);
+  }
+};
+} // namespace
+
 // Compute the trees corresponding to the "optimal" way of breaking
 // a permutation into dimensions, subject to some constraints
 long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
-                                       long depthBound)
+                                       long depthBound,
+                                       const PermCostModel& model)
 {
   // TODO: is this check necessary?
   assertTrue<InvalidArgument>(gens.length() >= 0, "negative gens size");
@@ -954,6 +1056,12 @@ long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
   }
   assertTrue<InvalidArgument>(depthBound > 0, "Zero or negative depthBound");
 
+  // Did we already optimize this shape under this model?
+  std::vector<long> key = PlanCache::makeKey(gens, depthBound, model);
+  long cachedCost;
+  if (PlanCache::instance().lookup(key, cachedCost, *this))
+    return cachedCost;
+
   // reset the trees, starting from only the roots
   for (long i = 0; i < trees.length(); i++) {
     if (trees[i].getNleaves() > 1) // tree is not empty/trivial
@@ -964,8 +1072,36 @@ long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
   LowerMemoTable lowerMemoTable;
 
   // Compute a solution in { t.cost, t.solution }
-  UpperMemoEntry t =
-      optimalUpperAux(gens, 0, depthBound, 1, upperMemoTable, lowerMemoTable);
+  UpperMemoEntry t;
+  if (model.depthCost <= 0) { // only the network cost matters
+    t = optimalUpperAux(gens,
+                        0,
+                        depthBound,
+                        1,
+                        upperMemoTable,
+                        lowerMemoTable,
+                        model);
+  } else { // trade depth for cost, the memo tables are shared by all budgets
+    long bestTotal = NTL_MAX_LONG;
+    for (long budget = 1; budget <= depthBound; budget++) {
+      UpperMemoEntry tb = optimalUpperAux(gens,
+                                          0,
+                                          budget,
+                                          1,
+                                          upperMemoTable,
+                                          lowerMemoTable,
+                                          model);
+      if (tb.cost == NTL_MAX_LONG)
+        continue;
+      long total = tb.cost + model.depthCost * budget;
+      if (total < bestTotal) {
+        bestTotal = total;
+        t = tb;
+      }
+    }
+    if (bestTotal == NTL_MAX_LONG)
+      t.cost = NTL_MAX_LONG;
+  }
 
   // Copy the solution into the trees
   GenNodePtr midPtr;
@@ -990,6 +1126,7 @@ long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
     trees.kill();
     map2cube.kill();
     map2array.kill();
+    PlanCache::instance().insert(key, NTL_MAX_LONG, *this);
     return NTL_MAX_LONG;
   }
 
@@ -1011,6 +1148,7 @@ long GeneratorTrees::buildOptimalTrees(const NTL::Vec<GenDescriptor>& gens,
   std::cerr << std::endl;
 #endif
 
+  PlanCache::instance().insert(key, t.cost, *this);
   return t.cost;
 }
 
@@ -9,9 +9,12 @@
  * See the License for the specific language governing permissions and
  * limitations under the License. See accompanying LICENSE file.
  */
+#include <algorithm>
+#include <cmath>
 #include <NTL/ZZ.h>
 #include <helib/Context.h>
 #include <helib/Ctxt.h>
+#include <helib/keys.h>
 #include <helib/permutations.h>
 #include <helib/EncryptedArray.h>
 
@@ -258,4 +261,58 @@ void PermNetwork::applyToCtxt(Ctxt& c, const EncryptedArray& ea) const
   }
 }
 
+// Time the operations that a permutation network is made of
+void PermCostModel::calibrate(const EncryptedArray& ea,
+                              const PubKey& pubKey,
+                              long trials)
+{
+  assertTrue<InvalidArgument>(trials > 0, "Number of trials must be positive");
+  const PAlgebra& al = ea.getPAlgebra();
+
+  Ctxt ctxt(pubKey);
+  pubKey.Encrypt(ctxt, NTL::ZZX(0));
+
+  // The time of multiplying by a (non-trivial) mask
+  std::vector<long> mask(ea.size());
+  for (long i = 0; i < lsize(mask); i++)
+    mask[i] = i % 2;
+  NTL::ZZX maskPoly;
+  ea.encode(maskPoly, mask);
+  double maskTime = 0.0;
+  for (long t = 0; t < trials; t++) {
+    Ctxt tmp = ctxt;
+    double start = NTL::GetTime();
+    tmp.multByConstant(maskPoly);
+    double elapsed = NTL::GetTime() - start;
+    if (t == 0 || elapsed < maskTime)
+      maskTime = elapsed;
+  }
+
+  // The time of a single shift along each of the generators
+  NTL::Vec<double> shiftTimes(NTL::INIT_SIZE, ea.dimension());
+  double minShift = 0.0;
+  for (long i = 0; i < ea.dimension(); i++) {
+    for (long t = 0; t < trials; t++) {
+      Ctxt tmp = ctxt;
+      double start = NTL::GetTime();
+      tmp.smartAutomorph(al.ZmStarGen(i));
+      double elapsed = NTL::GetTime() - start;
+      if (t == 0 || elapsed < shiftTimes[i])
+        shiftTimes[i] = elapsed;
+    }
+    if (i == 0 || shiftTimes[i] < minShift)
+      minShift = shiftTimes[i];
+  }
+  if (minShift <= 0.0) // too fast to measure, keep the current model
+    return;
+
+  // Scale everything so that the cheapest shift costs 100
+  double scale = 100.0 / minShift;
+  defaultShiftCost = 100;
+  maskCost = std::lround(maskTime * scale);
+  shiftCosts.SetLength(0);
+  for (long i = 0; i < ea.dimension(); i++)
+    setShiftCost(i, std::max(1L, std::lround(shiftTimes[i] * scale)));
+}
+
 } // namespace helib
@@ -0,0 +1,127 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <cstdio>
+#include <fstream>
+
+#include <helib/ReKeyer.h>
+#include <helib/keys.h>
+#include <helib/scheduler.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+ReKeyer::ReKeyer(const PubKey& newKey, long importedKeyID, long oldKeyID) :
+    newKey(newKey), importedKeyID(importedKeyID), oldKeyID(oldKeyID)
+{
+  assertTrue<InvalidArgument>(importedKeyID > 0,
+                              "The imported key cannot be key 0");
+  assertTrue<InvalidArgument>(newKey.haveKeySWmatrix(1, 1, importedKeyID, 0),
+                              "No re-keying matrix, call GenReKeyMatrix");
+}
+
+void ReKeyer::switchKey(Ctxt& ctxt) const
+{
+  assertTrue(ctxt.inCanonicalForm(oldKeyID),
+             "Can only re-key ciphertexts in canonical form");
+  if (ctxt.parts.size() > 1)
+    ctxt.parts[1].skHandle.setBase(importedKeyID);
+  ctxt.reLinearize(0);
+}
+
+void ReKeyer::reKey(Ctxt& out, const Ctxt& in) const
+{
+  HELIB_TIMER_START;
+  assertEq(&out.getPubKey(), &newKey, "Output is not of the new key");
+  assertEq(&in.getContext(),
+           &newKey.getContext(),
+           "Cannot re-key between different contexts");
+
+  Ctxt tmp = in;
+  tmp.reLinearize(oldKeyID); // with the old key, if needed
+  out.privateAssign(tmp);
+  switchKey(out);
+}
+
+void ReKeyer::reKey(std::vector<Ctxt>& out, const std::vector<Ctxt>& in) const
+{
+  HELIB_TIMER_START;
+  out.clear();
+  out.resize(in.size(), Ctxt(newKey));
+  HELIB_EXEC_RANGE(long(in.size()), first, last)
+  for (long i = first; i < last; i++)
+    reKey(out[i], in[i]);
+  HELIB_EXEC_RANGE_END
+}
+
+long ReKeyer::reKeyFile(const std::string& path, long batchSize) const
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(batchSize > 0, "Batch size must be positive");
+
+  std::ifstream inFile(path, std::ios::binary);
+  if (!inFile)
+    throw IOError("Could not open " + path);
+  const std::string tmpPath = path + ".rekey";
+  std::ofstream outFile(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!outFile)
+    throw IOError("Could not open " + tmpPath);
+
+  long count = 0;
+  std::vector<Ctxt> batch;
+  try {
+    while (inFile.peek() != std::ifstream::traits_type::eof()) {
+      // Read the ciphertexts as ciphertexts of the new key, which only
+      // differ in the key ID of their parts
+      batch.clear();
+      while (lsize(batch) < batchSize &&
+             inFile.peek() != std::ifstream::traits_type::eof()) {
+        batch.emplace_back(newKey);
+        batch.back().read(inFile);
+        if (!inFile)
+          throw IOError("Could not read from " + path);
+
+        // Without the old key's matrices the file cannot be re-linearized
+        // here, so it must hold canonical ciphertexts only
+        if (!batch.back().inCanonicalForm(oldKeyID))
+          throw InvalidArgument("Ciphertext " +
+                                std::to_string(count + lsize(batch) - 1) +
+                                " of " + path +
+                                " is not in canonical form, re-linearize it"
+                                " before re-keying the file");
+      }
+
+      HELIB_EXEC_RANGE(lsize(batch), first, last)
+      for (long i = first; i < last; i++)
+        switchKey(batch[i]);
+      HELIB_EXEC_RANGE_END
+
+      for (const Ctxt& ctxt : batch)
+        ctxt.write(outFile);
+      if (!outFile)
+        throw IOError("Could not write to " + tmpPath);
+      count += lsize(batch);
+    }
+  } catch (...) {
+    // Leave only the original file behind
+    outFile.close();
+    std::remove(tmpPath.c_str());
+    throw;
+  }
+
+  inFile.close();
+  outFile.close();
+  if (!outFile || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    throw IOError("Could not replace " + path);
+  return count;
+}
+
+} // namespace helib
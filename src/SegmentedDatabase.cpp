@@ -0,0 +1,231 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+
+#include <helib/SegmentedDatabase.h>
+#include <helib/SlotCompactor.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+SegmentedDatabase::SegmentedDatabase(const PubKey& pubKey,
+                                     long columns,
+                                     long rowsPerSegment) :
+    pubKey(pubKey),
+    ea(*pubKey.getContext().ea),
+    nColumns(columns),
+    rowsPerSegment(rowsPerSegment)
+{
+  assertTrue<InvalidArgument>(columns > 0, "Need at least one column");
+  assertTrue<InvalidArgument>(rowsPerSegment > 0,
+                              "Segments need at least one row");
+}
+
+long SegmentedDatabase::numSegments() const
+{
+  HELIB_MUTEX_GUARD(mutex);
+  return lsize(segments);
+}
+
+long SegmentedDatabase::numRows() const
+{
+  HELIB_MUTEX_GUARD(mutex);
+  long rows = 0;
+  for (const auto& entry : segments)
+    rows += lsize(entry.second->ids);
+  return rows;
+}
+
+long SegmentedDatabase::numRecords() const
+{
+  HELIB_MUTEX_GUARD(mutex);
+  return lsize(locations);
+}
+
+std::vector<std::shared_ptr<const SegmentedDatabase::Segment>>
+SegmentedDatabase::snapshot() const
+{
+  HELIB_MUTEX_GUARD(mutex);
+  std::vector<std::shared_ptr<const Segment>> segs;
+  for (const auto& entry : segments)
+    segs.push_back(entry.second);
+  return segs;
+}
+
+void SegmentedDatabase::addSegmentsLocked(
+    const Matrix<Ctxt>& data,
+    const std::vector<std::vector<long>>& ids)
+{
+  const long nRows = data.dims(0);
+  for (long first = 0; first < nRows; first += rowsPerSegment) {
+    const long rows = std::min(rowsPerSegment, nRows - first);
+    auto seg = std::make_shared<Segment>();
+    seg->ids.assign(ids.begin() + first, ids.begin() + first + rows);
+
+    // A deep copy, the elements of a Matrix are shared between copies
+    auto segData = std::make_shared<Matrix<Ctxt>>(data(0, 0), rows, nColumns);
+    for (long i = 0; i < rows; i++)
+      for (long j = 0; j < nColumns; j++)
+        (*segData)(i, j) = data(first + i, j);
+    seg->data = segData;
+
+    const long number = nextSegment++;
+    for (long i = 0; i < rows; i++)
+      for (long k = 0; k < lsize(seg->ids[i]); k++)
+        if (seg->ids[i][k] >= 0) {
+          locations[seg->ids[i][k]] = {number, i, k};
+          seg->live++;
+        }
+    if (seg->live > 0)
+      segments[number] = seg;
+  }
+}
+
+long SegmentedDatabase::append(const Matrix<Ctxt>& rows, long nRecords)
+{
+  HELIB_TIMER_START;
+  const long nslots = ea.size();
+  const long nRows = rows.dims(0);
+  assertEq<InvalidArgument>(long(rows.dims(1)),
+                            nColumns,
+                            "Wrong number of columns");
+  if (nRecords < 0)
+    nRecords = nRows * nslots;
+  assertInRange<InvalidArgument>(nRecords,
+                                 1l,
+                                 nRows * nslots,
+                                 "Number of records does not fit the rows",
+                                 /*right_inclusive=*/true);
+
+  HELIB_MUTEX_GUARD(mutex);
+  const long firstId = nextId;
+  nextId += nRecords;
+  std::vector<std::vector<long>> ids(nRows, std::vector<long>(nslots, -1));
+  for (long r = 0; r < nRecords; r++)
+    ids[r / nslots][r % nslots] = firstId + r;
+  addSegmentsLocked(rows, ids);
+  return firstId;
+}
+
+bool SegmentedDatabase::remove(long id)
+{
+  HELIB_MUTEX_GUARD(mutex);
+  auto it = locations.find(id);
+  if (it == locations.end())
+    return false;
+  const Location loc = it->second;
+  locations.erase(it);
+
+  // Segments are shared with running queries, so change a copy
+  auto seg = std::make_shared<Segment>(*segments.at(loc.segment));
+  seg->ids[loc.row][loc.slot] = -1;
+  if (--seg->live == 0)
+    segments.erase(loc.segment);
+  else
+    segments[loc.segment] = seg;
+  return true;
+}
+
+long SegmentedDatabase::compact(double maxFill)
+{
+  HELIB_TIMER_START;
+  const long nslots = ea.size();
+
+  std::vector<std::pair<long, std::shared_ptr<const Segment>>> picked;
+  {
+    HELIB_MUTEX_GUARD(mutex);
+    for (const auto& entry : segments) {
+      const Segment& seg = *entry.second;
+      if (seg.live <= maxFill * lsize(seg.ids) * nslots)
+        picked.push_back(entry);
+    }
+  }
+
+  // The rows of the picked segments, their live slots and their ids
+  std::vector<std::vector<const Ctxt*>> inputs(nColumns);
+  std::vector<std::vector<long>> masks, ids;
+  for (const auto& entry : picked) {
+    const Segment& seg = *entry.second;
+    for (long i = 0; i < lsize(seg.ids); i++) {
+      for (long j = 0; j < nColumns; j++)
+        inputs[j].push_back(&(*seg.data)(i, j));
+      ids.push_back(seg.ids[i]);
+      masks.emplace_back(nslots);
+      for (long k = 0; k < nslots; k++)
+        masks.back()[k] = (seg.ids[i][k] >= 0);
+    }
+  }
+  if (masks.empty())
+    return 0;
+
+  SlotCompactor plan(pubKey, masks);
+  const long nPacked = plan.numPacked();
+  if (nPacked >= lsize(masks))
+    return 0;
+
+  std::vector<std::vector<long>> packedIds(nPacked,
+                                           std::vector<long>(nslots, -1));
+  for (long i = 0; i < lsize(ids); i++)
+    for (long k = 0; k < nslots; k++)
+      if (ids[i][k] >= 0)
+        packedIds[plan.targetOf(i)][plan.destinationSlot(i, k)] = ids[i][k];
+
+  Matrix<Ctxt> packed(*inputs[0][0], nPacked, nColumns);
+  HELIB_EXEC_RANGE(nColumns, first, last)
+  std::vector<Ctxt> column;
+  for (long j = first; j < last; j++) {
+    // pack() only reads its inputs
+    std::vector<Ctxt*> ptrs;
+    for (const Ctxt* ctxt : inputs[j])
+      ptrs.push_back(const_cast<Ctxt*>(ctxt));
+    plan.pack(column, CtPtrs_vectorPt(ptrs));
+    for (long i = 0; i < nPacked; i++)
+      packed(i, j) = column[i];
+  }
+  HELIB_EXEC_RANGE_END
+
+  HELIB_MUTEX_GUARD(mutex);
+  for (const auto& entry : picked) {
+    auto it = segments.find(entry.first);
+    if (it == segments.end() || it->second != entry.second)
+      return 0;
+  }
+  for (const auto& entry : picked)
+    segments.erase(entry.first);
+  addSegmentsLocked(packed, packedIds);
+  return lsize(masks) - nPacked;
+}
+
+SegmentedResult SegmentedDatabase::merge(
+    const std::vector<std::shared_ptr<const Segment>>& segs,
+    std::vector<std::vector<Ctxt>>& scores) const
+{
+  SegmentedResult result;
+  for (long s = 0; s < lsize(segs); s++) {
+    const Segment& seg = *segs[s];
+    for (long i = 0; i < lsize(seg.ids); i++) {
+      std::vector<long> live(ea.size());
+      for (long k = 0; k < ea.size(); k++)
+        live[k] = (seg.ids[i][k] >= 0);
+      if (std::find(live.begin(), live.end(), 0l) != live.end()) {
+        zzX mask;
+        ea.encode(mask, live);
+        scores[s][i].multByConstant(mask);
+      }
+      result.values.push_back(std::move(scores[s][i]));
+      result.ids.push_back(seg.ids[i]);
+    }
+  }
+  return result;
+}
+
+} // namespace helib
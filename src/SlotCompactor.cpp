@@ -0,0 +1,190 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <numeric>
+
+#include <helib/SlotCompactor.h>
+#include <helib/EncryptedArray.h>
+
+namespace helib {
+
+namespace {
+
+struct Candidate
+{
+  long packCost, unpackCost, dim, amount;
+
+  long cost() const { return packCost + unpackCost; }
+};
+
+// Key switches of ea.rotate1D(ctxt, dim, amount), amount in [1, ord-1]: one
+// per automorphism with a matrix, two otherwise (smartAutomorph composes
+// them), and two automorphisms in a bad dimension
+long rotationCost(const PubKey& pubKey,
+                  const EncryptedArray& ea,
+                  long dim,
+                  long amount)
+{
+  const PAlgebra& zMStar = ea.getPAlgebra();
+  const auto automorphCost = [&](long amt) {
+    return pubKey.haveKeySWmatrix(1, zMStar.genToPow(dim, amt), 0, 0) ? 1 : 2;
+  };
+  long cost = automorphCost(amount);
+  if (!ea.nativeDimension(dim))
+    cost += automorphCost(amount - ea.sizeOfDimension(dim));
+  return cost;
+}
+
+} // namespace
+
+SlotCompactor::SlotCompactor(const PubKey& pubKey,
+                             const std::vector<std::vector<long>>& masks) :
+    ea(*pubKey.getContext().ea),
+    moves(masks.size()),
+    nPacked(0),
+    packKeySwitches(0),
+    unpackKeySwitches(0)
+{
+  const PAlgebra& zMStar = ea.getPAlgebra();
+  const long nslots = ea.size();
+
+  // The moves to try, cheapest first. unpack() rotates by -amt, which
+  // rotate1D does as a rotation by ord - amt.
+  std::vector<Candidate> candidates{{0, 0, -1, 0}};
+  for (long dim = 0; dim < ea.dimension(); dim++) {
+    const long ord = ea.sizeOfDimension(dim);
+    for (long amt = 1; amt < ord; amt++)
+      candidates.push_back({rotationCost(pubKey, ea, dim, amt),
+                            rotationCost(pubKey, ea, dim, ord - amt),
+                            dim,
+                            amt});
+  }
+  std::stable_sort(candidates.begin(),
+                   candidates.end(),
+                   [](const Candidate& a, const Candidate& b) {
+                     return a.cost() < b.cost();
+                   });
+
+  std::vector<std::vector<long>> valid(masks.size());
+  for (long i = 0; i < lsize(masks); i++) {
+    assertEq(lsize(masks[i]), nslots, "Mask size must be ea.size()");
+    for (long k = 0; k < nslots; k++)
+      if (masks[i][k] != 0)
+        valid[i].push_back(k);
+    moves[i].full = (lsize(valid[i]) == nslots);
+    std::vector<long> mask(nslots);
+    for (long k : valid[i])
+      mask[k] = 1;
+    ea.encode(moves[i].mask, mask);
+  }
+
+  // First-fit, the inputs with the most valid slots first
+  std::vector<long> order(masks.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](long a, long b) {
+    return valid[a].size() > valid[b].size();
+  });
+
+  std::vector<std::vector<bool>> used; // the occupied slots of every output
+  for (long i : order) {
+    if (valid[i].empty())
+      continue;
+
+    const auto destination = [&](const Candidate& cand, long k) {
+      return (cand.dim < 0) ? k : zMStar.addCoord(cand.dim, k, cand.amount);
+    };
+    const auto fits = [&](const Candidate& cand, long c) {
+      for (long k : valid[i])
+        if (used[c][destination(cand, k)])
+          return false;
+      return true;
+    };
+
+    // The cheapest move that fits into some output, or a new output
+    long target = -1;
+    const Candidate* best = &candidates[0];
+    for (const Candidate& cand : candidates) {
+      for (long c = 0; c < lsize(used) && target < 0; c++)
+        if (fits(cand, c))
+          target = c;
+      if (target >= 0) {
+        best = &cand;
+        break;
+      }
+    }
+    if (target < 0) {
+      target = lsize(used);
+      used.emplace_back(nslots, false);
+    }
+
+    for (long k : valid[i])
+      used[target][destination(*best, k)] = true;
+    moves[i].target = target;
+    moves[i].dim = best->dim;
+    moves[i].amount = best->amount;
+    packKeySwitches += best->packCost;
+    unpackKeySwitches += best->unpackCost;
+  }
+  nPacked = lsize(used);
+}
+
+long SlotCompactor::destinationSlot(long i, long k) const
+{
+  const Move& move = moves.at(i);
+  assertInRange(k, 0l, ea.size(), "Slot index out of range");
+  if (move.dim < 0)
+    return k;
+  return ea.getPAlgebra().addCoord(move.dim, k, move.amount);
+}
+
+void SlotCompactor::pack(std::vector<Ctxt>& packed, const CtPtrs& inputs) const
+{
+  assertEq(inputs.size(), numInputs(), "Wrong number of inputs");
+  packed.clear();
+  for (long i = 0; i < inputs.size(); i++) {
+    const Move& move = moves[i];
+    if (move.target < 0)
+      continue;
+    if (packed.empty())
+      packed.resize(nPacked, Ctxt(ZeroCtxtLike, *inputs[i]));
+
+    Ctxt tmp = *inputs[i];
+    if (!move.full)
+      tmp.multByConstant(move.mask);
+    if (move.dim >= 0)
+      ea.rotate1D(tmp, move.dim, move.amount);
+    packed[move.target] += tmp;
+  }
+}
+
+void SlotCompactor::unpack(const CtPtrs& outputs,
+                           const std::vector<Ctxt>& packed,
+                           bool zeroOutside) const
+{
+  assertEq(outputs.size(), numInputs(), "Wrong number of outputs");
+  assertEq(lsize(packed), nPacked, "Wrong number of packed ciphertexts");
+  for (long i = 0; i < outputs.size(); i++) {
+    const Move& move = moves[i];
+    Ctxt& out = *outputs[i];
+    if (move.target < 0) {
+      out.clear();
+      continue;
+    }
+    out = packed[move.target];
+    if (move.dim >= 0)
+      ea.rotate1D(out, move.dim, -move.amount);
+    if (zeroOutside && !move.full)
+      out.multByConstant(move.mask);
+  }
+}
+
+} // namespace helib
@@ -0,0 +1,286 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+
+#include <NTL/ZZ.h>
+
+#include <helib/Transcipher.h>
+#include <helib/EncryptedArray.h>
+#include <helib/keys.h>
+#include <helib/NumbTh.h>
+#include <helib/scheduler.h>
+#include <helib/timing.h>
+
+namespace helib {
+
+LowMC::LowMC(const Params& params, const std::string& seed) : params(params)
+{
+  const long n = params.blockSize, k = params.keySize;
+  assertTrue<InvalidArgument>(n > 0 && k > 0, "Sizes must be positive");
+  assertTrue<InvalidArgument>(params.rounds > 0, "Need at least one round");
+  assertInRange<InvalidArgument>(params.nSboxes,
+                                 1l,
+                                 n / 3,
+                                 "The S-boxes must fit in the block",
+                                 /*right_inclusive=*/true);
+
+  // Draw the instance from its own stream, leaving the global one alone
+  RandomState state;
+  NTL::SetSeed(
+      NTL::ZZFromBytes((const unsigned char*)seed.data(), seed.size()));
+
+  linear.resize(params.rounds);
+  constant.resize(params.rounds);
+  keyMat.resize(params.rounds + 1);
+  for (long r = 0; r < params.rounds; r++) {
+    do
+      NTL::random(linear[r], n, n);
+    while (NTL::IsZero(NTL::determinant(linear[r])));
+    NTL::random(constant[r], n);
+  }
+  for (NTL::mat_GF2& mat : keyMat) {
+    NTL::mat_GF2 tmp;
+    do {
+      NTL::random(mat, n, k);
+      tmp = mat;
+    } while (NTL::gauss(tmp) < std::min(n, k));
+  }
+}
+
+NTL::vec_GF2 LowMC::counterBlock(unsigned long nonce,
+                                 unsigned long counter) const
+{
+  const long n = params.blockSize, half = n / 2;
+  NTL::vec_GF2 block;
+  block.SetLength(n);
+  for (long j = 0; j < std::min(half, 64l); j++)
+    block.put(j, (counter >> j) & 1);
+  for (long j = 0; j < std::min(n - half, 64l); j++)
+    block.put(half + j, (nonce >> j) & 1);
+  return block;
+}
+
+// S(a, b, c) = (a + bc, a + b + ac, a + b + c + ab) on each triple
+void LowMC::sboxLayer(NTL::vec_GF2& state) const
+{
+  for (long i = 0; i < params.nSboxes; i++) {
+    NTL::GF2 a = state.get(3 * i), b = state.get(3 * i + 1),
+             c = state.get(3 * i + 2);
+    state.put(3 * i, a + b * c);
+    state.put(3 * i + 1, a + b + a * c);
+    state.put(3 * i + 2, a + b + c + a * b);
+  }
+}
+
+void LowMC::encryptBlock(NTL::vec_GF2& out,
+                         const NTL::vec_GF2& in,
+                         const NTL::vec_GF2& key) const
+{
+  assertEq(in.length(), params.blockSize, "Wrong block size");
+  assertEq(key.length(), params.keySize, "Wrong key size");
+
+  NTL::vec_GF2 state = in + keyMat[0] * key;
+  for (long r = 0; r < params.rounds; r++) {
+    sboxLayer(state);
+    state = linear[r] * state;
+    state += constant[r];
+    state += keyMat[r + 1] * key;
+  }
+  out = state;
+}
+
+void LowMC::applyKeystream(std::vector<NTL::vec_GF2>& blocks,
+                           const NTL::vec_GF2& key,
+                           unsigned long nonce,
+                           unsigned long firstCounter) const
+{
+  HELIB_EXEC_RANGE(lsize(blocks), first, last)
+  NTL::vec_GF2 stream;
+  for (long i = first; i < last; i++) {
+    assertEq(blocks[i].length(), params.blockSize, "Wrong block size");
+    encryptBlock(stream, counterBlock(nonce, firstCounter + i), key);
+    blocks[i] += stream;
+  }
+  HELIB_EXEC_RANGE_END
+}
+
+namespace {
+
+// out[j] = sum of in[i] over the ones in row j of mat
+void applyMatrix(std::vector<Ctxt>& out,
+                 const NTL::mat_GF2& mat,
+                 const std::vector<Ctxt>& in)
+{
+  out.assign(mat.NumRows(), Ctxt(ZeroCtxtLike, in[0]));
+  HELIB_EXEC_RANGE(mat.NumRows(), first, last)
+  for (long j = first; j < last; j++)
+    for (long i = 0; i < mat.NumCols(); i++)
+      if (NTL::IsOne(mat[j].get(i)))
+        out[j] += in[i];
+  HELIB_EXEC_RANGE_END
+}
+
+// Mod-down all of v to their common prime set, so that the additions of
+// the linear layer do not mod any of them back up
+void equalizeLevels(std::vector<Ctxt>& v)
+{
+  IndexSet s = v[0].getPrimeSet();
+  for (const Ctxt& ctxt : v)
+    s = s & ctxt.getPrimeSet();
+  for (Ctxt& ctxt : v)
+    ctxt.bringToSet(s);
+}
+
+} // namespace
+
+void Transcipher::encryptKey(std::vector<Ctxt>& encKey,
+                             const LowMC& cipher,
+                             const PubKey& publicKey,
+                             const NTL::vec_GF2& key)
+{
+  HELIB_TIMER_START;
+  assertEq<InvalidArgument>(key.length(), cipher.keySize(), "Wrong key size");
+  assertEq<InvalidArgument>(publicKey.getContext().zMStar.getP(),
+                            2l,
+                            "Transciphering needs p = 2");
+
+  encKey.assign(cipher.keySize(), Ctxt(publicKey));
+  HELIB_EXEC_RANGE(cipher.keySize(), first, last)
+  for (long i = first; i < last; i++)
+    publicKey.Encrypt(encKey[i], NTL::ZZX(NTL::rep(key.get(i))), 2);
+  HELIB_EXEC_RANGE_END
+}
+
+Transcipher::Transcipher(const LowMC& cipher, const std::vector<Ctxt>& encKey) :
+    cipher(cipher)
+{
+  HELIB_TIMER_START;
+  assertEq<InvalidArgument>(lsize(encKey),
+                            cipher.keySize(),
+                            "Wrong number of key ciphertexts");
+  for (const Ctxt& ctxt : encKey)
+    assertEq<InvalidArgument>(ctxt.getPtxtSpace(),
+                              2l,
+                              "Key ciphertexts must encrypt bits");
+
+  // The additions of applyMatrix need the key at a single level
+  std::vector<Ctxt> key(encKey);
+  equalizeLevels(key);
+  roundKeys.resize(cipher.keyMat.size());
+  for (long r = 0; r < lsize(roundKeys); r++)
+    applyMatrix(roundKeys[r], cipher.keyMat[r], key);
+}
+
+long Transcipher::blocksPerBatch() const
+{
+  return roundKeys[0][0].getContext().ea->size();
+}
+
+void Transcipher::addBits(Ctxt& ctxt, const std::vector<long>& bits) const
+{
+  long ones = std::count(bits.begin(), bits.end(), 1l);
+  if (ones == 0)
+    return;
+  if (ones == lsize(bits)) {
+    ctxt.addConstant(NTL::ZZ(1));
+    return;
+  }
+  NTL::ZZX poly;
+  roundKeys[0][0].getContext().ea->encode(poly, bits);
+  ctxt.addConstant(poly);
+}
+
+void Transcipher::keystream(std::vector<Ctxt>& out,
+                            unsigned long nonce,
+                            unsigned long firstCounter) const
+{
+  HELIB_TIMER_START;
+  const LowMC::Params& params = cipher.getParams();
+  const long n = params.blockSize, nBlocks = blocksPerBatch();
+
+  // Bit-slice the counter blocks, one block per slot
+  std::vector<std::vector<long>> bits(n, std::vector<long>(nBlocks));
+  for (long s = 0; s < nBlocks; s++) {
+    NTL::vec_GF2 block = cipher.counterBlock(nonce, firstCounter + s);
+    for (long j = 0; j < n; j++)
+      bits[j][s] = NTL::rep(block.get(j));
+  }
+
+  std::vector<Ctxt> state(roundKeys[0]);
+  HELIB_EXEC_RANGE(n, first, last)
+  for (long j = first; j < last; j++)
+    addBits(state[j], bits[j]);
+  HELIB_EXEC_RANGE_END
+
+  for (long r = 0; r < params.rounds; r++) {
+    HELIB_EXEC_RANGE(params.nSboxes, first, last)
+    for (long i = first; i < last; i++) {
+      Ctxt& a = state[3 * i];
+      Ctxt& b = state[3 * i + 1];
+      Ctxt& c = state[3 * i + 2];
+      Ctxt ab = a, ac = a, bc = b;
+      ab.multiplyBy(b);
+      ac.multiplyBy(c);
+      bc.multiplyBy(c);
+      c += a;
+      c += b;
+      c += ab;
+      b += a;
+      b += ac;
+      a += bc;
+    }
+    HELIB_EXEC_RANGE_END
+    equalizeLevels(state);
+
+    std::vector<Ctxt> next;
+    applyMatrix(next, cipher.linear[r], state);
+    state.swap(next);
+
+    // The cached round key is brought down to the level of the state
+    const IndexSet& level = state[0].getPrimeSet();
+    HELIB_EXEC_RANGE(n, first, last)
+    for (long j = first; j < last; j++) {
+      if (NTL::IsOne(cipher.constant[r].get(j)))
+        state[j].addConstant(NTL::ZZ(1));
+      Ctxt roundKey(roundKeys[r + 1][j]);
+      roundKey.bringToSet(level);
+      state[j] += roundKey;
+    }
+    HELIB_EXEC_RANGE_END
+  }
+  out.swap(state);
+}
+
+void Transcipher::decrypt(std::vector<Ctxt>& out,
+                          const std::vector<NTL::vec_GF2>& blocks,
+                          unsigned long nonce,
+                          unsigned long firstCounter) const
+{
+  HELIB_TIMER_START;
+  const long n = cipher.blockSize();
+  assertTrue<InvalidArgument>(lsize(blocks) <= blocksPerBatch(),
+                              "Too many blocks for one batch");
+
+  keystream(out, nonce, firstCounter);
+  HELIB_EXEC_RANGE(n, first, last)
+  std::vector<long> bits(blocksPerBatch());
+  for (long j = first; j < last; j++) {
+    for (long s = 0; s < lsize(blocks); s++) {
+      assertEq(blocks[s].length(), n, "Wrong block size");
+      bits[s] = NTL::rep(blocks[s].get(j));
+    }
+    addBits(out[j], bits);
+  }
+  HELIB_EXEC_RANGE_END
+}
+
+} // namespace helib
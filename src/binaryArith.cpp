@@ -11,7 +11,8 @@
  */
 /**
  * @file binaryArith.cpp
- * @brief Implementing integer addition, multiplication in binary representation
+ * @brief Implementing integer addition, multiplication and division in binary
+ * representation
  */
 #include <numeric>
 #include <climits>
@@ -23,6 +24,7 @@
 
 #include <NTL/BasicThreadPool.h>
 #include <helib/binaryArith.h>
+#include <helib/scheduler.h>
 
 #ifdef HELIB_DEBUG
 #include <cstdio>
@@ -339,7 +341,7 @@ void AddDAG::apply(CtPtrs& sum,
     sum[i]->clear();
 
   // Allow multi-threading in this loop
-  NTL_EXEC_RANGE(sizeLimit, first, last)
+  HELIB_EXEC_RANGE(sizeLimit, first, last)
   for (long i = first; i < last; i++) { //  for (long i=0; i<sizeLimit; i++) {
     if (i < bSize)
       addCtxtFromNode(*(sum[i]), this->findP(i, i), a, b);
@@ -349,7 +351,7 @@ void AddDAG::apply(CtPtrs& sum,
         addCtxtFromNode(*(sum[i]), node, a, b);
     }
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 }
 
 //! Get the ciphertext for a node, computing it as needed
@@ -851,7 +853,7 @@ static void three4Two(CtPtrs& lsb,
   resize(tmpLsb, lsbSize, Ctxt(ZeroCtxtLike, *ctptr));
   resize(tmpMsb, msbSize, Ctxt(ZeroCtxtLike, *ctptr));
 
-  NTL_EXEC_RANGE(msbSize - 1, first, last)
+  HELIB_EXEC_RANGE(msbSize - 1, first, last)
   for (long i = first; i < last; i++) {
     if (i < lsize(*p1))
       three4Two(&tmpLsb[i], &tmpMsb[i + 1], (*p1)[i], (*p2)[i], (*p3)[i]);
@@ -860,7 +862,7 @@ static void three4Two(CtPtrs& lsb,
     } else if (p3->isSet(i))
       tmpLsb[i] = *((*p3)[i]);
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   if (msbSize == lsbSize) { // we only computed upto lsbSize-1, do the last LSB
     if (p1->isSet(lsbSize - 1))
@@ -991,14 +993,14 @@ static void multByNegative(CtPtrs& product,
       }
   long nPairs = lsize(pairs);
 
-  NTL_EXEC_RANGE(nPairs, first, last)
+  HELIB_EXEC_RANGE(nPairs, first, last)
   for (long idx = first; idx < last; idx++) {
     long i, j;
     std::tie(i, j) = pairs[idx];
     numbers[i][j] = *(b[j - i]);
     numbers[i][j].multiplyBy(*(a[i])); // multiply by the bit of a
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   // sign extension
   for (long i = 0; i < nNums; i++)
@@ -1096,14 +1098,14 @@ void multTwoNumbers(CtPtrs& product,
         pairs.push_back(std::pair<long, long>(i, j));
     }
   long nPairs = lsize(pairs);
-  NTL_EXEC_RANGE(nPairs, first, last)
+  HELIB_EXEC_RANGE(nPairs, first, last)
   for (long idx = first; idx < last; idx++) {
     long i, j;
     std::tie(i, j) = pairs[idx];
     numbers[i][j] = *(lhs[j - i]);
     numbers[i][j].multiplyBy(*(rhs[i])); // multiply by the bit of rhs
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   CtPtrMat_VecCt nums(numbers); // A wrapper around numbers
 #ifdef HELIB_DEBUG
@@ -1341,6 +1343,338 @@ long fifteenOrLess4Four(const CtPtrs& out, const CtPtrs& in, long sizeLimit)
   return numNonNull;
 }
 
+/********************************************************************/
+/************** division and fixed-point arithmetic *****************/
+
+// Levels used by an AddDAG on numbers of the given size
+static long addDepth(long size) { return NTL::NumBits(size) + 1; }
+
+// Copy a number into a vector of the given size, with zeros for the
+// missing bits
+static std::vector<Ctxt> zeroExtend(const CtPtrs& number,
+                                    long size,
+                                    const Ctxt& like)
+{
+  std::vector<Ctxt> bits(size, Ctxt(ZeroCtxtLike, like));
+  for (long i = 0; i < std::min(size, lsize(number)); i++)
+    if (number.isSet(i))
+      bits[i] = *number[i];
+  return bits;
+}
+
+// Bootstrap the bits of the numbers that have fewer than `levels` levels
+// left, if any. Without unpackSlotEncoding or a bootstrappable key we go on
+// regardless, and the adders report it if the levels run out.
+static void recryptForDepth(std::initializer_list<const CtPtrs*> numbers,
+                            long levels,
+                            std::vector<zzX>* unpackSlotEncoding)
+{
+  const Ctxt* ct = nullptr;
+  for (const CtPtrs* number : numbers)
+    if (ct == nullptr)
+      ct = number->ptr2nonNull();
+  if (ct == nullptr || unpackSlotEncoding == nullptr ||
+      !ct->getPubKey().isBootstrappable())
+    return;
+
+  const Context& context = ct->getContext();
+  if (findMinBitCapacity(numbers) >= levels * context.BPL())
+    return;
+  std::vector<Ctxt*> bits;
+  for (const CtPtrs* number : numbers)
+    for (long i = 0; i < lsize(*number); i++)
+      if (number->isSet(i))
+        bits.push_back((*number)[i]);
+  packedRecrypt(CtPtrs_vectorPt(bits),
+                *unpackSlotEncoding,
+                *context.ea,
+                levels);
+}
+
+void divideBinary(CtPtrs& quotient,
+                  CtPtrs& remainder,
+                  const CtPtrs& dividend,
+                  const CtPtrs& divisor,
+                  DivisionAlgorithm algorithm,
+                  std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  const Ctxt* ct = divisor.ptr2nonNull();
+  assertNotNull<InvalidArgument>(ct, "divisor must not be empty");
+  assertTrue<InvalidArgument>(lsize(dividend) > 0,
+                              "dividend must not be empty");
+
+  // The partial remainder is below the divisor, and it is shifted and
+  // compared against it with one more bit for the sign of the difference
+  const long n = lsize(dividend);
+  const long m = lsize(divisor);
+  const long width = m + 1;
+  const Ctxt zero(ZeroCtxtLike, *ct);
+  std::vector<Ctxt> num = zeroExtend(dividend, n, *ct);
+  std::vector<Ctxt> d = zeroExtend(divisor, width, *ct);
+  std::vector<Ctxt> negD(width, zero);
+  std::vector<Ctxt> r(width, zero);
+  std::vector<Ctxt> q(n, zero);
+  CtPtrs_vectorCt numWrapper(num), dWrapper(d), negDWrapper(negD),
+      rWrapper(r);
+
+  recryptForDepth({&dWrapper}, NTL::NumBits(width), unpackSlotEncoding);
+  negateBinary(negDWrapper, dWrapper);
+
+  // isZero = prod_j (1 + d_j), which is 1 in the slots where the divisor is
+  // zero, by a tree of products of depth log(m)
+  std::vector<Ctxt> factors;
+  for (long j = 0; j < m; j++)
+    if (!d[j].isEmpty()) {
+      factors.push_back(d[j]);
+      factors.back().addConstant(NTL::ZZX(1L));
+    }
+  while (lsize(factors) > 1) {
+    std::vector<Ctxt> next;
+    for (long j = 0; j + 1 < lsize(factors); j += 2) {
+      next.push_back(factors[j]);
+      next.back().multiplyBy(factors[j + 1]);
+    }
+    if (lsize(factors) % 2 == 1)
+      next.push_back(factors.back());
+    factors.swap(next);
+  }
+  std::vector<Ctxt> isZero(1, zero);
+  if (factors.empty())
+    isZero[0].addConstant(NTL::ZZX(1L));
+  else
+    isZero[0] = factors[0];
+  const Ctxt& z = isZero[0];
+
+  for (long i = n - 1; i >= 0; --i) {
+    recryptForDepth({&rWrapper, &numWrapper, &dWrapper, &negDWrapper},
+                    addDepth(width) + 1,
+                    unpackSlotEncoding);
+
+    // shifted = 2*r + num[i], modulo 2^width
+    std::vector<Ctxt> shifted(width, zero);
+    shifted[0] = num[i];
+    for (long j = 1; j < width; j++)
+      shifted[j] = r[j - 1];
+    CtPtrs_vectorCt shiftedWrapper(shifted);
+
+    if (algorithm == DivisionAlgorithm::RESTORING) {
+      // r = (shifted >= d) ? shifted - d : shifted, where shifted < 2d so
+      // that the sign of the difference fits in width bits. The top bit of
+      // the new r is zero either way.
+      std::vector<Ctxt> diff(width, zero);
+      CtPtrs_vectorCt diffWrapper(diff);
+      addTwoNumbers(diffWrapper,
+                    shiftedWrapper,
+                    negDWrapper,
+                    width,
+                    unpackSlotEncoding);
+      q[i] = diff[m];
+      q[i].addConstant(NTL::ZZX(1L));
+      for (long j = 0; j < m; j++) {
+        r[j] = diff[j];
+        r[j] += shifted[j];
+        r[j].multiplyBy(q[i]);
+        r[j] += shifted[j];
+      }
+      r[m] = zero;
+    } else {
+      // r = (r < 0) ? shifted + d : shifted - d, which stays in [-d, d)
+      const Ctxt sign = r[m];
+      std::vector<Ctxt> addend(width, zero);
+      for (long j = 0; j < width; j++) {
+        addend[j] = d[j];
+        addend[j] += negD[j];
+        addend[j].multiplyBy(sign);
+        addend[j] += negD[j];
+      }
+      addTwoNumbers(rWrapper,
+                    shiftedWrapper,
+                    CtPtrs_vectorCt(addend),
+                    width,
+                    unpackSlotEncoding);
+      q[i] = r[m];
+      q[i].addConstant(NTL::ZZX(1L));
+    }
+  }
+
+  if (algorithm == DivisionAlgorithm::NON_RESTORING) {
+    // Add the divisor back to a negative remainder
+    recryptForDepth({&rWrapper, &dWrapper},
+                    addDepth(width) + 1,
+                    unpackSlotEncoding);
+    std::vector<Ctxt> addend(d);
+    for (Ctxt& bit : addend)
+      bit.multiplyBy(r[m]);
+    std::vector<Ctxt> corrected(width, zero);
+    CtPtrs_vectorCt correctedWrapper(corrected);
+    addTwoNumbers(correctedWrapper,
+                  rWrapper,
+                  CtPtrs_vectorCt(addend),
+                  width,
+                  unpackSlotEncoding);
+    r.swap(corrected);
+  }
+
+  // Where the divisor is zero, the quotient is all ones, q | isZero, and
+  // the remainder is the dividend, r + isZero*(r + dividend)
+  CtPtrs_vectorCt qWrapper(q), zWrapper(isZero);
+  recryptForDepth({&qWrapper, &rWrapper, &numWrapper, &zWrapper},
+                  1,
+                  unpackSlotEncoding);
+  for (Ctxt& bit : q) {
+    Ctxt both = bit;
+    both.multiplyBy(z);
+    bit += z;
+    bit += both;
+  }
+  for (long j = 0; j < m; j++) {
+    Ctxt diff = r[j];
+    if (j < n)
+      diff += num[j];
+    diff.multiplyBy(z);
+    r[j] += diff;
+  }
+
+  vecCopy(quotient, q);
+  vecCopy(remainder, r, m);
+}
+
+void multFixedPoint(CtPtrs& product,
+                    const CtPtrs& lhs,
+                    const CtPtrs& rhs,
+                    long fracBits,
+                    long sizeLimit,
+                    std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(fracBits >= 0,
+                              "fracBits must be non-negative");
+  const long size =
+      (sizeLimit > 0) ? sizeLimit : lsize(lhs) + lsize(rhs) - fracBits;
+  const Ctxt* ct = lhs.ptr2nonNull();
+  if (ct == nullptr || rhs.numNonNull() < 1 || size <= 0) {
+    setLengthZero(product);
+    return; // return 0
+  }
+
+  // The partial products use one level before addManyNumbers checks
+  recryptForDepth({&lhs, &rhs}, 2, unpackSlotEncoding);
+  std::vector<Ctxt> full;
+  CtPtrs_vectorCt fullWrapper(full);
+  multTwoNumbers(fullWrapper,
+                 lhs,
+                 rhs,
+                 /*rhsTwosComplement=*/false,
+                 fracBits + size,
+                 unpackSlotEncoding);
+
+  // Rescale by dropping the fractional bits of the full product
+  std::vector<Ctxt> bits(size, Ctxt(ZeroCtxtLike, *ct));
+  for (long i = 0; i < size && fracBits + i < lsize(full); i++)
+    bits[i] = full[fracBits + i];
+  vecCopy(product, bits);
+}
+
+void rescaleFixedPoint(CtPtrs& output,
+                       const CtPtrs& input,
+                       long shift,
+                       bool round,
+                       std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  round = round && shift > 0 && input.isSet(shift - 1) &&
+          !input[shift - 1]->isEmpty();
+  const long size = lsize(input) - shift + (round ? 1 : 0);
+  const Ctxt* ct = input.ptr2nonNull();
+  if (ct == nullptr || size <= 0) {
+    setLengthZero(output);
+    return; // return 0
+  }
+
+  std::vector<Ctxt> bits(size, Ctxt(ZeroCtxtLike, *ct));
+  for (long i = std::max(-shift, 0L); i < size; i++)
+    if (input.isSet(i + shift))
+      bits[i] = *input[i + shift];
+
+  if (round) {
+    // Adding the most significant of the dropped bits rounds halves up
+    std::vector<Ctxt> half(1, *input[shift - 1]);
+    std::vector<Ctxt> rounded(size, *ct);
+    CtPtrs_vectorCt roundedWrapper(rounded);
+    addTwoNumbers(roundedWrapper,
+                  CtPtrs_vectorCt(bits),
+                  CtPtrs_vectorCt(half),
+                  size,
+                  unpackSlotEncoding);
+    bits.swap(rounded);
+  }
+  vecCopy(output, bits);
+}
+
+void reciprocalFixedPoint(CtPtrs& reciprocal,
+                          const CtPtrs& divisor,
+                          long fracBits,
+                          long iterations,
+                          std::vector<zzX>* unpackSlotEncoding)
+{
+  HELIB_TIMER_START;
+  assertTrue<InvalidArgument>(fracBits > 0, "fracBits must be positive");
+  assertTrue<InvalidArgument>(iterations >= 0,
+                              "iterations must be non-negative");
+  const Ctxt* ct = divisor.ptr2nonNull();
+  assertNotNull<InvalidArgument>(ct, "divisor must not be empty");
+
+  // The initial relative error of at most 2^-3 is squared by every
+  // iteration, while the truncations cost less than 2 units in the last place
+  if (iterations == 0)
+    while ((3L << iterations) < fracBits + 1)
+      iterations++;
+
+  // All values are in [0, 4), with fracBits fractional bits
+  const long width = fracBits + 2;
+  const Ctxt zero(ZeroCtxtLike, *ct);
+  std::vector<Ctxt> d = zeroExtend(divisor, fracBits, *ct);
+  std::vector<Ctxt> x(width, zero);
+  CtPtrs_vectorCt dWrapper(d), xWrapper(x);
+
+  // x = 3 - 2d: negate 2d, then add 3*2^fracBits, which touches only the
+  // two top bits
+  recryptForDepth({&dWrapper}, NTL::NumBits(width), unpackSlotEncoding);
+  std::vector<Ctxt> twoD(width, zero);
+  for (long i = 0; i < fracBits; i++)
+    twoD[i + 1] = d[i];
+  negateBinary(xWrapper, CtPtrs_vectorCt(twoD));
+  Ctxt carry = x[fracBits];
+  x[fracBits].addConstant(NTL::ZZX(1L));
+  x[fracBits + 1] += carry;
+  x[fracBits + 1].addConstant(NTL::ZZX(1L));
+
+  for (long k = 0; k < iterations; k++) {
+    // x = x * (2 - d*x), where 2 - e = -e + 2^(fracBits+1) modulo 2^width
+    std::vector<Ctxt> e, twoMinusE(width, zero), next;
+    CtPtrs_vectorCt eWrapper(e), twoMinusEWrapper(twoMinusE),
+        nextWrapper(next);
+    multFixedPoint(eWrapper,
+                   dWrapper,
+                   xWrapper,
+                   fracBits,
+                   width,
+                   unpackSlotEncoding);
+    recryptForDepth({&eWrapper}, NTL::NumBits(width), unpackSlotEncoding);
+    negateBinary(twoMinusEWrapper, eWrapper);
+    twoMinusE[fracBits + 1].addConstant(NTL::ZZX(1L));
+    multFixedPoint(nextWrapper,
+                   xWrapper,
+                   twoMinusEWrapper,
+                   fracBits,
+                   width,
+                   unpackSlotEncoding);
+    x.swap(next);
+  }
+  vecCopy(reciprocal, x);
+}
+
 /********************************************************************/
 /***************** test/debugging functions *************************/
 
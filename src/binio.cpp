@@ -202,6 +202,21 @@ void read_raw_ZZ(std::istream& str, NTL::ZZ& zz)
   delete[] zzBytes;
 }
 
+void write_raw_string(std::ostream& str, const std::string& s)
+{
+  write_raw_int(str, s.size());
+  str.write(s.data(), s.size());
+}
+
+std::string read_raw_string(std::istream& str)
+{
+  long size = read_raw_int(str);
+  assertTrue<IOError>(size >= 0 && str.good(), "Could not read string size");
+  std::string s(size, '\0');
+  str.read(&s[0], size);
+  return s;
+}
+
 // FIXME: there is some repetitive code here.
 // We should think about a better overloading strategy for
 // read/write_raw_vector to avoid this.
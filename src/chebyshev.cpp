@@ -0,0 +1,293 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include <helib/chebyshev.h>
+
+namespace helib {
+
+// Coefficients this small relative to the largest one are skipped,
+// multiplying by them would blow up the ratFactor for no gain in accuracy
+static const double CHEBYSHEV_RELATIVE_TOLERANCE = 1e-12;
+
+static long defaultBabySteps(long deg)
+{
+  // The smallest power of two k with k*k >= deg+1
+  long k = 1;
+  while (k * k < deg + 1)
+    k *= 2;
+  return k;
+}
+
+static long ceilLog2(long n)
+{
+  long l = 0;
+  while ((1L << l) < n)
+    l++;
+  return l;
+}
+
+ChebyshevApprox::ChebyshevApprox(const std::function<double(double)>& f,
+                                 double a,
+                                 double b,
+                                 long degree) :
+    a(a), b(b)
+{
+  assertTrue<InvalidArgument>(b > a, "Empty interval for ChebyshevApprox");
+  assertTrue<InvalidArgument>(degree >= 1,
+                              "ChebyshevApprox degree must be at least 1");
+
+  // Interpolate at the N = degree+1 nodes cos(pi*(i+1/2)/N), using the
+  // discrete orthogonality of T_0..T_{N-1} on these nodes
+  const long N = degree + 1;
+  std::vector<double> fx(N);
+  for (long i = 0; i < N; i++) {
+    double t = std::cos(PI * (i + 0.5) / N);
+    fx[i] = f(0.5 * (b - a) * t + 0.5 * (a + b));
+  }
+  coeffs.assign(N, 0.0);
+  for (long j = 0; j < N; j++) {
+    double sum = 0;
+    for (long i = 0; i < N; i++)
+      sum += fx[i] * std::cos(PI * j * (i + 0.5) / N);
+    coeffs[j] = 2.0 * sum / N;
+  }
+  coeffs[0] /= 2;
+  k = defaultBabySteps(degree);
+}
+
+ChebyshevApprox::ChebyshevApprox(const std::vector<double>& coeffs,
+                                 double a,
+                                 double b) :
+    coeffs(coeffs), a(a), b(b)
+{
+  assertTrue<InvalidArgument>(b > a, "Empty interval for ChebyshevApprox");
+  assertTrue<InvalidArgument>(coeffs.size() >= 2,
+                              "ChebyshevApprox degree must be at least 1");
+  k = defaultBabySteps(degree());
+}
+
+double ChebyshevApprox::operator()(double x) const
+{
+  // Clenshaw's recurrence
+  double t = (2 * x - a - b) / (b - a);
+  double b1 = 0, b2 = 0;
+  for (long j = degree(); j >= 1; j--) {
+    double b0 = 2 * t * b1 - b2 + coeffs[j];
+    b2 = b1;
+    b1 = b0;
+  }
+  return t * b1 - b2 + coeffs[0];
+}
+
+double ChebyshevApprox::maxError(const std::function<double(double)>& f,
+                                 long samples) const
+{
+  assertTrue<InvalidArgument>(samples >= 2, "Too few samples");
+  double err = 0;
+  for (long i = 0; i < samples; i++) {
+    double x = a + (b - a) * i / (samples - 1);
+    err = std::max(err, std::abs((*this)(x) - f(x)));
+  }
+  return err;
+}
+
+void ChebyshevApprox::setBabySteps(long steps)
+{
+  assertTrue<InvalidArgument>(steps >= 0, "Negative number of baby steps");
+  if (steps == 0) {
+    k = defaultBabySteps(degree());
+    return;
+  }
+  k = 1;
+  while (k < steps)
+    k *= 2;
+}
+
+// The depth of the series of degree deg, with the baby steps T_j at depth
+// ceilLog2(j) and the giant steps T_{k*2^i} at depth log2(k)+i. Scalar
+// multiplications are free, as multByConstantCKKS only changes ratFactor.
+long ChebyshevApprox::seriesDepth(long deg, long& mults) const
+{
+  if (deg <= k)
+    return ceilLog2(deg);
+  long n = k;
+  while (2 * n <= deg)
+    n *= 2;
+  long qDepth = seriesDepth(deg - n, mults);
+  long rDepth = seriesDepth(n - 1, mults);
+  mults++;
+  return std::max(std::max(qDepth, ceilLog2(n)) + 1, rDepth);
+}
+
+long ChebyshevApprox::depth() const
+{
+  long mults = 0;
+  return seriesDepth(degree(), mults);
+}
+
+long ChebyshevApprox::numMults() const
+{
+  long mults = 0;
+  seriesDepth(degree(), mults);
+  long baby = std::min(k, degree()) - 1; // T_2..T_k
+  long giant = 0;
+  for (long n = 2 * k; n <= degree(); n *= 2)
+    giant++;
+  return mults + baby + giant;
+}
+
+// T_{i+j} = 2 T_i T_j - T_{i-j}, for i >= j
+static Ctxt chebyshevProduct(const Ctxt& ti, const Ctxt& tj, const Ctxt* diff)
+{
+  Ctxt result = ti;
+  result.multiplyBy(tj);
+  result.multByConstantCKKS(2.0);
+  if (diff != nullptr)
+    result -= *diff;
+  else
+    result.addConstantCKKS(-1.0); // T_0 = 1
+  result.setPtxtMag(NTL::xdouble(1.0)); // |T_n(t)| <= 1 on [-1,1]
+  return result;
+}
+
+// Add c*ctxt to sum, or set sum to c*ctxt if sum is empty. The ratFactor
+// must stay positive for equalizeRationalFactors, so a negative c negates
+// the term and scales it by |c|.
+static void addScaled(Ctxt& sum, const Ctxt& ctxt, double c)
+{
+  Ctxt term = ctxt;
+  if (c < 0)
+    term.negate();
+  term.multByConstantCKKS(std::abs(c));
+  if (sum.isEmpty())
+    sum = term;
+  else
+    sum += term;
+}
+
+double ChebyshevApprox::addSeries(Ctxt& sum,
+                                  const std::vector<double>& c,
+                                  const std::vector<Ctxt>& baby,
+                                  const std::vector<Ctxt>& giant,
+                                  double tol) const
+{
+  long deg = lsize(c) - 1;
+  while (deg > 0 && std::abs(c[deg]) <= tol)
+    deg--;
+
+  if (deg <= k) { // a linear combination of the baby steps
+    for (long j = 1; j <= deg; j++)
+      if (std::abs(c[j]) > tol)
+        addScaled(sum, baby[j], c[j]);
+    return c[0];
+  }
+
+  // Split by the largest giant step T_n with n <= deg < 2n as
+  // q*T_n + r, using T_n*T_j = (T_{n+j} + T_{n-j})/2
+  long n = k, i = 0;
+  while (2 * n <= deg) {
+    n *= 2;
+    i++;
+  }
+  std::vector<double> q(deg - n + 1), r(c.begin(), c.begin() + n);
+  q[0] = c[n];
+  for (long j = 1; j <= deg - n; j++) {
+    q[j] = 2 * c[n + j];
+    r[n - j] -= c[n + j];
+  }
+
+  Ctxt qSum(ZeroCtxtLike, giant[i]);
+  double q0 = addSeries(qSum, q, baby, giant, tol);
+  if (!qSum.isEmpty()) {
+    qSum.multiplyBy(giant[i]);
+    if (std::abs(q0) > tol)
+      addScaled(qSum, giant[i], q0);
+    if (sum.isEmpty())
+      sum = qSum;
+    else
+      sum += qSum;
+  } else if (std::abs(q0) > tol)
+    addScaled(sum, giant[i], q0);
+
+  return addSeries(sum, r, baby, giant, tol);
+}
+
+void ChebyshevApprox::evaluate(Ctxt& ctxt) const
+{
+  assertTrue(ctxt.isCKKS(), "ChebyshevApprox requires a CKKS ciphertext");
+
+  // Map [a,b] to [-1,1]
+  std::vector<Ctxt> baby(std::min(k, degree()) + 1, Ctxt(ZeroCtxtLike, ctxt));
+  baby[1] = ctxt;
+  baby[1].multByConstantCKKS(2.0 / (b - a));
+  baby[1].addConstantCKKS(-(a + b) / (b - a));
+  baby[1].setPtxtMag(NTL::xdouble(1.0));
+
+  // T_j from T_{ceil(j/2)} and T_{floor(j/2)}, at depth ceilLog2(j)
+  for (long j = 2; j < lsize(baby); j++) {
+    long hi = (j + 1) / 2, lo = j / 2;
+    baby[j] = chebyshevProduct(baby[hi],
+                               baby[lo],
+                               hi == lo ? nullptr : &baby[hi - lo]);
+  }
+
+  // T_k, T_2k, T_4k, ... up to the degree
+  std::vector<Ctxt> giant;
+  if (k <= degree()) {
+    giant.push_back(baby[k]);
+    for (long n = 2 * k; n <= degree(); n *= 2)
+      giant.push_back(chebyshevProduct(giant.back(), giant.back(), nullptr));
+  }
+
+  double maxCoeff = 0;
+  for (double c : coeffs)
+    maxCoeff = std::max(maxCoeff, std::abs(c));
+
+  Ctxt sum(ZeroCtxtLike, ctxt);
+  double c0 = addSeries(sum,
+                        coeffs,
+                        baby,
+                        giant,
+                        CHEBYSHEV_RELATIVE_TOLERANCE * maxCoeff);
+  assertFalse(sum.isEmpty(), "ChebyshevApprox of a constant function");
+  sum.addConstantCKKS(c0);
+  ctxt = sum;
+}
+
+ChebyshevApprox chebyshevSigmoid(double a, double b, long degree)
+{
+  return ChebyshevApprox([](double x) { return 1 / (1 + std::exp(-x)); },
+                         a,
+                         b,
+                         degree);
+}
+
+ChebyshevApprox chebyshevExp(double a, double b, long degree)
+{
+  return ChebyshevApprox([](double x) { return std::exp(x); }, a, b, degree);
+}
+
+ChebyshevApprox chebyshevInverse(double a, double b, long degree)
+{
+  assertTrue<InvalidArgument>(a > 0, "chebyshevInverse requires 0 < a");
+  return ChebyshevApprox([](double x) { return 1 / x; }, a, b, degree);
+}
+
+ChebyshevApprox chebyshevSqrt(double a, double b, long degree)
+{
+  assertTrue<InvalidArgument>(a >= 0, "chebyshevSqrt requires 0 <= a");
+  return ChebyshevApprox([](double x) { return std::sqrt(x); }, a, b, degree);
+}
+
+} // namespace helib
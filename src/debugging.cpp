@@ -10,12 +10,14 @@
  * limitations under the License. See accompanying LICENSE file.
  */
 // debugging.cpp - debugging utilities
+#include <algorithm>
 #include <NTL/xdouble.h>
 #include <helib/debugging.h>
 #include <helib/norms.h>
 #include <helib/Context.h>
 #include <helib/Ctxt.h>
 #include <helib/EncryptedArray.h>
+#include <helib/keys.h>
 //#include <helib/powerful.h>
 
 namespace helib {
@@ -66,6 +68,130 @@ NTL::xdouble embeddingLargestCoeff(const Ctxt& ctxt, const SecKey& sk)
   return embeddingLargestCoeff(pp, context.zMStar);
 }
 
+NoiseCalibrator::NoiseCalibrator(const SecKey& _sk) : sk(_sk), ratios(NUM_OPS)
+{
+  assertFalse<InvalidArgument>(sk.isCKKS(),
+                               "Noise calibration supports only BGV");
+}
+
+void NoiseCalibrator::record(Op op, double ratio)
+{
+  assertInRange<InvalidArgument>(op, ENCRYPT, NUM_OPS, "Unknown operation");
+  ratios[op].push_back(ratio);
+}
+
+double NoiseCalibrator::worstRatio(Op op) const
+{
+  const std::vector<double>& v = samples(op);
+  return v.empty() ? 0.0 : *std::max_element(v.begin(), v.end());
+}
+
+void NoiseCalibrator::clear()
+{
+  for (auto& v : ratios)
+    v.clear();
+}
+
+// Encrypt a random plaintext with the public key, and record the ratio
+void NoiseCalibrator::encryptRandom(Ctxt& ctxt)
+{
+  const Context& context = sk.getContext();
+  long ptxtSpace = context.alMod.getPPowR();
+  NTL::ZZX ptxt;
+  for (long i : range(context.zMStar.getPhiM()))
+    SetCoeff(ptxt, i, NTL::RandomBnd(ptxtSpace));
+
+  // SecKey overrides the virtual Encrypt with secret-key encryption
+  const PubKey& pk = sk;
+  pk.Encrypt(ctxt, ptxt, ptxtSpace, /*highNoise=*/false);
+  record(ENCRYPT,
+         realToEstimatedNoise(ctxt, sk) * context.noiseCorrection.encrypt);
+}
+
+// Apply the automorphism X -> X^k (k=1 for none) and re-linearize, and
+// record how much the key switching added to the noise and to its estimate.
+// Both are taken over the special primes, before the modulus switching that
+// ends the re-linearization divides the added noise by their product.
+void NoiseCalibrator::sampleKeySwitch(Ctxt& ctxt, long k)
+{
+  const Context& context = sk.getContext();
+  ctxt.dropSmallAndSpecialPrimes();
+  NTL::xdouble measured = embeddingLargestCoeff(ctxt, sk);
+  NTL::xdouble estimated = ctxt.getNoiseBound();
+
+  if (k != 1)
+    ctxt.automorph(k); // no change in the noise
+  if (ctxt.inCanonicalForm())
+    return;
+  ctxt.keySwitchToBase(0);
+
+  // Raising the modulus multiplies the noise by the special primes
+  NTL::xdouble modUp = NTL::xexp(context.logOfProduct(context.specialPrimes));
+  measured = embeddingLargestCoeff(ctxt, sk) - measured * modUp;
+  estimated = ctxt.getNoiseBound() - estimated * modUp;
+  ctxt.dropSmallAndSpecialPrimes();
+  if (estimated <= 0.0)
+    return;
+  if (measured < 0.0)
+    measured = 0.0;
+  record(KEY_SWITCH,
+         NTL::conv<double>(measured / estimated) *
+             sk.getContext().noiseCorrection.keySwitch);
+}
+
+void NoiseCalibrator::runWorkload(long rounds)
+{
+  const Context& context = sk.getContext();
+
+  // The automorphisms that can be applied with a single key switching
+  std::vector<long> autos;
+  for (long i : range(context.zMStar.numOfGens())) {
+    long k = context.zMStar.ZmStarGen(i);
+    if (sk.haveKeySWmatrix(1, k))
+      autos.push_back(k);
+  }
+
+  for (UNUSED long t : range(rounds)) {
+    Ctxt c1(sk), c2(sk);
+    encryptRandom(c1);
+    encryptRandom(c2);
+    double r1 = realToEstimatedNoise(c1, sk);
+    double r2 = realToEstimatedNoise(c2, sk);
+
+    Ctxt prod(c1);
+    prod.multLowLvl(c2);
+    record(MULTIPLY,
+           realToEstimatedNoise(prod, sk) / (r1 * r2) *
+               context.noiseCorrection.multiply);
+
+    sampleKeySwitch(prod, 1);
+    if (!autos.empty())
+      sampleKeySwitch(c1, autos[NTL::RandomBnd(autos.size())]);
+  }
+}
+
+NoiseCorrection NoiseCalibrator::fit(double safety) const
+{
+  assertTrue<InvalidArgument>(safety >= 1.0,
+                              "Safety margin must be at least 1");
+  NoiseCorrection corr = sk.getContext().noiseCorrection;
+  if (worstRatio(ENCRYPT) > 0.0)
+    corr.encrypt = safety * worstRatio(ENCRYPT);
+  if (worstRatio(MULTIPLY) > 0.0)
+    corr.multiply = safety * worstRatio(MULTIPLY);
+  if (worstRatio(KEY_SWITCH) > 0.0)
+    corr.keySwitch = safety * worstRatio(KEY_SWITCH);
+  return corr;
+}
+
+void NoiseCalibrator::apply(Context& context, double safety) const
+{
+  assertEq<InvalidArgument>(&sk.getContext(),
+                            (const Context*)&context,
+                            "Context does not match the secret key");
+  context.noiseCorrection = fit(safety);
+}
+
 void decryptAndPrint(std::ostream& s,
                      const Ctxt& ctxt,
                      const SecKey& sk,
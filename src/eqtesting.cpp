@@ -86,6 +86,24 @@ void fastPower(Ctxt& ctxt, long d)
   }
 }
 
+// The masks for incrementalZeroTest: the i'th map keeps bits 0..i
+LinPolyEvaluator buildIncrementalZeroTestMasks(const EncryptedArray& ea,
+                                               long n)
+{
+  long d = ea.getDegree();
+
+  std::vector<std::vector<NTL::ZZX>> L(n);
+  for (long i = 0; i < n; i++) {
+    // coefficients for mask on bits 0..i
+    // L[j] = X^j for j = 0..i, L[j] = 0 for j = i+1..d-1
+    L[i].resize(d);
+    for (long j = 0; j <= i; j++)
+      SetCoeff(L[i][j], j);
+  }
+
+  return LinPolyEvaluator(ea, L);
+}
+
 // ===> This function only works for p=2, r=1 <===
 // Test if prefixes of bits in slots are all zero: Set slot j of res[i] to 0
 // if bits 0..i of j'th slot in ctxt are all zero, else it is set to 1
@@ -97,55 +115,24 @@ void incrementalZeroTest(Ctxt* res[],
                          const Ctxt& ctxt,
                          long n)
 {
-  HELIB_TIMER_START;
-  long nslots = ea.size();
-  long d = ea.getDegree();
-
-  // compute linearized polynomial coefficients
-
-  std::vector<std::vector<NTL::ZZX>> Coeff;
-  Coeff.resize(n);
-
-  for (long i = 0; i < n; i++) {
-    // coefficients for mask on bits 0..i
-    // L[j] = X^j for j = 0..i, L[j] = 0 for j = i+1..d-1
-
-    std::vector<NTL::ZZX> L;
-    L.resize(d);
+  incrementalZeroTest(res, buildIncrementalZeroTestMasks(ea, n), ctxt);
+}
 
-    for (long j = 0; j <= i; j++)
-      SetCoeff(L[j], j);
-
-    std::vector<NTL::ZZX> C;
-
-    ea.buildLinPolyCoeffs(C, L);
-
-    Coeff[i].resize(d);
-    for (long j = 0; j < d; j++) {
-      // Coeff[i][j] = to the encoding that has C[j] in all slots
-      // FIXME: maybe encrypted array should have this functionality
-      //        built in
-      std::vector<NTL::ZZX> T;
-      T.resize(nslots);
-      for (long s = 0; s < nslots; s++)
-        T[s] = C[j];
-      ea.encode(Coeff[i][j], T);
-    }
-  }
+// Same as above, with the masks precomputed by buildIncrementalZeroTestMasks,
+// so repeated calls do not rebuild and re-encode the constants
+void incrementalZeroTest(Ctxt* res[],
+                         const LinPolyEvaluator& masks,
+                         const Ctxt& ctxt)
+{
+  HELIB_TIMER_START;
+  long d = masks.getEA().getDegree();
 
-  std::vector<Ctxt> Conj(d, ctxt);
-  // initialize Cong[j] to ctxt^{2^j}
-  for (long j = 0; j < d; j++) {
-    Conj[j].smartAutomorph(1L << j);
-  }
+  // Frob[j] = ctxt^{2^j}, shared by all the masks
+  std::vector<Ctxt> Frob;
+  masks.frobeniusImages(Frob, ctxt);
 
-  for (long i = 0; i < n; i++) {
-    res[i]->clear();
-    for (long j = 0; j < d; j++) {
-      Ctxt tmp = Conj[j];
-      tmp.multByConstant(Coeff[i][j]);
-      *res[i] += tmp;
-    }
+  for (long i = 0; i < masks.size(); i++) {
+    masks.apply(*res[i], Frob, i);
 
     // *res[i] now has 0..i in each slot
     // next, we raise to the power 2^d-1
@@ -15,6 +15,7 @@
  *
  * Copyright IBM Corporation 2012 All rights reserved.
  */
+#include <cstring>
 #include <unordered_set>
 #include <NTL/ZZ.h>
 #include <helib/permutations.h>
@@ -24,6 +25,7 @@
 #include <helib/keys.h>
 #include <helib/apiAttributes.h>
 #include <helib/log.h>
+#include <helib/memoryAccounting.h>
 
 namespace helib {
 
@@ -56,6 +58,9 @@ bool KeySwitch::operator==(const KeySwitch& other) const
   if (prgSeed != other.prgSeed)
     return false;
 
+  if (digits != other.digits)
+    return false;
+
   if (b.size() != other.b.size())
     return false;
   for (size_t i = 0; i < b.size(); i++)
@@ -108,7 +113,7 @@ void KeySwitch::verify(SecKey& sk)
 
   std::cout << "digits: ";
   for (long i = 0; i < n; i++)
-    std::cout << context.digits[i] << " ";
+    std::cout << getDigits(context)[i] << " ";
   std::cout << "\n";
 
   std::cout << "IndexSets of b: ";
@@ -166,7 +171,7 @@ void KeySwitch::verify(SecKey& sk)
         if (NumBits(coeff(D, j)) > nb)
           nb = NumBits(coeff(D, j));
     }
-    prod *= context.productOfPrimes(context.digits[i]);
+    prod *= context.productOfPrimes(getDigits(context)[i]);
   }
 
   std::cout << "error ratio: " << ((double)nb) / ((double)NumBits(Q)) << "\n";
@@ -184,7 +189,15 @@ std::ostream& operator<<(std::ostream& str, const KeySwitch& matrix)
       << matrix.ptxtSpace << " " << matrix.b.size() << std::endl;
   for (long i = 0; i < (long)matrix.b.size(); i++)
     str << matrix.b[i] << std::endl;
-  str << matrix.prgSeed << " " << matrix.noiseBound << "]";
+  str << matrix.prgSeed << " " << matrix.noiseBound;
+  // A custom digit partition is optional, so that the default format is
+  // the same as before partitions were recorded
+  if (!matrix.digits.empty()) {
+    str << " " << matrix.digits.size();
+    for (const IndexSet& digit : matrix.digits)
+      str << " " << digit;
+  }
+  str << "]";
   return str;
 }
 
@@ -192,6 +205,7 @@ std::ostream& operator<<(std::ostream& str, const KeySwitch& matrix)
 // matrix)
 void KeySwitch::readMatrix(std::istream& str, const Context& context)
 {
+  MemoryScope scope(MemCategory::KEY_SWITCH, "PubKey");
   seekPastChar(str, '['); // defined in NumbTh.cpp
   str >> fromKey;
   str >> toKeyID;
@@ -204,6 +218,18 @@ void KeySwitch::readMatrix(std::istream& str, const Context& context)
     str >> b[i];
   str >> prgSeed;
   str >> noiseBound;
+
+  // The digit partition is absent for the default context.digits, and in
+  // matrices written before partitions were recorded
+  digits.clear();
+  str >> std::ws;
+  if (str.peek() != ']') {
+    long nPartition;
+    str >> nPartition;
+    digits.resize(nPartition);
+    for (long i = 0; i < nPartition; i++)
+      str >> digits[i];
+  }
   seekPastChar(str, ']');
 }
 
@@ -218,6 +244,8 @@ void KeySwitch::write(std::ostream& str) const
       4. vector<DoubleCRT> b;
       5. ZZ prgSeed;
       6. xdouble noiseBound;
+      7. vector<IndexSet> digits, only if not empty, after its own
+         eye-catcher
   */
 
   fromKey.write(str);
@@ -229,11 +257,19 @@ void KeySwitch::write(std::ostream& str) const
   write_raw_ZZ(str, prgSeed);
   write_raw_xdouble(str, noiseBound);
 
+  if (!digits.empty()) {
+    writeEyeCatcher(str, BINIO_EYE_SKM_DIGITS);
+    write_raw_int(str, digits.size());
+    for (const IndexSet& digit : digits)
+      digit.write(str);
+  }
+
   writeEyeCatcher(str, BINIO_EYE_SKM_END);
 }
 
 void KeySwitch::read(std::istream& str, const Context& context)
 {
+  MemoryScope scope(MemCategory::KEY_SWITCH, "PubKey");
   int eyeCatcherFound = readEyeCatcher(str, BINIO_EYE_SKM_BEGIN);
   assertEq(eyeCatcherFound, 0, "Could not find pre-secret key eyecatcher");
 
@@ -245,7 +281,19 @@ void KeySwitch::read(std::istream& str, const Context& context)
   read_raw_ZZ(str, prgSeed);
   noiseBound = read_raw_xdouble(str);
 
-  eyeCatcherFound = readEyeCatcher(str, BINIO_EYE_SKM_END);
+  // The digit partition is absent for the default context.digits, and in
+  // matrices written before partitions were recorded
+  digits.clear();
+  char eye[BINIO_EYE_SIZE];
+  str.read(eye, BINIO_EYE_SIZE);
+  if (memcmp(eye, BINIO_EYE_SKM_DIGITS, BINIO_EYE_SIZE) == 0) {
+    long nPartition = read_raw_int(str);
+    digits.resize(nPartition);
+    for (long i = 0; i < nPartition; i++)
+      digits[i].read(str);
+    str.read(eye, BINIO_EYE_SIZE);
+  }
+  eyeCatcherFound = memcmp(eye, BINIO_EYE_SKM_END, BINIO_EYE_SIZE);
   assertEq(eyeCatcherFound, 0, "Could not find post-secret key eyecatcher");
 }
 
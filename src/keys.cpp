@@ -9,6 +9,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License. See accompanying LICENSE file.
  */
+#include <algorithm>
 #include <queue>
 
 #include <helib/keys.h>
@@ -20,7 +21,9 @@
 #include <helib/norms.h>
 #include <helib/apiAttributes.h>
 #include <helib/fhe_stats.h>
+#include <helib/memoryAccounting.h>
 #include <helib/log.h>
+#include <helib/scheduler.h>
 
 namespace helib {
 
@@ -346,6 +349,23 @@ void PubKey::setKSStrategy(long dim, int val)
   // std::cout << "*** setKSSStrategy for dim " << dim << " = " << val << "\n";
 }
 
+// Re-allocate the key-switching matrices from all the scheduler threads
+void PubKey::interleaveKeySWmatrices()
+{
+  std::vector<DoubleCRT*> parts;
+  for (KeySwitch& ks : keySwitching) {
+    for (DoubleCRT& dcrt : ks.b)
+      parts.push_back(&dcrt);
+    for (DoubleCRT& dcrt : ks.a)
+      parts.push_back(&dcrt);
+  }
+
+  HELIB_EXEC_RANGE(lsize(parts), first, last)
+  for (long i : range(first, last))
+    parts[i]->relocate();
+  HELIB_EXEC_RANGE_END
+}
+
 // Encrypts plaintext, result returned in the ciphertext argument. When
 // called with highNoise=true, returns a ciphertext with noise level
 // approximately q/8. For BGV, ptxtSpace is the intended plaintext
@@ -463,6 +483,7 @@ long PubKey::Encrypt(Ctxt& ctxt,
   HELIB_STATS_UPDATE("ptxt_rat", ptxt_rat);
 
   ctxt.noiseBound += ptxt_bound;
+  ctxt.noiseBound *= context.noiseCorrection.encrypt;
 
   // std::cerr << "*** ptxt_bound " << ptxt_bound << "\n";
 
@@ -551,6 +572,8 @@ void PubKey::CKKSencrypt(Ctxt& ctxt,
     }
     error_bound += e_bound;
   }
+  error_bound *= context.noiseCorrection.encrypt;
+
   // Compute the extra scaling factor, if needed
   long ef = NTL::conv<long>(ceil(error_bound * prec / (scaling * ptxtSize)));
   if (ef > 1) { // scale up some more
@@ -885,10 +908,20 @@ long SecKey::GenSecKey(long hwt, long ptxtSpace, long maxDegKswitch)
   }
 }
 
+void SecKey::GenKeySWmatrix(long fromSPower,
+                            long fromXPower,
+                            long fromIdx,
+                            long toIdx,
+                            long p)
+{
+  GenKeySWmatrix(fromSPower, fromXPower, context.digits, fromIdx, toIdx, p);
+}
+
 // Generate a key-switching matrix and store it in the public key.
 // The argument p denotes the plaintext space
 void SecKey::GenKeySWmatrix(long fromSPower,
                             long fromXPower,
+                            const std::vector<IndexSet>& digits,
                             long fromIdx,
                             long toIdx,
                             long p)
@@ -904,7 +937,30 @@ void SecKey::GenKeySWmatrix(long fromSPower,
   // See if this key-switching matrix already exists in our list
   if (haveKeySWmatrix(fromSPower, fromXPower, fromIdx, toIdx))
     return; // nothing to do here
+
+  // A custom partition must cover the ctxt primes, and the special primes
+  // absorb the size of one digit when key-switching, so its largest digit
+  // must still fit under them. The context's own partition is taken as is.
+  if (digits != context.digits) {
+    assertTrue<InvalidArgument>(!digits.empty(), "Empty digit partition");
+    IndexSet covered;
+    double maxDigitLog = 0.0;
+    for (const IndexSet& digit : digits) {
+      assertTrue<InvalidArgument>(!empty(digit), "Empty digit in partition");
+      assertTrue<InvalidArgument>(disjoint(covered, digit),
+                                  "Digits in partition are not disjoint");
+      covered.insert(digit);
+      maxDigitLog = std::max(maxDigitLog, context.logOfProduct(digit));
+    }
+    assertEq<InvalidArgument>(covered,
+                              context.ctxtPrimes,
+                              "Digit partition does not cover the ctxt primes");
+    assertTrue<InvalidArgument>(
+        maxDigitLog <= context.logOfProduct(context.specialPrimes),
+        "Largest digit in partition does not fit under the special primes");
+  }
   
+  MemoryScope scope(MemCategory::KEY_SWITCH, "PubKey");
   DoubleCRT fromKey = sKeys.at(fromIdx);    // copy object, not a reference
   DoubleCRT s_ = sKeys.at(toIdx); // this can be a reference 这可以作为参考
 
@@ -917,8 +973,10 @@ void SecKey::GenKeySWmatrix(long fromSPower,
     
   KeySwitch ksMatrix(fromSPower, fromXPower, fromIdx, toIdx);
   RandomBits(ksMatrix.prgSeed, 256); // a random 256-bit seed
+  if (digits != context.digits)
+    ksMatrix.digits = digits;
 
-  long n = context.digits.size();
+  long n = digits.size();
 
   const PAlgebra& palg = context.zMStar;
   double stdev = to_double(context.stdev);
@@ -1002,7 +1060,7 @@ void SecKey::GenKeySWmatrix(long fromSPower,
 
   fromKey *= context.productOfPrimes(context.specialPrimes);
   s_ *= context.productOfPrimes(context.specialPrimes);
-  NTL::ZZ productDi = context.productOfPrimes(context.digits[0]);
+  NTL::ZZ productDi = context.productOfPrimes(digits[0]);
   ksMatrix.b[0] *= fromKey;
   ksMatrix.a[0] *= s_;
   ksMatrix.b[0] += e2[0];
@@ -1012,7 +1070,7 @@ void SecKey::GenKeySWmatrix(long fromSPower,
     ksMatrix.b[i] *= productDi;
     ksMatrix.a[i] *= s_;
     ksMatrix.a[i] *= productDi;
-    productDi *= context.productOfPrimes(context.digits[i]);
+    productDi *= context.productOfPrimes(digits[i]);
 
     ksMatrix.b[i] += e2[i];
     ksMatrix.a[i] += e1[i];
@@ -1033,6 +1091,29 @@ void SecKey::GenKeySWmatrix(long fromSPower,
 #endif
 }
 
+long SecKey::GenReKeyMatrix(const SecKey& oldKey, long oldKeyID)
+{
+  assertEq(&context,
+           &oldKey.context,
+           "Cannot re-key between keys with different contexts");
+  assertFalse(sKeys.empty(), "Generate the new secret key first");
+  assertInRange(oldKeyID,
+                0l,
+                lsize(oldKey.sKeys),
+                "Old key index out of range");
+
+  // The old key is only the source of the matrix: it takes a new index, so
+  // that its bound is recorded with the public key, and is dropped again
+  // once the matrix is made. An empty key at that index cannot decrypt.
+  long keyID = ImportSecKey(oldKey.sKeys[oldKeyID],
+                            oldKey.skBounds[oldKeyID],
+                            /*ptxtSpace=*/0,
+                            /*maxDegKswitch=*/1);
+  GenKeySWmatrix(1, 1, keyID, 0);
+  sKeys[keyID] = DoubleCRT(context, IndexSet());
+  return keyID;
+}
+
 // Decryption
 void SecKey::Decrypt(NTL::ZZX& plaintxt, const Ctxt& ciphertxt) const
 {
@@ -1326,6 +1407,25 @@ long SecKey::genRecryptData()
   if (recryptKeyID >= 0)
     return recryptKeyID;
 
+  if (isCKKS()) {
+    assertTrue(context.isCKKSBootstrappable(),
+               "Cannot generate recrypt data for non-bootstrappable context");
+
+    // A sparse key, with switching matrices to it and back. Ciphertexts are
+    // switched to it just for ModRaise, so nothing is encrypted under it.
+    zzX keyPoly;
+    double bound =
+        sampleHWtBounded(keyPoly, context, context.ckksRcData.skHwt);
+    DoubleCRT newSk(keyPoly,
+                    context,
+                    context.ctxtPrimes | context.specialPrimes);
+    long keyID = ImportSecKey(newSk, bound, /*ptxtSpace=*/1,
+                              /*maxDegKswitch=*/1);
+    GenKeySWmatrix(/*fromSPower=*/1, /*fromXPower=*/1, /*fromIdx=*/0, keyID);
+    GenKeySWmatrix(/*fromSPower=*/1, /*fromXPower=*/1, keyID, /*toIdx=*/0);
+    return (recryptKeyID = keyID);
+  }
+
   // Make sure that the context has the bootstrapping EA and PAlgMod
   assertTrue(context.isBootstrappable(),
              "Cannot generate recrypt data for non-bootstrappable context");
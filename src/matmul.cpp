@@ -14,8 +14,11 @@
 #include <algorithm>
 #include <NTL/BasicThreadPool.h>
 #include <helib/matmul.h>
+#include <helib/MulAccumulator.h>
 #include <helib/norms.h>
 #include <helib/fhe_stats.h>
+#include <helib/memoryAccounting.h>
+#include <helib/scheduler.h>
 #include <helib/apiAttributes.h>
 
 namespace helib {
@@ -60,11 +63,13 @@ static bool comp_hoist(bool hoist)
 class BasicAutomorphPrecon
 {
   Ctxt ctxt;
-  NTL::xdouble noise;
+  NTL::xdouble baseNoise; // noise before key-switching, scaled by P
+  NTL::xdouble noise;     // baseNoise plus key-switching with context.digits
   std::vector<DoubleCRT> polyDigits;
 
 public:
-  BasicAutomorphPrecon(const Ctxt& _ctxt) : ctxt(_ctxt), noise(1.0)
+  BasicAutomorphPrecon(const Ctxt& _ctxt) :
+      ctxt(_ctxt), baseNoise(1.0), noise(1.0)
   {
     HELIB_TIMER_START;
     if (ctxt.parts.size() >= 1)
@@ -84,18 +89,21 @@ public:
                "Ciphertext is not in canonical form");
 
     // Compute the number of digits that we need and the estimated
-    // added noise from switching this ciphertext.
+    // added noise from switching this ciphertext. Matrices with their own
+    // digit partition are accounted for when they are used in automorph.
 
     NTL::xdouble addedNoise = ctxt.parts[1].breakIntoDigits(polyDigits);
     NTL::xdouble max_ks_noise(0.0);
     for (const KeySwitch& ks : pubKey.keySWlist()) {
-      if (max_ks_noise < ks.noiseBound)
+      if (ks.digits.empty() && max_ks_noise < ks.noiseBound)
         max_ks_noise = ks.noiseBound;
     }
-    addedNoise *= max_ks_noise;
+    // The same calibrated correction as in Ctxt::keySwitchPart
+    addedNoise *= max_ks_noise * context.noiseCorrection.keySwitch;
 
     double logProd = context.logOfProduct(context.specialPrimes);
-    noise = ctxt.getNoiseBound() * NTL::xexp(logProd);
+    baseNoise = ctxt.getNoiseBound() * NTL::xexp(logProd);
+    noise = baseNoise;
 
     HELIB_STATS_UPDATE("KS-noise-ratio-hoist",
                        NTL::conv<double>(addedNoise / noise));
@@ -157,8 +165,17 @@ public:
     tmpPart.addPrimesAndScale(context.specialPrimes);
     result->addPart(tmpPart, /*matchPrimeSet=*/true);
 
-    // Then rotate the digits and key-switch them
-    std::vector<DoubleCRT> tmpDigits = polyDigits;
+    // Then rotate the digits and key-switch them. A matrix with its own
+    // digit partition cannot use the precomputed digits or their noise.
+    std::vector<DoubleCRT> tmpDigits;
+    if (W.digits.empty())
+      tmpDigits = polyDigits;
+    else {
+      NTL::xdouble addedNoise =
+          ctxt.parts[1].breakIntoDigits(tmpDigits, W.digits);
+      result->noiseBound = baseNoise + addedNoise * W.noiseBound *
+                                           context.noiseCorrection.keySwitch;
+    }
     for (auto&& tmp : tmpDigits) // rotate each of the digits
       tmp.automorph(amt);
 
@@ -254,12 +271,12 @@ public:
     precon.resize(h);
 
     // parallel for k in [0..h)
-    NTL_EXEC_RANGE(h, first, last)
+    HELIB_EXEC_RANGE(h, first, last)
     for (long k = first; k < last; k++) {
       std::shared_ptr<Ctxt> p = precon0.automorph(zMStar.genToPow(dim, g * k));
       precon[k] = std::make_shared<BasicAutomorphPrecon>(*p);
     }
-    NTL_EXEC_RANGE_END
+    HELIB_EXEC_RANGE_END
   }
 
   std::shared_ptr<Ctxt> automorph(long i) const override
@@ -311,6 +328,21 @@ struct ConstMultiplier
 
   virtual void mul(Ctxt& ctxt) const = 0;
 
+  // acc += this * ctxt
+  virtual void mulAdd(MulAccumulator& acc, const Ctxt& ctxt) const
+  {
+    Ctxt tmp(ctxt);
+    mul(tmp);
+    acc.add(tmp);
+  }
+
+  // acc += this * ctxt, ctxt may be modified
+  virtual void destMulAdd(MulAccumulator& acc, Ctxt& ctxt) const
+  {
+    mul(ctxt);
+    acc.add(ctxt);
+  }
+
   virtual std::shared_ptr<ConstMultiplier> upgrade(
       const Context& context) const = 0;
   // Upgrade to DCRT. Returns null if no upgrade required
@@ -318,7 +350,7 @@ struct ConstMultiplier
 
 struct ConstMultiplier_DoubleCRT : ConstMultiplier
 {
-  DoubleCRT data;
+  DoubleCRTPrecon data; // prepared, as it multiplies many ciphertexts
   double sz;
 
   ConstMultiplier_DoubleCRT(const DoubleCRT& _data, double _sz) :
@@ -327,6 +359,16 @@ struct ConstMultiplier_DoubleCRT : ConstMultiplier
 
   void mul(Ctxt& ctxt) const override { ctxt.multByConstant(data, sz); }
 
+  void mulAdd(MulAccumulator& acc, const Ctxt& ctxt) const override
+  {
+    acc.mulAdd(data, ctxt, sz);
+  }
+
+  void destMulAdd(MulAccumulator& acc, Ctxt& ctxt) const override
+  {
+    acc.destMulAdd(data, ctxt, sz);
+  }
+
   std::shared_ptr<ConstMultiplier> upgrade(
       UNUSED const Context& context) const override
   {
@@ -388,6 +430,15 @@ void MulAdd(Ctxt& x, const std::shared_ptr<ConstMultiplier>& a, const Ctxt& b)
   }
 }
 
+void MulAdd(MulAccumulator& x,
+            const std::shared_ptr<ConstMultiplier>& a,
+            const Ctxt& b)
+// x += a*b, reduced when x is read
+{
+  if (a)
+    a->mulAdd(x, b);
+}
+
 void DestMulAdd(Ctxt& x, const std::shared_ptr<ConstMultiplier>& a, Ctxt& b)
 // x += a*b, b may be modified
 {
@@ -397,18 +448,29 @@ void DestMulAdd(Ctxt& x, const std::shared_ptr<ConstMultiplier>& a, Ctxt& b)
   }
 }
 
+void DestMulAdd(MulAccumulator& x,
+                const std::shared_ptr<ConstMultiplier>& a,
+                Ctxt& b)
+// x += a*b, reduced when x is read, b may be modified
+{
+  if (a)
+    a->destMulAdd(x, b);
+}
+
 void ConstMultiplierCache::upgrade(const Context& context)
 {
   HELIB_TIMER_START;
+  // The constants of an EvalMap (say) are charged to the EvalMap
+  MemoryScope scope(MemCategory::MATMUL, "MatMul", /*override=*/false);
 
   long n = multiplier.size();
-  NTL_EXEC_RANGE(n, first, last)
+  HELIB_EXEC_RANGE(n, first, last)
   for (long i : range(first, last)) {
     if (multiplier[i])
       if (auto newptr = multiplier[i]->upgrade(context))
         multiplier[i] = std::shared_ptr<ConstMultiplier>(newptr);
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 }
 
 static inline long dimSz(const EncryptedArray& ea, long dim)
@@ -747,7 +809,7 @@ void plaintextAutomorph_CKKS(zzX& b,
 
 struct ConstMultiplier_DoubleCRT_CKKS : ConstMultiplier
 {
-  DoubleCRT data;
+  DoubleCRTPrecon data;
   double size, factor;
 
   ConstMultiplier_DoubleCRT_CKKS(const DoubleCRT& _data,
@@ -957,25 +1019,63 @@ void GenBabySteps(std::vector<std::shared_ptr<Ctxt>>& v,
       ctxt.getPubKey().getKSStrategy(dim) != HELIB_KSS_UNKNOWN) {
     BasicAutomorphPrecon precon(ctxt);
 
-    NTL_EXEC_RANGE(n, first, last)
+    HELIB_EXEC_RANGE(n, first, last)
     for (long j : range(first, last)) {
       v[j] = precon.automorph(zMStar.genToPow(dim, j));
       if (clean)
         v[j]->cleanUp();
     }
-    NTL_EXEC_RANGE_END
+    HELIB_EXEC_RANGE_END
   } else {
     Ctxt ctxt0(ctxt);
     ctxt0.cleanUp();
 
-    NTL_EXEC_RANGE(n, first, last)
+    HELIB_EXEC_RANGE(n, first, last)
     for (long j : range(first, last)) {
       v[j] = std::make_shared<Ctxt>(ctxt0);
       v[j]->smartAutomorph(zMStar.genToPow(dim, j));
       if (clean)
         v[j]->cleanUp();
     }
-    NTL_EXEC_RANGE_END
+    HELIB_EXEC_RANGE_END
+  }
+}
+
+void hoistedRotate1D(std::vector<std::shared_ptr<Ctxt>>& v,
+                     const Ctxt& ctxt,
+                     long dim,
+                     const std::vector<long>& amts)
+{
+  HELIB_TIMER_START;
+
+  const PAlgebra& zMStar = ctxt.getContext().zMStar;
+  assertTrue<InvalidArgument>(zMStar.SameOrd(dim),
+                              "hoistedRotate1D requires a native dimension");
+  long ord = zMStar.OrderOf(dim);
+  long n = amts.size();
+  v.resize(n);
+
+  if (fhe_test_force_hoist >= 0 &&
+      ctxt.getPubKey().getKSStrategy(dim) != HELIB_KSS_UNKNOWN) {
+    BasicAutomorphPrecon precon(ctxt);
+
+    HELIB_EXEC_RANGE(n, first, last)
+    for (long j : range(first, last)) {
+      v[j] = precon.automorph(zMStar.genToPow(dim, mcMod(amts[j], ord)));
+      v[j]->cleanUp();
+    }
+    HELIB_EXEC_RANGE_END
+  } else {
+    Ctxt ctxt0(ctxt);
+    ctxt0.cleanUp();
+
+    HELIB_EXEC_RANGE(n, first, last)
+    for (long j : range(first, last)) {
+      v[j] = std::make_shared<Ctxt>(ctxt0);
+      v[j]->smartAutomorph(zMStar.genToPow(dim, mcMod(amts[j], ord)));
+      v[j]->cleanUp();
+    }
+    HELIB_EXEC_RANGE_END
   }
 }
 
@@ -1018,12 +1118,14 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
             sum.cleanUp();
           }
 
+          MulAccumulator inner(ctxt.getPubKey());
           for (long j : range(g)) {
             long i = j + g * k;
             if (i >= D)
               break;
-            MulAdd(sum, cache.multiplier[i], baby_steps[j]);
+            MulAdd(inner, cache.multiplier[i], baby_steps[j]);
           }
+          inner.addTo(sum);
         }
 
         ctxt = sum;
@@ -1045,14 +1147,15 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
         pinfo.interval(first, last, index);
 
         for (long k : range(first, last)) {
-          Ctxt acc_inner(ZeroCtxtLike, ctxt);
-
+          MulAccumulator inner(ctxt.getPubKey());
           for (long j : range(g)) {
             long i = j + g * k;
             if (i >= D)
               break;
-            MulAdd(acc_inner, cache.multiplier[i], *baby_steps[j]);
+            MulAdd(inner, cache.multiplier[i], *baby_steps[j]);
           }
+          Ctxt acc_inner(ZeroCtxtLike, ctxt);
+          inner.addTo(acc_inner);
 
           if (k > 0)
             acc_inner.smartAutomorph(zMStar.genToPow(dim, g * k));
@@ -1200,16 +1303,19 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
         pinfo.interval(first, last, index);
 
         for (long k : range(first, last)) {
-          Ctxt acc_inner(ZeroCtxtLike, ctxt);
-          Ctxt acc_inner1(ZeroCtxtLike, ctxt);
-
+          MulAccumulator inner(ctxt.getPubKey());
+          MulAccumulator inner1(ctxt.getPubKey());
           for (long j : range(g)) {
             long i = j + g * k;
             if (i >= D)
               break;
-            MulAdd(acc_inner, cache.multiplier[i], *baby_steps[j]);
-            MulAdd(acc_inner1, cache1.multiplier[i], *baby_steps[j]);
+            MulAdd(inner, cache.multiplier[i], *baby_steps[j]);
+            MulAdd(inner1, cache1.multiplier[i], *baby_steps[j]);
           }
+          Ctxt acc_inner(ZeroCtxtLike, ctxt);
+          Ctxt acc_inner1(ZeroCtxtLike, ctxt);
+          inner.addTo(acc_inner);
+          inner1.addTo(acc_inner1);
 
           if (k > 0) {
             acc_inner.smartAutomorph(zMStar.genToPow(dim, g * k));
@@ -1247,12 +1353,14 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
       long first, last;
       pinfo.interval(first, last, index);
 
+      MulAccumulator inner(ctxt.getPubKey());
       for (long i : range(first, last)) {
         if (cache.multiplier[i]) {
           std::shared_ptr<Ctxt> tmp = precon->automorph(i);
-          DestMulAdd(acc[index], cache.multiplier[i], *tmp);
+          DestMulAdd(inner, cache.multiplier[i], *tmp);
         }
       }
+      inner.addTo(acc[index]);
       NTL_EXEC_INDEX_END
 
       ctxt = acc[0];
@@ -1274,13 +1382,17 @@ void MatMul1DExec::mul(Ctxt& ctxt) const
       long first, last;
       pinfo.interval(first, last, index);
 
+      MulAccumulator inner(ctxt.getPubKey());
+      MulAccumulator inner1(ctxt.getPubKey());
       for (long i : range(first, last)) {
         if (cache.multiplier[i] || cache1.multiplier[i]) {
           std::shared_ptr<Ctxt> tmp = precon->automorph(i);
-          MulAdd(acc[index], cache.multiplier[i], *tmp);
-          DestMulAdd(acc1[index], cache1.multiplier[i], *tmp);
+          MulAdd(inner, cache.multiplier[i], *tmp);
+          DestMulAdd(inner1, cache1.multiplier[i], *tmp);
         }
       }
+      inner.addTo(acc[index]);
+      inner1.addTo(acc1[index]);
       NTL_EXEC_INDEX_END
 
       for (long i : range(1, cnt))
@@ -1821,12 +1933,16 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
 
         NTL_EXEC_RANGE_END
 
+        // The products of a block are summed with deferred reduction, one
+        // accumulator per thread at a time
         NTL_EXEC_RANGE(d1, first, last)
 
         for (long j : range(first, last)) {
+          MulAccumulator inner(ctxt.getPubKey());
           for (long i : range(first_i, last_i)) {
-            MulAdd(acc[j], cache.multiplier[i * d1 + j], *par_buf[i - first_i]);
+            MulAdd(inner, cache.multiplier[i * d1 + j], *par_buf[i - first_i]);
           }
+          inner.addTo(acc[j]);
         }
 
         NTL_EXEC_RANGE_END
@@ -1910,15 +2026,21 @@ void BlockMatMul1DExec::mul(Ctxt& ctxt) const
 
         NTL_EXEC_RANGE_END
 
+        // The products of a block are summed with deferred reduction, two
+        // accumulators per thread at a time
         NTL_EXEC_RANGE(d1, first, last)
 
         for (long j : range(first, last)) {
+          MulAccumulator inner(ctxt.getPubKey());
+          MulAccumulator inner1(ctxt.getPubKey());
           for (long i : range(first_i, last_i)) {
-            MulAdd(acc[j], cache.multiplier[i * d1 + j], *par_buf[i - first_i]);
-            MulAdd(acc1[j],
+            MulAdd(inner, cache.multiplier[i * d1 + j], *par_buf[i - first_i]);
+            MulAdd(inner1,
                    cache1.multiplier[i * d1 + j],
                    *par_buf[i - first_i]);
           }
+          inner.addTo(acc[j]);
+          inner1.addTo(acc1[j]);
         }
 
         NTL_EXEC_RANGE_END
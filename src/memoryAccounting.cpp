@@ -0,0 +1,321 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <map>
+#include <mutex>
+
+#include <helib/memoryAccounting.h>
+#include <helib/exceptions.h>
+
+namespace helib {
+
+class MemoryAccount
+{
+public:
+  MemoryAccount(MemCategory category, const std::string& owner) :
+      category(category), owner(owner), bytes(0), peak(0)
+  {}
+
+  const MemCategory category;
+  const std::string owner;
+  std::atomic<long> bytes;
+  std::atomic<long> peak;
+};
+
+struct MemoryShrinker::Entry
+{
+  MemCategory category;
+  std::string owner;
+  std::function<void()> shrink; // empty once unregistered
+  std::mutex mutex;             // held while shrink runs
+};
+
+namespace {
+
+// Function-local statics, as rows may be charged during static
+// initialization of other translation units
+struct Ledger
+{
+  std::atomic<long> total{0};
+  std::atomic<long> peak{0};
+  std::atomic<long> budget{0};
+  std::atomic<bool> hard{false};
+
+  std::mutex accountsMutex;
+  std::map<std::pair<int, std::string>, std::unique_ptr<MemoryAccount>>
+      accounts;
+
+  std::mutex shrinkersMutex;
+  std::vector<std::shared_ptr<MemoryShrinker::Entry>> shrinkers;
+
+  static Ledger& instance()
+  {
+    static Ledger ledger;
+    return ledger;
+  }
+};
+
+MemoryAccount* findAccount(MemCategory category, const std::string& owner)
+{
+  Ledger& ledger = Ledger::instance();
+  std::lock_guard<std::mutex> lock(ledger.accountsMutex);
+  std::unique_ptr<MemoryAccount>& account =
+      ledger.accounts[std::make_pair(int(category), owner)];
+  if (!account)
+    account.reset(new MemoryAccount(category, owner));
+  return account.get();
+}
+
+MemoryAccount* defaultAccount()
+{
+  static MemoryAccount* account = findAccount(MemCategory::CTXT, "");
+  return account;
+}
+
+thread_local MemoryAccount* tls_account = nullptr; // null for the default
+thread_local bool tls_reclaiming = false;
+
+void raiseMax(std::atomic<long>& max, long value)
+{
+  long old = max.load(std::memory_order_relaxed);
+  while (value > old &&
+         !max.compare_exchange_weak(old, value, std::memory_order_relaxed))
+    ;
+}
+
+void charge(MemoryAccount* account, long bytes)
+{
+  Ledger& ledger = Ledger::instance();
+  long total = ledger.total.fetch_add(bytes, std::memory_order_relaxed);
+  total += bytes;
+  const long budget = ledger.budget.load(std::memory_order_relaxed);
+  if (budget > 0 && total > budget) {
+    try {
+      reclaimMemory(budget);
+    } catch (...) {
+      ledger.total.fetch_sub(bytes, std::memory_order_relaxed);
+      throw;
+    }
+    total = ledger.total.load(std::memory_order_relaxed);
+    if (total > budget && ledger.hard.load(std::memory_order_relaxed)) {
+      ledger.total.fetch_sub(bytes, std::memory_order_relaxed);
+      throw RuntimeError("Memory budget of " + std::to_string(budget) +
+                         " bytes exceeded by " + account->owner + " (" +
+                         memCategoryName(account->category) + ")");
+    }
+  }
+  raiseMax(ledger.peak, total);
+  long own = account->bytes.fetch_add(bytes, std::memory_order_relaxed);
+  raiseMax(account->peak, own + bytes);
+}
+
+void release(MemoryAccount* account, long bytes)
+{
+  account->bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  Ledger::instance().total.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+} // namespace
+
+const char* memCategoryName(MemCategory category)
+{
+  switch (category) {
+  case MemCategory::CTXT:
+    return "ctxt";
+  case MemCategory::KEY_SWITCH:
+    return "keySwitch";
+  case MemCategory::MATMUL:
+    return "matmul";
+  case MemCategory::EVAL_MAP:
+    return "evalMap";
+  case MemCategory::RECRYPTION:
+    return "recryption";
+  case MemCategory::CACHE:
+    return "cache";
+  }
+  return "unknown";
+}
+
+MemoryScope::MemoryScope(MemCategory category,
+                         const std::string& owner,
+                         bool override) :
+    saved(tls_account)
+{
+  if (override || tls_account == nullptr)
+    tls_account = findAccount(category, owner);
+}
+
+MemoryScope::MemoryScope(MemoryAccount* account) : saved(tls_account)
+{
+  tls_account = account;
+}
+
+MemoryScope::~MemoryScope() { tls_account = saved; }
+
+MemoryAccount* MemoryScope::current()
+{
+  return tls_account != nullptr ? tls_account : defaultAccount();
+}
+
+MemoryCharge::MemoryCharge(long bytes) :
+    account(MemoryScope::current()), nBytes(bytes)
+{
+  charge(account, nBytes);
+}
+
+MemoryCharge::MemoryCharge(const MemoryCharge& other) :
+    account(other.account), nBytes(other.nBytes)
+{
+  if (account != nullptr)
+    charge(account, nBytes);
+}
+
+MemoryCharge::MemoryCharge(MemoryCharge&& other) noexcept :
+    account(other.account), nBytes(other.nBytes)
+{
+  other.account = nullptr;
+  other.nBytes = 0;
+}
+
+MemoryCharge& MemoryCharge::operator=(MemoryCharge other) noexcept
+{
+  std::swap(account, other.account);
+  std::swap(nBytes, other.nBytes);
+  return *this;
+}
+
+MemoryCharge::~MemoryCharge()
+{
+  if (account != nullptr)
+    release(account, nBytes);
+}
+
+MemoryShrinker::MemoryShrinker(MemCategory category,
+                               const std::string& owner,
+                               const std::function<void()>& shrink) :
+    entry(std::make_shared<Entry>())
+{
+  entry->category = category;
+  entry->owner = owner;
+  entry->shrink = shrink;
+  Ledger& ledger = Ledger::instance();
+  std::lock_guard<std::mutex> lock(ledger.shrinkersMutex);
+  ledger.shrinkers.push_back(entry);
+}
+
+MemoryShrinker::~MemoryShrinker()
+{
+  {
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    entry->shrink = nullptr;
+  }
+  Ledger& ledger = Ledger::instance();
+  std::lock_guard<std::mutex> lock(ledger.shrinkersMutex);
+  auto& shrinkers = ledger.shrinkers;
+  shrinkers.erase(std::find(shrinkers.begin(), shrinkers.end(), entry));
+}
+
+void setMemoryBudget(long bytes, bool hard)
+{
+  Ledger& ledger = Ledger::instance();
+  ledger.hard = hard;
+  ledger.budget = std::max(bytes, 0L);
+  if (bytes > 0 && memoryInUse() > bytes)
+    reclaimMemory(bytes);
+}
+
+long memoryBudget() { return Ledger::instance().budget; }
+
+long memoryInUse() { return Ledger::instance().total; }
+
+long memoryInUse(MemCategory category)
+{
+  long bytes = 0;
+  for (const MemoryUsage& usage : memoryUsage())
+    if (usage.category == category)
+      bytes += usage.bytes;
+  return bytes;
+}
+
+long peakMemoryInUse() { return Ledger::instance().peak; }
+
+long reclaimMemory(long target)
+{
+  // A shrinker that allocates must not start another round
+  if (tls_reclaiming)
+    return 0;
+  struct Reclaiming
+  {
+    Reclaiming() { tls_reclaiming = true; }
+    ~Reclaiming() { tls_reclaiming = false; }
+  } reclaiming;
+
+  Ledger& ledger = Ledger::instance();
+  std::vector<std::shared_ptr<MemoryShrinker::Entry>> shrinkers;
+  {
+    std::lock_guard<std::mutex> lock(ledger.shrinkersMutex);
+    shrinkers = ledger.shrinkers;
+  }
+  std::stable_partition(
+      shrinkers.begin(),
+      shrinkers.end(),
+      [](const std::shared_ptr<MemoryShrinker::Entry>& entry) {
+        return entry->category == MemCategory::CACHE;
+      });
+
+  const long before = memoryInUse();
+  for (const auto& entry : shrinkers) {
+    if (memoryInUse() <= target)
+      break;
+    std::unique_lock<std::mutex> lock(entry->mutex, std::try_to_lock);
+    if (lock.owns_lock() && entry->shrink)
+      entry->shrink();
+  }
+  return std::max(before - memoryInUse(), 0L);
+}
+
+std::vector<MemoryUsage> memoryUsage()
+{
+  Ledger& ledger = Ledger::instance();
+  std::lock_guard<std::mutex> lock(ledger.accountsMutex);
+  std::vector<MemoryUsage> usage;
+  for (const auto& account : ledger.accounts)
+    usage.push_back(MemoryUsage{account.second->category,
+                                account.second->owner,
+                                account.second->bytes,
+                                account.second->peak});
+  return usage;
+}
+
+void printMemoryUsage(std::ostream& s)
+{
+  const double MB = 1 << 20;
+  const std::ios_base::fmtflags flags = s.flags();
+  const std::streamsize precision = s.precision();
+  s << "||||| memory (MB) |||||\n";
+  s << std::fixed << std::setprecision(1);
+  for (const MemoryUsage& usage : memoryUsage())
+    if (usage.peak > 0)
+      s << memCategoryName(usage.category) << " "
+        << (usage.owner.empty() ? "-" : usage.owner)
+        << " now=" << usage.bytes / MB << " peak=" << usage.peak / MB << "\n";
+  s << "total now=" << memoryInUse() / MB << " peak=" << peakMemoryInUse() / MB;
+  if (memoryBudget() > 0)
+    s << " budget=" << memoryBudget() / MB;
+  s << "\n";
+  s.flags(flags);
+  s.precision(precision);
+}
+
+} // namespace helib
@@ -514,6 +514,37 @@ std::ostream& operator<<(std::ostream& s, const SubDimension& sd)
   return s;
 }
 
+void PermCostModel::setShiftCost(long genIdx, long cost)
+{
+  assertTrue<InvalidArgument>(genIdx >= 0, "Negative generator index");
+  assertTrue<InvalidArgument>(cost > 0, "Shift cost must be positive");
+  if (genIdx >= shiftCosts.length()) {
+    long oldLen = shiftCosts.length();
+    shiftCosts.SetLength(genIdx + 1);
+    for (long i = oldLen; i < genIdx; i++)
+      shiftCosts[i] = 0; // not set
+  }
+  shiftCosts[genIdx] = cost;
+}
+
+void PermCostModel::serialize(std::vector<long>& out) const
+{
+  out.push_back(defaultShiftCost);
+  out.push_back(maskCost);
+  out.push_back(depthCost);
+  out.push_back(shiftCosts.length());
+  for (long i = 0; i < shiftCosts.length(); i++)
+    out.push_back(shiftCosts[i]);
+}
+
+// Prints out a cost model
+std::ostream& operator<<(std::ostream& s, const PermCostModel& model)
+{
+  return s << "[shift=" << model.defaultShiftCost << " " << model.shiftCosts
+           << " mask=" << model.maskCost << " depth=" << model.depthCost
+           << "]";
+}
+
 // Prints out the vector of trees
 std::ostream& operator<<(std::ostream& s, const GeneratorTrees& trees)
 {
@@ -16,12 +16,15 @@
 #include <climits>
 #include <cmath>
 #include <algorithm>
+#include <unordered_map>
 #include <helib/primeChain.h>
 #include <helib/Context.h>
 #include <helib/sample.h>
 #include <helib/binio.h>
 #include <helib/fhe_stats.h>
 #include <helib/log.h>
+#include <helib/timing.h>
+#include <helib/multicore.h>
 
 namespace helib {
 
@@ -54,19 +57,58 @@ void read(std::istream& s, ModuliSizes::Entry& e)
   e.second.read(s);
 }
 
+struct ModuliSizes::SelectionCache
+{
+  struct Key
+  {
+    IndexSet from1, from2;
+    long lo, hi;
+    bool twoSets, reverse;
+
+    bool operator==(const Key& other) const
+    {
+      return lo == other.lo && hi == other.hi && twoSets == other.twoSets &&
+             reverse == other.reverse && from1 == other.from1 &&
+             from2 == other.from2;
+    }
+  };
+
+  struct KeyHash
+  {
+    std::size_t operator()(const Key& key) const
+    {
+      std::size_t h = std::hash<long>()(key.lo);
+      h = h * 1000003 ^ std::hash<long>()(key.hi);
+      h = h * 1000003 ^ (2 * key.twoSets + key.reverse);
+      for (long i : key.from1)
+        h = h * 31 ^ std::hash<long>()(i);
+      for (long i : key.from2)
+        h = h * 37 ^ std::hash<long>()(i);
+      return h;
+    }
+  };
+
+  // The table is cleared when it grows beyond this many entries,
+  // so a long computation cannot make it grow without bound.
+  static constexpr std::size_t MAX_ENTRIES = 1L << 16;
+
+  HELIB_MUTEX_TYPE mtx;
+  std::unordered_map<Key, long, KeyHash> table; // maps key to index in sizes
+};
+
+// The static heuristic, derived from experimental data: the iFFT
+// cost is the same as the FFT cost when m is a power of two,
+// and 1.20 times the FFT cost otherwise.
+static long defaultIFFTCost(const Context& context)
+{
+  return context.zMStar.getPow2() ? 0 : 20;
+}
+
 // initialize helper table for a given chain
 void ModuliSizes::init(const Context& context)
 {
-  if (context.zMStar.getPow2())
-    iFFT_cost = 0; // iFFT cost is same as FFT cost
-  else
-    iFFT_cost = 20; // iFFT cost is 1.20 times FFT cost.
-                    // This is heuristic and derived from
-                    // experimantal data.
-                    // FIXME: should allow use to override
-                    // this default value.
-
   long n = (1L << context.smallPrimes.card()) * (context.ctxtPrimes.card() + 1);
+  sizes.clear();
   sizes.reserve(n); // allocate space
   // each entry of sizes is a pair<double,IndexSet>=(size, set-of-primes)
 
@@ -113,6 +155,69 @@ void ModuliSizes::init(const Context& context)
   }
   std::cout << "\n";
 #endif
+
+  setIFFTCost(defaultIFFTCost(context));
+}
+
+void ModuliSizes::calibrate(const Context& context, long trials)
+{
+  long heuristic = defaultIFFTCost(context);
+
+  if (empty(context.ctxtPrimes) || trials <= 0) {
+    setIFFTCost(heuristic);
+    return;
+  }
+
+  // All the ctxtPrimes have roughly the same size, so we time just one
+  const Cmodulus& cmod = context.ithModulus(context.ctxtPrimes.first());
+  long phim = context.zMStar.getPhiM();
+
+  zzX x;
+  x.SetLength(phim);
+  // A fixed input, so as not to advance the NTL random stream
+  for (long i : range(phim))
+    x[i] = NTL::MulMod(i + 1, 0x5DEECE66DL % cmod.getQ(), cmod.getQ());
+
+  NTL::zz_pPush push;
+  cmod.restoreModulus();
+  NTL::vec_long y;
+  NTL::zz_pX z;
+
+  // warm up, so that lazily-built tables are not included in the timing
+  cmod.FFT(y, x);
+  cmod.iFFT(z, y);
+
+  // take the minimum over all trials, as it is the least noisy
+  unsigned long fftTime = ULONG_MAX, ifftTime = ULONG_MAX;
+  for (long t = 0; t < trials; t++) {
+    unsigned long start = GetTimerClock();
+    cmod.FFT(y, x);
+    unsigned long mid = GetTimerClock();
+    cmod.iFFT(z, y);
+    unsigned long end = GetTimerClock();
+
+    fftTime = std::min(fftTime, mid - start);
+    ifftTime = std::min(ifftTime, end - mid);
+  }
+
+  HELIB_STATS_UPDATE("calibrate-FFT-time", fftTime);
+  HELIB_STATS_UPDATE("calibrate-iFFT-time", ifftTime);
+
+  // With too few clock ticks the measured ratio is meaningless
+  if (fftTime < 10) {
+    setIFFTCost(heuristic);
+    return;
+  }
+
+  double ratio = double(ifftTime) / double(fftTime);
+  setIFFTCost(std::max(0L, std::lround(100.0 * (ratio - 1.0))));
+}
+
+void ModuliSizes::setIFFTCost(long cost)
+{
+  assertTrue<InvalidArgument>(cost >= 0, "iFFT_cost must be non-negative");
+  iFFT_cost = cost;
+  cache = std::make_shared<SelectionCache>();
 }
 
 // If the estimated cost (in terms of # of FFTs) in
@@ -120,7 +225,8 @@ void ModuliSizes::init(const Context& context)
 // this function returns the value 100*C.
 //
 // This uses the value iFFT_cost, which is normally set to 0
-// when m is a power of two, and to 20 othewise.
+// when m is a power of two, and to 20 othewise, unless it is
+// overridden or measured (see ModuliSizes::calibrate).
 // The idea is that the cost of an iFFT is estimated as
 // the cost of an FFT times (1 + iFFT_cost/100).
 //
@@ -159,42 +265,61 @@ static inline long cost_estimate(const IndexSet& fromSet,
 
 #endif
 
-// Find a suitable IndexSet of primes whose total size is in the
-// target interval [low,high], trying to minimize the number of
-// primes dropped from fromSet.
-// If no IndexSet exists that fits in the target interval, returns
-// the IndexSet that gives the largest value smaller than low, or
-// else just the singleton containing the smallest prime.
-IndexSet ModuliSizes::getSet4Size(double low,
-                                  double high,
-                                  const IndexSet& fromSet,
-                                  bool reverse) const
+// The window [lo, hi) consists of all the entries whose size is in the
+// target interval [low, high]. If the interval is empty then lo == hi.
+void ModuliSizes::findWindow(long& lo,
+                             long& hi,
+                             double low,
+                             double high) const
 {
-  long n = sizes.size();
-
   // lower_bound returns an iterator to the first element with size>=low
   auto it = std::lower_bound(sizes.begin(),
                              sizes.end(),
                              Entry(low, IndexSet::emptySet()));
-  long idx = it - sizes.begin(); // The index of this element
+  lo = it - sizes.begin(); // The index of this element
+
+  // upper_bound returns an iterator to the first element with size>high
+  auto jt = std::upper_bound(it,
+                             sizes.end(),
+                             high,
+                             [](double val, const Entry& e) {
+                               return val < e.first;
+                             });
+  hi = std::max(lo, long(jt - sizes.begin()));
+}
 
-  long nchoices = 0;
+long ModuliSizes::selectEntry(long lo,
+                              long hi,
+                              const IndexSet& from1,
+                              const IndexSet* from2,
+                              bool reverse) const
+{
+  long n = sizes.size();
+
+  auto cost = [&](const IndexSet& toSet) {
+    long c = cost_estimate(from1, toSet, iFFT_cost);
+    if (from2)
+      c += cost_estimate(*from2, toSet, iFFT_cost);
+    return c;
+  };
 
   long bestOption = -1;
   long bestCost = LONG_MAX;
-  long ii = idx;
-  for (; ii < n && sizes[ii].first <= high; ii++) {
-    nchoices++;
-
-    long thisCost = cost_estimate(fromSet, sizes[ii].second, iFFT_cost);
+  for (long i = lo; i < hi; i++) {
+    long thisCost = cost(sizes[i].second);
     if (thisCost <= bestCost) {
-      bestOption = ii;
+      bestOption = i;
       bestCost = thisCost;
     }
   }
 
-  HELIB_STATS_UPDATE("window1-in", (bestOption != -1));
-  HELIB_STATS_UPDATE("window1-nchoices", nchoices);
+  if (from2) {
+    HELIB_STATS_UPDATE("window2-in", (bestOption != -1));
+    HELIB_STATS_UPDATE("window2-nchoices", hi - lo);
+  } else {
+    HELIB_STATS_UPDATE("window1-in", (bestOption != -1));
+    HELIB_STATS_UPDATE("window1-nchoices", hi - lo);
+  }
 
   // If nothing was found, use the closest set below 'low' (or
   // above 'high' if reverse).  We actually have one bit of slack,
@@ -203,10 +328,10 @@ IndexSet ModuliSizes::getSet4Size(double low,
 
   if (bestOption == -1) {
     if (reverse) {
-      if (ii < n) {
-        double upperBound = sizes[ii].first + 1.0 * std::log(2.0);
-        for (long i = ii; i < n && sizes[i].first <= upperBound; ++i) {
-          long thisCost = cost_estimate(fromSet, sizes[i].second, iFFT_cost);
+      if (hi < n) {
+        double upperBound = sizes[hi].first + 1.0 * std::log(2.0);
+        for (long i = hi; i < n && sizes[i].first <= upperBound; ++i) {
+          long thisCost = cost(sizes[i].second);
           if (thisCost < bestCost) {
             bestOption = i;
             bestCost = thisCost;
@@ -214,10 +339,10 @@ IndexSet ModuliSizes::getSet4Size(double low,
         }
       }
     } else {
-      if (idx > 0) {
-        double lowerBound = sizes[idx - 1].first - 1.0 * std::log(2.0);
-        for (long i = idx - 1; i >= 0 && sizes[i].first >= lowerBound; --i) {
-          long thisCost = cost_estimate(fromSet, sizes[i].second, iFFT_cost);
+      if (lo > 0) {
+        double lowerBound = sizes[lo - 1].first - 1.0 * std::log(2.0);
+        for (long i = lo - 1; i >= 0 && sizes[i].first >= lowerBound; --i) {
+          long thisCost = cost(sizes[i].second);
           if (thisCost < bestCost) {
             bestOption = i;
             bestCost = thisCost;
@@ -227,6 +352,40 @@ IndexSet ModuliSizes::getSet4Size(double low,
     }
   }
 
+  return bestOption;
+}
+
+// Find a suitable IndexSet of primes whose total size is in the
+// target interval [low,high], trying to minimize the number of
+// primes dropped from fromSet.
+// If no IndexSet exists that fits in the target interval, returns
+// the IndexSet that gives the largest value smaller than low, or
+// else just the singleton containing the smallest prime.
+IndexSet ModuliSizes::getSet4Size(double low,
+                                  double high,
+                                  const IndexSet& fromSet,
+                                  bool reverse) const
+{
+  long lo, hi;
+  findWindow(lo, hi, low, high);
+
+  long bestOption;
+  if (cache) {
+    SelectionCache::Key key{fromSet, IndexSet(), lo, hi, false, reverse};
+    HELIB_MUTEX_GUARD(cache->mtx);
+    auto it = cache->table.find(key);
+    if (it != cache->table.end()) {
+      bestOption = it->second;
+    } else {
+      bestOption = selectEntry(lo, hi, fromSet, nullptr, reverse);
+      if (cache->table.size() >= SelectionCache::MAX_ENTRIES)
+        cache->table.clear();
+      cache->table.emplace(std::move(key), bestOption);
+    }
+  } else {
+    bestOption = selectEntry(lo, hi, fromSet, nullptr, reverse);
+  }
+
   // Nothing was found. This almost surely means decryption
   // error, but we'll just display a warning and carry on.
   if (bestOption == -1) {
@@ -249,67 +408,24 @@ IndexSet ModuliSizes::getSet4Size(double low,
                                   const IndexSet& from2,
                                   bool reverse) const
 {
-  long n = sizes.size();
-
-  // lower_bound returns an iterator to the first element with size>=low
-  auto it = std::lower_bound(sizes.begin(),
-                             sizes.end(),
-                             Entry(low, IndexSet::emptySet()));
-  long idx = it - sizes.begin(); // The index of this element
-
-  long nchoices = 0;
-
-  long bestOption = -1;
-  long bestCost = LONG_MAX;
-  long ii = idx;
-  for (; ii < n && sizes[ii].first <= high; ii++) {
-    nchoices++;
-
-    long thisCost = cost_estimate(from1, sizes[ii].second, iFFT_cost) +
-                    cost_estimate(from2, sizes[ii].second, iFFT_cost);
-
-    if (thisCost <= bestCost) {
-      bestOption = ii;
-      bestCost = thisCost;
-    }
-  }
-
-  HELIB_STATS_UPDATE("window2-in", (bestOption != -1));
-  HELIB_STATS_UPDATE("window2-nchoices", nchoices);
-
-  // If nothing was found, use the closest set below 'low'
-  // (or above 'high' if reverse).  We actually one bit of slack,
-  // examining the not just the closest set, but those sets
-  // whose size is within 1 bit of the closest.
-
-  if (bestOption == -1) {
-    if (reverse) {
-      if (ii < n) {
-        double upperBound = sizes[ii].first + 1.0 * std::log(2.0);
-        for (long i = ii; i < n && sizes[i].first <= upperBound; ++i) {
-          long thisCost = cost_estimate(from1, sizes[i].second, iFFT_cost) +
-                          cost_estimate(from2, sizes[i].second, iFFT_cost);
-
-          if (thisCost < bestCost) {
-            bestOption = i;
-            bestCost = thisCost;
-          }
-        }
-      }
+  long lo, hi;
+  findWindow(lo, hi, low, high);
+
+  long bestOption;
+  if (cache) {
+    SelectionCache::Key key{from1, from2, lo, hi, true, reverse};
+    HELIB_MUTEX_GUARD(cache->mtx);
+    auto it = cache->table.find(key);
+    if (it != cache->table.end()) {
+      bestOption = it->second;
     } else {
-      if (idx > 0) {
-        double lowerBound = sizes[idx - 1].first - 1.0 * std::log(2.0);
-        for (long i = idx - 1; i >= 0 && sizes[i].first >= lowerBound; --i) {
-          long thisCost = cost_estimate(from1, sizes[i].second, iFFT_cost) +
-                          cost_estimate(from2, sizes[i].second, iFFT_cost);
-
-          if (thisCost < bestCost) {
-            bestOption = i;
-            bestCost = thisCost;
-          }
-        }
-      }
+      bestOption = selectEntry(lo, hi, from1, &from2, reverse);
+      if (cache->table.size() >= SelectionCache::MAX_ENTRIES)
+        cache->table.clear();
+      cache->table.emplace(std::move(key), bestOption);
     }
+  } else {
+    bestOption = selectEntry(lo, hi, from1, &from2, reverse);
   }
 
   // Nothing was found. This almost surely means decryption
@@ -336,6 +452,7 @@ std::istream& operator>>(std::istream& s, ModuliSizes& szs)
   for (long i = 0; i < n; i++)
     s >> szs.sizes[i];
   seekPastChar(s, ']');
+  szs.cache = std::make_shared<ModuliSizes::SelectionCache>();
   return s;
 }
 
@@ -352,6 +469,7 @@ void ModuliSizes::read(std::istream& str)
   sizes.resize(n); // allocate space
   for (long i = 0; i < n; i++)
     ::helib::read(str, sizes[i]);
+  cache = std::make_shared<SelectionCache>();
 }
 
 // You initialize a PrimeGenerator as follows:
@@ -604,57 +722,64 @@ static void addCtxtPrimes(Context& context, long nBits, long targetSize)
   HELIB_STATS_UPDATE("excess-ctxtPrimes", bitlen - nBits);
 }
 
-static void addSpecialPrimes(Context& context,
-                             long nDgts,
-                             bool willBeBootstrappable,
-                             long skHwt,
-                             long bitsInSpecialPrimes)
+std::vector<IndexSet> buildDigitPartition(const IndexSet& primes, long nDgts)
 {
-  const PAlgebra& palg = context.zMStar;
-  long p = palg.getP();
-  long m = palg.getM();
-  long p2r = context.alMod.getPPowR();
-
-  long p2e = p2r;
-  if (willBeBootstrappable) { // bigger p^e for bootstrapping
-    long e, ePrime;
-    RecryptData::setAE(e, ePrime, context, skHwt);
-    p2e *= NTL::power_long(p, e - ePrime);
-  }
-
-  long nCtxtPrimes = context.ctxtPrimes.card();
-  if (nDgts > nCtxtPrimes)
-    nDgts = nCtxtPrimes; // sanity checks
+  long nPrimes = primes.card();
+  if (nDgts > nPrimes)
+    nDgts = nPrimes; // sanity checks
   if (nDgts <= 0)
     nDgts = 1;
 
-  context.digits.resize(nDgts); // allocate space
+  std::vector<IndexSet> digits(nDgts); // allocate space
 
-  if (nDgts > 1) { // we break ciphertext into a few digits when key-switching
-    // NOTE: The code below assumes that all the ctxtPrimes have roughly the
+  if (nDgts > 1) {
+    // NOTE: The code below assumes that all the primes have roughly the
     // same size
 
-    IndexSet remaining = context.ctxtPrimes;
+    IndexSet remaining = primes;
     for (long dgt = 0; dgt < nDgts - 1; dgt++) {
       long digitCard = divc(remaining.card(), nDgts - dgt);
       // ceiling(#-of-remaining-primes, #-or-remaining-digits)
 
       for (long i : remaining) {
-        context.digits[dgt].insert(i);
-        if (context.digits[dgt].card() >= digitCard)
+        digits[dgt].insert(i);
+        if (digits[dgt].card() >= digitCard)
           break;
       }
-      remaining.remove(context.digits[dgt]); // update the remaining set
+      remaining.remove(digits[dgt]); // update the remaining set
     }
     // The last digit has everything else
-    if (empty(remaining)) { // sanity check, use one less digit
-      nDgts--;
-      context.digits.resize(nDgts);
-    } else
-      context.digits[nDgts - 1] = remaining;
+    if (empty(remaining)) // sanity check, use one less digit
+      digits.resize(nDgts - 1);
+    else
+      digits[nDgts - 1] = remaining;
   } else { // only one digit
-    context.digits[0] = context.ctxtPrimes;
+    digits[0] = primes;
   }
+  return digits;
+}
+
+static void addSpecialPrimes(Context& context,
+                             long nDgts,
+                             bool willBeBootstrappable,
+                             long skHwt,
+                             long bitsInSpecialPrimes)
+{
+  const PAlgebra& palg = context.zMStar;
+  long p = palg.getP();
+  long m = palg.getM();
+  long p2r = context.alMod.getPPowR();
+
+  long p2e = p2r;
+  if (willBeBootstrappable) { // bigger p^e for bootstrapping
+    long e, ePrime;
+    RecryptData::setAE(e, ePrime, context, skHwt);
+    p2e *= NTL::power_long(p, e - ePrime);
+  }
+
+  // we break ciphertext into a few digits when key-switching
+  context.digits = buildDigitPartition(context.ctxtPrimes, nDgts);
+  nDgts = context.digits.size();
 
   double maxDigitLog = 0.0;
   for (auto& digit : context.digits) {
@@ -11,7 +11,10 @@
  */
 #include <NTL/BasicThreadPool.h>
 
+#include <cmath>
+
 #include <helib/recryption.h>
+#include <helib/chebyshev.h>
 #include <helib/EncryptedArray.h>
 #include <helib/EvalMap.h>
 #include <helib/powerful.h>
@@ -21,7 +24,9 @@
 #include <helib/sample.h>
 #include <helib/debugging.h>
 #include <helib/fhe_stats.h>
+#include <helib/scheduler.h>
 #include <helib/log.h>
+#include <helib/memoryAccounting.h>
 
 #ifdef HELIB_DEBUG
 
@@ -292,6 +297,7 @@ void RecryptData::init(const Context& context,
   // Record the arguments to this function
   mvec = mvec_;
   build_cache = build_cache_;
+  MemoryScope scope(MemCategory::RECRYPTION, "RecryptData");
 
   bool mvec_ok = true;
   for (long i : range(mvec.length())) {
@@ -367,6 +373,11 @@ void PubKey::reCrypt(Ctxt& ctxt) const
 {
   HELIB_TIMER_START;
 
+  if (ctxt.isCKKS()) {
+    ckksReCrypt(ctxt);
+    return;
+  }
+
   // Some sanity checks for dummy ciphertext
   long ptxtSpace = ctxt.getPtxtSpace();
   if (ctxt.isEmpty())
@@ -579,7 +590,7 @@ void extractDigitsPacked(Ctxt& ctxt,
     HELIB_NTIMER_START(unpack2);
     std::vector<Ctxt> frob(d, Ctxt(ZeroCtxtLike, ctxt));
 
-    NTL_EXEC_RANGE(d, first, last)
+    HELIB_EXEC_RANGE(d, first, last)
     // FIXME: implement using hoisting!
     for (long j = first; j < last; j++) { // process jth Frobenius
       frob[j] = ctxt;
@@ -587,7 +598,7 @@ void extractDigitsPacked(Ctxt& ctxt,
       frob[j].cleanUp();
       // FIXME: not clear if we should call cleanUp here
     }
-    NTL_EXEC_RANGE_END
+    HELIB_EXEC_RANGE_END
 
     HELIB_NTIMER_STOP(unpack2);
 
@@ -609,11 +620,11 @@ void extractDigitsPacked(Ctxt& ctxt,
   //  CheckCtxt(unpacked[0], "after unpack");
   //#endif
 
-  NTL_EXEC_RANGE(d, first, last)
+  HELIB_EXEC_RANGE(d, first, last)
   for (long i = first; i < last; i++) {
     extractDigitsThin(unpacked[i], botHigh, r, ePrime);
   }
-  NTL_EXEC_RANGE_END
+  HELIB_EXEC_RANGE_END
 
   //#ifdef HELIB_DEBUG
   // CheckCtxt(unpacked[0], "before repack");
@@ -764,6 +775,91 @@ void packedRecrypt(const CtPtrMat& m,
   packedRecrypt(CtPtrs_vectorPt(v), unpackConsts, ea);
 }
 
+// The mask of the sub-hypercube with the given extent, moved by offset
+static NTL::ZZX subHypercubeMask(const EncryptedArray& ea,
+                                 const std::vector<long>& extent,
+                                 const std::vector<long>& offset)
+{
+  std::vector<long> mask(ea.size(), 1);
+  for (long k = 0; k < ea.size(); k++)
+    for (long i = 0; i < ea.dimension(); i++) {
+      long c = ea.coordinate(i, k) - offset[i];
+      if (c < 0 || c >= extent[i])
+        mask[k] = 0;
+    }
+  NTL::ZZX poly;
+  ea.encode(poly, mask);
+  return poly;
+}
+
+// Several sub-hypercubes are placed side by side along every dimension, so
+// one thin recryption serves prod_i floor(D_i/extent[i]) ciphertexts. As
+// digit extraction works on all the slots at once anyway, the cost per
+// ciphertext scales with the number of slots it uses.
+void sparseThinRecrypt(const CtPtrs& cPtrs,
+                       const std::vector<long>& extent,
+                       bool zeroOutside)
+{
+  if (cPtrs.size() == 0)
+    return;
+  const PubKey& pKey = cPtrs[0]->getPubKey();
+  const EncryptedArray& ea = *pKey.getContext().ea;
+  long nDims = ea.dimension();
+  assertEq(lsize(extent),
+           nDims,
+           "Sub-hypercube must have ea.dimension() sizes");
+
+  std::vector<long> fit(nDims);
+  long perCtxt = 1;
+  for (long i = 0; i < nDims; i++) {
+    assertInRange(extent[i],
+                  1l,
+                  ea.sizeOfDimension(i),
+                  "Sub-hypercube extent out of range",
+                  /*right_inclusive=*/true);
+    fit[i] = ea.sizeOfDimension(i) / extent[i];
+    perCtxt *= fit[i];
+  }
+
+  // The position of the b'th sub-hypercube in a packed ciphertext
+  std::vector<std::vector<long>> offsets(perCtxt, std::vector<long>(nDims));
+  for (long b = 0; b < perCtxt; b++) {
+    long rest = b;
+    for (long i = 0; i < nDims; i++) {
+      offsets[b][i] = (rest % fit[i]) * extent[i];
+      rest /= fit[i];
+    }
+  }
+  const NTL::ZZX mask = subHypercubeMask(ea, extent, offsets[0]);
+
+  for (long first = 0; first < cPtrs.size(); first += perCtxt) {
+    long count = std::min(perCtxt, cPtrs.size() - first);
+
+    Ctxt packed(ZeroCtxtLike, *cPtrs[first]);
+    for (long b = 0; b < count; b++) {
+      Ctxt tmp = *cPtrs[first + b];
+      if (count > 1)
+        tmp.multByConstant(mask); // clear the slots of the others
+      for (long i = 0; i < nDims; i++)
+        if (offsets[b][i] != 0)
+          ea.rotate1D(tmp, i, offsets[b][i]);
+      packed += tmp;
+    }
+
+    pKey.thinReCrypt(packed);
+
+    for (long b = 0; b < count; b++) {
+      Ctxt& out = *cPtrs[first + b];
+      out = packed;
+      for (long i = 0; i < nDims; i++)
+        if (offsets[b][i] != 0)
+          ea.rotate1D(out, i, -offsets[b][i]);
+      if (zeroOutside)
+        out.multByConstant(mask);
+    }
+  }
+}
+
 //===================== Thin Bootstrapping stuff ==================
 
 // This code was copied from RecryptData::init, and is mostly
@@ -1124,6 +1220,145 @@ void PubKey::thinReCrypt(Ctxt& ctxt) const
     ctxt.intFactor = NTL::MulMod(ctxt.intFactor, intFactor, ptxtSpace);
 }
 
+
+/********************************************************************/
+/************************* CKKS bootstrapping ***********************/
+/********************************************************************/
+
+long CKKSRecryptData::defMargin(long r)
+{
+  // (2*pi*2^{-margin})^2/6 = 2^{margin-r}
+  const double twoPi = 2 * PI;
+  return long(std::ceil((r + std::log2(twoPi * twoPi / 6)) / 3));
+}
+
+void CKKSRecryptData::init(const Context& context, long t, long margin_)
+{
+  if (evalMod != nullptr) { // were we called for a second time?
+    std::cerr << "@Warning: multiple calls to CKKSRecryptData::init\n";
+    return;
+  }
+  assertEq(context.alMod.getTag(),
+           PA_cx_tag,
+           "CKKS bootstrapping requires a CKKS context");
+
+  assertTrue<InvalidArgument>(margin_ >= 0, "Negative bootstrapping margin");
+
+  long phim = context.zMStar.getPhiM();
+  long defHwt = RecryptData::defSkHwt;
+  skHwt = (t > 0) ? t : std::min(defHwt, phim / 2);
+  modBound = context.boundForRecryption(skHwt);
+  margin = (margin_ > 0) ? margin_ : defMargin(context.alMod.getR());
+
+  // The inputs of evalMod are in [-(modBound+1), modBound+1]. Halving the
+  // angle until it is in about [-pi,pi] keeps the degree low, and every
+  // double-angle step multiplies the approximation error by at most 4.
+  doublings = 1;
+  while ((1L << doublings) < 2 * (modBound + 1))
+    doublings++;
+  const double twoPi = 2 * PI;
+  const double scale = twoPi / (1L << doublings);
+  const auto f = [scale](double x) {
+    return std::cos(scale * (x - 0.25));
+  };
+  double target = std::ldexp(1.0, -context.alMod.getR() - 2 * doublings);
+  double bound = modBound + 1;
+  long degree = 8;
+  std::shared_ptr<ChebyshevApprox> approx;
+  for (;; degree += 4) {
+    approx = std::make_shared<ChebyshevApprox>(f, -bound, bound, degree);
+    if (degree >= 128 || approx->maxError(f) <= target)
+      break;
+  }
+  evalMod = approx;
+
+  coeffMap = std::make_shared<CKKSEvalMap>(*context.ea);
+}
+
+void PubKey::ckksReCrypt(Ctxt& ctxt) const
+{
+  HELIB_TIMER_START;
+
+  if (ctxt.isEmpty())
+    return;
+
+  const CKKSRecryptData& rcData = context.ckksRcData;
+  assertTrue(ctxt.isCKKS(), "ckksReCrypt requires a CKKS ciphertext");
+  assertTrue(rcData.isInitialized(), "No CKKS bootstrapping data in context");
+  assertTrue(recryptKeyID >= 0l, "No bootstrapping data");
+
+  NTL::xdouble ptxtMag = ctxt.ptxtMag;
+
+  // Switch to the sparse key, so that I in P + q0*I is small
+  HELIB_NTIMER_START(AAA_bootKeySwitch);
+  ctxt.cleanUp();
+  ctxt.reLinearize(recryptKeyID);
+  ctxt.dropSmallAndSpecialPrimes();
+  HELIB_NTIMER_STOP(AAA_bootKeySwitch);
+
+  // Scale P up to about 2^{-margin} of q0: the sine approximation needs
+  // P/q0 small, and the linear maps lose precision relative to I
+  double logQ0 = context.logOfProduct(ctxt.primeSet);
+  double logPtxt = NTL::log(ctxt.ratFactor * ptxtMag);
+  long bits = long((logQ0 - logPtxt) / std::log(2.0)) - rcData.margin;
+  assertTrue<LogicError>(bits >= 0,
+                         "Not enough capacity left for CKKS bootstrapping");
+  if (bits > 0) {
+    NTL::ZZ factor = NTL::power2_ZZ(bits);
+    for (CtxtPart& part : ctxt.parts)
+      part *= factor;
+    ctxt.noiseBound *= NTL::to_xdouble(factor);
+    ctxt.ratFactor *= NTL::to_xdouble(factor);
+  }
+  NTL::xdouble ratFactor = ctxt.ratFactor;
+
+  // ModRaise: the parts, lifted to [-q0/2,q0/2), decrypt modulo the whole
+  // chain to P + q0*I. Dividing by q0 the slots hold the decoding of
+  // P/q0 + I, where I is part of the plaintext and not of the noise.
+  HELIB_NTIMER_START(AAA_modRaise);
+  IndexSet raise = context.ctxtPrimes / ctxt.primeSet;
+  for (CtxtPart& part : ctxt.parts)
+    part.addPrimes(raise);
+  ctxt.primeSet.insert(raise);
+  ctxt.ratFactor = NTL::xexp(logQ0);
+  ctxt.ptxtMag = rcData.modBound * std::sqrt(double(context.zMStar.getPhiM()));
+  ctxt.reLinearize(0); // back to the main key
+  ctxt.dropSmallAndSpecialPrimes();
+  HELIB_NTIMER_STOP(AAA_modRaise);
+
+  // Move the coefficients into the slots, the first half in re and the
+  // second half in im
+  HELIB_NTIMER_START(AAA_coeffToSlot);
+  Ctxt re(ZeroCtxtLike, ctxt), im(ZeroCtxtLike, ctxt);
+  rcData.coeffMap->coeffToSlot(re, im, ctxt);
+  HELIB_NTIMER_STOP(AAA_coeffToSlot);
+
+  // x -> sin(2*pi*x) = cos(2*pi*(x-1/4)), which is 2*pi*(x-round(x)) for x
+  // near an integer
+  HELIB_NTIMER_START(AAA_evalMod);
+  for (Ctxt* x : {&re, &im}) {
+    rcData.evalMod->evaluate(*x);
+    for (long i = 0; i < rcData.doublings; i++) {
+      x->square();
+      x->multByConstantCKKS(2.0);
+      x->addConstantCKKS(-1.0);
+      x->setPtxtMag(NTL::xdouble(1.0));
+    }
+  }
+  HELIB_NTIMER_STOP(AAA_evalMod);
+
+  // Back to coefficients. The slots hold the decoding of 2*pi*P/q0,
+  // i.e. 2*pi*ratFactor/q0 times the original values.
+  HELIB_NTIMER_START(AAA_slotToCoeff);
+  rcData.coeffMap->slotToCoeff(ctxt, re, im);
+  HELIB_NTIMER_STOP(AAA_slotToCoeff);
+
+  const double twoPi = 2 * PI;
+  ctxt.multByConstantCKKS(
+      NTL::conv<double>(NTL::xexp(logQ0) / (ratFactor * twoPi)));
+  ctxt.ptxtMag = ptxtMag;
+}
+
 #ifdef HELIB_DEBUG
 
 static void checkCriticalValue(const std::vector<NTL::ZZX>& zzParts,
@@ -0,0 +1,449 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <NTL/BasicThreadPool.h>
+#include <helib/scheduler.h>
+#include <helib/apiAttributes.h>
+#include <helib/memoryAccounting.h>
+
+#ifdef HELIB_THREADS
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#endif
+
+#if defined(HELIB_THREADS) && defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace helib {
+
+// Parse a sysfs cpu list such as "0-3,8-11"
+static std::vector<long> parseCpuList(const std::string& list)
+{
+  std::vector<long> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty())
+      continue;
+    std::size_t dash = range.find('-');
+    long lo = std::stol(range.substr(0, dash));
+    long hi =
+        (dash == std::string::npos) ? lo : std::stol(range.substr(dash + 1));
+    for (long cpu = lo; cpu <= hi; cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+// The CPUs of every NUMA node that has any, as reported by Linux sysfs.
+// Empty if the topology is not available.
+static const std::vector<std::vector<long>>& numaTopology()
+{
+  static const std::vector<std::vector<long>> topology = [] {
+    std::vector<std::vector<long>> nodes;
+    for (long node = 0; node < 1024; node++) {
+      std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) +
+                       "/cpulist");
+      if (!in)
+        continue;
+      std::string list;
+      std::getline(in, list);
+      std::vector<long> cpus = parseCpuList(list);
+      if (!cpus.empty())
+        nodes.push_back(cpus);
+    }
+    return nodes;
+  }();
+  return topology;
+}
+
+long TaskScheduler::numaNodes() const
+{
+  return std::max<long>(numaTopology().size(), 1);
+}
+
+#ifdef HELIB_THREADS
+
+// Worker threads have indexes 1..nThreads-1, every other thread has index 0
+static thread_local long tls_workerId = 0;
+
+// The NUMA node that this thread is pinned to, if any
+static thread_local long tls_node = -1;
+
+// The number of parallel loops that this thread is taking part in
+static thread_local long tls_depth = 0;
+
+class LoopDepth
+{
+public:
+  LoopDepth() { tls_depth++; }
+  ~LoopDepth() { tls_depth--; }
+  LoopDepth(const LoopDepth&) = delete;
+  LoopDepth& operator=(const LoopDepth&) = delete;
+};
+
+// Detaches NTL's thread pool from the calling thread while it takes part in
+// a parallel loop, so that an NTL_EXEC_RANGE in the body runs serially rather
+// than waking NTL's threads next to the busy workers. The workers have no
+// NTL pool (it is thread-local), so theirs already do.
+class NTLPoolDetach
+{
+  NTL::BasicThreadPool* pool;
+
+public:
+  NTLPoolDetach() : pool(NTL::ReleaseThreadPool()) {}
+  ~NTLPoolDetach() { NTL::ResetThreadPool(pool); }
+  NTLPoolDetach(const NTLPoolDetach&) = delete;
+  NTLPoolDetach& operator=(const NTLPoolDetach&) = delete;
+};
+
+// Pin the calling thread to the CPUs of the given node
+static void pinToNode(long node)
+{
+  const std::vector<std::vector<long>>& topology = numaTopology();
+  if (topology.size() > 1) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (long cpu : topology[node])
+      if (cpu < CPU_SETSIZE)
+        CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      return; // not allowed to pin, leave the thread where it is
+#else
+    return;
+#endif
+  }
+  tls_node = node;
+}
+
+// The chunks of a single parallel loop
+struct LoopGroup
+{
+  std::mutex mtx;
+  std::condition_variable done; // signalled when the last chunk completes
+  long pending;                 // chunks not yet completed
+  std::exception_ptr error;     // the first exception thrown by a chunk
+
+  explicit LoopGroup(long n) : pending(n) {}
+
+  void fail(std::exception_ptr e)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!error)
+      error = e;
+  }
+};
+
+struct LoopTask
+{
+  LoopGroup* group;
+  const std::function<void(long, long)>* body;
+  long first, last;
+};
+
+struct TaskQueue
+{
+  std::mutex mtx;
+  std::deque<LoopTask> tasks; // the owner works at the back, thieves at front
+};
+
+struct TaskScheduler::Impl
+{
+  std::vector<std::unique_ptr<TaskQueue>> queues; // one per thread index
+  std::vector<std::thread> workers;
+  std::atomic<bool> stop{false};
+  std::atomic<long> queued{0}; // total number of tasks in all the queues
+  std::mutex sleepMtx;          // guards the increments of queued and stop
+  std::condition_variable wake; // signalled when tasks are pushed or on stop
+  std::mutex configMtx;         // serializes restarts
+  // Held shared by the outermost loop of every non-worker thread, and
+  // exclusively by a restart, which so waits for the loops in flight
+  std::shared_timed_mutex loopMtx;
+
+  void start(long nThreads, bool pin, long nNodes)
+  {
+    stop = false;
+    queues.clear();
+    for (long i = 0; i < nThreads; i++)
+      queues.emplace_back(new TaskQueue);
+    for (long i = 1; i < nThreads; i++)
+      workers.emplace_back([this, i, pin, nNodes] {
+        if (pin)
+          pinToNode(i % nNodes);
+        workerLoop(i);
+      });
+  }
+
+  void shutdown()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleepMtx);
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers)
+      t.join();
+    workers.clear();
+  }
+
+  void push(long id, std::vector<LoopTask>& tasks)
+  {
+    {
+      std::lock_guard<std::mutex> lock(queues[id]->mtx);
+      for (const LoopTask& t : tasks)
+        queues[id]->tasks.push_back(t);
+    }
+    {
+      // Under the lock, so that a worker cannot miss the wake-up between
+      // checking queued and going to sleep
+      std::lock_guard<std::mutex> lock(sleepMtx);
+      queued += tasks.size();
+    }
+    wake.notify_all();
+  }
+
+  // Take the newest task from our own queue, or the oldest from another one
+  bool take(long id, LoopTask& task)
+  {
+    long n = queues.size();
+    for (long k = 0; k < n; k++) {
+      long victim = (id + k) % n;
+      TaskQueue& q = *queues[victim];
+      std::lock_guard<std::mutex> lock(q.mtx);
+      if (q.tasks.empty())
+        continue;
+      if (k == 0) {
+        task = q.tasks.back();
+        q.tasks.pop_back();
+      } else {
+        task = q.tasks.front();
+        q.tasks.pop_front();
+      }
+      queued--;
+      return true;
+    }
+    return false;
+  }
+
+  // Take a task that belongs to the given loop, from any of the queues
+  bool takeFromGroup(long id, const LoopGroup* group, LoopTask& task)
+  {
+    long n = queues.size();
+    for (long k = 0; k < n; k++) {
+      TaskQueue& q = *queues[(id + k) % n];
+      std::lock_guard<std::mutex> lock(q.mtx);
+      for (auto it = q.tasks.rbegin(); it != q.tasks.rend(); ++it) {
+        if (it->group != group)
+          continue;
+        task = *it;
+        q.tasks.erase(std::next(it).base());
+        queued--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void run(const LoopTask& task)
+  {
+    LoopGroup* group = task.group;
+    std::exception_ptr error;
+    try {
+      (*task.body)(task.first, task.last);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    // The caller destroys the group once it sees pending == 0, which it can
+    // only check after this lock is released: this is the last access
+    std::lock_guard<std::mutex> lock(group->mtx);
+    if (error && !group->error)
+      group->error = error;
+    if (--group->pending == 0)
+      group->done.notify_all();
+  }
+
+  void workerLoop(long id)
+  {
+    tls_workerId = id;
+    while (!stop) {
+      LoopTask task;
+      if (take(id, task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepMtx);
+      wake.wait(lock, [this] { return stop || queued > 0; });
+    }
+  }
+};
+
+TaskScheduler::TaskScheduler() :
+    impl(new Impl),
+    nThreads(std::max(NTL::AvailableThreads(), 1L)),
+    pinned(false)
+{
+  impl->start(nThreads, pinned, numaNodes());
+}
+
+TaskScheduler::~TaskScheduler() { impl->shutdown(); }
+
+void TaskScheduler::setNumThreads(long n)
+{
+  assertTrue<InvalidArgument>(n >= 1, "Number of threads must be positive");
+  assertTrue<LogicError>(tls_depth == 0 && currentWorker() == 0,
+                         "Cannot resize the scheduler from a parallel loop");
+  if (NTL::AvailableThreads() != n)
+    NTL::SetNumThreads(n);
+  std::lock_guard<std::mutex> lock(impl->configMtx);
+  if (n == nThreads)
+    return;
+  std::unique_lock<std::shared_timed_mutex> loops(impl->loopMtx);
+  impl->shutdown();
+  nThreads = n;
+  impl->start(nThreads, pinned, numaNodes());
+}
+
+void TaskScheduler::setNumaPinning(bool pin)
+{
+  assertTrue<LogicError>(tls_depth == 0 && currentWorker() == 0,
+                         "Cannot restart the scheduler from a parallel loop");
+  std::lock_guard<std::mutex> lock(impl->configMtx);
+  if (pin == pinned)
+    return;
+  std::unique_lock<std::shared_timed_mutex> loops(impl->loopMtx);
+  impl->shutdown();
+  pinned = pin;
+  impl->start(nThreads, pinned, numaNodes());
+}
+
+long TaskScheduler::currentWorker() { return tls_workerId; }
+
+long TaskScheduler::currentNode() { return tls_node; }
+
+void TaskScheduler::parallelFor(long n,
+                                const std::function<void(long, long)>& body,
+                                long grain)
+{
+  if (n <= 0)
+    return;
+  grain = std::max(grain, 1L);
+
+  // The outermost loop of a non-worker keeps the scheduler from being
+  // restarted until it is done
+  long id = currentWorker();
+  std::shared_lock<std::shared_timed_mutex> running;
+  if (id == 0 && tls_depth == 0)
+    running = std::shared_lock<std::shared_timed_mutex>(impl->loopMtx);
+  LoopDepth depth;
+
+  // A few chunks per thread, so that uneven chunks can be balanced
+  long nChunks = std::min((n + grain - 1) / grain, 4 * nThreads);
+  if (nThreads == 1 || nChunks <= 1) {
+    body(0, n);
+    return;
+  }
+
+  // Charge the memory allocated by the chunks to the caller's MemoryScope
+  MemoryAccount* account = MemoryScope::current();
+  const std::function<void(long, long)> scopedBody = [&](long first,
+                                                         long last) {
+    MemoryScope scope(account);
+    body(first, last);
+  };
+
+  LoopGroup group(nChunks - 1);
+  std::vector<LoopTask> tasks;
+  for (long k = 1; k < nChunks; k++)
+    tasks.push_back(
+        LoopTask{&group, &scopedBody, k * n / nChunks, (k + 1) * n / nChunks});
+  impl->push(id, tasks);
+
+  // Run the first chunk here, then help with the rest of this loop, and
+  // sleep until the chunks that other threads took are done
+  {
+    NTLPoolDetach detach;
+    try {
+      body(0, n / nChunks);
+    } catch (...) {
+      group.fail(std::current_exception());
+    }
+    LoopTask task;
+    while (impl->takeFromGroup(id, &group, task))
+      Impl::run(task);
+  }
+  {
+    std::unique_lock<std::mutex> lock(group.mtx);
+    group.done.wait(lock, [&group] { return group.pending == 0; });
+  }
+
+  if (group.error)
+    std::rethrow_exception(group.error);
+}
+
+#else // no HELIB_THREADS, everything runs serially in the calling thread
+
+struct TaskScheduler::Impl
+{};
+
+TaskScheduler::TaskScheduler() : impl(new Impl), nThreads(1), pinned(false)
+{}
+
+TaskScheduler::~TaskScheduler() = default;
+
+void TaskScheduler::setNumThreads(long n)
+{
+  assertTrue<InvalidArgument>(n >= 1, "Number of threads must be positive");
+}
+
+void TaskScheduler::setNumaPinning(bool pin) { pinned = pin; }
+
+long TaskScheduler::currentWorker() { return 0; }
+
+long TaskScheduler::currentNode() { return -1; }
+
+void TaskScheduler::parallelFor(long n,
+                                const std::function<void(long, long)>& body,
+                                UNUSED long grain)
+{
+  if (n > 0)
+    body(0, n);
+}
+
+#endif // ifdef HELIB_THREADS
+
+TaskScheduler& TaskScheduler::instance()
+{
+  static TaskScheduler scheduler;
+  return scheduler;
+}
+
+void TaskScheduler::invoke(const std::function<void()>& f1,
+                           const std::function<void()>& f2)
+{
+  parallelFor(2, [&](long first, long last) {
+    for (long i = first; i < last; i++)
+      (i == 0) ? f1() : f2();
+  });
+}
+
+} // namespace helib
@@ -1228,6 +1228,193 @@ TEST_P(GTestBinaryArith, bitwiseNotNotsCorrectly)
   EXPECT_THROW(do_not(), helib::LogicError);
 }
 
+TEST_P(GTestBinaryArith, divideBinaryDividesCorrectly)
+{
+  // Small sizes keep the circuit within the levels of the parameters that
+  // do not bootstrap
+  const helib::EncryptedArray& ea = *context.ea;
+  const long dividendSize = 3;
+  const long divisorSize = 2;
+  long dividend_data = NTL::RandomBits_long(dividendSize);
+  long divisor_data = 1 + NTL::RandomBnd((1L << divisorSize) - 1);
+
+  std::vector<helib::Ctxt> dividend(dividendSize, helib::Ctxt(secKey));
+  std::vector<helib::Ctxt> divisor(divisorSize, helib::Ctxt(secKey));
+  for (long i = 0; i < dividendSize; ++i)
+    secKey.Encrypt(dividend[i], NTL::ZZX((dividend_data >> i) & 1));
+  for (long i = 0; i < divisorSize; ++i)
+    secKey.Encrypt(divisor[i], NTL::ZZX((divisor_data >> i) & 1));
+
+  for (helib::DivisionAlgorithm algorithm :
+       {helib::DivisionAlgorithm::RESTORING,
+        helib::DivisionAlgorithm::NON_RESTORING}) {
+    std::vector<helib::Ctxt> quotient, remainder;
+    helib::CtPtrs_vectorCt quotient_wrapper(quotient);
+    helib::CtPtrs_vectorCt remainder_wrapper(remainder);
+    helib::divideBinary(quotient_wrapper,
+                        remainder_wrapper,
+                        helib::CtPtrs_vectorCt(dividend),
+                        helib::CtPtrs_vectorCt(divisor),
+                        algorithm,
+                        &unpackSlotEncoding);
+    EXPECT_EQ(quotient.size(), dividendSize);
+    EXPECT_EQ(remainder.size(), divisorSize);
+
+    std::vector<long> decrypted_quotient, decrypted_remainder;
+    helib::decryptBinaryNums(decrypted_quotient, quotient_wrapper, secKey, ea);
+    helib::decryptBinaryNums(decrypted_remainder,
+                             remainder_wrapper,
+                             secKey,
+                             ea);
+    for (long i = 0; i < ea.size(); ++i) {
+      EXPECT_EQ(decrypted_quotient[i], dividend_data / divisor_data)
+          << dividend_data << "/" << divisor_data << ", i = " << i;
+      EXPECT_EQ(decrypted_remainder[i], dividend_data % divisor_data)
+          << dividend_data << "%" << divisor_data << ", i = " << i;
+    }
+  }
+
+  // The divisor must have at least one bit
+  std::vector<helib::Ctxt> quotient, remainder, empty;
+  helib::CtPtrs_vectorCt quotient_wrapper(quotient);
+  helib::CtPtrs_vectorCt remainder_wrapper(remainder);
+  EXPECT_THROW(helib::divideBinary(quotient_wrapper,
+                                   remainder_wrapper,
+                                   helib::CtPtrs_vectorCt(dividend),
+                                   helib::CtPtrs_vectorCt(empty)),
+               helib::InvalidArgument);
+}
+
+TEST_P(GTestBinaryArith, divideBinaryByZeroGivesAllOnes)
+{
+  const helib::EncryptedArray& ea = *context.ea;
+  const long dividendSize = 3;
+  const long divisorSize = 2;
+  long dividend_data = NTL::RandomBits_long(dividendSize);
+
+  std::vector<helib::Ctxt> dividend(dividendSize, helib::Ctxt(secKey));
+  std::vector<helib::Ctxt> divisor(divisorSize, helib::Ctxt(secKey));
+  for (long i = 0; i < dividendSize; ++i)
+    secKey.Encrypt(dividend[i], NTL::ZZX((dividend_data >> i) & 1));
+  for (long i = 0; i < divisorSize; ++i)
+    secKey.Encrypt(divisor[i], NTL::ZZX(0L));
+
+  for (helib::DivisionAlgorithm algorithm :
+       {helib::DivisionAlgorithm::RESTORING,
+        helib::DivisionAlgorithm::NON_RESTORING}) {
+    std::vector<helib::Ctxt> quotient, remainder;
+    helib::CtPtrs_vectorCt quotient_wrapper(quotient);
+    helib::CtPtrs_vectorCt remainder_wrapper(remainder);
+    helib::divideBinary(quotient_wrapper,
+                        remainder_wrapper,
+                        helib::CtPtrs_vectorCt(dividend),
+                        helib::CtPtrs_vectorCt(divisor),
+                        algorithm,
+                        &unpackSlotEncoding);
+
+    std::vector<long> decrypted_quotient, decrypted_remainder;
+    helib::decryptBinaryNums(decrypted_quotient, quotient_wrapper, secKey, ea);
+    helib::decryptBinaryNums(decrypted_remainder,
+                             remainder_wrapper,
+                             secKey,
+                             ea);
+    for (long i = 0; i < ea.size(); ++i) {
+      EXPECT_EQ(decrypted_quotient[i], (1L << dividendSize) - 1)
+          << dividend_data << "/0, i = " << i;
+      EXPECT_EQ(decrypted_remainder[i],
+                dividend_data & ((1L << divisorSize) - 1))
+          << dividend_data << "%0, i = " << i;
+    }
+  }
+}
+
+TEST_P(GTestBinaryArith, fixedPointMultiplyAndRescaleRoundCorrectly)
+{
+  const helib::EncryptedArray& ea = *context.ea;
+  const long fracBits = 2;
+  long lhs_data = NTL::RandomBits_long(bitSize);
+  long rhs_data = NTL::RandomBits_long(bitSize);
+
+  std::vector<helib::Ctxt> lhs(bitSize, helib::Ctxt(secKey));
+  std::vector<helib::Ctxt> rhs(bitSize, helib::Ctxt(secKey));
+  for (long i = 0; i < bitSize; ++i) {
+    secKey.Encrypt(lhs[i], NTL::ZZX((lhs_data >> i) & 1));
+    secKey.Encrypt(rhs[i], NTL::ZZX((rhs_data >> i) & 1));
+  }
+
+  // The product of two numbers with fracBits fractional bits is rescaled
+  // back to fracBits fractional bits, rounding down
+  std::vector<helib::Ctxt> product;
+  helib::CtPtrs_vectorCt product_wrapper(product);
+  helib::multFixedPoint(product_wrapper,
+                        helib::CtPtrs_vectorCt(lhs),
+                        helib::CtPtrs_vectorCt(rhs),
+                        fracBits,
+                        /*sizeLimit=*/0,
+                        &unpackSlotEncoding);
+  EXPECT_EQ(product.size(), 2 * bitSize - fracBits);
+
+  std::vector<long> decrypted_result;
+  helib::decryptBinaryNums(decrypted_result, product_wrapper, secKey, ea);
+  for (long i = 0; i < ea.size(); ++i)
+    EXPECT_EQ(decrypted_result[i], (lhs_data * rhs_data) >> fracBits)
+        << lhs_data << "*" << rhs_data << ", i = " << i;
+
+  // Rescaling rounds down by default, and halves up when asked to round
+  std::vector<helib::Ctxt> output;
+  helib::CtPtrs_vectorCt output_wrapper(output);
+  helib::rescaleFixedPoint(output_wrapper, helib::CtPtrs_vectorCt(lhs), 2);
+  EXPECT_EQ(output.size(), bitSize - 2);
+  helib::decryptBinaryNums(decrypted_result, output_wrapper, secKey, ea);
+  EXPECT_EQ(decrypted_result[0], lhs_data >> 2);
+
+  helib::rescaleFixedPoint(output_wrapper,
+                           helib::CtPtrs_vectorCt(lhs),
+                           2,
+                           /*round=*/true,
+                           &unpackSlotEncoding);
+  EXPECT_EQ(output.size(), bitSize - 1);
+  helib::decryptBinaryNums(decrypted_result, output_wrapper, secKey, ea);
+  EXPECT_EQ(decrypted_result[0], (lhs_data + 2) >> 2);
+
+  // A negative shift multiplies by a power of two
+  helib::rescaleFixedPoint(output_wrapper, helib::CtPtrs_vectorCt(lhs), -3);
+  EXPECT_EQ(output.size(), bitSize + 3);
+  helib::decryptBinaryNums(decrypted_result, output_wrapper, secKey, ea);
+  EXPECT_EQ(decrypted_result[0], lhs_data << 3);
+}
+
+TEST_P(GTestBinaryArith, reciprocalFixedPointConverges)
+{
+  const helib::EncryptedArray& ea = *context.ea;
+  const long fracBits = 3;
+  // A divisor in [1/2, 1), i.e. with its top fractional bit set
+  long divisor_data =
+      (1L << (fracBits - 1)) | NTL::RandomBits_long(fracBits - 1);
+
+  std::vector<helib::Ctxt> divisor(fracBits, helib::Ctxt(secKey));
+  for (long i = 0; i < fracBits; ++i)
+    secKey.Encrypt(divisor[i], NTL::ZZX((divisor_data >> i) & 1));
+
+  std::vector<helib::Ctxt> reciprocal;
+  helib::CtPtrs_vectorCt reciprocal_wrapper(reciprocal);
+  helib::reciprocalFixedPoint(reciprocal_wrapper,
+                              helib::CtPtrs_vectorCt(divisor),
+                              fracBits,
+                              /*iterations=*/0,
+                              &unpackSlotEncoding);
+  EXPECT_EQ(reciprocal.size(), fracBits + 2);
+
+  // Less than 2 units in the last place from 2^fracBits / divisor
+  std::vector<long> decrypted_result;
+  helib::decryptBinaryNums(decrypted_result, reciprocal_wrapper, secKey, ea);
+  const long one = 1L << (2 * fracBits);
+  for (long i = 0; i < ea.size(); ++i)
+    EXPECT_LT(std::abs(decrypted_result[i] * divisor_data - one),
+              2 * divisor_data)
+        << "divisor = " << divisor_data << ", i = " << i;
+}
+
 INSTANTIATE_TEST_SUITE_P(
     smallParameterSizesRepeated,
     GTestBinaryArith,
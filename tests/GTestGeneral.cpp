@@ -528,6 +528,64 @@ TEST_P(GTestGeneral, rotate1D)
   delete handler;
 }
 
+// The number of rotation plans cached by ea
+long numRotationPlans(const helib::EncryptedArray& ea)
+{
+  if (ea.getTag() == helib::PA_GF2_tag)
+    return ea.getDerived(helib::PA_GF2()).numRotationPlans();
+  return ea.getDerived(helib::PA_zz_p()).numRotationPlans();
+}
+
+TEST_P(GTestGeneral, rotationPlansAreBuiltOnceAndReused)
+{
+  const helib::EncryptedArray& ea = *context.ea;
+  long nslots = ea.size();
+
+  helib::PlaintextArray p0(ea);
+  helib::random(ea, p0);
+  helib::Ctxt c0(publicKey);
+  ea.encrypt(c0, publicKey, p0);
+
+  const std::vector<long> amounts{1, -1, nslots / 2 + 1, 3 - nslots};
+  long plansAfterFirstRound = 0;
+  for (long round = 0; round < 2; round++) {
+    // The second round only uses cached plans
+    for (long amt : amounts) {
+      helib::PlaintextArray rotated(p0), shifted(p0);
+      helib::Ctxt cRotated(c0), cShifted(c0);
+      rotate(ea, rotated, amt);
+      ea.rotate(cRotated, amt);
+      shift(ea, shifted, amt);
+      ea.shift(cShifted, amt);
+      EXPECT_TRUE(ciphertextMatches(ea, secretKey, rotated, cRotated))
+          << "rotate by " << amt << " in round " << round;
+      EXPECT_TRUE(ciphertextMatches(ea, secretKey, shifted, cShifted))
+          << "shift by " << amt << " in round " << round;
+    }
+    if (round == 0)
+      plansAfterFirstRound = numRotationPlans(ea);
+  }
+  EXPECT_EQ(numRotationPlans(ea), plansAfterFirstRound);
+  if (context.zMStar.numOfGens() > 1)
+    EXPECT_GT(plansAfterFirstRound, 0);
+
+  // With room for a single plan, the others are dropped and rebuilt
+  if (ea.getTag() == helib::PA_GF2_tag)
+    ea.getDerived(helib::PA_GF2()).setMaxRotationPlans(1);
+  else
+    ea.getDerived(helib::PA_zz_p()).setMaxRotationPlans(1);
+  EXPECT_LE(numRotationPlans(ea), 1);
+  for (long amt : amounts) {
+    helib::PlaintextArray rotated(p0);
+    helib::Ctxt cRotated(c0);
+    rotate(ea, rotated, amt);
+    ea.rotate(cRotated, amt);
+    EXPECT_TRUE(ciphertextMatches(ea, secretKey, rotated, cRotated))
+        << "rotate by " << amt << " with a single cached plan";
+    EXPECT_LE(numRotationPlans(ea), 1);
+  }
+}
+
 // clang-format off
 INSTANTIATE_TEST_SUITE_P(variousParameters, GTestGeneral, ::testing::Values(
     //         R, p, r, d, c,  k,   L, s,  m,        mvec,        gens,     ords, seed, nt
@@ -128,6 +128,53 @@ TEST_P(GTestIntraSlot, packingAndUnpackingWorks)
     ASSERT_TRUE(equals(ea, p1[i], p2)) << "p2[" << i << "]=" << p2;
   }
 }
+
+TEST_P(GTestIntraSlot, linPolyEvaluatorMatchesApplyLinPoly1)
+{
+  NTL::ZZX G = context.alMod.getFactorsOverZZ()[0];
+  helib::EncryptedArray ea(context, G);
+  long d = ea.getDegree();
+
+  // Three random linear maps, each described by its action on X^j
+  std::vector<std::vector<NTL::ZZX>> maps(3, std::vector<NTL::ZZX>(d));
+  for (auto& map : maps)
+    for (auto& image : map) {
+      std::vector<long> coeffs(d);
+      for (long& c : coeffs)
+        c = NTL::RandomBnd(p);
+      for (long k = 0; k < d; k++)
+        SetCoeff(image, k, coeffs[k]);
+    }
+
+  helib::PlaintextArray p0(ea);
+  random(ea, p0);
+  helib::Ctxt ctxt(publicKey);
+  ea.encrypt(ctxt, publicKey, p0);
+
+  helib::LinPolyEvaluator evaluator(ea, maps);
+  std::vector<helib::Ctxt> images;
+  evaluator.applyAll(images, ctxt);
+  ASSERT_EQ(helib::lsize(images), helib::lsize(maps));
+
+  helib::PlaintextArray expected(ea), actual(ea);
+  for (long i = 0; i < helib::lsize(maps); i++) {
+    std::vector<NTL::ZZX> C;
+    ea.buildLinPolyCoeffs(C, maps[i]);
+    helib::Ctxt reference(ctxt);
+    helib::applyLinPoly1(ea, reference, C);
+
+    ea.decrypt(reference, secretKey, expected);
+    ea.decrypt(images[i], secretKey, actual);
+    EXPECT_TRUE(equals(ea, expected, actual)) << "map " << i;
+
+    // Applying a single map in place
+    helib::Ctxt single(ctxt);
+    evaluator.apply(single, i);
+    ea.decrypt(single, secretKey, actual);
+    EXPECT_TRUE(equals(ea, expected, actual)) << "map " << i << " (single)";
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(someParameters,
                          GTestIntraSlot,
                          ::testing::Values(
@@ -128,10 +128,12 @@ protected:
   virtual void TearDown() override { helib::cleanupDebugGlobals(); }
 };
 
-void testCube(NTL::Vec<helib::GenDescriptor>& vec, long widthBound)
+void testCube(NTL::Vec<helib::GenDescriptor>& vec,
+              long widthBound,
+              const helib::PermCostModel& model = helib::PermCostModel())
 {
   helib::GeneratorTrees trees;
-  long cost = trees.buildOptimalTrees(vec, widthBound);
+  long cost = trees.buildOptimalTrees(vec, widthBound, model);
   if (!helib_test::noPrint) {
     std::cout << "@TestCube: trees=" << trees << std::endl;
     std::cout << " cost =" << cost << std::endl;
@@ -326,6 +328,36 @@ TEST_P(GTestPermutations, ciphertextPermutations)
   }
 }
 
+TEST(GTestPermutationsCostModel, weightedModelsGiveValidCachedNetworks)
+{
+  NTL::Vec<helib::GenDescriptor> vec(NTL::INIT_SIZE, 2);
+  vec[0] = helib::GenDescriptor(/*order=*/6, /*good=*/true, /*genIdx=*/0);
+  vec[1] = helib::GenDescriptor(/*order=*/4, /*good=*/false, /*genIdx=*/1);
+
+  // The default model counts the shifts, as the two-argument version does
+  helib::GeneratorTrees plain, counted;
+  EXPECT_EQ(plain.buildOptimalTrees(vec, 4),
+            counted.buildOptimalTrees(vec, 4, helib::PermCostModel()));
+
+  // Make the second generator expensive and charge for masks and depth
+  helib::PermCostModel model(/*shift=*/100, /*mask=*/20, /*depth=*/50);
+  model.setShiftCost(1, 400);
+  EXPECT_EQ(model.shiftCost(0), 100);
+  EXPECT_EQ(model.shiftCost(1), 400);
+  EXPECT_THROW(model.setShiftCost(1, 0), helib::InvalidArgument);
+
+  helib::GeneratorTrees trees1, trees2;
+  long cost1 = trees1.buildOptimalTrees(vec, 4, model);
+  long cost2 = trees2.buildOptimalTrees(vec, 4, model); // from the cache
+  ASSERT_NE(cost1, NTL_MAX_LONG);
+  EXPECT_EQ(cost1, cost2);
+  EXPECT_EQ(trees1.numLayers(), trees2.numLayers());
+  EXPECT_LE(trees1.numLayers(), 4);
+  EXPECT_EQ(trees1.mapToCube(), trees2.mapToCube());
+
+  ASSERT_NO_FATAL_FAILURE(testCube(vec, 4, model));
+}
+
 INSTANTIATE_TEST_SUITE_P(
     defaultParameters,
     GTestPermutations,
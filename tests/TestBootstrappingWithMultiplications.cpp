@@ -11,6 +11,7 @@
  */
 #include <helib/helib.h>
 #include <helib/debugging.h>
+#include <helib/CtPtrs.h>
 
 #include "gtest/gtest.h"
 #include "test_common.h"
@@ -397,6 +398,45 @@ TEST_P(TestThinBootstrappingWithMultiplications,
   EXPECT_EQ(decrypted, ptxt);
 }
 
+TEST_P(TestThinBootstrappingWithMultiplications,
+       sparseThinBootstrappingPacksSubHypercubes)
+{
+  const long nslots = ea.size();
+  std::vector<long> extent(ea.dimension());
+  for (long i = 0; i < ea.dimension(); i++)
+    extent[i] = ea.sizeOfDimension(i);
+  extent[0] = std::max(1l, extent[0] / 2); // two per ciphertext
+
+  const auto inBox = [&](long k) {
+    for (long i = 0; i < ea.dimension(); i++)
+      if (ea.coordinate(i, k) >= extent[i])
+        return false;
+    return true;
+  };
+
+  // Three ciphertexts with different values, also outside the box
+  std::vector<long> bits(generateRandomBinaryVector(nslots));
+  std::vector<std::vector<long>> ptxts(3, std::vector<long>(nslots));
+  std::vector<helib::Ctxt> ctxts(3, helib::Ctxt(publicKey));
+  for (long j = 0; j < 3; j++) {
+    for (long k = 0; k < nslots; k++)
+      ptxts[j][k] = (bits[k] + j * (k % 3 == 0)) % 2;
+    ea.encrypt(ctxts[j], publicKey, ptxts[j]);
+  }
+
+  helib::sparseThinRecrypt(helib::CtPtrs_vectorCt(ctxts),
+                           extent,
+                           /*zeroOutside=*/true);
+
+  for (long j = 0; j < 3; j++) {
+    std::vector<long> decrypted(nslots);
+    ea.decrypt(ctxts[j], secretKey, decrypted);
+    for (long k = 0; k < nslots; k++)
+      EXPECT_EQ(decrypted[k], inBox(k) ? ptxts[j][k] : 0)
+          << "ciphertext " << j << ", slot " << k;
+  }
+}
+
 TEST_P(TestThinBootstrappingWithMultiplications,
        correctlyPerformsThinBootstrappingWithMultiplications)
 {
@@ -12,10 +12,14 @@
 #include <NTL/ZZ.h>
 #include <algorithm>
 #include <complex>
+#include <memory>
+#include <sstream>
 
 #include <helib/norms.h>
 #include <helib/helib.h>
 #include <helib/debugging.h>
+#include <helib/chebyshev.h>
+#include <helib/EvalMap.h>
 
 #include "gtest/gtest.h"
 #include "test_common.h"
@@ -515,6 +519,143 @@ TEST_P(
       << std::endl;
 }
 
+TEST_P(TestCKKS, chebyshevApproximationOfSigmoidWorks)
+{
+  const auto sigmoid = [](double x) { return 1 / (1 + std::exp(-x)); };
+  helib::ChebyshevApprox approx = helib::chebyshevSigmoid(-8, 8, 15);
+  EXPECT_LT(approx.maxError(sigmoid), 0.01);
+  EXPECT_LE(approx.depth(), 5);
+
+  // Random real values in [-8,8], ea.random returns them in [-1,1]
+  std::vector<double> vd;
+  ea.random(vd);
+  std::vector<std::complex<double>> vd1(vd.size()), vd2, vd3(vd.size());
+  for (std::size_t i = 0; i < vd.size(); i++) {
+    vd1[i] = 8 * vd[i];
+    vd3[i] = approx(vd1[i].real());
+  }
+
+  helib::Ctxt c1(publicKey);
+  ea.encrypt(c1, publicKey, vd1);
+  long bitsBefore = c1.bitCapacity();
+  approx.evaluate(c1);
+  ea.decrypt(c1, secretKey, vd2);
+
+  EXPECT_TRUE(cx_equals(vd2, vd3, epsilon))
+      << "  max(vd2)=" << helib::largestCoeff(vd2)
+      << ", max(vd3)=" << helib::largestCoeff(vd3)
+      << ", maxDiff=" << calcMaxDiff(vd2, vd3) << std::endl
+      << ", bits used=" << bitsBefore - c1.bitCapacity() << std::endl;
+}
+
+TEST_P(TestCKKS, chebyshevSeriesWithNegativeCoefficientsWorks)
+{
+  // Negative coefficients must not give a term a negative ratFactor
+  helib::ChebyshevApprox approx({0.5, -1.0, 0.25, -0.5, 1e-3}, -1, 1);
+
+  std::vector<double> vd;
+  ea.random(vd);
+  std::vector<std::complex<double>> vd1(vd.size()), vd2, vd3(vd.size());
+  for (std::size_t i = 0; i < vd.size(); i++) {
+    vd1[i] = vd[i];
+    vd3[i] = approx(vd[i]);
+  }
+
+  helib::Ctxt c1(publicKey);
+  ea.encrypt(c1, publicKey, vd1);
+  approx.evaluate(c1);
+  EXPECT_GT(NTL::conv<double>(c1.getRatFactor()), 0.0);
+  ea.decrypt(c1, secretKey, vd2);
+
+  EXPECT_TRUE(cx_equals(vd2, vd3, epsilon))
+      << "  max(vd2)=" << helib::largestCoeff(vd2)
+      << ", max(vd3)=" << helib::largestCoeff(vd3)
+      << ", maxDiff=" << calcMaxDiff(vd2, vd3) << std::endl;
+}
+
+TEST(TestCKKS, coeffToSlotAndSlotToCoeffAreInverses)
+{
+  helib::Context context(/*m=*/256, /*p=*/-1, /*r=*/20);
+  helib::buildModChain(context, /*bits=*/600, /*c=*/2);
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  helib::addSome1DMatrices(secretKey);
+  helib::addFrbMatrices(secretKey); // complex conjugation
+  const helib::PubKey& publicKey = secretKey;
+  const helib::EncryptedArrayCx& ea = context.ea->getCx();
+
+  helib::CKKSEvalMap map(*context.ea);
+  EXPECT_EQ(map.numLayers(), 5); // log2 of the 32 slots
+
+  std::vector<std::complex<double>> vd1, vd2, vre, vim;
+  ea.random(vd1);
+  helib::Ctxt c1(publicKey), re(publicKey), im(publicKey);
+  ea.encrypt(c1, publicKey, vd1);
+  map.coeffToSlot(re, im, c1);
+
+  // The slots of re and im are real
+  ea.decrypt(re, secretKey, vre);
+  ea.decrypt(im, secretKey, vim);
+  for (std::size_t i = 0; i < vre.size(); i++) {
+    EXPECT_NEAR(vre[i].imag(), 0, 1e-3);
+    EXPECT_NEAR(vim[i].imag(), 0, 1e-3);
+  }
+
+  map.slotToCoeff(c1, re, im);
+  ea.decrypt(c1, secretKey, vd2);
+  EXPECT_TRUE(cx_equals(vd2, vd1, 1e-3))
+      << "  max(vd1)=" << helib::largestCoeff(vd1)
+      << ", max(vd2)=" << helib::largestCoeff(vd2)
+      << ", maxDiff=" << calcMaxDiff(vd1, vd2) << std::endl;
+}
+
+TEST(TestCKKS, bootstrappingRefreshesCapacityAndKeepsTheSlots)
+{
+  helib::Context context(/*m=*/256, /*p=*/-1, /*r=*/20);
+  helib::buildModChain(context, /*bits=*/1600, /*c=*/2);
+  context.makeCKKSBootstrappable();
+  EXPECT_EQ(context.ckksRcData.margin,
+            helib::CKKSRecryptData::defMargin(/*r=*/20));
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  helib::addSome1DMatrices(secretKey);
+  helib::addFrbMatrices(secretKey); // complex conjugation
+  secretKey.genRecryptData();
+  const helib::PubKey& publicKey = secretKey;
+  const helib::EncryptedArrayCx& ea = context.ea->getCx();
+  ASSERT_TRUE(publicKey.isBootstrappable());
+
+  // The bootstrapping parameters survive serialization of the context
+  std::stringstream str;
+  helib::writeContextBase(str, context);
+  str << context;
+  std::unique_ptr<helib::Context> copy = helib::buildContextFromAscii(str);
+  str >> *copy;
+  EXPECT_TRUE(copy->isCKKSBootstrappable());
+  EXPECT_EQ(*copy, context);
+
+  std::vector<std::complex<double>> vd1, vd2;
+  ea.random(vd1);
+  helib::Ctxt c1(publicKey);
+  ea.encrypt(c1, publicKey, vd1);
+
+  // Use up most of the capacity, keeping the values
+  helib::IndexSet bottom = context.ctxtPrimes;
+  while (context.logOfProduct(bottom) / std::log(2.0) > 200)
+    bottom.remove(bottom.last());
+  c1.modDownToSet(bottom);
+  long before = c1.bitCapacity();
+
+  publicKey.reCrypt(c1);
+  ea.decrypt(c1, secretKey, vd2);
+
+  EXPECT_GT(c1.bitCapacity(), before);
+  EXPECT_TRUE(cx_equals(vd2, vd1, 0.01))
+      << "  max(vd1)=" << helib::largestCoeff(vd1)
+      << ", max(vd2)=" << helib::largestCoeff(vd2)
+      << ", maxDiff=" << calcMaxDiff(vd1, vd2) << std::endl;
+}
+
 TEST(TestCKKS, buildingCKKSContextWithMAsNotAPowerOfTwoThrows)
 {
   EXPECT_THROW(helib::Context context(99, -1, 20), helib::InvalidArgument);
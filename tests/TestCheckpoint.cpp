@@ -0,0 +1,129 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <cstdio>
+
+#include <helib/helib.h>
+#include <helib/Checkpoint.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestCheckpoint : public ::testing::Test
+{
+protected:
+  TestCheckpoint() :
+      context(/*m=*/257, /*p=*/2, /*r=*/1),
+      secretKey((buildModChain(context, /*bits=*/150, /*c=*/2), context)),
+      publicKey((secretKey.GenSecKey(), secretKey)),
+      ea(*context.ea),
+      path(::testing::TempDir() + "TestCheckpoint.ckpt")
+  {
+    std::remove(path.c_str());
+  }
+
+  ~TestCheckpoint() { std::remove(path.c_str()); }
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const helib::EncryptedArray& ea;
+  std::string path;
+
+  helib::Ptxt<helib::BGV> ptxtFor(long i)
+  {
+    std::vector<long> slots(ea.size());
+    for (long k = 0; k < ea.size(); k++)
+      slots[k] = (i * k + 1) % 2;
+    return helib::Ptxt<helib::BGV>(context, slots);
+  }
+};
+
+TEST_F(TestCheckpoint, restoresTrackedCiphertextsAndTheirMetadata)
+{
+  helib::Ctxt state(publicKey);
+  std::vector<helib::Ctxt> batch(3, helib::Ctxt(publicKey));
+  publicKey.Encrypt(state, ptxtFor(0));
+  for (long i = 0; i < 3; i++)
+    publicKey.Encrypt(batch[i], ptxtFor(i + 1));
+  state.multiplyBy(batch[0]); // at a lower level than fresh ciphertexts
+
+  {
+    helib::Checkpoint cp(publicKey, path, /*intervalSeconds=*/3600);
+    cp.track("state", state);
+    cp.track("batch", batch);
+    EXPECT_FALSE(cp.exists());
+    EXPECT_FALSE(cp.saveIfDue("too early"));
+    cp.save("step 7");
+    EXPECT_TRUE(cp.exists());
+  }
+
+  // A restarted job
+  helib::Ctxt state2(publicKey);
+  std::vector<helib::Ctxt> batch2;
+  helib::Checkpoint cp(publicKey, path);
+  cp.track("batch", batch2);
+  cp.track("state", state2);
+  std::string token;
+  ASSERT_TRUE(cp.restore(token));
+  EXPECT_EQ(token, "step 7");
+
+  EXPECT_EQ(state2.getPrimeSet(), state.getPrimeSet());
+  EXPECT_EQ(state2.getNoiseBound(), state.getNoiseBound());
+  helib::Ptxt<helib::BGV> expected = ptxtFor(0), result(context);
+  expected *= ptxtFor(1);
+  secretKey.Decrypt(result, state2);
+  EXPECT_EQ(result, expected);
+
+  ASSERT_EQ(batch2.size(), batch.size());
+  for (long i = 0; i < 3; i++) {
+    secretKey.Decrypt(result, batch2[i]);
+    EXPECT_EQ(result, ptxtFor(i + 1)) << "batch " << i;
+  }
+
+  // The restored ciphertexts continue the computation
+  state2 += batch2[1];
+  secretKey.Decrypt(result, state2);
+  expected += ptxtFor(2);
+  EXPECT_EQ(result, expected);
+}
+
+TEST_F(TestCheckpoint, refusesCheckpointsOfAnotherKeyOrMissingNames)
+{
+  helib::Ctxt state(publicKey);
+  publicKey.Encrypt(state, ptxtFor(0));
+  {
+    helib::Checkpoint cp(publicKey, path, /*intervalSeconds=*/0);
+    cp.track("state", state);
+    EXPECT_TRUE(cp.saveIfDue("0"));
+  }
+
+  std::string token;
+  helib::SecKey otherKey(context);
+  otherKey.GenSecKey();
+  helib::Ctxt other(otherKey);
+  helib::Checkpoint otherCp(otherKey, path);
+  otherCp.track("state", other);
+  EXPECT_THROW(otherCp.restore(token), helib::InvalidArgument);
+
+  helib::Checkpoint cp(publicKey, path);
+  cp.track("state", state);
+  helib::Ctxt missing(publicKey);
+  cp.track("missing", missing);
+  EXPECT_THROW(cp.restore(token), helib::InvalidArgument);
+
+  std::remove(path.c_str());
+  EXPECT_FALSE(cp.restore(token));
+}
+
+} // namespace
@@ -108,6 +108,85 @@ TEST_P(TestContext, calculateBitSizeOfQ)
   EXPECT_EQ(calcFullPrimesBitSize, bitsize);
 }
 
+TEST_P(TestContext, modSizesSelectionOnlyDependsOnTheChain)
+{
+  buildModChain(*context, /*bits=*/300, /*c=*/2);
+  long heuristic = context->zMStar.getPow2() ? 0 : 20;
+  EXPECT_EQ(context->modSizes.getIFFTCost(), heuristic);
+
+  // An independent context with the same chain, and its own memo, makes
+  // the same choices
+  helib::Context other(m, p, r);
+  buildModChain(other, /*bits=*/300, /*c=*/2);
+  ASSERT_EQ(other.ctxtPrimes, context->ctxtPrimes);
+  EXPECT_EQ(other.modSizes.getIFFTCost(), context->modSizes.getIFFTCost());
+
+  helib::IndexSet lower =
+      context->ctxtPrimes / helib::IndexSet(context->ctxtPrimes.last());
+  for (const helib::IndexSet& from :
+       {context->ctxtPrimes, lower, context->fullPrimes()}) {
+    double top = context->logOfProduct(from);
+    for (double frac : {0.95, 0.8, 0.6, 0.4, 0.2}) {
+      double low = frac * top, high = low + 10.0;
+      for (bool reverse : {false, true}) {
+        helib::IndexSet chosen =
+            context->modSizes.getSet4Size(low, high, from, reverse);
+        EXPECT_FALSE(helib::empty(chosen));
+        EXPECT_EQ(other.modSizes.getSet4Size(low, high, from, reverse),
+                  chosen);
+        EXPECT_EQ(other.modSizes.getSet4Size(low, high, from, lower, reverse),
+                  context->modSizes.getSet4Size(low,
+                                                high,
+                                                from,
+                                                lower,
+                                                reverse));
+      }
+    }
+  }
+}
+
+TEST_P(TestContext, modSizesCalibrationIsExplicitAndKeepsTheRandomStream)
+{
+  buildModChain(*context, /*bits=*/300, /*c=*/2);
+
+  NTL::SetSeed(NTL::ZZ(1234));
+  context->modSizes.calibrate(*context);
+  long afterCalibrate = NTL::RandomBnd(1L << 30);
+  NTL::SetSeed(NTL::ZZ(1234));
+  EXPECT_EQ(NTL::RandomBnd(1L << 30), afterCalibrate);
+  EXPECT_GE(context->modSizes.getIFFTCost(), 0);
+
+  context->modSizes.setIFFTCost(35);
+  EXPECT_EQ(context->modSizes.getIFFTCost(), 35);
+  EXPECT_THROW(context->modSizes.setIFFTCost(-1), helib::InvalidArgument);
+}
+
+TEST_P(TestContext, modSizesMemoizedSelectionMatchesFreshSelection)
+{
+  buildModChain(*context, /*bits=*/300, /*c=*/2);
+  const helib::IndexSet& from = context->ctxtPrimes;
+  double top = context->logOfProduct(from);
+
+  for (double frac : {0.9, 0.7, 0.5, 0.3}) {
+    double low = frac * top, high = low + 10.0;
+    helib::IndexSet first =
+        context->modSizes.getSet4Size(low, high, from, false);
+    helib::IndexSet second =
+        context->modSizes.getSet4Size(low, high, from, false);
+    EXPECT_EQ(first, second);
+
+    // A copy of the table shares the memoized choices
+    helib::ModuliSizes copy = context->modSizes;
+    EXPECT_EQ(copy.getSet4Size(low, high, from, false), first);
+
+    // Resetting the cost drops the memo, the same cost gives the same choice
+    copy.setIFFTCost(context->modSizes.getIFFTCost());
+    EXPECT_EQ(copy.getSet4Size(low, high, from, false), first);
+    EXPECT_EQ(copy.getSet4Size(low, high, from, from, false),
+              context->modSizes.getSet4Size(low, high, from, from, false));
+  }
+}
+
 TEST(TestContext, securityHasLowerBoundOfZero)
 {
   // Security = -109
@@ -18,6 +18,8 @@
 #include <helib/helib.h>
 #include <helib/debugging.h>
 
+#include <sstream>
+
 #include "test_common.h"
 #include "gtest/gtest.h"
 
@@ -224,6 +226,245 @@ TEST_P(TestCtxt, frobeniusAutomorphWorksCorrectly)
   }
 }
 
+TEST_P(TestCtxt, keySwitchingWithPerMatrixDigitsWorks)
+{
+  // Find an automorphism that has no key-switching matrix yet
+  long k = 0;
+  for (long i = 2; i < context.zMStar.getM() && k == 0; i++)
+    if (context.zMStar.inZmStar(i) && !publicKey.haveKeySWmatrix(1, i) &&
+        !secretKey.haveKeySWmatrix(1, i))
+      k = i;
+  if (k == 0)
+    GTEST_SKIP() << "All automorphisms already have matrices";
+
+  // One digit per ctxt prime: more columns than the default, less noise
+  std::vector<helib::IndexSet> digits =
+      helib::buildDigitPartition(context.ctxtPrimes,
+                                 context.ctxtPrimes.card());
+  EXPECT_THROW(secretKey.GenKeySWmatrix(1, k, {helib::IndexSet()}),
+               helib::InvalidArgument);
+  // A single digit must still fit under the special primes
+  if (context.logOfProduct(context.ctxtPrimes) >
+      context.logOfProduct(context.specialPrimes))
+    EXPECT_THROW(secretKey.GenKeySWmatrix(1, k, {context.ctxtPrimes}),
+                 helib::InvalidArgument);
+  secretKey.GenKeySWmatrix(1, k, digits);
+  const helib::KeySwitch& W = secretKey.getKeySWmatrix(1, k);
+  EXPECT_EQ(W.NumCols(), digits.size());
+  EXPECT_EQ(W.getDigits(context), digits);
+
+  // The partition survives both serialization formats
+  std::stringstream bin;
+  W.write(bin);
+  helib::KeySwitch fromBin;
+  fromBin.read(bin, context);
+  EXPECT_EQ(fromBin, W);
+  std::stringstream txt;
+  txt << W;
+  helib::KeySwitch fromTxt;
+  fromTxt.readMatrix(txt, context);
+  EXPECT_EQ(fromTxt.getDigits(context), digits);
+
+  // A matrix with the default partition is written as before partitions
+  // were recorded
+  const helib::KeySwitch& R = secretKey.getKeySWmatrix(2, 1);
+  ASSERT_FALSE(R.isDummy());
+  std::stringstream defaultBin, defaultTxt;
+  R.write(defaultBin);
+  defaultTxt << R;
+  EXPECT_EQ(defaultBin.str().find("|KD["), std::string::npos);
+  helib::KeySwitch defaultFromBin, defaultFromTxt;
+  defaultFromBin.read(defaultBin, context);
+  defaultFromTxt.readMatrix(defaultTxt, context);
+  EXPECT_EQ(defaultFromBin, R);
+  EXPECT_EQ(defaultFromTxt.getDigits(context), context.digits);
+
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 0);
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+  helib::Ctxt ctxt(secretKey);
+  secretKey.Encrypt(ctxt, ptxt);
+  ctxt.automorph(k);
+  ctxt.reLinearize();
+
+  ptxt.automorph(k);
+  helib::Ptxt<helib::BGV> result(context);
+  secretKey.Decrypt(result, ctxt);
+  EXPECT_EQ(ptxt, result);
+}
+
+TEST_P(TestCtxt, doubleCRTCopiesShareRowsUntilWritten)
+{
+  NTL::ZZX poly;
+  for (long i = 0; i < context.zMStar.getPhiM(); i++)
+    SetCoeff(poly, i, NTL::RandomBnd(11) - 5);
+  helib::DoubleCRT a(poly, context, context.ctxtPrimes);
+  long first = context.ctxtPrimes.first();
+
+  helib::DoubleCRT b(a);
+  EXPECT_TRUE(a.getMap().isShared(first));
+  EXPECT_EQ(&a.getMap()[first], &b.getMap()[first]);
+
+  // Permuting a shared copy must give the same as permuting in place
+  long k = context.zMStar.ZmStarGen(0);
+  if (k == 0)
+    k = context.zMStar.getM() - 1;
+  helib::DoubleCRT c(poly, context, context.ctxtPrimes);
+  b.automorph(k);
+  c.automorph(k);
+  EXPECT_FALSE(a.getMap().isShared(first));
+  EXPECT_EQ(b, c);
+
+  helib::DoubleCRT d(a);
+  helib::DoubleCRT e(poly, context, context.ctxtPrimes);
+  d.complexConj();
+  e.complexConj();
+  EXPECT_EQ(d, e);
+
+  // Arithmetic on a copy leaves the original alone
+  b = a;
+  b += a;
+  NTL::ZZX back;
+  a.toPoly(back);
+  EXPECT_EQ(back, poly);
+  b.toPoly(back);
+  EXPECT_EQ(back, 2 * poly);
+}
+
+TEST_P(TestCtxt, doubleCRTNewRowsKeepTheirFixedLength)
+{
+  NTL::ZZX poly;
+  for (long i = 0; i < context.zMStar.getPhiM(); i++)
+    SetCoeff(poly, i, NTL::RandomBnd(11) - 5);
+  helib::DoubleCRT a(poly, context, context.ctxtPrimes);
+  const helib::IndexSet& primes = a.getIndexSet();
+
+  // Moving shared rows gives fresh rows of the same contents
+  helib::DoubleCRT b(a);
+  b.relocate();
+  EXPECT_EQ(a, b);
+  for (long i : primes) {
+    EXPECT_FALSE(b.getMap().isShared(i));
+    EXPECT_TRUE(b.getMap()[i].fixed());
+  }
+  a.relocate(); // and so does moving rows that are not shared
+  EXPECT_EQ(a, b);
+
+  // So do the rows made by copy-on-write and by the shared-row paths
+  helib::DoubleCRT c(a), d(a);
+  c += a;
+  d.automorph(context.zMStar.getM() - 1);
+  d.complexConj();
+  EXPECT_EQ(d, a);
+  for (long i : primes) {
+    EXPECT_TRUE(c.getMap()[i].fixed());
+    EXPECT_TRUE(d.getMap()[i].fixed());
+  }
+}
+
+TEST_P(TestCtxt, preparedConstantsMultiplyLikeTheirDoubleCRT)
+{
+  NTL::ZZX poly;
+  for (long i = 0; i < context.zMStar.getPhiM(); i++)
+    SetCoeff(poly, i, NTL::RandomBnd(11) - 5);
+  helib::DoubleCRT c(poly, context, context.allPrimes());
+  helib::DoubleCRTPrecon prepared(c);
+
+  helib::DoubleCRT a(poly + 1, context, context.ctxtPrimes);
+  helib::DoubleCRT b(a);
+  a.Mul(c, /*matchIndexSets=*/false);
+  b.Mul(prepared, /*matchIndexSets=*/false);
+  EXPECT_EQ(a, b);
+  EXPECT_THROW(b *= prepared, helib::RuntimeError);
+
+  std::vector<long> slots(ea.size());
+  for (long& x : slots)
+    x = NTL::RandomBnd(p);
+  helib::Ptxt<helib::BGV> ptxt(context, slots);
+  helib::Ctxt ctxt(publicKey), expected(publicKey);
+  publicKey.Encrypt(ctxt, ptxt);
+  ctxt.dropSmallAndSpecialPrimes();
+  expected = ctxt;
+  expected.multByConstant(c);
+  ctxt.multByConstant(prepared);
+
+  helib::Ptxt<helib::BGV> result(context), expectedResult(context);
+  secretKey.Decrypt(result, ctxt);
+  secretKey.Decrypt(expectedResult, expected);
+  EXPECT_EQ(result, expectedResult);
+  EXPECT_EQ(ctxt.getNoiseBound(), expected.getNoiseBound());
+}
+
+TEST_P(TestCtxt, calibratedNoiseEstimatesBoundTheMeasuredNoise)
+{
+  helib::NoiseCalibrator calibrator(secretKey);
+  calibrator.runWorkload(4);
+  EXPECT_EQ(calibrator.samples(helib::NoiseCalibrator::ENCRYPT).size(), 8u);
+  EXPECT_EQ(calibrator.samples(helib::NoiseCalibrator::MULTIPLY).size(), 4u);
+  EXPECT_FALSE(calibrator.samples(helib::NoiseCalibrator::KEY_SWITCH).empty());
+  EXPECT_THROW(calibrator.fit(0.5), helib::InvalidArgument);
+
+  // With the default factors the context is written as before they existed
+  // (no extension section), and reads back with the default factors
+  if (!context.isCKKSBootstrappable()) {
+    std::stringstream defaultBin, defaultText;
+    helib::writeContextBaseBinary(defaultBin, context);
+    helib::writeContextBinary(defaultBin, context);
+    EXPECT_EQ(defaultBin.str().find("|CE["), std::string::npos);
+    std::unique_ptr<helib::Context> defaultFromBin =
+        helib::buildContextFromBinary(defaultBin);
+    helib::readContextBinary(defaultBin, *defaultFromBin);
+    EXPECT_EQ(defaultFromBin->noiseCorrection, helib::NoiseCorrection());
+    helib::writeContextBase(defaultText, context);
+    defaultText << context;
+    std::unique_ptr<helib::Context> defaultFromText =
+        helib::buildContextFromAscii(defaultText);
+    defaultText >> *defaultFromText;
+    EXPECT_EQ(*defaultFromText, context);
+  }
+
+  calibrator.apply(context, 2.0);
+  EXPECT_DOUBLE_EQ(
+      context.noiseCorrection.encrypt,
+      2.0 * calibrator.worstRatio(helib::NoiseCalibrator::ENCRYPT));
+
+  // The factors are serialized with the context
+  std::stringstream bin, text;
+  helib::writeContextBaseBinary(bin, context);
+  helib::writeContextBinary(bin, context);
+  std::unique_ptr<helib::Context> fromBin =
+      helib::buildContextFromBinary(bin);
+  helib::readContextBinary(bin, *fromBin);
+  EXPECT_EQ(fromBin->noiseCorrection, context.noiseCorrection);
+  helib::writeContextBase(text, context);
+  text << context;
+  std::unique_ptr<helib::Context> fromText =
+      helib::buildContextFromAscii(text);
+  text >> *fromText;
+  EXPECT_EQ(fromText->noiseCorrection, context.noiseCorrection);
+
+  // With the corrections, fresh and multiplied ciphertexts stay within
+  // their estimates and still decrypt correctly
+  std::vector<long> data(ea.size());
+  std::iota(data.begin(), data.end(), 0);
+  helib::Ptxt<helib::BGV> ptxt(context, data);
+  helib::Ctxt ctxt(publicKey);
+  publicKey.Encrypt(ctxt, ptxt);
+  EXPECT_LE(helib::realToEstimatedNoise(ctxt, secretKey), 1.0);
+
+  ctxt.multiplyBy(ctxt);
+  ptxt.multiplyBy(ptxt);
+  EXPECT_LE(helib::realToEstimatedNoise(ctxt, secretKey), 1.0);
+  helib::Ptxt<helib::BGV> result(context);
+  secretKey.Decrypt(result, ctxt);
+  EXPECT_EQ(ptxt, result);
+
+  // A second calibration refines the factors already in the context
+  helib::NoiseCalibrator refined(secretKey);
+  refined.runWorkload(2);
+  EXPECT_GT(refined.fit().encrypt, 0.0);
+}
+
 TEST_P(TestCtxtWithBadDimensions, rotate1DRotatesCorrectlyWithBadDimensions)
 {
   std::vector<long> data(ea.size());
@@ -0,0 +1,145 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+
+#include <helib/helib.h>
+#include <helib/CtxtStore.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestCtxtStore : public ::testing::Test
+{
+protected:
+  TestCtxtStore() :
+      context(/*m=*/257, /*p=*/2, /*r=*/1),
+      secretKey((buildModChain(context, /*bits=*/100, /*c=*/2), context)),
+      publicKey((secretKey.GenSecKey(), secretKey)),
+      ea(*context.ea),
+      spillPath(::testing::TempDir() + "TestCtxtStore.spill")
+  {}
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const helib::EncryptedArray& ea;
+  std::string spillPath;
+
+  helib::Ptxt<helib::BGV> ptxtFor(long i)
+  {
+    return helib::Ptxt<helib::BGV>(context, std::vector<long>(ea.size(), i % 2));
+  }
+
+  helib::Ctxt encrypt(long i)
+  {
+    helib::Ctxt ctxt(publicKey);
+    publicKey.Encrypt(ctxt, ptxtFor(i));
+    return ctxt;
+  }
+
+  void expectDecryptsTo(const helib::Ctxt& ctxt, long i)
+  {
+    helib::Ptxt<helib::BGV> result(context);
+    secretKey.Decrypt(result, ctxt);
+    EXPECT_EQ(result, ptxtFor(i)) << "ciphertext " << i;
+  }
+};
+
+TEST_F(TestCtxtStore, spillsBeyondTheBudgetAndReloadsCorrectly)
+{
+  const long n = 10;
+  helib::Ctxt sample = encrypt(0);
+  long bytes = helib::CtxtStore::ctxtBytes(sample);
+  helib::CtxtStore store(publicKey, spillPath, 3 * bytes);
+
+  for (long i = 0; i < n; i++)
+    store.push_back(encrypt(i));
+  EXPECT_EQ(store.size(), n);
+  EXPECT_LE(store.residentBytes(), 3 * bytes);
+  EXPECT_GE(store.spillCount(), n - 3);
+  EXPECT_FALSE(store.isResident(0));
+  EXPECT_TRUE(store.isResident(n - 1));
+
+  for (long i = 0; i < n; i++)
+    expectDecryptsTo(store.get(i), i);
+  EXPECT_GT(store.loadCount(), 0);
+  EXPECT_THROW(store.get(n), helib::OutOfRangeError);
+}
+
+TEST_F(TestCtxtStore, forEachVisitsInOrderWithUpdatedValues)
+{
+  const long n = 8;
+  helib::Ctxt sample = encrypt(0);
+  helib::CtxtStore store(publicKey,
+                         spillPath,
+                         2 * helib::CtxtStore::ctxtBytes(sample));
+  for (long i = 0; i < n; i++)
+    store.push_back(encrypt(i));
+
+  // Replace a spilled ciphertext, the old copy in the file must not be used
+  store.set(1, encrypt(2));
+
+  std::vector<long> order(n);
+  std::iota(order.rbegin(), order.rend(), 0);
+  std::vector<long> visited;
+  helib::Ctxt sum(publicKey);
+  store.forEach(order, [&](long i, const helib::Ctxt& ctxt) {
+    visited.push_back(i);
+    sum += ctxt;
+  });
+  EXPECT_EQ(visited, order);
+
+  // 0 + 0 + 0 + 1 + 0 + 1 + 0 + 1 (mod 2), as ciphertext 1 now holds 0
+  expectDecryptsTo(sum, 1);
+
+  store.setMemoryBudget(0);
+  EXPECT_EQ(store.residentBytes(), 0);
+  expectDecryptsTo(store.get(1), 2);
+}
+
+TEST_F(TestCtxtStore, roundTripsThroughTheTOCFormat)
+{
+  const long n = 6;
+  helib::Ctxt sample = encrypt(0);
+  const long bytes = helib::CtxtStore::ctxtBytes(sample);
+  const std::string tocPath = ::testing::TempDir() + "TestCtxtStore.toc";
+  {
+    helib::CtxtStore store(publicKey, spillPath, 2 * bytes);
+    for (long i = 0; i < n; i++)
+      store.push_back(encrypt(i));
+    EXPECT_THROW(store.writeTOC(tocPath, 4), helib::InvalidArgument);
+    store.writeTOC(tocPath, 2);
+  }
+
+  // The header of TOC::write: rows, columns, then the offsets
+  std::ifstream in(tocPath, std::ios::binary);
+  uint64_t dims[2];
+  in.read(reinterpret_cast<char*>(dims), sizeof(dims));
+  EXPECT_EQ(dims[0], 3u);
+  EXPECT_EQ(dims[1], 2u);
+  in.close();
+
+  helib::CtxtStore copy(publicKey, spillPath, 2 * bytes);
+  copy.appendFromTOC(tocPath);
+  ASSERT_EQ(copy.size(), n);
+  EXPECT_LE(copy.residentBytes(), 2 * bytes);
+  for (long i = 0; i < n; i++)
+    expectDecryptsTo(copy.get(i), i);
+  std::remove(tocPath.c_str());
+}
+
+} // namespace
@@ -0,0 +1,140 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <numeric>
+
+#include <helib/helib.h>
+#include <helib/GroupBy.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestGroupBy : public ::testing::Test
+{
+protected:
+  TestGroupBy() :
+      context(/*m=*/257, /*p=*/2, /*r=*/8),
+      secretKey((buildModChain(context, /*bits=*/400, /*c=*/2), context)),
+      publicKey((secretKey.GenSecKey(),
+                 helib::addSome1DMatrices(secretKey),
+                 secretKey)),
+      ea(*context.ea)
+  {}
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const helib::EncryptedArray& ea;
+
+  helib::Ctxt encrypt(const std::vector<long>& slots)
+  {
+    helib::Ctxt ctxt(publicKey);
+    ea.encrypt(ctxt, publicKey, slots);
+    return ctxt;
+  }
+
+  std::vector<long> decrypt(const helib::Ctxt& ctxt)
+  {
+    std::vector<long> slots;
+    ea.decrypt(ctxt, secretKey, slots);
+    return slots;
+  }
+};
+
+TEST_F(TestGroupBy, reducePacksTheSumsOfAnyNumberOfCiphertexts)
+{
+  const long n = ea.size();
+  helib::GroupBy groupBy(ea, 1);
+
+  // Fewer rotations than a totalSums per input
+  EXPECT_LT(groupBy.numRotations(n), n * NTL::NumBits(n - 1));
+
+  for (long count : {3l, n + 2}) {
+    std::vector<helib::Ctxt> in;
+    std::vector<long> expected;
+    for (long a = 0; a < count; a++) {
+      std::vector<long> slots(n);
+      for (long& x : slots)
+        x = NTL::RandomBnd(8);
+      in.push_back(encrypt(slots));
+      expected.push_back(std::accumulate(slots.begin(), slots.end(), 0l));
+    }
+
+    std::vector<helib::Ctxt> out;
+    groupBy.reduce(out, in);
+    ASSERT_EQ(lsize(out), (count + n - 1) / n);
+    std::vector<std::vector<long>> slots;
+    for (const helib::Ctxt& ctxt : out)
+      slots.push_back(decrypt(ctxt));
+    for (long a = 0; a < count; a++)
+      EXPECT_EQ(slots[a / n][a % n], expected[a] % 256) << "input " << a;
+  }
+}
+
+TEST_F(TestGroupBy, countsAndSumsEveryGroup)
+{
+  const long n = ea.size(), keyBits = 2, nValues = 2;
+  helib::GroupBy groupBy(ea, keyBits);
+  EXPECT_EQ(groupBy.numGroups(), 4);
+
+  std::vector<long> keys(n);
+  std::vector<std::vector<long>> values(nValues, std::vector<long>(n));
+  for (long s = 0; s < n; s++) {
+    keys[s] = NTL::RandomBnd(groupBy.numGroups());
+    for (auto& column : values)
+      column[s] = NTL::RandomBnd(10);
+  }
+
+  std::vector<helib::Ctxt> keyBitCtxts;
+  for (long i = 0; i < keyBits; i++) {
+    std::vector<long> bits(n);
+    for (long s = 0; s < n; s++)
+      bits[s] = (keys[s] >> i) & 1;
+    keyBitCtxts.push_back(encrypt(bits));
+  }
+  std::vector<helib::Ctxt> valueCtxts;
+  for (const auto& column : values)
+    valueCtxts.push_back(encrypt(column));
+
+  std::vector<helib::Ctxt> indicators;
+  groupBy.indicators(indicators, helib::CtPtrs_vectorCt(keyBitCtxts));
+  ASSERT_EQ(lsize(indicators), groupBy.numGroups());
+  for (long g = 0; g < groupBy.numGroups(); g++) {
+    std::vector<long> slots = decrypt(indicators[g]);
+    for (long s = 0; s < n; s++)
+      EXPECT_EQ(slots[s], long(keys[s] == g)) << "group " << g;
+  }
+
+  std::vector<helib::Ctxt> out;
+  groupBy.aggregate(out, helib::CtPtrs_vectorCt(keyBitCtxts), valueCtxts);
+  std::vector<std::vector<long>> slots;
+  for (const helib::Ctxt& ctxt : out)
+    slots.push_back(decrypt(ctxt));
+
+  for (long g = 0; g < groupBy.numGroups(); g++) {
+    std::vector<long> expected(1 + nValues);
+    for (long s = 0; s < n; s++)
+      if (keys[s] == g) {
+        expected[0]++;
+        for (long v = 0; v < nValues; v++)
+          expected[v + 1] += values[v][s];
+      }
+    for (long column = 0; column <= nValues; column++) {
+      long a = groupBy.aggregateIndex(g, column);
+      EXPECT_EQ(slots[a / n][a % n], expected[column])
+          << "group " << g << ", column " << column;
+    }
+  }
+}
+
+} // namespace
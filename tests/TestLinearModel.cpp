@@ -0,0 +1,146 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <cmath>
+
+#include <helib/helib.h>
+#include <helib/LinearModel.h>
+#include <helib/chebyshev.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestLinearModel : public ::testing::Test
+{
+protected:
+  TestLinearModel() :
+      context(/*m=*/1024, /*p=*/-1, /*r=*/20),
+      secretKey((helib::buildModChain(context, /*bits=*/400, /*c=*/2),
+                 context)),
+      publicKey((secretKey.GenSecKey(),
+                 helib::addSome1DMatrices(secretKey),
+                 secretKey)),
+      ea(*context.ea)
+  {}
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const helib::EncryptedArray& ea;
+
+  static std::vector<std::vector<double>> randomMatrix(long rows,
+                                                       long cols,
+                                                       double bound)
+  {
+    std::vector<std::vector<double>> mat(rows, std::vector<double>(cols));
+    for (auto& row : mat)
+      for (double& x : row)
+        x = bound * (2 * NTL::RandomReal() - 1);
+    return mat;
+  }
+
+  // Encrypt the samples, evaluate the model and decrypt the outputs
+  std::vector<std::vector<double>> score(
+      const helib::LinearModel& model,
+      const std::vector<std::vector<double>>& samples)
+  {
+    std::vector<helib::Ctxt> batch;
+    for (const auto& slots : model.encodeBatch(samples)) {
+      batch.emplace_back(publicKey);
+      ea.getCx().encrypt(batch.back(), publicKey, slots);
+    }
+    model.evaluate(batch);
+    std::vector<std::vector<double>> slots(batch.size());
+    for (std::size_t i = 0; i < batch.size(); i++)
+      ea.getCx().decrypt(batch[i], secretKey, slots[i]);
+    return model.decodeBatch(slots, samples.size());
+  }
+};
+
+TEST_F(TestLinearModel, choosesTheEncodingWithFewerRotations)
+{
+  helib::LinearLayer inner(ea, randomMatrix(1, 8, 1.0));
+  EXPECT_EQ(inner.getEncoding(), helib::BlockEncoding::HYBRID);
+  EXPECT_EQ(inner.numRotations(), 3);
+  EXPECT_EQ(inner.blockSize(), 8);
+
+  helib::LinearLayer outer(ea, randomMatrix(8, 2, 1.0));
+  EXPECT_EQ(outer.getEncoding(), helib::BlockEncoding::DIAGONAL);
+  EXPECT_EQ(outer.numRotations(), 8);
+
+  EXPECT_EQ(helib::LinearModel::choosePacking(ea, 1, {8, 1}),
+            helib::SamplePacking::BLOCKS);
+  EXPECT_EQ(helib::LinearModel::choosePacking(ea, 4 * ea.size(), {8, 1}),
+            helib::SamplePacking::REPLICATED);
+}
+
+TEST_F(TestLinearModel, logisticRegressionMatchesThePlaintextModel)
+{
+  const long nFeatures = 8;
+  std::vector<std::vector<double>> weights = randomMatrix(1, nFeatures, 0.5);
+  std::vector<double> bias{0.25};
+  helib::ChebyshevApprox sigmoid = helib::chebyshevSigmoid(-8, 8, 15);
+
+  helib::LinearModel model(ea);
+  model.addLayer(weights, bias).addActivation(sigmoid);
+  EXPECT_EQ(model.samplesPerBatch(), ea.size() / 8);
+
+  std::vector<std::vector<double>> samples =
+      randomMatrix(model.samplesPerBatch(), nFeatures, 1.0);
+  std::vector<std::vector<double>> outputs = score(model, samples);
+
+  ASSERT_EQ(outputs.size(), samples.size());
+  for (std::size_t s = 0; s < samples.size(); s++) {
+    double z = bias[0];
+    for (long c = 0; c < nFeatures; c++)
+      z += weights[0][c] * samples[s][c];
+    EXPECT_NEAR(outputs[s][0], sigmoid(z), 0.01) << "sample " << s;
+  }
+}
+
+TEST_F(TestLinearModel, mlpGivesTheSameOutputsWithEveryLayout)
+{
+  std::vector<std::vector<double>> w1 = randomMatrix(4, 6, 0.5);
+  std::vector<std::vector<double>> w2 = randomMatrix(3, 4, 0.5);
+  std::vector<double> b1{0.1, -0.2, 0.3, 0}, b2{0.5, 0, -0.5};
+  std::vector<std::vector<double>> samples = randomMatrix(5, 6, 1.0);
+
+  std::vector<std::vector<double>> expected;
+  for (const auto& x : samples) {
+    std::vector<double> h(b1), y(b2);
+    for (long j = 0; j < 4; j++)
+      for (long c = 0; c < 6; c++)
+        h[j] += w1[j][c] * x[c];
+    for (long j = 0; j < 3; j++)
+      for (long c = 0; c < 4; c++)
+        y[j] += w2[j][c] * h[c];
+    expected.push_back(y);
+  }
+
+  const std::vector<std::pair<helib::SamplePacking, helib::BlockEncoding>>
+      layouts{{helib::SamplePacking::BLOCKS, helib::BlockEncoding::DIAGONAL},
+              {helib::SamplePacking::BLOCKS, helib::BlockEncoding::HYBRID},
+              {helib::SamplePacking::REPLICATED, helib::BlockEncoding::AUTO}};
+  for (const auto& layout : layouts) {
+    helib::LinearModel model(ea, layout.first);
+    model.addLayer(w1, b1, layout.second).addLayer(w2, b2, layout.second);
+    std::vector<std::vector<double>> outputs = score(model, samples);
+    for (std::size_t s = 0; s < samples.size(); s++)
+      for (long j = 0; j < 3; j++)
+        EXPECT_NEAR(outputs[s][j], expected[s][j], 0.01)
+            << "packing " << int(layout.first) << ", encoding "
+            << int(layout.second) << ", sample " << s << ", output " << j;
+  }
+}
+
+} // namespace
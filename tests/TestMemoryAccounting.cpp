@@ -0,0 +1,143 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <memory>
+#include <sstream>
+
+#include <helib/helib.h>
+#include <helib/memoryAccounting.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestMemoryAccounting : public ::testing::Test
+{
+protected:
+  TestMemoryAccounting() :
+      context(/*m=*/257, /*p=*/2, /*r=*/1),
+      secretKey((buildModChain(context, /*bits=*/150, /*c=*/2), context)),
+      publicKey((secretKey.GenSecKey(), secretKey)),
+      rowBytes(context.zMStar.getPhiM() * sizeof(long))
+  {}
+
+  ~TestMemoryAccounting() { helib::setMemoryBudget(0); }
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const long rowBytes;
+
+  helib::Ctxt encrypt()
+  {
+    helib::Ctxt ctxt(publicKey);
+    publicKey.Encrypt(ctxt, helib::Ptxt<helib::BGV>(context));
+    return ctxt;
+  }
+};
+
+TEST_F(TestMemoryAccounting, chargesRowsToTheirCategoryOnce)
+{
+  using helib::MemCategory;
+  const long before = helib::memoryInUse(MemCategory::CTXT);
+  {
+    helib::Ctxt ctxt = encrypt();
+    const long bytes =
+        ctxt.numParts() * ctxt.getPrimeSet().card() * rowBytes;
+    EXPECT_EQ(helib::memoryInUse(MemCategory::CTXT) - before, bytes);
+
+    // A copy shares the rows until it is written
+    helib::Ctxt copy = ctxt;
+    EXPECT_EQ(helib::memoryInUse(MemCategory::CTXT) - before, bytes);
+    copy.negate();
+    EXPECT_EQ(helib::memoryInUse(MemCategory::CTXT) - before, 2 * bytes);
+  }
+  EXPECT_EQ(helib::memoryInUse(MemCategory::CTXT), before);
+
+  // Both rows of every key-switching matrix are charged to the keys
+  const long keysBefore = helib::memoryInUse(MemCategory::KEY_SWITCH);
+  {
+    helib::SecKey otherKey(context);
+    otherKey.GenSecKey();
+    long expected = 0;
+    for (const helib::KeySwitch& matrix : otherKey.keySWlist())
+      expected += (matrix.a.size() + matrix.b.size()) *
+                  (context.ctxtPrimes | context.specialPrimes).card() *
+                  rowBytes;
+    EXPECT_GT(expected, 0);
+    EXPECT_EQ(helib::memoryInUse(MemCategory::KEY_SWITCH) - keysBefore,
+              expected);
+
+    bool found = false;
+    for (const helib::MemoryUsage& usage : helib::memoryUsage())
+      if (usage.category == MemCategory::KEY_SWITCH &&
+          usage.owner == "PubKey")
+        found = usage.bytes >= expected && usage.peak >= usage.bytes;
+    EXPECT_TRUE(found);
+  }
+  EXPECT_EQ(helib::memoryInUse(MemCategory::KEY_SWITCH), keysBefore);
+
+  // A scope that does not override keeps the enclosing one
+  const long recryptionBefore = helib::memoryInUse(MemCategory::RECRYPTION);
+  const long matmulBefore = helib::memoryInUse(MemCategory::MATMUL);
+  {
+    helib::MemoryScope outer(MemCategory::RECRYPTION, "TestMemoryAccounting");
+    helib::MemoryScope inner(MemCategory::MATMUL, "ignored", false);
+    helib::MemoryCharge charge(12345);
+    EXPECT_EQ(helib::memoryInUse(MemCategory::RECRYPTION) - recryptionBefore,
+              12345);
+    EXPECT_EQ(helib::memoryInUse(MemCategory::MATMUL), matmulBefore);
+  }
+  EXPECT_EQ(helib::memoryInUse(MemCategory::RECRYPTION), recryptionBefore);
+
+  std::ostringstream report;
+  helib::printMemoryUsage(report);
+  EXPECT_NE(report.str().find("keySwitch PubKey"), std::string::npos);
+}
+
+TEST_F(TestMemoryAccounting, shrinkersRunWhenTheBudgetIsExceeded)
+{
+  using helib::MemCategory;
+  std::unique_ptr<helib::MemoryCharge> cache;
+  {
+    helib::MemoryScope scope(MemCategory::CACHE, "TestMemoryAccounting");
+    cache.reset(new helib::MemoryCharge(1 << 20));
+  }
+  long shrinks = 0;
+  helib::MemoryShrinker shrinker(MemCategory::CACHE,
+                                 "TestMemoryAccounting",
+                                 [&] {
+                                   cache.reset();
+                                   shrinks++;
+                                 });
+
+  // A new ciphertext fits only once the cache is dropped
+  helib::setMemoryBudget(helib::memoryInUse() + rowBytes);
+  EXPECT_EQ(shrinks, 0);
+  helib::Ctxt ctxt = encrypt();
+  EXPECT_EQ(shrinks, 1);
+  EXPECT_FALSE(cache);
+  EXPECT_LE(helib::memoryInUse(), helib::memoryBudget());
+
+  // Under a hard budget an allocation that cannot fit throws, and is not
+  // charged
+  helib::setMemoryBudget(helib::memoryInUse() + rowBytes, /*hard=*/true);
+  const long inUse = helib::memoryInUse();
+  EXPECT_THROW(helib::MemoryCharge(2 * rowBytes), helib::RuntimeError);
+  EXPECT_EQ(helib::memoryInUse(), inUse);
+  EXPECT_NO_THROW(helib::MemoryCharge(rowBytes));
+
+  helib::setMemoryBudget(0);
+  EXPECT_NO_THROW(ctxt.negate());
+}
+
+} // namespace
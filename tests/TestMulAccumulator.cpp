@@ -0,0 +1,119 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <helib/helib.h>
+#include <helib/MulAccumulator.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestMulAccumulator : public ::testing::Test
+{
+protected:
+  TestMulAccumulator() :
+      context(/*m=*/257, /*p=*/2, /*r=*/1),
+      secretKey((buildModChain(context, /*bits=*/150, /*c=*/2), context)),
+      publicKey((secretKey.GenSecKey(),
+                 helib::addSome1DMatrices(secretKey),
+                 secretKey)),
+      ea(*context.ea)
+  {}
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const helib::EncryptedArray& ea;
+
+  helib::DoubleCRT randomConstant(const helib::IndexSet& primes)
+  {
+    std::vector<long> slots(ea.size());
+    for (long& x : slots)
+      x = NTL::RandomBnd(2);
+    NTL::ZZX poly;
+    ea.encode(poly, slots);
+    return helib::DoubleCRT(poly, context, primes);
+  }
+};
+
+TEST_F(TestMulAccumulator, wideSumsMatchReducedSumsPastTheFoldingPoint)
+{
+  const helib::IndexSet& primes = context.ctxtPrimes;
+  helib::DoubleCRTAccumulator acc(context, primes);
+  helib::DoubleCRT expected(context, primes), product(context, primes);
+
+  // Enough products of random residues to make the words fold at least once
+  for (long n = 0; n < 600; n++) {
+    helib::DoubleCRT a(context, primes), b(context, primes);
+    a.randomize();
+    b.randomize();
+    acc.mulAdd(a, b);
+    product = a;
+    product *= b;
+    expected += product;
+  }
+
+  helib::DoubleCRT result(context, primes);
+  acc.reduce(result);
+  EXPECT_EQ(result, expected);
+
+  acc.clear();
+  acc.reduce(result);
+  EXPECT_EQ(result, helib::DoubleCRT(context, primes));
+}
+
+TEST_F(TestMulAccumulator, sumOfProductsDecryptsLikeTheProductsAddedUp)
+{
+  std::vector<long> slots(ea.size());
+  for (long& x : slots)
+    x = NTL::RandomBnd(2);
+  helib::Ctxt ctxt(publicKey);
+  ea.encrypt(ctxt, publicKey, slots);
+
+  helib::MulAccumulator acc(publicKey);
+  helib::Ctxt expected(publicKey);
+  for (long k = 0; k < 5; k++) {
+    helib::Ctxt rotated(ctxt);
+    ea.rotate(rotated, k);
+    helib::DoubleCRT c = randomConstant(context.fullPrimes());
+    acc.mulAdd(helib::DoubleCRTPrecon(c), rotated);
+    rotated.multByConstant(c);
+    expected += rotated;
+  }
+  // A product at a lower level cannot be deferred and is added as usual
+  helib::Ctxt lower(ctxt);
+  lower.modDownToSet(lower.getPrimeSet() / helib::IndexSet(
+                                               lower.getPrimeSet().last()));
+  helib::DoubleCRT c = randomConstant(context.fullPrimes());
+  acc.mulAdd(c, lower);
+  helib::Ctxt dest(lower);
+  lower.multByConstant(c);
+  expected += lower;
+  // ... and destMulAdd computes it in place
+  acc.destMulAdd(c, dest);
+  EXPECT_EQ(dest, lower);
+  expected += lower;
+
+  helib::Ctxt result(publicKey);
+  EXPECT_FALSE(acc.isEmpty());
+  acc.addTo(result);
+  EXPECT_TRUE(acc.isEmpty());
+
+  std::vector<long> decrypted, wanted;
+  ea.decrypt(result, secretKey, decrypted);
+  ea.decrypt(expected, secretKey, wanted);
+  EXPECT_EQ(decrypted, wanted);
+  EXPECT_EQ(result.getPrimeSet(), expected.getPrimeSet());
+  EXPECT_LE(result.getNoiseBound(), expected.getNoiseBound() * 1.01);
+}
+
+} // namespace
@@ -963,8 +963,139 @@ TEST_P(TestPartialMatch, scoringWorksWithEncryptedDatabaseAndQueryAPIs)
     }
 }
 
+TEST_P(TestPartialMatch, fuzzyLookupMatchesRecordsEqualOnEnoughColumns)
+{
+  const long nslots = ea.size(), columns = 4, threshold = 3;
+  std::vector<std::vector<long>> records(columns), queries(columns);
+  std::vector<long> distance(nslots), matched(nslots);
+  for (long c = 0; c < columns; ++c)
+    for (long s = 0; s < nslots; ++s) {
+      records[c].push_back((s + c) % 3);
+      queries[c].push_back((s * c + 1) % 3);
+      distance[s] += records[c][s] != queries[c][s];
+    }
+  for (long s = 0; s < nslots; ++s)
+    matched[s] = columns - distance[s] >= threshold;
+
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_database(1l, columns);
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_query(1l, columns);
+  helib::Matrix<helib::Ctxt> encrypted_query(helib::Ctxt(publicKey),
+                                             1l,
+                                             columns);
+  for (long c = 0; c < columns; ++c) {
+    plaintext_database(0, c) = helib::Ptxt<helib::BGV>(context, records[c]);
+    plaintext_query(0, c) = helib::Ptxt<helib::BGV>(context, queries[c]);
+    publicKey.Encrypt(encrypted_query(0, c), plaintext_query(0, c));
+  }
+  helib::Database<helib::Ptxt<helib::BGV>> database(plaintext_database,
+                                                    context);
+  std::vector<long> index_set = {0, 1, 2, 3};
+
+  auto plaintext_distance =
+      database.getHammingDistance(index_set, plaintext_query);
+  auto plaintext_result =
+      database.fuzzyContains(index_set, threshold, plaintext_query);
+  auto encrypted_result =
+      database.fuzzyContains(index_set, threshold, encrypted_query);
+
+  ASSERT_EQ(encrypted_result.dims(0), 1l);
+  ASSERT_EQ(encrypted_result.dims(1), 1l);
+  EXPECT_EQ(plaintext_distance(0, 0),
+            helib::Ptxt<helib::BGV>(context, distance));
+  EXPECT_EQ(plaintext_result(0, 0), helib::Ptxt<helib::BGV>(context, matched));
+  helib::Ptxt<helib::BGV> decrypted_result(context);
+  secretKey.Decrypt(decrypted_result, encrypted_result(0, 0));
+  EXPECT_EQ(decrypted_result, helib::Ptxt<helib::BGV>(context, matched));
+}
+
+TEST_P(TestPartialMatch, fuzzyLookupWorksWithAnEncryptedThreshold)
+{
+  const long nslots = ea.size(), columns = 3;
+  std::vector<std::vector<long>> records(columns), queries(columns);
+  std::vector<long> thresholds(nslots), matched(nslots);
+  for (long s = 0; s < nslots; ++s) {
+    long count = 0;
+    for (long c = 0; c < columns; ++c) {
+      records[c].push_back((s + 2 * c) % 4);
+      queries[c].push_back((s * (c + 1)) % 4);
+      count += records[c][s] == queries[c][s];
+    }
+    thresholds[s] = s % (columns + 1);
+    matched[s] = count >= thresholds[s];
+  }
+
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_database(1l, columns);
+  helib::Matrix<helib::Ctxt> encrypted_database(helib::Ctxt(publicKey),
+                                                1l,
+                                                columns);
+  helib::Matrix<helib::Ptxt<helib::BGV>> plaintext_query(1l, columns);
+  helib::Matrix<helib::Ctxt> encrypted_query(helib::Ctxt(publicKey),
+                                             1l,
+                                             columns);
+  for (long c = 0; c < columns; ++c) {
+    plaintext_database(0, c) = helib::Ptxt<helib::BGV>(context, records[c]);
+    publicKey.Encrypt(encrypted_database(0, c), plaintext_database(0, c));
+    plaintext_query(0, c) = helib::Ptxt<helib::BGV>(context, queries[c]);
+    publicKey.Encrypt(encrypted_query(0, c), plaintext_query(0, c));
+  }
+  helib::Ptxt<helib::BGV> plaintext_threshold(context, thresholds);
+  helib::Ctxt encrypted_threshold(publicKey);
+  publicKey.Encrypt(encrypted_threshold, plaintext_threshold);
+  std::vector<long> index_set = {0, 1, 2};
+
+  helib::Database<helib::Ptxt<helib::BGV>> database(plaintext_database,
+                                                    context);
+  auto plaintext_result =
+      database.fuzzyContains(index_set, plaintext_threshold, plaintext_query);
+  EXPECT_EQ(plaintext_result(0, 0), helib::Ptxt<helib::BGV>(context, matched));
+
+  helib::Database<helib::Ctxt> encrypted(encrypted_database, context);
+  auto encrypted_result =
+      encrypted.fuzzyContains(index_set, encrypted_threshold, encrypted_query);
+  helib::Ptxt<helib::BGV> decrypted_result(context);
+  secretKey.Decrypt(decrypted_result, encrypted_result(0, 0));
+  EXPECT_EQ(decrypted_result, helib::Ptxt<helib::BGV>(context, matched));
+}
+
 INSTANTIATE_TEST_SUITE_P(variousParameters,
                          TestPartialMatch,
                          ::testing::Values(BGVParameters(1024, 1087, 1, 700)));
 
+// mapTo01 needs r = 1, so with r > 1 only the threshold test is run
+class TestPartialMatchLifted : public TestPartialMatch
+{};
+
+TEST_P(TestPartialMatchLifted, thresholdPolynomialIsFittedModPToTheR)
+{
+  const long p2r = context.alMod.getPPowR();
+  const long half = (p - 1) / 2;
+  const NTL::ZZX step = helib::thresholdPolynomial(-half, half, 0, p, r);
+
+  // Negative differences are held as p^r + v, not p + v
+  for (long v = -half; v <= half; ++v) {
+    NTL::ZZ x(((v % p2r) + p2r) % p2r), value(0);
+    for (long i = NTL::deg(step); i >= 0; --i)
+      value = value * x + NTL::coeff(step, i);
+    EXPECT_EQ(NTL::rem(value, p2r), v >= 0 ? 1 : 0) << "v = " << v;
+  }
+
+  std::vector<long> values(ea.size()), expected(ea.size());
+  for (long i = 0; i < ea.size(); ++i) {
+    long v = i % (2 * half + 1) - half;
+    values[i] = ((v % p2r) + p2r) % p2r;
+    expected[i] = v >= 0;
+  }
+  helib::Ctxt ctxt(publicKey);
+  ea.encrypt(ctxt, publicKey, values);
+  helib::applyPolynomial(ctxt, step);
+  std::vector<long> decrypted;
+  ea.decrypt(ctxt, secretKey, decrypted);
+  EXPECT_EQ(decrypted, expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(variousParameters,
+                         TestPartialMatchLifted,
+                         ::testing::Values(BGVParameters(1024, 5, 2, 500),
+                                           BGVParameters(1024, 17, 2, 700)));
+
 } // namespace
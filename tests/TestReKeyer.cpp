@@ -0,0 +1,148 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <helib/helib.h>
+#include <helib/ReKeyer.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestReKeyer : public ::testing::Test
+{
+protected:
+  TestReKeyer() :
+      context(/*m=*/257, /*p=*/2, /*r=*/1),
+      oldKey((buildModChain(context, /*bits=*/150, /*c=*/2), context)),
+      newKey(context),
+      ea(*context.ea),
+      path(::testing::TempDir() + "TestReKeyer.ctxts")
+  {
+    oldKey.GenSecKey();
+    newKey.GenSecKey();
+  }
+
+  helib::Context context;
+  helib::SecKey oldKey;
+  helib::SecKey newKey;
+  const helib::EncryptedArray& ea;
+  std::string path;
+
+  helib::Ptxt<helib::BGV> ptxtFor(long i)
+  {
+    std::vector<long> slots(ea.size());
+    for (long k = 0; k < ea.size(); k++)
+      slots[k] = (i + k) % 2;
+    return helib::Ptxt<helib::BGV>(context, slots);
+  }
+
+  void expectDecryptsTo(const helib::Ctxt& ctxt, long i)
+  {
+    helib::Ptxt<helib::BGV> result(context);
+    newKey.Decrypt(result, ctxt);
+    EXPECT_EQ(result, ptxtFor(i)) << "ciphertext " << i;
+  }
+};
+
+TEST_F(TestReKeyer, reKeyedCiphertextsDecryptUnderTheNewKey)
+{
+  long keyID = newKey.GenReKeyMatrix(oldKey);
+  helib::ReKeyer reKeyer(newKey, keyID);
+  // The old secret is not kept in the new key
+  EXPECT_EQ(newKey.sKeys[keyID].getIndexSet().card(), 0);
+
+  std::vector<helib::Ctxt> old(4, helib::Ctxt(oldKey));
+  for (long i = 0; i < long(old.size()); i++)
+    oldKey.Encrypt(old[i], ptxtFor(i));
+
+  std::vector<helib::Ctxt> reKeyed;
+  reKeyer.reKey(reKeyed, old);
+  ASSERT_EQ(reKeyed.size(), old.size());
+  for (long i = 0; i < long(reKeyed.size()); i++) {
+    EXPECT_TRUE(reKeyed[i].inCanonicalForm(0));
+    EXPECT_TRUE(reKeyed[i].isCorrect());
+    expectDecryptsTo(reKeyed[i], i);
+  }
+
+  // The results are ordinary ciphertexts of the new key
+  helib::Ctxt fresh(newKey);
+  newKey.Encrypt(fresh, ptxtFor(1));
+  reKeyed[0] += fresh;
+  helib::Ptxt<helib::BGV> expected = ptxtFor(0), result(context);
+  expected += ptxtFor(1);
+  newKey.Decrypt(result, reKeyed[0]);
+  EXPECT_EQ(result, expected);
+}
+
+TEST_F(TestReKeyer, reKeysAFileInPlace)
+{
+  helib::ReKeyer reKeyer(newKey, newKey.GenReKeyMatrix(oldKey));
+
+  const long n = 5;
+  {
+    std::ofstream out(path, std::ios::binary);
+    for (long i = 0; i < n; i++) {
+      helib::Ctxt ctxt(oldKey);
+      oldKey.Encrypt(ctxt, ptxtFor(i));
+      ctxt.write(out);
+    }
+  }
+
+  EXPECT_EQ(reKeyer.reKeyFile(path, /*batchSize=*/2), n);
+
+  std::ifstream in(path, std::ios::binary);
+  for (long i = 0; i < n; i++) {
+    helib::Ctxt ctxt(newKey);
+    ctxt.read(in);
+    EXPECT_TRUE(ctxt.inCanonicalForm(0));
+    expectDecryptsTo(ctxt, i);
+  }
+  EXPECT_EQ(in.peek(), std::ifstream::traits_type::eof());
+}
+
+TEST_F(TestReKeyer, rejectsAFileWithNonCanonicalCiphertexts)
+{
+  helib::ReKeyer reKeyer(newKey, newKey.GenReKeyMatrix(oldKey));
+
+  std::string original;
+  {
+    std::ostringstream out;
+    helib::Ctxt ctxt(oldKey);
+    oldKey.Encrypt(ctxt, ptxtFor(0));
+    ctxt.write(out);
+    ctxt.multLowLvl(ctxt); // relative to (1, s, s^2)
+    ctxt.write(out);
+    original = out.str();
+  }
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << original;
+  }
+
+  EXPECT_THROW(reKeyer.reKeyFile(path), helib::InvalidArgument);
+  std::ifstream in(path, std::ios::binary);
+  std::string contents((std::istreambuf_iterator<char>(in)),
+                       std::istreambuf_iterator<char>());
+  EXPECT_EQ(contents, original);
+  EXPECT_FALSE(std::ifstream(path + ".rekey").good());
+}
+
+TEST_F(TestReKeyer, refusesAKeyWithoutTheMatrix)
+{
+  EXPECT_THROW(helib::ReKeyer(newKey, 1), helib::InvalidArgument);
+}
+
+} // namespace
@@ -0,0 +1,194 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <atomic>
+#include <numeric>
+#include <vector>
+
+#include <NTL/BasicThreadPool.h>
+#include <helib/helib.h>
+#include <helib/scheduler.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(TestScheduler, parallelForCoversTheRangeExactlyOnce)
+{
+  std::vector<long> hits(1000, 0);
+  HELIB_EXEC_RANGE((long)hits.size(), first, last)
+  for (long i = first; i < last; i++)
+    hits[i]++;
+  HELIB_EXEC_RANGE_END
+
+  for (long h : hits)
+    EXPECT_EQ(h, 1);
+}
+
+TEST(TestScheduler, nestedLoopsComputeTheSameAsSerialLoops)
+{
+  const long outer = 16, inner = 200;
+  std::vector<long> sums(outer, 0);
+
+  HELIB_EXEC_RANGE(outer, first, last)
+  for (long i = first; i < last; i++) {
+    std::vector<long> row(inner);
+    HELIB_EXEC_RANGE(inner, first2, last2)
+    for (long j = first2; j < last2; j++)
+      row[j] = i * j;
+    HELIB_EXEC_RANGE_END
+    sums[i] = std::accumulate(row.begin(), row.end(), 0L);
+  }
+  HELIB_EXEC_RANGE_END
+
+  for (long i = 0; i < outer; i++)
+    EXPECT_EQ(sums[i], i * inner * (inner - 1) / 2);
+}
+
+TEST(TestScheduler, exceptionsArePropagatedToTheCaller)
+{
+  EXPECT_THROW(helib::TaskScheduler::instance().parallelFor(
+                   100,
+                   [](long first, long last) {
+                     for (long i = first; i < last; i++)
+                       if (i == 57)
+                         throw helib::RuntimeError("chunk failed");
+                   }),
+               helib::RuntimeError);
+}
+
+TEST(TestScheduler, invokeRunsBothFunctions)
+{
+  std::atomic<long> count(0);
+  helib::TaskScheduler::instance().invoke([&] { count += 1; },
+                                          [&] { count += 2; });
+  EXPECT_EQ(count, 3);
+}
+
+TEST(TestScheduler, perThreadScratchCombinesToTheTotal)
+{
+  helib::PerThread<long> partial(0);
+  HELIB_EXEC_RANGE(1000, first, last)
+  for (long i = first; i < last; i++)
+    partial.local() += i;
+  HELIB_EXEC_RANGE_END
+
+  long total = 0;
+  partial.forEach([&total](long x) { total += x; });
+  EXPECT_EQ(total, 999 * 1000 / 2);
+}
+
+TEST(TestScheduler, numaPinningKeepsLoopsCorrect)
+{
+  helib::TaskScheduler& scheduler = helib::TaskScheduler::instance();
+  EXPECT_GE(scheduler.numaNodes(), 1);
+
+  scheduler.setNumaPinning(true);
+  std::vector<long> nodes(64, -2);
+  HELIB_EXEC_RANGE((long)nodes.size(), first, last)
+  for (long i = first; i < last; i++)
+    nodes[i] = helib::TaskScheduler::currentNode();
+  HELIB_EXEC_RANGE_END
+  scheduler.setNumaPinning(false);
+
+  for (long node : nodes) {
+    EXPECT_GE(node, -1); // the calling thread is not pinned
+    EXPECT_LT(node, scheduler.numaNodes());
+  }
+  EXPECT_EQ(helib::TaskScheduler::currentNode(), -1);
+}
+
+TEST(TestScheduler, interleavedKeySwitchingMatricesStillSwitchKeys)
+{
+  helib::Context context(/*m=*/257, /*p=*/2, /*r=*/1);
+  buildModChain(context, /*bits=*/150, /*c=*/2);
+  helib::SecKey secretKey(context);
+  secretKey.GenSecKey();
+  addSome1DMatrices(secretKey);
+  const helib::PubKey& publicKey = secretKey;
+
+  std::vector<helib::KeySwitch> before = publicKey.keySWlist();
+  helib::TaskScheduler::instance().setNumaPinning(true);
+  secretKey.interleaveKeySWmatrices();
+  helib::TaskScheduler::instance().setNumaPinning(false);
+
+  // The same matrices, in rows that are no longer shared with the copies
+  ASSERT_EQ(publicKey.keySWlist().size(), before.size());
+  for (std::size_t i = 0; i < before.size(); i++) {
+    const helib::KeySwitch& matrix = publicKey.keySWlist()[i];
+    EXPECT_EQ(matrix, before[i]);
+    const helib::IndexSet& primes = matrix.b[0].getIndexSet();
+    EXPECT_FALSE(matrix.b[0].getMap().isShared(primes.first()));
+  }
+
+  std::vector<long> slots(context.ea->size());
+  std::iota(slots.begin(), slots.end(), 0);
+  for (long& slot : slots)
+    slot %= 2;
+  helib::Ptxt<helib::BGV> ptxt(context, slots), result(context);
+  helib::Ctxt ctxt(publicKey);
+  publicKey.Encrypt(ctxt, ptxt);
+  ctxt.multiplyBy(ctxt);
+  context.ea->rotate(ctxt, 1);
+  ptxt.multiplyBy(ptxt);
+  ptxt.rotate(1);
+  secretKey.Decrypt(result, ctxt);
+  EXPECT_EQ(result, ptxt);
+}
+
+#ifdef HELIB_THREADS
+TEST(TestScheduler, isOnlyResizedExplicitlyAndDetachesNTLsPoolInLoops)
+{
+  helib::TaskScheduler& scheduler = helib::TaskScheduler::instance();
+  const long saved = scheduler.numThreads();
+
+  // NTL's pool size is per thread, so it does not resize the scheduler
+  NTL::SetNumThreads(saved + 1);
+  scheduler.parallelFor(8, [](long, long) {});
+  EXPECT_EQ(scheduler.numThreads(), saved);
+
+  scheduler.setNumThreads(3);
+
+  // The chunks run on the caller see no NTL pool, the workers have none
+  std::atomic<bool> sawPool{false};
+  scheduler.parallelFor(64, [&](long, long) {
+    if (NTL::AvailableThreads() > 1)
+      sawPool = true;
+  });
+  EXPECT_EQ(scheduler.numThreads(), 3);
+  EXPECT_FALSE(sawPool);
+  EXPECT_EQ(NTL::AvailableThreads(), 3);
+
+  // A loop cannot restart the scheduler that runs it
+  std::atomic<bool> threw{false};
+  scheduler.parallelFor(4, [&](long, long) {
+    try {
+      scheduler.setNumThreads(2);
+    } catch (const helib::LogicError&) {
+      threw = true;
+    }
+  });
+  EXPECT_TRUE(threw);
+  EXPECT_EQ(scheduler.numThreads(), 3);
+
+  scheduler.setNumThreads(saved);
+  EXPECT_EQ(NTL::AvailableThreads(), saved);
+}
+#endif
+
+TEST(TestScheduler, setNumThreadsRejectsNonPositiveCounts)
+{
+  EXPECT_THROW(helib::TaskScheduler::instance().setNumThreads(0),
+               helib::InvalidArgument);
+}
+
+} // namespace
@@ -0,0 +1,148 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <map>
+
+#include <helib/helib.h>
+#include <helib/SegmentedDatabase.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestSegmentedDatabase : public ::testing::Test
+{
+protected:
+  TestSegmentedDatabase() :
+      context(/*m=*/257, /*p=*/2, /*r=*/1),
+      secretKey((buildModChain(context, /*bits=*/300, /*c=*/2), context)),
+      publicKey((secretKey.GenSecKey(),
+                 helib::addSome1DMatrices(secretKey),
+                 helib::addFrbMatrices(secretKey),
+                 secretKey)),
+      ea(*context.ea),
+      // Records equal to the query in both columns
+      query(helib::QueryBuilder(helib::makeQueryExpr(0) &&
+                                helib::makeQueryExpr(1))
+                .build(2))
+  {}
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const helib::EncryptedArray& ea;
+  helib::Query_t query;
+  std::map<long, std::vector<long>> records; // the live ones, by id
+
+  // Append nRecords random records of bits in rows of ea.size() slots
+  long append(helib::SegmentedDatabase& db, long nRows, long nRecords)
+  {
+    std::vector<std::vector<long>> values(nRecords, std::vector<long>(2));
+    for (auto& record : values)
+      for (long& bit : record)
+        bit = NTL::RandomBnd(2);
+
+    helib::Matrix<helib::Ctxt> rows(helib::Ctxt(publicKey), nRows, 2l);
+    for (long i = 0; i < nRows; i++)
+      for (long j = 0; j < 2; j++) {
+        std::vector<long> slots(ea.size());
+        for (long k = 0; k < ea.size() && i * ea.size() + k < nRecords; k++)
+          slots[k] = values[i * ea.size() + k][j];
+        ea.encrypt(rows(i, j), publicKey, slots);
+      }
+
+    long firstId = db.append(rows, nRecords);
+    for (long r = 0; r < nRecords; r++)
+      records[firstId + r] = values[r];
+    return firstId;
+  }
+
+  bool remove(helib::SegmentedDatabase& db, long id)
+  {
+    records.erase(id);
+    return db.remove(id);
+  }
+
+  // Check that the query for 1, 1 matches exactly the live records 1, 1
+  void expectMatches(const helib::SegmentedDatabase& db)
+  {
+    helib::Matrix<helib::Ctxt> data(helib::Ctxt(publicKey), 1l, 2l);
+    ea.encrypt(data(0, 0), publicKey, std::vector<long>(ea.size(), 1));
+    ea.encrypt(data(0, 1), publicKey, std::vector<long>(ea.size(), 1));
+    helib::SegmentedResult result = db.contains(query, data);
+
+    ASSERT_EQ(result.values.size(), result.ids.size());
+    long seen = 0;
+    std::vector<long> slots;
+    for (std::size_t i = 0; i < result.values.size(); i++) {
+      ea.decrypt(result.values[i], secretKey, slots);
+      for (long k = 0; k < ea.size(); k++) {
+        long id = result.ids[i][k];
+        if (id < 0) {
+          EXPECT_EQ(slots[k], 0) << "empty slot " << k << " of row " << i;
+          continue;
+        }
+        ASSERT_EQ(records.count(id), 1u) << "record " << id;
+        const std::vector<long>& record = records.at(id);
+        EXPECT_EQ(slots[k], long(record[0] == 1 && record[1] == 1))
+            << "record " << id;
+        seen++;
+      }
+    }
+    EXPECT_EQ(seen, lsize(records));
+  }
+};
+
+TEST_F(TestSegmentedDatabase, appendsRemovesAndQueriesAcrossSegments)
+{
+  helib::SegmentedDatabase db(publicKey, 2, /*rowsPerSegment=*/1);
+  const long nslots = ea.size();
+
+  EXPECT_EQ(append(db, 2, 2 * nslots), 0);
+  EXPECT_EQ(append(db, 1, 5), 2 * nslots);
+  EXPECT_EQ(db.numSegments(), 3);
+  EXPECT_EQ(db.numRows(), 3);
+  EXPECT_EQ(db.numRecords(), 2 * nslots + 5);
+
+  EXPECT_TRUE(remove(db, 1));
+  EXPECT_TRUE(remove(db, 2 * nslots + 4));
+  EXPECT_FALSE(db.remove(1));
+  EXPECT_FALSE(db.remove(2 * nslots + 5));
+  EXPECT_EQ(db.numRecords(), 2 * nslots + 3);
+
+  expectMatches(db);
+}
+
+TEST_F(TestSegmentedDatabase, compactionRepacksSparseSegmentsKeepingAnswers)
+{
+  helib::SegmentedDatabase db(publicKey, 2, /*rowsPerSegment=*/4);
+  const long nslots = ea.size();
+
+  append(db, 1, nslots);
+  for (long i = 0; i < 3; i++)
+    append(db, 1, nslots / 4);
+  EXPECT_TRUE(remove(db, nslots + 1));
+  EXPECT_EQ(db.numRows(), 4);
+  expectMatches(db);
+
+  // The three quarter-full rows fit into one, the full one is left alone
+  EXPECT_EQ(db.compact(), 2);
+  EXPECT_EQ(db.numRows(), 2);
+  EXPECT_EQ(db.numRecords(), nslots + 3 * (nslots / 4) - 1);
+  expectMatches(db);
+
+  EXPECT_EQ(db.compact(), 0);
+  EXPECT_TRUE(remove(db, nslots));
+  expectMatches(db);
+}
+
+} // namespace
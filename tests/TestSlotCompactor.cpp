@@ -0,0 +1,106 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <helib/helib.h>
+#include <helib/SlotCompactor.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestSlotCompactor : public ::testing::Test
+{
+protected:
+  TestSlotCompactor() :
+      context(/*m=*/257, /*p=*/2, /*r=*/1),
+      secretKey((buildModChain(context, /*bits=*/150, /*c=*/2), context)),
+      publicKey((secretKey.GenSecKey(),
+                 helib::addSome1DMatrices(secretKey),
+                 secretKey)),
+      ea(*context.ea)
+  {}
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const helib::EncryptedArray& ea;
+};
+
+TEST_F(TestSlotCompactor, packsSparseCiphertextsIntoOneAndUnpacksThem)
+{
+  const long nslots = ea.size();
+  const long n = 4;
+  const long used = nslots / n;
+
+  // Ciphertext i holds values in slots [0,used), and garbage elsewhere
+  std::vector<std::vector<long>> masks(n, std::vector<long>(nslots, 0));
+  std::vector<std::vector<long>> values(n, std::vector<long>(nslots));
+  std::vector<helib::Ctxt> ctxts(n, helib::Ctxt(publicKey));
+  for (long i = 0; i < n; i++) {
+    for (long k = 0; k < nslots; k++) {
+      masks[i][k] = (k < used);
+      values[i][k] = NTL::RandomBnd(2);
+    }
+    ea.encrypt(ctxts[i], publicKey, values[i]);
+  }
+
+  helib::SlotCompactor compactor(publicKey, masks);
+  EXPECT_EQ(compactor.numInputs(), n);
+  EXPECT_EQ(compactor.numPacked(), 1);
+  EXPECT_GE(compactor.numPackKeySwitches(), n - 1);
+  EXPECT_GE(compactor.numUnpackKeySwitches(), n - 1);
+  EXPECT_EQ(compactor.numKeySwitches(),
+            compactor.numPackKeySwitches() + compactor.numUnpackKeySwitches());
+
+  std::vector<helib::Ctxt> packed;
+  compactor.pack(packed, helib::CtPtrs_vectorCt(ctxts));
+  ASSERT_EQ(packed.size(), 1u);
+
+  std::vector<helib::Ctxt> unpacked(n, helib::Ctxt(publicKey));
+  compactor.unpack(helib::CtPtrs_vectorCt(unpacked),
+                   packed,
+                   /*zeroOutside=*/true);
+  for (long i = 0; i < n; i++) {
+    std::vector<long> decrypted;
+    ea.decrypt(unpacked[i], secretKey, decrypted);
+    for (long k = 0; k < nslots; k++)
+      EXPECT_EQ(decrypted[k], masks[i][k] ? values[i][k] : 0)
+          << "ciphertext " << i << ", slot " << k;
+  }
+}
+
+TEST_F(TestSlotCompactor, keepsCollidingCiphertextsApart)
+{
+  const long nslots = ea.size();
+  std::vector<std::vector<long>> masks{std::vector<long>(nslots, 1),
+                                       std::vector<long>(nslots, 1),
+                                       std::vector<long>(nslots, 0)};
+  helib::SlotCompactor compactor(publicKey, masks);
+  EXPECT_EQ(compactor.numPacked(), 2);
+  EXPECT_EQ(compactor.numKeySwitches(), 0);
+
+  std::vector<helib::Ctxt> ctxts(3, helib::Ctxt(publicKey));
+  std::vector<long> ones(nslots, 1);
+  for (helib::Ctxt& ctxt : ctxts)
+    ea.encrypt(ctxt, publicKey, ones);
+
+  std::vector<helib::Ctxt> packed;
+  compactor.pack(packed, helib::CtPtrs_vectorCt(ctxts));
+  compactor.unpack(helib::CtPtrs_vectorCt(ctxts), packed);
+
+  std::vector<long> decrypted;
+  ea.decrypt(ctxts[1], secretKey, decrypted);
+  EXPECT_EQ(decrypted, ones);
+  EXPECT_TRUE(ctxts[2].isEmpty());
+}
+
+} // namespace
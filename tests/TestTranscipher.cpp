@@ -0,0 +1,122 @@
+/* Copyright (C) 2020 IBM Corp.
+ * This program is Licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. See accompanying LICENSE file.
+ */
+#include <helib/helib.h>
+#include <helib/Transcipher.h>
+
+#include "test_common.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class TestTranscipher : public ::testing::Test
+{
+protected:
+  static helib::LowMC::Params smallParams()
+  {
+    helib::LowMC::Params params;
+    params.blockSize = 16;
+    params.keySize = 16;
+    params.nSboxes = 5;
+    params.rounds = 3;
+    return params;
+  }
+
+  TestTranscipher() :
+      context(/*m=*/257, /*p=*/2, /*r=*/1),
+      secretKey((helib::buildModChain(context, /*bits=*/300, /*c=*/2),
+                 context)),
+      publicKey((secretKey.GenSecKey(), secretKey)),
+      ea(*context.ea),
+      cipher(smallParams())
+  {
+    NTL::random(key, cipher.keySize());
+  }
+
+  helib::Context context;
+  helib::SecKey secretKey;
+  const helib::PubKey& publicKey;
+  const helib::EncryptedArray& ea;
+  helib::LowMC cipher;
+  NTL::vec_GF2 key;
+
+  std::vector<NTL::vec_GF2> randomBlocks(long n)
+  {
+    std::vector<NTL::vec_GF2> blocks(n);
+    for (NTL::vec_GF2& block : blocks)
+      NTL::random(block, cipher.blockSize());
+    return blocks;
+  }
+
+  // Check that slot s of bits[j] holds bit j of blocks[s]
+  void expectBitSliced(const std::vector<helib::Ctxt>& bits,
+                       const std::vector<NTL::vec_GF2>& blocks)
+  {
+    ASSERT_EQ(bits.size(), std::size_t(cipher.blockSize()));
+    std::vector<long> slots;
+    for (long j = 0; j < cipher.blockSize(); j++) {
+      ea.decrypt(bits[j], secretKey, slots);
+      for (std::size_t s = 0; s < blocks.size(); s++)
+        EXPECT_EQ(slots[s], NTL::rep(blocks[s].get(j)))
+            << "bit " << j << " of block " << s;
+    }
+  }
+};
+
+TEST_F(TestTranscipher, counterModeRoundTripsAndDependsOnTheNonce)
+{
+  const std::vector<NTL::vec_GF2> data = randomBlocks(4);
+  std::vector<NTL::vec_GF2> blocks = data;
+  cipher.applyKeystream(blocks, key, /*nonce=*/7, /*firstCounter=*/3);
+  EXPECT_NE(blocks, data);
+
+  std::vector<NTL::vec_GF2> other = data;
+  cipher.applyKeystream(other, key, /*nonce=*/8, /*firstCounter=*/3);
+  EXPECT_NE(other, blocks);
+
+  cipher.applyKeystream(blocks, key, /*nonce=*/7, /*firstCounter=*/3);
+  EXPECT_EQ(blocks, data);
+
+  // The same seed gives the same instance
+  helib::LowMC same(smallParams());
+  NTL::vec_GF2 in = cipher.counterBlock(7, 3), out1, out2;
+  cipher.encryptBlock(out1, in, key);
+  same.encryptBlock(out2, in, key);
+  EXPECT_EQ(out1, out2);
+}
+
+TEST_F(TestTranscipher, decryptsSymmetricCiphertextsHomomorphically)
+{
+  std::vector<helib::Ctxt> encKey;
+  helib::Transcipher::encryptKey(encKey, cipher, publicKey, key);
+  helib::Transcipher server(cipher, encKey);
+  EXPECT_EQ(server.blocksPerBatch(), ea.size());
+
+  // The keystream is the encryption of the zero blocks
+  std::vector<NTL::vec_GF2> stream(ea.size());
+  for (NTL::vec_GF2& block : stream)
+    block.SetLength(cipher.blockSize());
+  cipher.applyKeystream(stream, key, /*nonce=*/5, /*firstCounter=*/100);
+  std::vector<helib::Ctxt> bits;
+  server.keystream(bits, /*nonce=*/5, /*firstCounter=*/100);
+  expectBitSliced(bits, stream);
+
+  // A partial batch of data
+  const std::vector<NTL::vec_GF2> data = randomBlocks(ea.size() - 3);
+  std::vector<NTL::vec_GF2> uploaded = data;
+  cipher.applyKeystream(uploaded, key, /*nonce=*/9);
+  server.decrypt(bits, uploaded, /*nonce=*/9);
+  expectBitSliced(bits, data);
+  for (const helib::Ctxt& ctxt : bits)
+    EXPECT_TRUE(ctxt.isCorrect());
+}
+
+} // namespace